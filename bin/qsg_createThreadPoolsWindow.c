@@ -71,7 +71,7 @@ void Response_cb(GtkWidget *w, int res,
         case NEW_THREADPOOL:
         {
             struct QsThreadPool *tp = qsGraph_createThreadPool(
-                    layout->qsGraph, DEFAULT_MAXTHREADS, 0);
+                    layout->qsGraph, DEFAULT_MAXTHREADS, 0, 0);
             ASSERT(tp);
 
             GtkTreeIter iter;
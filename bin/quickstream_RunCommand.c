@@ -1,10 +1,13 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
 #include <time.h>
 #include <string.h>
 #include <signal.h>
+#include <sched.h>
 #include <pthread.h>
 
 #include "../lib/debug.h"
@@ -111,6 +114,73 @@ static inline bool Strtod(const char *s, double *ret) {
 }
 
 
+// Print the stream statistics in the --wait command every statsInterval
+// seconds, if it's greater than 0.  Set with --stats.
+static double statsInterval = 0;
+
+
+static inline int MaxNameLen(int len, const char *name) {
+    int l = strlen(name);
+    return (l > len)?l:len;
+}
+
+
+// Print the graph stream statistics to stderr in one write, so that other
+// threads do not put text in-between the lines.
+//
+static void PrintStats(struct QsGraph *g) {
+
+    struct QsGraphStats *s = qsGraph_getStats(g);
+    ASSERT(s);
+
+    char *str = 0;
+    size_t size = 0;
+    FILE *f = open_memstream(&str, &size);
+    ASSERT(f, "open_memstream() failed");
+
+    int w = 5;
+    for(uint32_t i = 0; i < s->numBlocks; ++i)
+        w = MaxNameLen(w, s->blocks[i].name);
+    for(uint32_t i = 0; i < s->numOutputs; ++i)
+        w = MaxNameLen(w, s->outputs[i].name);
+
+    fprintf(f, "Graph \"%s\" stream %s %.3f seconds\n",
+            qsGraph_getName(g), s->running?"running":"ran", s->seconds);
+
+    fprintf(f, "%-*s %10s %10s %6s %10s %10s %14s %14s\n", w,
+            "block", "calls", "stalls", "busy%", "busy_ms", "wait_ms",
+            "bytes_in", "bytes_out");
+    for(uint32_t i = 0; i < s->numBlocks; ++i) {
+        struct QsBlockStats *b = s->blocks + i;
+        fprintf(f, "%-*s %10" PRIu64 " %10" PRIu64 " %6.1f %10.3f %10.3f"
+                " %14" PRIu64 " %14" PRIu64 "\n", w,
+                b->name, b->calls, b->stalls,
+                (s->seconds > 0.0)?
+                    (100.0e-9 * b->busyNanoseconds)/s->seconds:0.0,
+                b->busyNanoseconds/1.0e6, b->waitNanoseconds/1.0e6,
+                b->bytesIn, b->bytesOut);
+    }
+
+    if(s->numOutputs)
+        fprintf(f, "%-*s %4s %7s %14s %10s %10s %10s\n", w,
+                "output", "port", "readers", "bytes", "high_water",
+                "buffer", "clogs");
+    for(uint32_t i = 0; i < s->numOutputs; ++i) {
+        struct QsOutputStats *o = s->outputs + i;
+        fprintf(f, "%-*s %4" PRIu32 " %7" PRIu32 " %14" PRIu64
+                " %10zu %10zu %10" PRIu64 "\n", w,
+                o->name, o->port, o->numReaders, o->bytes,
+                o->highWater, o->bufferLength, o->clogs);
+    }
+
+    fclose(f);
+    fputs(str, stderr);
+    free(str);
+
+    qsGraphStats_destroy(s);
+}
+
+
 static pthread_t masterThread;
 static int sig_num = 0;
 
@@ -677,6 +747,21 @@ bool RunCommand(int c, int argc, const char *command,
             break;
 
 
+        case STATS:// --stats [INTERVAL]
+
+            if(!graph)
+                return ErrorRet(2, argc, argv, command,
+                         "no graph exists\n");
+            if(argc < 2) {
+                PrintStats(graph);
+                break;
+            }
+            if(Strtod(argv[1], &statsInterval) || statsInterval < 0.0)
+                return ErrorRet(2, argc, argv, command,
+                         "bad INTERVAL argument: \"%s\"\n", argv[1]);
+            break;
+
+
         case THREADS:// --threads MAX_THREADS [TP_NAME]
 
             if(argc < 2)
@@ -705,7 +790,7 @@ bool RunCommand(int c, int argc, const char *command,
                     // A newly created thread pool is the default
                     // thread pool.
                     tp = qsGraph_createThreadPool(graph,
-                            maxThreads, tpname);
+                            maxThreads, tpname, 0);
                 else {
                     qsGraph_setDefaultThreadPool(graph, tp);
                     qsThreadPool_setMaxThreads(tp, maxThreads);
@@ -742,6 +827,104 @@ bool RunCommand(int c, int argc, const char *command,
             break;
 
 
+        case THREADS_AFFINITY:// --threads-affinity TP_NAME CPU_LIST
+
+            if(argc != 3)
+                return ErrorRet(2, argc, argv, command,
+                         "bad usage\n");
+            if(!graph)
+                return ErrorRet(2, argc, argv, command,
+                         "no graph exists\n");
+            {
+                struct QsThreadPool *tp =
+                    qsGraph_getThreadPool(graph, argv[1]);
+                if(!tp)
+                    return ErrorRet(2, argc, argv, command,
+                         "thread pool %s not found\n", argv[1]);
+                const char *cpus = argv[2];
+                if(strcmp(cpus, "any") == 0)
+                    cpus = 0;
+                if(qsThreadPool_setAffinity(tp, cpus))
+                    return ErrorRet(2, argc, argv, command,
+                         "bad CPU_LIST \"%s\"\n", argv[2]);
+            }
+            break;
+
+
+        case THREADS_MEMORY:// --threads-memory TP_NAME NUMA_NODE [RING_BUFFER]
+
+            if(argc != 3 && argc != 4)
+                return ErrorRet(2, argc, argv, command,
+                         "bad usage\n");
+            if(!graph)
+                return ErrorRet(2, argc, argv, command,
+                         "no graph exists\n");
+            {
+                struct QsThreadPool *tp =
+                    qsGraph_getThreadPool(graph, argv[1]);
+                if(!tp)
+                    return ErrorRet(2, argc, argv, command,
+                         "thread pool %s not found\n", argv[1]);
+                int numaNode = -1;
+                if(strcmp(argv[2], "auto")) {
+                    char *end = 0;
+                    numaNode = strtol(argv[2], &end, 10);
+                    if(end == argv[2] || *end || numaNode < 0)
+                        return ErrorRet(2, argc, argv, command,
+                             "bad NUMA_NODE \"%s\"\n", argv[2]);
+                }
+                const char *mode = 0;
+                if(argc == 4 && strcmp(argv[3], "default"))
+                    mode = argv[3];
+                if(qsThreadPool_setNumaNode(tp, numaNode))
+                    return ErrorRet(2, argc, argv, command,
+                         "bad NUMA_NODE \"%s\"\n", argv[2]);
+                if(qsThreadPool_setRingBuffer(tp, mode))
+                    return ErrorRet(2, argc, argv, command,
+                         "bad RING_BUFFER \"%s\"\n", argv[3]);
+            }
+            break;
+
+
+        case THREADS_SCHED:// --threads-sched TP_NAME POLICY [PRIORITY]
+
+            if(argc != 3 && argc != 4)
+                return ErrorRet(2, argc, argv, command,
+                         "bad usage\n");
+            if(!graph)
+                return ErrorRet(2, argc, argv, command,
+                         "no graph exists\n");
+            {
+                struct QsThreadPool *tp =
+                    qsGraph_getThreadPool(graph, argv[1]);
+                if(!tp)
+                    return ErrorRet(2, argc, argv, command,
+                         "thread pool %s not found\n", argv[1]);
+                int policy;
+                if(strcasecmp(argv[2], "other") == 0)
+                    policy = SCHED_OTHER;
+                else if(strcasecmp(argv[2], "fifo") == 0)
+                    policy = SCHED_FIFO;
+                else if(strcasecmp(argv[2], "rr") == 0)
+                    policy = SCHED_RR;
+                else
+                    return ErrorRet(2, argc, argv, command,
+                         "bad POLICY \"%s\"\n", argv[2]);
+                int priority = sched_get_priority_min(policy);
+                if(argc == 4) {
+                    char *end = 0;
+                    priority = strtol(argv[3], &end, 10);
+                    if(end == argv[3] || *end)
+                        return ErrorRet(2, argc, argv, command,
+                             "bad PRIORITY argument\n");
+                }
+                if(qsThreadPool_setSchedPolicy(tp, policy, priority))
+                    return ErrorRet(2, argc, argv, command,
+                         "bad POLICY or PRIORITY\n");
+            }
+            break;
+
+
         case THREADS_DESTROY:// --threads-destroy TP_NAME [...]
 
             if(argc < 2)
@@ -817,10 +1000,31 @@ bool RunCommand(int c, int argc, const char *command,
                                 "bad SECONDS argument: \"%s\"\n",
                                 argv[1]);
                 }
-                int ret = qsGraph_wait(graph, seconds);
-                if(ret == 1)
-                    // The graph has been destroyed.
-                    graph = 0;
+                if(statsInterval <= 0.0) {
+                    if(qsGraph_wait(graph, seconds) == 1)
+                        // The graph has been destroyed.
+                        graph = 0;
+                    break;
+                }
+                // Print the stats every statsInterval seconds, until the
+                // stream stops or we waited "seconds".
+                double t = 0.0;
+                while(true) {
+                    double dt = statsInterval;
+                    if(seconds > 0.0 && t + dt > seconds)
+                        dt = seconds - t;
+                    if(qsGraph_wait(graph, dt) == 1) {
+                        graph = 0;
+                        break;
+                    }
+                    t += dt;
+                    PrintStats(graph);
+                    struct QsGraphStats *s = qsGraph_getStats(graph);
+                    bool running = s->running;
+                    qsGraphStats_destroy(s);
+                    if(!running || (seconds > 0.0 && t >= seconds))
+                        break;
+                }
             }
             break;
 
@@ -12,6 +12,11 @@
 #define QS_DEFAULT_MAXWRITE  ((size_t) 1024)
 #define QS_DEFAULT_MAXREAD   QS_DEFAULT_MAXWRITE
 
+// The ring buffer memory that the stream flow() and flush() buffer
+// pointers point into starts at an address that is a multiple of this.
+// See qsSetInputType().
+#define QS_STREAM_BUFFER_ALIGNMENT  64
+
 
 // Option flag for qsGetMemory()
 #define QS_GETMEMORY_RECURSIVE   001
@@ -66,12 +71,39 @@ enum QsValueType {
 };
 
 
+// The type of the elements that flow through a stream port.  See
+// qsSetInputType() and qsSetOutputType().  The complex types are
+// interleaved real and imaginary parts.
+//
+enum QsStreamType {
+
+    QsStreamType_bytes = 0, // Untyped bytes; the default.
+    QsStreamType_u8,
+    QsStreamType_s8,
+    QsStreamType_u16,
+    QsStreamType_s16,
+    QsStreamType_u32,
+    QsStreamType_s32,
+    QsStreamType_u64,
+    QsStreamType_s64,
+    QsStreamType_f32,
+    QsStreamType_f64,
+    QsStreamType_cu8,
+    QsStreamType_cs8,
+    QsStreamType_cs16,
+    QsStreamType_cs32,
+    QsStreamType_cf32,
+    QsStreamType_cf64
+};
+
+
 
 struct QsGraph;
 struct QsThreadPool;
 struct QsBlock;
 struct QsParameter;
 struct QsInterBlockJob;
+struct QsTimerJob;
 struct QsTask;
 struct QsPort;
 
@@ -113,14 +145,34 @@ QS_EXPORT
 void qsAdvanceOutput(uint32_t outputPortNum, size_t len);
 
 
+// Call this in the block's start() callback so that the block's flow()
+// is only called when the graph's epoll_wait(2) thread finds that the
+// file descriptor, rfd, is readable.  It's only used if rfd is a pipe,
+// socket, or anonymous inode file descriptor (like from eventfd(2) or
+// io_uring_setup(2)), and rfd is set to O_NONBLOCK until the stream
+// stops; so flow() must handle read(2) failing with errno EAGAIN.
+//
 // port is 0 for stream input or output otherwise it's a
-// control parameter.
+// control parameter.  Only port == 0 is written so far.
 QS_EXPORT
 void qsAddEpollReadJob(int rfd, struct QsPort *port);
 
 
+// Called in flow() or flush() of a block that added an epoll file
+// descriptor with qsAddEpollReadJob() or qsAddEpollWriteJob(), when
+// flow() moved data through the file descriptor without advancing a
+// stream port, like a splice(2) from one pipe to another.  Like
+// qsAdvanceOutput(), that keeps the file descriptor "ready", so flow()
+// is called again without waiting on epoll_wait(2), until a flow() call
+// does not advance anything.
+QS_EXPORT
+void qsEpollAdvance(void);
+
+
+// Like qsAddEpollReadJob() but for writing wfd.
+//
 // port is 0 for stream input or output, otherwise it's a
-// control parameter.
+// control parameter.  Only port == 0 is written so far.
 QS_EXPORT
 void qsAddEpollWriteJob(int wfd, struct QsPort *port);
 
@@ -142,9 +194,163 @@ and output ports are at limits set by qsSetInputMax() and qsSetOutputMax()
 QS_EXPORT
 void qsSetInputMax(uint32_t inputPortNum, size_t len);
 
+// Set the least number of bytes that we wait for on an input before the
+// block's flow() is called, so that cheap blocks do not get flow() called
+// for every few bytes that the block before it writes.  This coalesces
+// many small writes into one flow() call.  We only wait while the
+// writing block is still calling flow(), so when the writer stops (like
+// at the end of the stream) flow() gets called with whatever is there.
+// The threshold is capped at the input maximum read length from
+// qsSetInputMax().  len = 0 (the default) turns it off.
+//
+// Like qsSetInputMax(), this takes effect at the next stream start.
+QS_EXPORT
+void qsSetInputThreshold(uint32_t inputPortNum, size_t len);
+
+// Make an input "lossy".  A lossy input does not hold back the block that
+// writes to it.  The other inputs that read the same output still get
+// every byte, but when this reader lags so far behind that the writer
+// would write over its unread data, the reader's read pointer is moved
+// up to the newest data and the bytes that it skipped are counted as
+// dropped.  That's for readers like displays and monitors that want
+// to see the latest data and are not worth stalling the stream for.
+//
+// The skips are always a multiple of skipSize bytes, so that the reader
+// stays aligned to its' data frames, like sizeof(float complex) or a
+// whole FFT frame.  skipSize = 0 (the default) makes the input not
+// lossy.  The flow() and flush() callbacks get the number of dropped
+// bytes with qsInputDropped(), and see if the data they are reading was
+// written over with qsInputOverrun().
+//
+// Lossy inputs that are in a pass-through buffer chain are not lossy;
+// we spew a warning at start in that case.
+//
+// Like qsSetInputMax(), this takes effect at the next stream start.
+QS_EXPORT
+void qsSetInputLossy(uint32_t inputPortNum, size_t skipSize);
+
+// Called in a block's flow() or flush().  Returns the number of bytes
+// that were dropped from this input since the last call, or since the
+// stream started.  Only inputs set with qsSetInputLossy() drop bytes.
+// That includes bytes that the writer may have written over while the
+// last flow() or flush() call was reading them.
+QS_EXPORT
+size_t qsInputDropped(uint32_t inputPortNum);
+
+// Called in a block's flow() or flush(), after it reads the input data.
+// Returns true if the writer may have written over the input data that
+// this call got, while it was being read; so the block should throw out
+// what it read from it.  The bytes that it advances this input by are
+// then counted as dropped too (see qsInputDropped()).  Always returns
+// false for inputs that are not lossy.
+QS_EXPORT
+bool qsInputOverrun(uint32_t inputPortNum);
+
 QS_EXPORT
 void qsSetOutputMax(uint32_t outputPortNum, size_t maxWriteLen);
 
+// Declare the type of the elements that an input reads.  elementSize is
+// the size of an element in bytes; it must be a multiple of the size of
+// the type, and 0 means the size of one value of the type, like 8 for
+// QsStreamType_cf32.  With QsStreamType_bytes any element size may be
+// used, like the size of a struct or a whole frame.  The default is
+// QsStreamType_bytes with an element size of 1, which is untyped bytes.
+//
+// Then the input lengths that flow() and flush() get are always a
+// multiple of the element size, the maximum read length (from
+// qsSetInputMax()) is rounded up to a multiple of it, and the block must
+// advance the input (qsAdvanceInput()) by a multiple of it.  The ring
+// buffer memory starts at a multiple of QS_STREAM_BUFFER_ALIGNMENT
+// bytes and the page size; so the input buffer pointers are always
+// aligned to the element size, if the element size is a power of two, no
+// larger than the page size.  For 64 byte aligned pointers, for aligned
+// vector loads, use an element size of 64, like 16 floats; then the
+// block also only gets whole vectors.  If the stream ends with part of an
+// element left in the input, that part is not passed to the block.
+//
+// If both an input and the output that feeds it have a type that is
+// not QsStreamType_bytes the types must be the same, or
+// qsGraph_connect() (and qsGraph_start()) fails.  The element sizes do
+// not need to be the same.
+//
+// Call this in declare() or in a configuration callback (see
+// qsAddConfig()).  Like qsSetInputMax(), the element size takes effect
+// at the next stream start.
+QS_EXPORT
+void qsSetInputType(uint32_t inputPortNum, enum QsStreamType type,
+        size_t elementSize);
+
+// Like qsSetInputType() but for an output.  The output lengths that
+// flow() and flush() get are a multiple of the element size, and the
+// block must advance the output (qsAdvanceOutput()) by a multiple of it.
+QS_EXPORT
+void qsSetOutputType(uint32_t outputPortNum, enum QsStreamType type,
+        size_t elementSize);
+
+
+// Call this in a source block's start() callback to make the buffer of
+// the output a memory mapping of the length bytes at offset in the
+// regular file that is open with file descriptor fd.  Then the output
+// buffer that flow() gets already has the file data in it, and the
+// block just calls qsAdvanceOutput(), without copying.  The file must
+// stay unchanged while the stream runs.  fd may be closed after the
+// stream starts.
+//
+// The mapping is private, so a pass-through block that writes to its'
+// input does not change the file.  The buffer does not wrap around like
+// a ring buffer, so no more than length bytes may be written to the
+// output.  The buffer pointers have the same alignment, relative to the
+// page size, as offset; so offset must be a multiple of the element
+// sizes of the output and the inputs that read it, that are a power of
+// two (see qsSetInputType()).
+//
+// This is for one stream run, and returns 0 on success, or -1 if fd
+// is not a regular file, offset and length are not in it, or offset is
+// not aligned to the element sizes.
+QS_EXPORT
+int qsMapOutputFile(uint32_t outputPortNum, int fd, off_t offset,
+        size_t length);
+
+// Call this in a block's start() callback to make the ring buffer of the
+// output be the length bytes at offset in the shared memory file that is
+// open with file descriptor fd, like from shm_open(3), so that a block
+// in another process that maps the same file reads what is written to
+// the output, or writes data into the output, without copying it.  The
+// buffer wraps around at length bytes, so byte number n that is written
+// to the output is at offset + n % length in the file.  See the ShmIn
+// and ShmOut blocks.  fd may be closed after the stream starts.
+//
+// offset and length must be multiples of the page size.  length must be
+// longer than the ring buffer would be without this, that is longer than
+// the output's maximum write length (see qsSetOutputMax()) plus the
+// largest maximum read length of the inputs that it feeds (see
+// qsSetInputMax()), so that the other process always has room to write.
+// The output may not be in a pass-through buffer and the inputs that
+// it feeds may not be lossy.  If these are not so the stream does not
+// start.
+//
+// This is for one stream run, and returns 0 on success, or -1 if fd is
+// not a file, or offset and length are not page aligned or in it.
+QS_EXPORT
+int qsMapOutputShared(uint32_t outputPortNum, int fd, off_t offset,
+        size_t length);
+
+// Like qsMapOutputShared() but for the ring buffer of the output that
+// feeds the input, that is owned by the block that writes to it; so that
+// the data that the other block writes to the input is in the shared
+// memory file.
+QS_EXPORT
+int qsMapInputShared(uint32_t inputPortNum, int fd, off_t offset,
+        size_t length);
+
+// Called in a block's flow() or flush().  Returns the number of bytes
+// that were written to the output, before this call, that the inputs
+// that it feeds have not all read yet.  For an output from
+// qsMapOutputShared(), the bytes written before that were read by all the
+// readers, so the other process may write over them.
+QS_EXPORT
+size_t qsOutputUnread(uint32_t outputPortNum);
+
 
 QS_EXPORT
 void qsMakePassThroughBuffer(uint32_t inPort, uint32_t outPort);
@@ -188,6 +394,19 @@ struct QsParameter *qsCreateSetter(const char *name, size_t size,
         int (*setCallback)(const struct QsParameter *p, const void *value,
             uint32_t readCount, uint32_t queueCount, void *userData));
 
+// Make a setter, from qsCreateSetter(), only get the newest value when it
+// gets its' callback called, and not all the values that are queued.
+// That's for setters like a radio frequency tuner, where setting old
+// values is a waste of time.  The readCount passed to the setter callback
+// jumps ahead by one more than the number of values skipped, and
+// readCount equals queueCount when the value is the newest.
+//
+// Called in the block's declare() or configure callbacks.  latestOnly
+// false (the default) makes the setter callback get called with every
+// queued value.
+QS_EXPORT
+void qsSetterLatestOnly(struct QsParameter *setter, bool latestOnly);
+
 QS_EXPORT
 struct QsParameter *qsCreateGetter(const char *name, size_t size,
         enum QsValueType valueType, const void *initValue);
@@ -210,6 +429,61 @@ void qsSignalJobDestroy(struct QsSignalJob *signalJob);
 
 
 
+// Have callback called every periodNs nanoseconds by a thread pool worker
+// thread, for periodic work like refreshing a display, pushing a getter
+// value at a limited rate, or a watchdog; without the block having to
+// make its' own thread.  The graph's epoll thread waits on a timerfd(2)
+// for each timer job and queues the job in the block's thread pool.
+//
+// ticks is the number of periods since the last callback.  If the
+// callback is late, from a busy thread pool or a slow callback, it gets
+// called once with all the ticks that it missed, and not once per tick.
+//
+// Called in the block's declare() or configure callbacks.  A periodNs of
+// 0 makes a timer that is not running until qsTimerJobSetPeriod() is
+// called.  The timer runs whether the stream is running or not, until
+// the block is destroyed or qsTimerJobDestroy() is called.
+QS_EXPORT
+struct QsTimerJob *qsAddTimerJob(uint64_t periodNs,
+        void (*callback)(uint64_t ticks, void *userData),
+        void *userData);
+
+// Change the timer period and restart the timer, with the first tick one
+// period from now.  A periodNs of 0 stops the timer.  This may be called
+// from any block callback, including the timer callback.
+QS_EXPORT
+void qsTimerJobSetPeriod(struct QsTimerJob *timerJob, uint64_t periodNs);
+
+// The timer job is destroyed with the block, so this is only needed to
+// stop using it before that, or if the callback uses memory that the
+// block frees in destroy() or undeclare().  Not called from the timer
+// callback.
+QS_EXPORT
+void qsTimerJobDestroy(struct QsTimerJob *timerJob);
+
+
+// Called from a block's flow(), flush(), or other callback that runs in
+// a thread pool worker thread, to edit the graph while the stream runs,
+// like moving a block to another thread pool.  A worker thread cannot
+// wait for its' own thread pool to halt, so this queues a graph command
+// and returns.  Later the thread in qsGraph_wait() halts the thread
+// pools of the calling block and of the numBlocks blocks named in
+// blockNames[], calls callback(graph, userData) when they have no
+// working threads, and then unhalts them.
+//
+// The graph command queue is only read by qsGraph_wait(), so the
+// callback is not called until a thread is in qsGraph_wait() for the
+// graph, and that qsGraph_wait() call returns after the callback; use
+// qsGraph_waitForStream() to keep waiting.  The other thread pools keep running, so the callback may only
+// edit the calling block and the named blocks.  A named block that is
+// not found when the command runs is skipped with a warning.
+QS_EXPORT
+void qsBlockHaltAsync(void (*callback)(struct QsGraph *graph,
+            void *userData), void *userData,
+        const char * const *blockNames, uint32_t numBlocks);
+
+
+
 QS_EXPORT
 void qsExist(struct QsGraph *graph, int status);
 
@@ -500,10 +774,29 @@ int flow(const void * const in[], const size_t inLens[], uint32_t numIn,
         void * const out[], const size_t outLens[], uint32_t numOut,
         QS_USER_DATA_TYPE userData);
 
+/** A block's optional stream flush function
+
+A block may define flush() if it keeps some stream data in it, like a
+filter with a tail, that it needs to write out at the end of a stream
+run.
+
+When all the blocks that write to this block's inputs are finished, the
+block is "draining".  flow() keeps getting called until all inputs have
+less than the maximum read length (see qsSetInputMax()) to read, and
+then flush() is called in place of flow() with the exact remaining
+input lengths.  flush() is called, like flow(), until it returns
+non-zero, or until there is no input left and it writes nothing when
+it has room to write.  Then the block is finished and its outputs are
+flushed, so the blocks that read them drain in turn.
+
+If a block has no flush() then flow() is called while the block is
+draining.
+
+\return 0 to keep getting flush() called, or 1 if the block is done.
+*/
 extern
-int flush(const void * const in[], const size_t inLens[],
-        void * const out[], const size_t outLens[],
-        uint32_t numInputs, uint32_t numOutputs,
+int flush(const void * const in[], const size_t inLens[], uint32_t numIn,
+        void * const out[], const size_t outLens[], uint32_t numOut,
         QS_USER_DATA_TYPE userData);
 
 extern
@@ -566,6 +859,33 @@ extern
 int destroy(QS_USER_DATA_TYPE userData);
 
 
+/** Optional DSO block reentrant marker
+
+By default, when a DSO block is loaded more than once, in any graph,
+libquickstream.so loads a new copy of the DSO file for each block, so
+that each block gets its own copy of all the static and global variables
+in the block code.
+
+A block that keeps all its state in memory that it allocates in
+declare() and passes to qsSetUserData(), and so gets back as the
+userData argument in its callbacks, may define:
+
+\code
+const bool qsBlockIsReentrant = true;
+\endcode
+
+and then the DSO file is loaded just once and shared by all the blocks
+that load it.  Building graphs with lots of the same block is then much
+faster and uses less memory.  The block must not have any static or
+global variables that change, since all the blocks from that DSO file
+share them.
+
+\sa qsSetUserData()
+*/
+extern
+const bool qsBlockIsReentrant;
+
+
 #undef QS_USER_DATA_TYPE
 
 
@@ -8,6 +8,7 @@
 #include <stdbool.h>
 #include <signal.h>
 #include <dlfcn.h>
+#include <sys/types.h>
 
 /** \defgroup macros CPP macros
 
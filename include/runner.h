@@ -15,6 +15,12 @@
 #define QS_GRAPH_IS_MASTER          00001
 #define QS_GRAPH_SAVE_ATTRIBUTES    00002
 #define QS_GRAPH_HALTED             00004 // create with graph wide halt
+#define QS_GRAPH_WORK_STEALING      00010 // default thread pool steals
+#define QS_GRAPH_FUSE_CHAINS        00020 // default thread pool fuses
+
+/** qsGraph_createThreadPool() bit mask flags */
+#define QS_THREADPOOL_WORK_STEALING 00001 // per worker queues with stealing
+#define QS_THREADPOOL_FUSE_CHAINS   00002 // run linear chains in one worker
 
 
 
@@ -31,7 +37,7 @@ void qsGraph_destroy(struct QsGraph *graph);
 QS_EXPORT
 struct QsThreadPool *qsGraph_createThreadPool(
         struct QsGraph *graph, uint32_t maxThreads,
-        const char *name);
+        const char *name, uint32_t flags);
 
 QS_EXPORT
 struct QsThreadPool *qsGraph_getThreadPool(struct QsGraph *graph,
@@ -54,6 +60,79 @@ QS_EXPORT
 void qsThreadPool_destroy(struct QsThreadPool *threadPool);
 
 
+/** Set the CPUs that the thread pool worker threads may run on
+
+\param threadPool the thread pool.
+\param cpus a CPU list string like "0-3,6", as in taskset(1) -c, or
+0 or "" to let the worker threads run on any CPU.
+
+The existing worker threads are replaced with worker threads that have
+the new CPU affinity.
+
+\return 0 on success, or non-zero if \p cpus is not a CPU list that
+this process may run on.
+*/
+QS_EXPORT
+int qsThreadPool_setAffinity(struct QsThreadPool *threadPool,
+        const char *cpus);
+
+/** Set the scheduling policy and priority of the thread pool worker
+threads
+
+\param threadPool the thread pool.
+\param policy a sched(7) policy like SCHED_FIFO, SCHED_RR or
+SCHED_OTHER.
+\param priority the static priority for the policy, like 1 to 99 for
+SCHED_FIFO and 0 for SCHED_OTHER.
+
+Using SCHED_OTHER with priority 0 makes the worker threads inherit the
+scheduling of the thread that creates them, which is the default.  If
+the process does not have the privileges to make worker threads with the
+policy, like for SCHED_FIFO without CAP_SYS_NICE, the worker threads are
+made without it and a warning is spewed.
+
+\return 0 on success, or non-zero if the policy or priority is invalid.
+*/
+QS_EXPORT
+int qsThreadPool_setSchedPolicy(struct QsThreadPool *threadPool,
+        int policy, int priority);
+
+/** Set the NUMA node that the thread pool's stream ring buffers get
+their memory from
+
+\param threadPool the thread pool.
+\param numaNode the NUMA node number, or -1 to use the NUMA node of the
+thread pool's CPU affinity, if all its CPUs are on one node, or else the
+node from env QS_NUMA_NODE, if it is set.
+
+The ring buffers that are written by blocks in this thread pool get
+their memory from the NUMA node.  This takes effect when the ring
+buffers are made at the next stream start.
+
+\return 0 on success, or non-zero if \p numaNode is invalid.
+*/
+QS_EXPORT
+int qsThreadPool_setNumaNode(struct QsThreadPool *threadPool,
+        int numaNode);
+
+/** Set how the thread pool's stream ring buffers get their memory
+
+\param threadPool the thread pool.
+\param mode "shm" for shm_open(3), "memfd" for memfd_create(2), or
+"hugetlb" for memfd_create(2) with huge pages; or 0 or "" to use the
+mode from env QS_RING_BUFFER, which defaults to "shm".
+
+The ring buffers that are written by blocks in this thread pool get
+their memory this way.  This takes effect when the ring buffers are made
+at the next stream start.
+
+\return 0 on success, or non-zero if \p mode is not a mode.
+*/
+QS_EXPORT
+int qsThreadPool_setRingBuffer(struct QsThreadPool *threadPool,
+        const char *mode);
+
+
 QS_EXPORT
 int qsGraph_wait(struct QsGraph *graph, double seconds);
 
@@ -150,6 +229,86 @@ int qsGraph_save(const struct QsGraph *graph,
         const char *path, const char *gpath,
         uint32_t optsFlag);
 
+/** Statistics for one simple block with stream connections, from the
+last qsGraph_start() */
+struct QsBlockStats {
+
+    /** The block name */
+    char *name;
+    /** The number of flow() and flush() calls */
+    uint64_t calls;
+    /** The number of flow() and flush() calls that did not read or
+     * write anything */
+    uint64_t stalls;
+    /** The nanoseconds spent in flow() and flush() calls */
+    uint64_t busyNanoseconds;
+    /** The nanoseconds the block waited for a worker thread after it
+     * had stream data to work on */
+    uint64_t waitNanoseconds;
+    /** The total bytes read from all inputs */
+    uint64_t bytesIn;
+    /** The total bytes written to all outputs */
+    uint64_t bytesOut;
+};
+
+/** Statistics for one stream output and the ring buffer that it writes,
+from the last qsGraph_start() */
+struct QsOutputStats {
+
+    /** The name of the block that has the output */
+    char *name;
+    /** The output port number */
+    uint32_t port;
+    /** The number of inputs that read this output */
+    uint32_t numReaders;
+    /** The total bytes written */
+    uint64_t bytes;
+    /** The most bytes that were waiting to be read by the slowest
+     * reader */
+    size_t highWater;
+    /** The ring buffer length in bytes */
+    size_t bufferLength;
+    /** The number of times the writing block stopped because the readers
+     * did not leave it room to write */
+    uint64_t clogs;
+};
+
+/** Statistics for all the stream blocks and outputs in a graph, from
+qsGraph_getStats() */
+struct QsGraphStats {
+
+    /** The seconds that the stream ran, or has been running */
+    double seconds;
+    /** true if the stream is running */
+    bool running;
+
+    uint32_t numBlocks;
+    struct QsBlockStats *blocks;
+
+    uint32_t numOutputs;
+    struct QsOutputStats *outputs;
+};
+
+
+/** Get runtime statistics for the graph stream
+
+The statistics are counted for each stream run, from qsGraph_start(), and
+are kept after the stream stops until the next qsGraph_start().  This may
+be called while the stream is running.
+
+\param graph the graph.
+
+\return an allocated struct QsGraphStats that must be freed with
+qsGraphStats_destroy().
+*/
+QS_EXPORT
+struct QsGraphStats *qsGraph_getStats(struct QsGraph *graph);
+
+/** Free the statistics that qsGraph_getStats() returned */
+QS_EXPORT
+void qsGraphStats_destroy(struct QsGraphStats *stats);
+
+
 QS_EXPORT
 const char *qsGraph_getName(const struct QsGraph *g);
 
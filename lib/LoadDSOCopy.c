@@ -0,0 +1,241 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <dlfcn.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "../include/quickstream.h"
+
+#include "debug.h"
+#include "Dictionary.h"
+
+#include "c-rbtree.h"
+#include "name.h"
+#include "threadPool.h"
+#include "block.h"
+#include "LoadDSOCopy.h"
+
+
+// When a DSO (dynamic shared object) file is already loaded we must load
+// a copy of the DSO file.  Otherwise we will have just the one plugin
+// loaded, but referred to by two or more blocks, which is not what we
+// want; the blocks would share all their static variables.
+//
+// We used to always copy the DSO to a file in /tmp, through a small
+// stack buffer, and dlopen() that.  With a graph with 64 of the same
+// block that was a lot of writing to /tmp.  Now, by default, we copy the
+// DSO to a memfd_create(2) file, which is just memory, with
+// copy_file_range(2) or sendfile(2), and dlopen() it using its
+// "/proc/self/fd/N" path.  If that fails we fall back to the old /tmp
+// file way.
+//
+// Why not dlmopen(3) with LM_ID_NEWLM?  Each new link map namespace
+// gets its own copy of all the libraries that the DSO depends on,
+// including libquickstream.so and libc.  A block in a new namespace
+// would then call a libquickstream.so that does not have our graphs in
+// it.  And the glibc implementation supports a maximum of 16 namespaces.
+
+
+// Set from env QS_DSO_COPY in lib_constructor.c.
+enum QsDSOCopyMode dsoCopyMode = QsDSOCopy_memfd;
+
+
+// Copy all of file descriptor from to file descriptor to.  Returns true
+// on error.
+//
+static inline
+bool CopyFile(int to, int from, const char *path) {
+
+    struct stat st;
+    if(fstat(from, &st)) {
+        ERROR("fstat() \"%s\" failed", path);
+        return true;
+    }
+
+    size_t rem = st.st_size;
+    ssize_t ret;
+
+    // copy_file_range(2) does not work between file systems on older
+    // kernels (EXDEV), and sendfile(2) can fail for some file systems
+    // too.  So we try, and fall back to reading and writing if the first
+    // try fails.
+    if(rem && (ret = copy_file_range(from, 0, to, 0, rem, 0)) > 0) {
+        rem -= ret;
+        while(rem && (ret = copy_file_range(from, 0, to, 0, rem, 0)) > 0)
+            rem -= ret;
+        if(!rem) return false;
+        ERROR("copy_file_range() \"%s\" failed", path);
+        return true;
+    }
+
+    if(rem && (ret = sendfile(to, from, 0, rem)) > 0) {
+        rem -= ret;
+        while(rem && (ret = sendfile(to, from, 0, rem)) > 0)
+            rem -= ret;
+        if(!rem) return false;
+        ERROR("sendfile() \"%s\" failed", path);
+        return true;
+    }
+
+    // We have not read or written anything yet, so the file offsets are
+    // still at 0.
+    const size_t Len = 64*1024;
+    uint8_t *buf = malloc(Len);
+    ASSERT(buf, "malloc(%zu) failed", Len);
+
+    ssize_t rr = read(from, buf, Len);
+    while(rr > 0) {
+        size_t bw = 0;
+        while(rr > 0) {
+            ssize_t wr = write(to, buf + bw, rr);
+            if(wr < 1) {
+                ERROR("Failed to write copy of %s", path);
+                free(buf);
+                return true;
+            }
+            rr -= wr;
+            bw += wr;
+        }
+        rr = read(from, buf, Len);
+    }
+    free(buf);
+
+    if(rr < 0) {
+        ERROR("Failed to read %s", path);
+        return true;
+    }
+
+    return false;
+}
+
+
+static
+void *LoadDSOFromMemfd(const char *path, int dso) {
+
+    int fd = memfd_create("qs_dso", MFD_CLOEXEC);
+    if(fd < 0) {
+        WARN("memfd_create() failed");
+        return 0;
+    }
+
+    if(CopyFile(fd, dso, path)) {
+        close(fd);
+        return 0;
+    }
+
+    // The dynamic linker/loader finds already loaded objects by file
+    // name before it looks at the file.  A "/proc/self/fd/N" DSO that we
+    // loaded before has its file descriptor closed, so N can be reused by
+    // a later copy.  If the name is taken we move our file to a higher
+    // file descriptor number until we find a name that is not loaded.
+    //
+    char name[64];
+    void *handle;
+
+    for(;;) {
+        snprintf(name, 64, "/proc/self/fd/%d", fd);
+        handle = dlopen(name, RTLD_NOLOAD | QS_MODULE_DLOPEN_FLAGS);
+        if(!handle) break;
+        // Remove the reference count that we just added.
+        dlclose(handle);
+        int nfd = fcntl(fd, F_DUPFD_CLOEXEC, fd + 1);
+        close(fd);
+        if(nfd < 0) {
+            WARN("fcntl(,F_DUPFD_CLOEXEC,) failed");
+            return 0;
+        }
+        fd = nfd;
+    }
+
+    handle = dlopen(name, QS_MODULE_DLOPEN_FLAGS);
+
+    // The file is mapped to this process now, so we do not need the
+    // file descriptor any more.  The memory goes away with the last
+    // mapping.
+    close(fd);
+
+    if(!handle)
+        // Maybe /proc is not mounted.
+        WARN("dlopen(\"%s\" copy of \"%s\",) failed: %s",
+                name, path, dlerror());
+
+    return handle;
+}
+
+
+static
+void *LoadDSOFromTmpFile(const char *path, int dso) {
+
+    char tmpFilename[32];
+    strcpy(tmpFilename, "/tmp/qs_XXXXXX.so");
+    int tmpFd = mkstemps(tmpFilename, 3);
+    if(tmpFd < 0) {
+        ERROR("mkstemp() failed");
+        return 0;
+    }
+    DSPEW("made temporary file: %s", tmpFilename);
+
+    if(CopyFile(tmpFd, dso, path)) {
+        close(tmpFd);
+        unlink(tmpFilename);
+        return 0;
+    }
+    close(tmpFd);
+    chmod(tmpFilename, 0700);
+
+    void *handle = dlopen(tmpFilename, QS_MODULE_DLOPEN_FLAGS);
+    //
+    // This file is mapped to this process.  No other process will have
+    // access to this temp file after the following unlink() call.
+    //
+    if(unlink(tmpFilename))
+        // There is no big reason to fuss to much.
+        WARN("unlink(\"%s\") failed", tmpFilename);
+
+    if(!handle) {
+        ERROR("dlopen(\"%s\",) failed: %s", tmpFilename, dlerror());
+        return 0;
+    }
+
+    return handle;
+}
+
+
+void *LoadDSOCopy(const char *path) {
+
+    INFO("DSO from %s was loaded before, loading a copy", path);
+
+    int dso = open(path, O_RDONLY | O_CLOEXEC);
+    if(dso < 0) {
+        ERROR("open(\"%s\", O_RDONLY) failed", path);
+        return 0;
+    }
+
+    void *handle = 0;
+
+    if(dsoCopyMode == QsDSOCopy_memfd) {
+        handle = LoadDSOFromMemfd(path, dso);
+        if(!handle && lseek(dso, 0, SEEK_SET)) {
+            ERROR("lseek() \"%s\" failed", path);
+            close(dso);
+            return 0;
+        }
+    }
+
+    if(!handle)
+        handle = LoadDSOFromTmpFile(path, dso);
+
+    close(dso);
+
+    return handle;
+}
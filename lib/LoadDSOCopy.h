@@ -0,0 +1,18 @@
+// How LoadDSOCopy() makes the copy of a block DSO (dynamic shared
+// object) file that is already loaded.
+enum QsDSOCopyMode {
+
+    QsDSOCopy_memfd = 0,
+    QsDSOCopy_tmpfile
+};
+
+
+// Set from env QS_DSO_COPY.
+extern
+enum QsDSOCopyMode dsoCopyMode;
+
+
+// Returns a dlopen() handle to a new copy of the DSO file at path, or 0
+// on failure.
+extern
+void *LoadDSOCopy(const char *path);
@@ -15,6 +15,7 @@
 #include "block.h"
 #include "graph.h"
 #include "job.h"
+#include "epoll.h"
 
 
 
@@ -116,6 +117,9 @@ void qsBlock_init(struct QsGraph *g, struct QsBlock *b,
         // because it has just been allocated.  We just need to write to
         // the thread pool data structure.
         //
+        CHECK(pthread_spin_init(&((struct QsJobsBlock *)b)->queueLock,
+                    PTHREAD_PROCESS_PRIVATE));
+
         CHECK(pthread_mutex_lock(&tp->mutex));
 
         Block_addThreadPool((struct QsJobsBlock *)b, tp);
@@ -179,6 +183,10 @@ void qsBlock_cleanup(struct QsBlock *b) {
         uint32_t numHalts = qsBlock_threadPoolHaltLock(jb);
 
 
+        // The epoll thread may be handling a timer job tick, and it does
+        // not care that the thread pools are halted.
+        RemoveTimerJobs(jb);
+
         // Cleanup all jobs owned by this block, in reverse order that
         // they were created.
         while(jb->jobsStack)
@@ -201,6 +209,8 @@ void qsBlock_cleanup(struct QsBlock *b) {
         } else
             jb->threadPool->maxThreadsRun = maxThreadsRun;
 
+        CHECK(pthread_spin_destroy(&jb->queueLock));
+
         while(numHalts--)
             qsGraph_threadPoolHaltUnlock(g);
     }
@@ -21,6 +21,7 @@
 #define CB_FLUSH            ((uint32_t) 000400)
 #define CB_INTERBLOCK       ((uint32_t) 001000)
 #define CB_SET              ((uint32_t) 002000)
+#define CB_TIMER            ((uint32_t) 004000)
 
 #define CB_ANY              (CB_DECLARE|\
                             CB_UNDECLARE|\
@@ -32,7 +33,8 @@
                             CB_FLOW|\
                             CB_FLUSH|\
                             CB_INTERBLOCK|\
-                            CB_SET)
+                            CB_SET|\
+                            CB_TIMER)
 
 
 
@@ -150,6 +152,19 @@ struct QsJobsBlock {
     //
     bool busy;
 
+    // For blocks in a work stealing thread pool (see
+    // QsThreadPool::workStealing) this protects the job queue above
+    // (first, last, and firstStream), the QsJob::inQueue and QsJob::busy
+    // flags of the jobs in it, and this block's inQueue and busy flags;
+    // in place of the thread pool mutex.  For a block in a work stealing
+    // thread pool "inQueue" means it's in a worker deque or the thread
+    // pool block queue.
+    //
+    // It's always the last lock gotten; no other lock is gotten while
+    // holding it.
+    //
+    pthread_spinlock_t queueLock;
+
 
     // A list of thread pools that have jobs that may access queue this
     // block and the jobs in it.
@@ -378,6 +393,14 @@ struct QsWhichJob {
 
     // The thread pool stays fixed.
     struct QsThreadPool *threadPool;
+
+    // For thread pools with QsThreadPool::workStealing set; this worker
+    // thread's deque of blocks to run, else 0.
+    struct QsWorkDeque *deque;
+
+    // List of worker threads in QsThreadPool::workers.  Protected by the
+    // thread pool mutex.
+    struct QsWhichJob *next, *prev;
 };
 
 
@@ -1,10 +1,17 @@
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
 #include <pthread.h>
 #include <stdatomic.h>
 #include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 
 #include "../include/quickstream.h"
 
@@ -22,42 +29,655 @@
 #include "epoll.h"
 
 
+// The most events we get from one epoll_wait(2) call.
+#define EVENTS_LEN  32
 
-static inline struct QsStreamJob *Init(int fd, struct QsPort *port,
-        struct QsSimpleBlock **b) {
 
+struct QsTimerJob {
+
+    struct QsJob job; // inherit
+
+    void (*callback)(uint64_t ticks, void *userData);
+    void *userData;
+
+    struct QsGraph *graph;
+
+    // The timerfd(2) file descriptor.
+    int fd;
+
+    // The epoll client for fd.  client.fd is -1 when fd is not in the
+    // epoll set.
+    struct EpollClient client;
+
+    // Ticks that the epoll thread read from fd that the callback has not
+    // gotten yet.  Accessed with the job lock.
+    uint64_t ticks;
+
+    // Protects the job and ticks.
+    pthread_mutex_t mutex;
+};
+
+
+
+static inline void Wake(struct Epoll *e) {
+
+    uint64_t one = 1;
+    ASSERT(write(e->wakeFd, &one, sizeof(one)) == sizeof(one));
+}
+
+
+// We have the epoll mutex lock.
+//
+static inline void HandleClient(struct QsGraph *g, struct EpollClient *c) {
+
+    if(c->fd < 0)
+        // This client was removed after epoll_wait() returned this
+        // event.
+        return;
+
+    struct QsStreamJob *sj = c->streamJob;
+    DASSERT(sj);
+
+    qsJob_lock((void *) sj);
+
+    if(!c->waiting) {
+        qsJob_unlock((void *) sj);
+        return;
+    }
+
+    c->waiting = false;
+    c->ready = true;
+
+    // This queues the stream job if it can run flow() now.
+    QueueEpollStreamJob(sj);
+
+    qsJob_unlock((void *) sj);
+
+    // The stream job is no longer waiting, so we remove the count it had
+    // while it was waiting.  If it got queued above it's counted again.
+    if(--g->streamJobCount == 0)
+        CheckStreamFinished(g);
+}
+
+
+// We have the epoll mutex lock.
+//
+static inline void HandleTimer(struct EpollClient *c) {
+
+    if(c->fd < 0)
+        // This timer was removed after epoll_wait() returned this
+        // event.
+        return;
+
+    struct QsTimerJob *t = c->timerJob;
+    DASSERT(t);
+
+    uint64_t ticks;
+    if(read(t->fd, &ticks, sizeof(ticks)) != sizeof(ticks))
+        // EAGAIN: the timer was set again after it expired.
+        return;
+
+    qsJob_lock(&t->job);
+
+    t->ticks += ticks;
+
+    struct QsThreadPool *tp = t->job.jobsBlock->threadPool;
+    DASSERT(tp);
+    // Like in signalThread.c, we are not in a thread pool worker thread
+    // so we must check that the thread pool is not halted.  If it is, the
+    // ticks wait for the next tick after it is not halted.
+    CHECK(pthread_mutex_lock(&tp->mutex));
+    if(!tp->halt)
+        _qsJob_queueJob(&t->job, false/*have thread pool lock already*/);
+    CHECK(pthread_mutex_unlock(&tp->mutex));
+
+    qsJob_unlock(&t->job);
+}
+
+
+static void *RunEpoll(struct Epoll *e) {
+
+    struct QsGraph *g = e->graph;
+    DASSERT(g);
+
+    DSPEW("Graph \"%s\" epoll thread running", g->name);
+
+    struct epoll_event events[EVENTS_LEN];
+
+    CHECK(pthread_mutex_lock(&e->mutex));
+
+    while(!e->quit) {
+
+        CHECK(pthread_mutex_unlock(&e->mutex));
+
+        int n = epoll_wait(e->epfd, events, EVENTS_LEN, -1);
+
+        CHECK(pthread_mutex_lock(&e->mutex));
+
+        if(n < 0) {
+            ASSERT(errno == EINTR, "epoll_wait() failed");
+            n = 0;
+        }
+
+        for(int i = 0; i < n; ++i) {
+            struct EpollClient *c = events[i].data.ptr;
+            if(c) {
+                if(c->timerJob)
+                    HandleTimer(c);
+                else
+                    HandleClient(g, c);
+                continue;
+            }
+            // It's the wake up eventfd.
+            uint64_t val;
+            ASSERT(read(e->wakeFd, &val, sizeof(val)) == sizeof(val));
+        }
+
+        ++e->loopCount;
+        CHECK(pthread_cond_broadcast(&e->cond));
+    }
+
+    CHECK(pthread_mutex_unlock(&e->mutex));
+
+    DSPEW("Graph \"%s\" epoll thread exiting", g->name);
+
+    return 0;
+}
+
+
+static inline struct Epoll *CreateEpoll(struct QsGraph *g) {
+
+    struct Epoll *e = calloc(1, sizeof(*e));
+    ASSERT(e, "calloc(1,%zu) failed", sizeof(*e));
+
+    e->graph = g;
+
+    // We do not want the file descriptors to leak into programs that
+    // blocks run, like in the PipeIn block.
+    e->epfd = epoll_create1(EPOLL_CLOEXEC);
+    ASSERT(e->epfd > -1, "epoll_create1() failed");
+    e->wakeFd = eventfd(0, EFD_CLOEXEC);
+    ASSERT(e->wakeFd > -1, "eventfd() failed");
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = 0 };
+    ASSERT(epoll_ctl(e->epfd, EPOLL_CTL_ADD, e->wakeFd, &ev) == 0);
+
+    CHECK(pthread_mutex_init(&e->mutex, 0));
+    CHECK(pthread_cond_init(&e->cond, 0));
+
+    CHECK(pthread_create(&e->thread, 0, (void *(*) (void *)) RunEpoll, e));
+
+    return e;
+}
+
+
+static inline void AddClient(int fd, struct QsPort *port, bool isRead) {
 
     // The other non-stream port would be for a control parameter
     // setter.
     ASSERT(port == 0, "This code is not written for "
             "non-stream block callbacks yet.");
+    ASSERT(fd > -1);
 
-    struct QsStreamJob *sj = GetStreamJob(CB_DECLARE, b);
+    struct QsSimpleBlock *b;
+    struct QsStreamJob *sj = GetStreamJob(CB_START, &b);
+    DASSERT(b);
+    struct QsGraph *g = b->jobsBlock.block.graph;
+    DASSERT(g);
 
-    int flags = fcntl(fd, F_GETFL, 0);
-    ASSERT(flags != -1);
-    ASSERT(-1 != fcntl(fd, F_SETFL, flags | O_NONBLOCK));
+    ASSERT(!sj->epoll, "Block \"%s\" already has an epoll "
+            "file descriptor", b->jobsBlock.block.name);
 
-ERROR("Write more code here: sj=%p", sj);
+    struct stat st;
+    ASSERT(fstat(fd, &st) == 0, "fstat(%d,) failed", fd);
 
-    return sj;
-}
+    // Anonymous inodes, like from io_uring_setup(2) and eventfd(2), have
+    // no file type bits, and they work with epoll(7) too.
+    if(!S_ISFIFO(st.st_mode) && !S_ISSOCK(st.st_mode) &&
+            (st.st_mode & S_IFMT)) {
+        // epoll(7) does not work with regular files, they are always
+        // ready.  We also leave character devices alone, so we do not
+        // set O_NONBLOCK on a terminal that we share with the shell.  The
+        // block will get flow() called as it did without epoll.
+        DSPEW("Block \"%s\" fd=%d is not a pipe or socket, "
+                "not using epoll", b->jobsBlock.block.name, fd);
+        return;
+    }
 
+    if(!g->epoll)
+        g->epoll = CreateEpoll(g);
+    struct Epoll *e = g->epoll;
 
+    struct EpollClient *c = calloc(1, sizeof(*c));
+    ASSERT(c, "calloc(1,%zu) failed", sizeof(*c));
+    c->isRead = isRead;
+    c->fd = fd;
+    c->flags = -1;
+    c->port = port;
+    c->streamJob = sj;
 
-void qsAddEpollReadJob(int fd, struct QsPort *port) {
+    CHECK(pthread_mutex_lock(&e->mutex));
+    c->next = e->clients;
+    if(e->clients)
+        e->clients->prev = c;
+    e->clients = c;
+    CHECK(pthread_mutex_unlock(&e->mutex));
 
-    struct QsSimpleBlock *b;
-    struct QsStreamJob *sj = Init(fd, port, &b);
+    sj->epoll = c;
+
+    DSPEW("Block \"%s\" added epoll %s fd=%d",
+            b->jobsBlock.block.name, isRead?"read":"write", fd);
+}
+
+
+void qsAddEpollReadJob(int fd, struct QsPort *port) {
 
-ERROR("Write more code here: sj=%p", sj);
+    AddClient(fd, port, true);
 }
 
+
 void qsAddEpollWriteJob(int fd, struct QsPort *port) {
 
-    struct QsSimpleBlock *b;
-    struct QsStreamJob *sj = Init(fd, port, &b);
+    AddClient(fd, port, false);
+}
+
+
+// We have the epoll mutex lock.  Wait for the epoll thread to go through
+// another loop, so that it's not holding events for clients that we
+// removed.
+//
+static inline void WaitForLoop(struct Epoll *e) {
+
+    uint64_t loopCount = e->loopCount;
+    Wake(e);
+    while(loopCount == e->loopCount)
+        CHECK(pthread_cond_wait(&e->cond, &e->mutex));
+}
+
+
+static inline void FreeClient(struct Epoll *e, struct EpollClient *c) {
+
+    if(c->next)
+        c->next->prev = c->prev;
+    if(c->prev)
+        c->prev->next = c->next;
+    else
+        e->clients = c->next;
+
+    DZMEM(c, sizeof(*c));
+    free(c);
+}
+
+
+static inline uint32_t Events(const struct EpollClient *c) {
+
+    return (c->isRead?EPOLLIN:EPOLLOUT) | EPOLLONESHOT;
+}
+
+
+// If fd is a pipe, make fd refer to a new open file description of the
+// same pipe, so that setting O_NONBLOCK on it does not change the pipe
+// for other processes that share the old open file description; like a
+// shell that gave us the pipe as stdin or stdout.  If we can't, like for
+// a pipe with no reader, we just use the shared one, and put the flags
+// back in StopEpollClients().
+//
+// This must be done before the file descriptor is added to the epoll
+// set, which keeps the open file description and not the number.
+//
+static inline void ReopenPipe(int fd, int flags) {
+
+    struct stat st;
+    if(fstat(fd, &st) || !S_ISFIFO(st.st_mode))
+        return;
+
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    int newFd = open(path, (flags & O_ACCMODE) | O_NONBLOCK | O_CLOEXEC);
+    if(newFd < 0) {
+        DSPEW("open(\"%s\",) failed; using the shared pipe", path);
+        return;
+    }
+
+    // dup2(2) does not keep the close-on-exec flag.
+    int fdFlags = fcntl(fd, F_GETFD);
+    ASSERT(dup2(newFd, fd) == fd);
+    ASSERT(close(newFd) == 0);
+    if(fdFlags != -1)
+        fcntl(fd, F_SETFD, fdFlags);
+}
 
-ERROR("Write more code here: sj=%p", sj);
+
+void StartEpollClients(struct QsGraph *g) {
+
+    struct Epoll *e = g->epoll;
+    if(!e) return;
+
+    CHECK(pthread_mutex_lock(&e->mutex));
+
+    struct EpollClient *next;
+    for(struct EpollClient *c = e->clients; c; c = next) {
+        next = c->next;
+
+        struct QsStreamJob *sj = c->streamJob;
+        DASSERT(sj);
+        DASSERT(sj->epoll == c);
+
+        if(!sj->numInputs && !sj->numOutputs) {
+            // The stream job does not run; no connections.
+            sj->epoll = 0;
+            FreeClient(e, c);
+            continue;
+        }
+
+        c->ready = false;
+        c->waiting = true;
+        ++g->streamJobCount;
+
+        c->flags = fcntl(c->fd, F_GETFL, 0);
+        ASSERT(c->flags != -1);
+        ReopenPipe(c->fd, c->flags);
+        ASSERT(-1 != fcntl(c->fd, F_SETFL, c->flags | O_NONBLOCK));
+
+        struct epoll_event ev = { .events = Events(c), .data.ptr = c };
+        if(epoll_ctl(e->epfd, EPOLL_CTL_ADD, c->fd, &ev)) {
+            WARN("epoll_ctl(,EPOLL_CTL_ADD, %d,) failed, "
+                    "not using epoll", c->fd);
+            fcntl(c->fd, F_SETFL, c->flags);
+            --g->streamJobCount;
+            sj->epoll = 0;
+            FreeClient(e, c);
+            continue;
+        }
+    }
+
+    CHECK(pthread_mutex_unlock(&e->mutex));
+}
+
+
+void StopEpollClients(struct QsGraph *g) {
+
+    struct Epoll *e = g->epoll;
+    if(!e) return;
+
+    CHECK(pthread_mutex_lock(&e->mutex));
+
+    if(!e->clients) {
+        CHECK(pthread_mutex_unlock(&e->mutex));
+        return;
+    }
+
+    for(struct EpollClient *c = e->clients; c; c = c->next) {
+        DASSERT(c->streamJob);
+        // The block may have closed the file descriptor already, so we
+        // ignore errors.
+        epoll_ctl(e->epfd, EPOLL_CTL_DEL, c->fd, 0);
+        if(c->flags != -1)
+            fcntl(c->fd, F_SETFL, c->flags);
+        c->fd = -1;
+        c->streamJob->epoll = 0;
+    }
+
+    // The epoll thread may have gotten events for these clients before
+    // we removed them, so we wait for it to go through another loop
+    // before we free them.
+    WaitForLoop(e);
+
+    while(e->clients)
+        FreeClient(e, e->clients);
+
+    CHECK(pthread_mutex_unlock(&e->mutex));
+}
+
+
+void RearmEpollClient(struct QsStreamJob *j) {
+
+    struct EpollClient *c = j->epoll;
+    DASSERT(c);
+    DASSERT(!c->waiting);
+    DASSERT(c->fd > -1);
+    struct QsGraph *g = ((struct QsJob *) j)->jobsBlock->block.graph;
+    DASSERT(g);
+    DASSERT(g->epoll);
+
+    c->ready = false;
+    c->waiting = true;
+    // This worker is running this stream job, so this count will not go
+    // from 0 to 1 here.
+    ++g->streamJobCount;
+
+    struct epoll_event ev = { .events = Events(c), .data.ptr = c };
+    if(epoll_ctl(g->epoll->epfd, EPOLL_CTL_MOD, c->fd, &ev)) {
+        // The block closed the file descriptor?  We'll just stop
+        // waiting on it and call flow() as if we never used epoll.
+        WARN("epoll_ctl(,EPOLL_CTL_MOD, %d,) failed", c->fd);
+        c->waiting = false;
+        c->ready = true;
+        --g->streamJobCount;
+    }
+}
+
+
+void DestroyEpoll(struct QsGraph *g) {
+
+    struct Epoll *e = g->epoll;
+    if(!e) return;
+
+    CHECK(pthread_mutex_lock(&e->mutex));
+    e->quit = true;
+    Wake(e);
+    CHECK(pthread_mutex_unlock(&e->mutex));
+
+    CHECK(pthread_join(e->thread, 0));
+
+    while(e->clients) {
+        if(e->clients->streamJob)
+            e->clients->streamJob->epoll = 0;
+        FreeClient(e, e->clients);
+    }
+
+    // The timer jobs are destroyed with their blocks, after this; we
+    // just mark them as not in the epoll set.
+    for(struct EpollClient *c = e->timers; c; c = c->next)
+        c->fd = -1;
+
+    close(e->epfd);
+    close(e->wakeFd);
+    CHECK(pthread_mutex_destroy(&e->mutex));
+    CHECK(pthread_cond_destroy(&e->cond));
+
+    DZMEM(e, sizeof(*e));
+    free(e);
+    g->epoll = 0;
+}
+
+
+static bool TimerWork(struct QsTimerJob *t) {
+
+    // We start with the job lock.
+
+    // Ticks that come while we are calling the callback do not queue this
+    // job, because it is busy; they wait for the next tick to queue it.
+    // We do not loop here until there are no ticks, so a callback that is
+    // slower than the period does not keep this worker thread forever.
+    uint64_t ticks = t->ticks;
+    t->ticks = 0;
+
+    if(ticks) {
+
+        qsJob_unlock(&t->job);
+
+        struct QsWhichBlock stackSave;
+        SetBlockCallback((void *) t->job.jobsBlock, CB_TIMER, &stackSave);
+        t->callback(ticks, t->userData);
+        RestoreBlockCallback(&stackSave);
+
+        qsJob_lock(&t->job);
+    }
+
+    // We return with the job lock.
+
+    return false;
 }
 
+
+// We have the epoll mutex lock.  Take the timer out of the epoll set.
+// The caller must WaitForLoop() after, before the timer job's mutexes are
+// freed, because the epoll thread may be handling a tick for it; see
+// HandleTimer().
+//
+static inline bool RemoveTimer(struct Epoll *e, struct QsTimerJob *t) {
+
+    if(t->client.fd < 0)
+        return false;
+
+    epoll_ctl(e->epfd, EPOLL_CTL_DEL, t->fd, 0);
+    t->client.fd = -1;
+    return true;
+}
+
+
+void RemoveTimerJobs(struct QsJobsBlock *jb) {
+
+    struct Epoll *e = jb->block.graph->epoll;
+    if(!e) return;
+
+    bool removed = false;
+
+    CHECK(pthread_mutex_lock(&e->mutex));
+    for(struct EpollClient *c = e->timers; c; c = c->next)
+        if(c->timerJob->job.jobsBlock == jb &&
+                RemoveTimer(e, c->timerJob))
+            removed = true;
+    if(removed)
+        WaitForLoop(e);
+    CHECK(pthread_mutex_unlock(&e->mutex));
+}
+
+
+static void FreeTimerJob(struct QsTimerJob *t) {
+
+    DASSERT(t);
+    struct QsGraph *g = t->graph;
+    DASSERT(g);
+
+    // If there is no epoll (thread) now, the graph is being destroyed and
+    // DestroyEpoll() already removed this timer.
+    struct Epoll *e = g->epoll;
+
+    if(e) {
+        CHECK(pthread_mutex_lock(&e->mutex));
+        // qsTimerJobDestroy() or RemoveTimerJobs() took the timer out of
+        // the epoll set before the job cleanup freed the job mutexes.
+        DASSERT(t->client.fd < 0);
+        if(t->client.next)
+            t->client.next->prev = t->client.prev;
+        if(t->client.prev)
+            t->client.prev->next = t->client.next;
+        else
+            e->timers = t->client.next;
+        CHECK(pthread_mutex_unlock(&e->mutex));
+    }
+
+    close(t->fd);
+    CHECK(pthread_mutex_destroy(&t->mutex));
+
+    DZMEM(t, sizeof(*t));
+    free(t);
+}
+
+
+void qsTimerJobSetPeriod(struct QsTimerJob *t, uint64_t periodNs) {
+
+    DASSERT(t);
+    DASSERT(t->fd > -1);
+
+    struct itimerspec its;
+    its.it_interval.tv_sec = periodNs/1000000000;
+    its.it_interval.tv_nsec = periodNs%1000000000;
+    // The first tick is one period from now.  A zero period disarms the
+    // timer.
+    its.it_value = its.it_interval;
+
+    ASSERT(timerfd_settime(t->fd, 0, &its, 0) == 0,
+            "timerfd_settime(%d,,) failed", t->fd);
+}
+
+
+struct QsTimerJob *qsAddTimerJob(uint64_t periodNs,
+        void (*callback)(uint64_t ticks, void *userData),
+        void *userData) {
+
+    NotWorkerThread();
+    ASSERT(callback);
+
+    struct QsSimpleBlock *b = GetBlock(CB_DECLARE|CB_CONFIG, 0,
+            QsBlockType_simple);
+    struct QsGraph *g = b->jobsBlock.block.graph;
+    DASSERT(g);
+
+    struct QsTimerJob *t = calloc(1, sizeof(*t));
+    ASSERT(t, "calloc(1,%zu) failed", sizeof(*t));
+
+    t->callback = callback;
+    t->userData = userData;
+    t->graph = g;
+
+    // CLOCK_MONOTONIC does not jump with the wall clock.
+    t->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+    ASSERT(t->fd > -1, "timerfd_create() failed");
+
+    CHECK(pthread_mutex_init(&t->mutex, 0));
+
+    qsJob_init(&t->job, (void *) b, (void *) TimerWork,
+            (void *) FreeTimerJob, 0);
+    qsJob_addMutex(&t->job, &t->mutex);
+
+    if(!g->epoll)
+        g->epoll = CreateEpoll(g);
+    struct Epoll *e = g->epoll;
+
+    struct EpollClient *c = &t->client;
+    c->isRead = true;
+    c->fd = t->fd;
+    c->flags = -1;
+    c->timerJob = t;
+
+    CHECK(pthread_mutex_lock(&e->mutex));
+    c->next = e->timers;
+    if(e->timers)
+        e->timers->prev = c;
+    e->timers = c;
+    // The timer file descriptor is read once per tick, so it's level
+    // triggered and not one shot like the stream clients.
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+    ASSERT(epoll_ctl(e->epfd, EPOLL_CTL_ADD, t->fd, &ev) == 0);
+    CHECK(pthread_mutex_unlock(&e->mutex));
+
+    qsTimerJobSetPeriod(t, periodNs);
+
+    DSPEW("Block \"%s\" added timer fd=%d period %" PRIu64 " ns",
+            b->jobsBlock.block.name, t->fd, periodNs);
+
+    return t;
+}
+
+
+void qsTimerJobDestroy(struct QsTimerJob *t) {
+
+    DASSERT(t);
+
+    // We must stop the epoll thread from handling ticks for this timer
+    // before qsJob_cleanup() frees the job's mutex list, which
+    // HandleTimer() uses.  Halting the thread pools does not stop the
+    // epoll thread.
+    struct Epoll *e = t->graph->epoll;
+    if(e) {
+        CHECK(pthread_mutex_lock(&e->mutex));
+        if(RemoveTimer(e, t))
+            WaitForLoop(e);
+        CHECK(pthread_mutex_unlock(&e->mutex));
+    }
+
+    qsJob_cleanup(&t->job);
+}
@@ -1,23 +1,138 @@
+// The graph's epoll_wait(2) thread and the stream jobs that use it.
+//
+// A simple block that reads or writes a file descriptor (like a pipe or a
+// socket) that may not be ready for a long time calls
+// qsAddEpollReadJob() or qsAddEpollWriteJob() in its start() callback.
+// From then on, until the stream stops, the block's stream job is only
+// queued to run flow() (or flush()) when the epoll thread sees that the
+// file descriptor is ready.  So a thread pool worker thread does not sit
+// in a blocking read(2) or write(2) waiting on a slow file descriptor,
+// and can go work other blocks.
+//
+// The file descriptor is set to O_NONBLOCK, so the block's flow() must
+// handle read(2) and write(2) failing with errno EAGAIN; which just means
+// there was no data (or room) after all.  A pipe gets a new open file
+// description first, so that other processes that share the pipe do not
+// see O_NONBLOCK.  While flow() keeps advancing the stream we keep calling
+// it, and only when it does not do we wait on the epoll thread again; so
+// a fast file descriptor is read (or written) until EAGAIN, like with an
+// edge triggered epoll.
+//
+// There is one epoll thread per graph.  It's started at the first
+// qsAddEpollReadJob(), qsAddEpollWriteJob() or qsAddTimerJob() call in
+// the graph and stopped when the graph is destroyed.
+//
+// The timer jobs from qsAddTimerJob() use the same epoll thread.  Each
+// timer job has a timerfd(2) file descriptor, and when it's readable the
+// epoll thread reads the number of timer expirations (ticks) and queues
+// the timer job in its' block's thread pool.  The ticks add up while the
+// job is queued or running, so the callback gets called once with all
+// the ticks that it missed, and not once for each tick.  Timer jobs are
+// not stream jobs; they keep ticking while the stream is not running,
+// until they are destroyed.
 
 
 struct EpollClient {
 
     bool isRead;
 
+    // If set this client is for a timer job, and not a stream job.  The
+    // timer job client is in the timer job, and is in Epoll::timers and
+    // not Epoll::clients.
+    struct QsTimerJob *timerJob;
+
     int fd;
 
+    // The fcntl(2) F_GETFL flags before we set O_NONBLOCK; so we can put
+    // them back when we stop using the file descriptor.
+    int flags;
+
     // We use the port to get to the stream job or a control parameter
     // setter (job).
     struct QsPort *port;
 
+    // The stream job that gets queued when the file descriptor is ready.
+    struct QsStreamJob *streamJob;
+
+    // Set by the epoll thread when the file descriptor is ready.  Unset
+    // when flow() or flush() does not advance the stream, and we wait for
+    // the epoll thread again.  Accessed with the stream job lock.
+    bool ready;
+
+    // Set when the file descriptor is registered with epoll_ctl(2) and
+    // waiting for the epoll thread.  When the stream job is waiting it is
+    // counted in QsGraph::streamJobCount, just like it was queued; so
+    // that the stream does not look finished when the only thing left to
+    // do is to wait for a slow file descriptor.  Accessed with the stream
+    // job lock.
+    bool waiting;
+
     struct EpollClient *prev, *next;
 };
 
 
 struct Epoll {
 
+    struct QsGraph *graph;
+
+    // The epoll file descriptor from epoll_create1(2).
+    int epfd;
+
+    // An eventfd(2) file descriptor that we use to wake up the epoll
+    // thread.
+    int wakeFd;
+
+    pthread_t thread;
+
+    // Protects all the data in this struct, except for the file
+    // descriptors which do not change until the thread is joined.
+    //
+    // Lock order: mutex then stream job lock.  The epoll thread holds
+    // this mutex while it handles a batch of events.
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+
+    // Counts the times the epoll thread returned from epoll_wait(2) and
+    // handled the events.  Used to know that the epoll thread is not
+    // holding events for clients that we removed.
+    uint64_t loopCount;
+
+    bool quit;
+
     struct EpollClient *clients;
 
+    // The timer job clients, that are not removed at stream stop.
+    struct EpollClient *timers;
 };
 
 
+// Called at qsGraph_start() after the blocks start() callbacks and after
+// the stream flow() arguments are allocated.  The thread pools must be
+// halted.
+extern
+void StartEpollClients(struct QsGraph *g);
+
+// Called at qsGraph_stop() before the blocks stop() callbacks.  The
+// thread pools must be halted.
+extern
+void StopEpollClients(struct QsGraph *g);
+
+// Called with the stream job lock, just after the stream job calls flow()
+// or flush() and it did not advance the stream, so we wait for the file
+// descriptor to be ready again.
+extern
+void RearmEpollClient(struct QsStreamJob *j);
+
+// Called when a block is destroyed, before its' jobs are cleaned up, to
+// stop the epoll thread from handling the block's timer jobs.
+extern
+void RemoveTimerJobs(struct QsJobsBlock *jb);
+
+// Called in graph destroy.
+extern
+void DestroyEpoll(struct QsGraph *g);
+
+// In streamWork.c.  Called by the epoll thread with the stream job lock
+// when the file descriptor is ready.
+extern
+void QueueEpollStreamJob(struct QsStreamJob *j);
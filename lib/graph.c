@@ -16,6 +16,9 @@
 #include "block.h"
 #include "graph.h"
 #include "job.h"
+#include "port.h"
+#include "stream.h"
+#include "epoll.h"
 
 #include "metaData.h"
 
@@ -258,7 +261,11 @@ struct QsGraph *qsGraph_create(const char *path,
     }
 
     struct QsThreadPool *tp =
-        _qsGraph_createThreadPool(g, maxThreads, threadPoolName);
+        _qsGraph_createThreadPool(g, maxThreads, threadPoolName,
+                ((flags & QS_GRAPH_WORK_STEALING)?
+                QS_THREADPOOL_WORK_STEALING:0) |
+                ((flags & QS_GRAPH_FUSE_CHAINS)?
+                QS_THREADPOOL_FUSE_CHAINS:0));
     ASSERT(tp);
     DZMEM((char *) threadPoolName, strlen(threadPoolName));
     free((char *) threadPoolName);
@@ -411,6 +418,9 @@ void _qsGraph_destroy(struct QsGraph *g) {
     qsGraph_threadPoolHaltLock(g, 0);
     // That halt gave us a g->mutex lock again too.
 
+    // Stop the epoll thread, if there is one, before the blocks go away.
+    DestroyEpoll(g);
+
     DASSERT(g->name);
     DSPEW("Destroying graph \"%s\"", g->name);
 
@@ -433,6 +443,8 @@ void _qsGraph_destroy(struct QsGraph *g) {
 
     CleanupQsGetMemory(g);
 
+    FreeBufferPool(g);
+
     // We did not stop the possibility of blocks doing stuff since
     // the last FreeGraphCommands(g).
     //
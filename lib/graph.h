@@ -155,6 +155,10 @@ struct QsGraph {
     //
     // The number of connected stream inputs for a given stream run.
     uint32_t numInputs;
+    //
+    // The times, from GetNanoseconds(), of the last qsGraph_start() and
+    // qsGraph_stop(); for qsGraph_getStats().
+    uint64_t streamStartTime, streamStopTime;
 
 
     // List of thread pools:
@@ -254,7 +258,19 @@ struct QsGraph {
     //
     bool saveAttributes;
 
-    bool hasEpollBlock;
+    // The graph's epoll_wait(2) thread and the file descriptors it
+    // watches for stream jobs.  Created at the first
+    // qsAddEpollReadJob() or qsAddEpollWriteJob() call, else 0.  See
+    // epoll.h.
+    struct Epoll *epoll;
+
+    // Stream ring buffers that are not in use.  qsGraph_stop() puts the
+    // ring buffers here, and qsGraph_start() takes the ones that are big
+    // enough for the new stream run, so that we do not need to mmap()
+    // and munmap() them at every stop and start.  The ones that do not
+    // get used at start are freed.  It's a singly linked list using
+    // QsBuffer::next.
+    struct QsBuffer *bufferPool;
 };
 
 
@@ -176,6 +176,10 @@ CheckStreamFinish(struct QsGraph *g) {
 
     DASSERT(!g->destroyingGraph);
 
+    // All the stream blocks finished (drained), so there is no reason to
+    // wait for the last stream jobs to return from the worker threads.
+    bool blocksFinished = !g->streamBlockCount;
+
     CHECK(pthread_mutex_unlock(&g->cqMutex));
 
     // After the above unlock the state of g->destroyingGraph
@@ -183,7 +187,7 @@ CheckStreamFinish(struct QsGraph *g) {
 
     CHECK(pthread_mutex_lock(&g->mutex));
 
-    if(g->runningStreams && !g->streamJobCount) {
+    if(g->runningStreams && (blocksFinished || !g->streamJobCount)) {
         qsGraph_stop(g);
         DASSERT(!g->runningStreams);
         ret = true;
@@ -598,6 +602,167 @@ void qsStop(void) {
             Stop, sizeof(*c));
 }
 
+
+struct HaltAsync {
+
+    struct QsCommand command; // inherit
+
+    struct QsJob *job;
+
+    // One of these is set; callback from
+    // qsJob_threadPoolHaltLockAsync() or blockCallback from
+    // qsBlockHaltAsync().
+    void (*callback)(struct QsJob *j);
+    void (*blockCallback)(struct QsGraph *g, void *userData);
+    void *userData;
+
+    // From qsBlockHaltAsync(), the names of the blocks[], one after
+    // the other with their '\0' terminators, in the memory after
+    // blocks[].  The blocks[] are looked up when the command runs, so
+    // we do not keep a pointer to a block that may get destroyed
+    // before then.  Or 0 if the blocks[] are passed in.
+    const char *names;
+
+    // The other blocks that the callback edits.
+    uint32_t numBlocks;
+    struct QsJobsBlock *blocks[];
+};
+
+
+static int
+HaltAsync(struct QsGraph *g, struct QsBlock *b, struct QsCommand *c) {
+
+#ifdef DEBUG
+    NotWorkerThread();
+#endif
+
+    DASSERT(g);
+    DASSERT(b);
+    DASSERT(c);
+    DASSERT(c->callback == HaltAsync);
+
+    struct HaltAsync *h = (void *) c;
+    DASSERT(h->job);
+    DASSERT(h->callback || h->blockCallback);
+    DASSERT((void *) h->job->jobsBlock == (void *) b);
+
+    if(h->names) {
+        const char *name = h->names;
+        uint32_t n = 0;
+        for(uint32_t i = 0; i < h->numBlocks; ++i) {
+            struct QsBlock *block = qsGraph_getBlock(g, name);
+            if(!block)
+                WARN("Block \"%s\" was not found", name);
+            else if(!(block->type & QS_TYPE_JOBS))
+                WARN("Block \"%s\" does not run in a thread pool",
+                        name);
+            else
+                h->blocks[n++] = (void *) block;
+            name += strlen(name) + 1;
+        }
+        h->numBlocks = n;
+    }
+
+    // Halt just the thread pools that this block and the other blocks
+    // use, and not all the thread pools in the graph like
+    // qsGraph_threadPoolHaltLock(g, 0) does.  This waits for the worker
+    // threads in them to finish what they are working on, including the
+    // worker that queued this.  The halt lock is recursive, so thread
+    // pools that the blocks share just get halted more than once.
+    uint32_t numHalts = qsBlock_threadPoolHaltLock((void *) b);
+    for(uint32_t i = 0; i < h->numBlocks; ++i)
+        numHalts += qsBlock_threadPoolHaltLock(h->blocks[i]);
+
+    if(h->callback)
+        h->callback(h->job);
+    else
+        h->blockCallback(g, h->userData);
+
+    while(numHalts--)
+        qsGraph_threadPoolHaltUnlock(g);
+
+    return 0;
+}
+
+
+// Called from a job work() function, that is in a thread pool worker
+// thread.  See threadPool.h.
+//
+void qsJob_threadPoolHaltLockAsync(struct QsJob *j,
+        void (*callback)(struct QsJob *j),
+        struct QsJobsBlock * const *blocks, uint32_t numBlocks) {
+
+    DASSERT(j);
+    DASSERT(j->jobsBlock);
+    ASSERT(callback);
+    ASSERT(pthread_getspecific(threadPoolKey),
+            "Only thread pool worker threads can call this");
+    ASSERT(blocks || !numBlocks);
+
+    struct QsGraph *g = j->jobsBlock->block.graph;
+    DASSERT(g);
+
+    size_t size = sizeof(struct HaltAsync) +
+            numBlocks*sizeof(struct QsJobsBlock *);
+    struct HaltAsync *h = calloc(1, size);
+    ASSERT(h, "calloc(1,%zu) failed", size);
+    h->job = j;
+    h->callback = callback;
+    h->numBlocks = numBlocks;
+    for(uint32_t i = 0; i < numBlocks; ++i) {
+        DASSERT(blocks[i]);
+        DASSERT(blocks[i]->block.graph == g);
+        h->blocks[i] = blocks[i];
+    }
+
+    QueueAndSignalCommand(g, &h->command, (void *) j->jobsBlock,
+            HaltAsync, size);
+}
+
+
+void qsBlockHaltAsync(void (*callback)(struct QsGraph *graph,
+            void *userData), void *userData,
+        const char * const *blockNames, uint32_t numBlocks) {
+
+    ASSERT(callback);
+    ASSERT(blockNames || !numBlocks);
+    struct QsWhichJob *wj = pthread_getspecific(threadPoolKey);
+    ASSERT(wj, "Only block callbacks in thread pool worker threads "
+            "can call this");
+    DASSERT(wj->job);
+    struct QsJob *j = wj->job;
+    DASSERT(j->jobsBlock);
+
+    struct QsGraph *g = j->jobsBlock->block.graph;
+    DASSERT(g);
+
+    size_t namesLen = 0;
+    for(uint32_t i = 0; i < numBlocks; ++i) {
+        ASSERT(blockNames[i] && blockNames[i][0]);
+        namesLen += strlen(blockNames[i]) + 1;
+    }
+
+    size_t size = sizeof(struct HaltAsync) +
+            numBlocks*sizeof(struct QsJobsBlock *) + namesLen;
+    struct HaltAsync *h = calloc(1, size);
+    ASSERT(h, "calloc(1,%zu) failed", size);
+    h->job = j;
+    h->blockCallback = callback;
+    h->userData = userData;
+    h->numBlocks = numBlocks;
+    char *names = (char *) (h->blocks + numBlocks);
+    h->names = names;
+    for(uint32_t i = 0; i < numBlocks; ++i) {
+        size_t len = strlen(blockNames[i]) + 1;
+        memcpy(names, blockNames[i], len);
+        names += len;
+    }
+
+    QueueAndSignalCommand(g, &h->command, (void *) j->jobsBlock,
+            HaltAsync, size);
+}
+
+
 // I love to ramble and rant.  This is a total fucking rambling rant:
 //
 // The program quickstreamGUI has the "two center of the universes"
@@ -549,17 +549,19 @@ static inline void ReQueueBlock(struct QsThreadPool *tp,
 
 // We need a thread pool mutex lock to call this:
 //
+// Wake or launch a worker thread, if we can.  The caller knows that there
+// is a block ready for another worker thread.
+//
 static inline
-void CheckLaunchWorkers(struct QsThreadPool *tp) {
+void WakeOrLaunchWorker(struct QsThreadPool *tp) {
 
-    if(!tp->first || tp->numWorkingThreads >= tp->maxThreadsRun
+    if(tp->numWorkingThreads >= tp->maxThreadsRun
             || tp->halt || tp->signalingOne)
-        // We do not have a block in the thread pool queue, or we have the
-        // maximum number of worker threads (or more) now working, or we
-        // are halting this thread pool OR we are launching a worker
-        // thread now, or we are trying to join worker threads now, or we
-        // are in the process of signaling the tp->cond to wake a worker
-        // thread.  Enough crap?
+        // We have the maximum number of worker threads (or more) now
+        // working, or we are halting this thread pool OR we are launching
+        // a worker thread now, or we are trying to join worker threads
+        // now, or we are in the process of signaling the tp->cond to wake
+        // a worker thread.  Enough crap?
         return;
 
 
@@ -575,6 +577,24 @@ void CheckLaunchWorkers(struct QsThreadPool *tp) {
 }
 
 
+// We need a thread pool mutex lock to call this:
+//
+static inline
+void CheckLaunchWorkers(struct QsThreadPool *tp) {
+
+    if(!tp->first)
+        // We do not have a block in the thread pool queue.
+        return;
+
+    WakeOrLaunchWorker(tp);
+}
+
+
+// The work stealing version of _qsJob_queueJob(); in threadPool.c.
+extern
+void WorkStealingQueueJob(struct QsJob *j, bool getTPL);
+
+
 // We must have the job lock before calling this.
 //
 // mutex locking order of:
@@ -598,6 +618,11 @@ void _qsJob_queueJob(struct QsJob *j, bool getTPL) {
     struct QsThreadPool *tp = b->threadPool;
     DASSERT(tp);
 
+    if(tp->workStealing) {
+        WorkStealingQueueJob(j, getTPL);
+        return;
+    }
+
     if(getTPL)
         CHECK(pthread_mutex_lock(&tp->mutex));
 
@@ -21,6 +21,8 @@
 #include "block.h"
 #include "graph.h"
 #include "dir.h"
+#include "mmapRingBuffer.h"
+#include "LoadDSOCopy.h"
 
 #include "builtInBlocks.h"
 
@@ -34,6 +36,28 @@
 uint32_t parameterQueueLength = ((uint32_t) 10);
 
 
+// env QS_WORK_STEALING set to non-zero makes all thread pools use work
+// stealing, like they were created with the QS_THREADPOOL_WORK_STEALING
+// flag.  Handy for comparing the two thread pool schedulers.
+bool workStealingDefault = false;
+
+// env QS_FUSE_CHAINS set to non-zero makes all thread pools fuse linear
+// chains of stream blocks, like they were created with the
+// QS_THREADPOOL_FUSE_CHAINS flag.
+bool fuseChainsDefault = false;
+
+
+// env QS_RING_BUFFER set to "shm", "memfd", or "hugetlb" sets how the
+// stream ring buffers get their memory; see mmapRingBuffer.c.  The
+// default is "shm".
+//
+// env QS_NUMA_NODE set to a NUMA node number makes the stream ring
+// buffers get their memory from that NUMA node.  Both can be set per
+// thread pool with qsThreadPool_setNumaNode() and
+// qsThreadPool_setRingBuffer().
+int numaNodeDefault = -1;
+
+
 // env QS_WAIT_SIGNAL can make this variable if it is good.
 //
 int waitSignal = 0; // The value it set to non-zero below.
@@ -186,6 +210,52 @@ static void qsLibrary_create(void) {
     DSPEW("QS_PARAMETER_QUEUE_LENGTH is %" PRIu32, parameterQueueLength);
 
 
+    env = getenv("QS_WORK_STEALING");
+    if(env && strtol(env, 0, 10))
+        workStealingDefault = true;
+    DSPEW("QS_WORK_STEALING is %d", workStealingDefault);
+
+
+    env = getenv("QS_FUSE_CHAINS");
+    if(env && strtol(env, 0, 10))
+        fuseChainsDefault = true;
+    DSPEW("QS_FUSE_CHAINS is %d", fuseChainsDefault);
+
+
+    env = getenv("QS_RING_BUFFER");
+    if(env) {
+        int mode = RingBufferMode(env);
+        if(mode > -1)
+            ringBufferMode = mode;
+        else
+            WARN("Bad env QS_RING_BUFFER=\"%s\"", env);
+    }
+    DSPEW("QS_RING_BUFFER mode is %s",
+            RingBufferModeName(ringBufferMode));
+
+
+    env = getenv("QS_DSO_COPY");
+    if(env) {
+        if(!strcmp(env, "memfd"))
+            dsoCopyMode = QsDSOCopy_memfd;
+        else if(!strcmp(env, "tmpfile"))
+            dsoCopyMode = QsDSOCopy_tmpfile;
+        else
+            WARN("Bad env QS_DSO_COPY=\"%s\"", env);
+    }
+    DSPEW("QS_DSO_COPY mode is %d", dsoCopyMode);
+
+
+    env = getenv("QS_NUMA_NODE");
+    if(env) {
+        char *end;
+        long l = strtol(env, &end, 10);
+        if(end != env && l >= 0 && l < 1024)
+            numaNodeDefault = l;
+    }
+    DSPEW("QS_NUMA_NODE is %d", numaNodeDefault);
+
+
     env = getenv("QS_WAIT_SIGNAL");
     if(env) {
         char *end;
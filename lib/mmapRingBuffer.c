@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <sys/mman.h>
 #include <stdlib.h>
@@ -9,13 +10,50 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <pthread.h>
+#include <sys/syscall.h>
 
 #include "debug.h"
+#include "mmapRingBuffer.h"
 
 
 
 #define TMP_LEN  (64)
 
+// We use MFD_HUGE_2MB huge pages with QsRingBuffer_hugetlb.
+#define HUGE_PAGESIZE  ((size_t) (2*1024*1024))
+#ifndef MFD_HUGE_2MB
+// It's in linux/memfd.h, which is not included by sys/mman.h.
+#  define MFD_HUGE_2MB  (21U << 26)
+#endif
+
+// From linux/mempolicy.h.  We call mbind(2) with syscall(2) so that we do
+// not need to link with libnuma.
+#define QS_MPOL_BIND  (2)
+
+
+// Set from env QS_RING_BUFFER in lib_constructor.c.
+enum QsRingBufferMode ringBufferMode = QsRingBuffer_shm;
+
+
+// Indexed by enum QsRingBufferMode.
+static const char *modeNames[] = { "shm", "memfd", "hugetlb", 0 };
+
+
+int RingBufferMode(const char *name) {
+
+    for(int i = 0; modeNames[i]; ++i)
+        if(!strcmp(name, modeNames[i]))
+            return i;
+    return -1;
+}
+
+
+const char *RingBufferModeName(enum QsRingBufferMode mode) {
+
+    DASSERT(mode >= 0 && mode <= QsRingBuffer_hugetlb);
+    return modeNames[mode];
+}
+
 
 //
 // CREDIT: We copied ideas for this from circular (ring) buffer idea from
@@ -57,6 +95,24 @@
 // for another purpose, accidentally or otherwise.   The parameters will
 // be increased to the nearest page size (4096 bytes as of Sept 2019).
 //
+// The shared memory comes from one of (see env QS_RING_BUFFER in
+// lib_constructor.c):
+//
+//   QsRingBuffer_shm     shm_open(3); the old way.
+//
+//   QsRingBuffer_memfd   memfd_create(2); it has no name, so there can
+//                        be no name clash with another process.
+//
+//   QsRingBuffer_hugetlb memfd_create(2) with 2 MiB huge pages for
+//                        buffers that are at least 2 MiB long.  Fewer
+//                        TLB misses in flow() loops that run through
+//                        large buffers.  The parameters get increased to
+//                        the nearest 2 MiB.  If we can't get huge pages
+//                        we use memfd_create(2) without huge pages.
+//
+// In all cases we reserve the address space for both mappings before we
+// make them, so that the second mapping is always next to the first.
+//
 // After "len" and "overhang" are increased to the nearest page size the
 // buffer will looks like:
 //
@@ -77,45 +133,183 @@
 //
 //
 
-// TODO:
-//
-// Since mmap()ing and munmap() this memory is an expensive part of the
-// stream startup and stopping, we need to consider making a circular
-// buffer allocator by putting the buffers in a (red/black?) tree with a
-// key that is the sum of mapLength and overhangLength.  Maybe a searching
-// a singly linked list would be much faster than all the mmap()ing and
-// munmap() system calls.  Or we could put the list of circular buffers in
-// an ordered array so we can have O(log) speed search.  Or maybe just not
-// sweat it because the kernel will be caching these pages for us anyway,
-// so the cost gets smaller when we cycle the starting and stopping.
+// mmap()ing and munmap()ing this memory is an expensive part of the
+// stream startup and stopping, so the buffers are not freed at stream
+// stop; they are kept in a list in the graph, QsGraph::bufferPool, and
+// reused at the next stream start, in CreateOutputRingBuffer() in
+// qsGraph_start.c.  FreeBufferPool() frees them.
 //
 
 
 
 static size_t pagesize = 0;
 
-// Make *len be the nearest multiple of pagesize.
+// Make *len be the nearest multiple of psize.
 //
-static inline void bumpSize(size_t *len)
+static inline void bumpSize(size_t *len, size_t psize)
 {
-    DASSERT(pagesize);
+    DASSERT(psize);
 
-    if((*len) > (size_t) pagesize)
+    if((*len) > psize)
     {
-        if((*len) % pagesize)
-            *len += pagesize - (*len) % pagesize;
+        if((*len) % psize)
+            *len += psize - (*len) % psize;
     }
     else
-        *len = pagesize;
+        *len = psize;
+}
+
+
+// Returns a file descriptor to shared memory that is not linked into any
+// file system.
+//
+static inline int MakeShmFd(void) {
+
+    // This is not thread safe.  We expect that this is only
+    // called by the main thread.
+    //
+    static uint32_t segmentCount = 0;
+
+    char tmp[TMP_LEN];
+    int fd;
+
+    snprintf(tmp, TMP_LEN, "/qs_ringbuffer_%" PRIu32 "_%d",
+            segmentCount++, getpid());
+
+    // Using shm_open(), instead of open(), incurs less overhead in use.
+    // reference:
+    //   https://stackoverflow.com/questions/24875257/why-use-shm-open
+    //
+    ASSERT((fd = shm_open(tmp, O_RDWR|O_CREAT|O_EXCL, S_IRUSR | S_IWUSR))
+            > -1, "shm_open(\"%s\",,) failed", tmp);
+
+    // We unlink it now, so that the shared memory file may never be used
+    // for another purpose, accidentally or otherwise.
+    ASSERT(shm_unlink(tmp) == 0, "shm_unlink(\"%s\") failed", tmp);
+
+    return fd;
+}
+
+
+// Reserve "length" bytes of address space aligned to "align" bytes, so
+// that we can put the two ring buffer mappings in it with MAP_FIXED
+// without another mmap() call in this process taking part of the
+// address space in between our two mmap() calls.
+//
+static inline uint8_t *Reserve(size_t length, size_t align) {
+
+    uint8_t *x;
+
+    ASSERT(MAP_FAILED != (x = mmap(0, length + align - pagesize,
+            PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,
+            -1, 0)), "mmap(0,%zu,PROT_NONE,) failed",
+            length + align - pagesize);
+
+    // Trim the reservation to "length" bytes starting at an "align"
+    // bytes aligned address.
+    size_t head = (align - ((uintptr_t) x) % align) % align;
+    size_t tail = align - pagesize - head;
+
+    if(head)
+        ASSERT(0 == munmap(x, head));
+    x += head;
+    if(tail)
+        ASSERT(0 == munmap(x + length, tail));
+
+    return x;
+}
+
+
+// Map the shared memory in fd at file offset, with length len, at x and
+// then map the start of it again at x + len.
+//
+// Returns true on success.  If it fails the reserved address space at x
+// is still reserved.
+//
+static inline bool MapRing(uint8_t *x, size_t len, size_t overhang,
+        int fd, off_t offset) {
+
+    if(MAP_FAILED == mmap(x, len, PROT_WRITE|PROT_READ,
+                MAP_SHARED|MAP_FIXED, fd, offset))
+        return false;
+
+    if(MAP_FAILED == mmap(x + len, overhang, PROT_WRITE|PROT_READ,
+                MAP_SHARED|MAP_FIXED, fd, offset)) {
+        // Put back the reservation.
+        ASSERT(MAP_FAILED != mmap(x, len, PROT_NONE,
+                MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE|MAP_FIXED,
+                -1, 0));
+        return false;
+    }
+
+    return true;
+}
+
+
+// Try to make a ring buffer with huge pages.  Returns 0 if that fails,
+// like when there are no huge pages reserved in
+// /proc/sys/vm/nr_hugepages.
+//
+static inline uint8_t *MakeHugeRing(size_t *len, size_t *overhang) {
+
+    size_t l = *len, o = *overhang;
+    bumpSize(&l, HUGE_PAGESIZE);
+    bumpSize(&o, HUGE_PAGESIZE);
+
+    int fd = memfd_create("qs_ringbuffer",
+            MFD_CLOEXEC|MFD_HUGETLB|MFD_HUGE_2MB);
+    if(fd < 0)
+        return 0;
+
+    uint8_t *x = 0;
+
+    if(ftruncate(fd, l)) goto finish;
+
+    x = Reserve(l + o, HUGE_PAGESIZE);
+
+    if(!MapRing(x, l, o, fd, 0)) {
+        ASSERT(0 == munmap(x, l + o));
+        x = 0;
+        goto finish;
+    }
+
+    *len = l;
+    *overhang = o;
+
+finish:
+
+    ASSERT(close(fd) == 0);
+    return x;
+}
+
+
+// Ask the kernel to get the pages for the memory from NUMA node
+// numaNode.  The memory policy is kept with the shared memory object, so
+// it is for both mappings.
+//
+static inline void Bind(uint8_t *x, size_t len, int numaNode) {
+
+    unsigned long mask[(numaNode)/(8*sizeof(unsigned long)) + 1];
+    memset(mask, 0, sizeof(mask));
+    mask[numaNode/(8*sizeof(unsigned long))] =
+        1UL << (numaNode%(8*sizeof(unsigned long)));
+
+    if(syscall(SYS_mbind, x, len, QS_MPOL_BIND, mask,
+                (unsigned long) (8*sizeof(mask) + 1), 0))
+        WARN("mbind() to NUMA node %d failed", numaNode);
 }
 
 
 // Sets len to the next pagesize.
 // Sets overhang to the next pagesize.
 //
+// numaNode is the NUMA node to get the memory from, or -1 to let the
+// kernel do what it does.  mode is where the memory comes from.
+//
 // Returns a pointer to the start of the first mapping.
 //
-void *makeRingBuffer(size_t *len, size_t *overhang)
+void *makeRingBuffer(size_t *len, size_t *overhang, int numaNode,
+        enum QsRingBufferMode mode)
 {
     DASSERT(len);
     DASSERT(overhang);
@@ -126,59 +320,54 @@ void *makeRingBuffer(size_t *len, size_t *overhang)
         DASSERT(pagesize == 4*1024);
     }
 
-    // This is not thread safe.  We expect that this is only
-    // called by the main thread.
-    //
-    static uint32_t segmentCount = 0;
-
     DASSERT((*len) >= (*overhang));
 
-    bumpSize(len);
-    bumpSize(overhang);
-
-    char tmp[TMP_LEN];
-    uint8_t *x;
-    int fd;
-
-    snprintf(tmp, TMP_LEN, "/qs_ringbuffer_%" PRIu32 "_%d",
-            segmentCount, getpid());
+    uint8_t *x = 0;
+
+    // Huge pages are only worth it if the buffer is at least one huge
+    // page; otherwise we'd just waste memory.
+    if(mode == QsRingBuffer_hugetlb && *len >= HUGE_PAGESIZE) {
+        x = MakeHugeRing(len, overhang);
+        if(!x) {
+            static bool warned = false;
+            if(!warned) {
+                WARN("Failed to make huge page ring buffer; "
+                        "using normal pages");
+                warned = true;
+            }
+        }
+    }
 
+    if(!x) {
 
-    // It's all just a crap ton of system calls that can't fail hence
-    // ASSERT().
+        bumpSize(len, pagesize);
+        bumpSize(overhang, pagesize);
 
+        // It's all just a crap ton of system calls that can't fail hence
+        // ASSERT().
 
-    // Using shm_open(), instead of open(), incurs less overhead in use.
-    // reference:
-    //   https://stackoverflow.com/questions/24875257/why-use-shm-open
-    //
-    ASSERT((fd = shm_open(tmp, O_RDWR|O_CREAT|O_EXCL, S_IRUSR | S_IWUSR))
-            > -1, "shm_open(\"%s\",,) failed", tmp);
+        int fd;
+        if(mode == QsRingBuffer_shm)
+            fd = MakeShmFd();
+        else
+            // memfd_create(2) has no name in a file system, so there is
+            // no chance of another process getting the same name.
+            ASSERT((fd = memfd_create("qs_ringbuffer", MFD_CLOEXEC)) > -1,
+                    "memfd_create() failed");
 
-    ASSERT(ftruncate(fd, (*len) + (*overhang)) == 0, "ftruncate() failed");
+        ASSERT(ftruncate(fd, *len) == 0, "ftruncate() failed");
 
-    ASSERT(MAP_FAILED != (x = (uint8_t *) mmap(0, (*len) + (*overhang),
-            PROT_WRITE|PROT_READ, MAP_SHARED,
-            fd,  0/*file offset*/)), "mmap() failed");
+        x = Reserve((*len) + (*overhang), pagesize);
 
-    // Make a hole of size "overhang" in the mapping.  If we did not make
-    // the original mapping larger than we'd have no way to make the
-    // second mapping be next to the first mapping.
-    ASSERT(0 == munmap(x + (*len), *overhang));
+        ASSERT(MapRing(x, *len, *overhang, fd, 0), "mmap() failed");
 
-    // Fill the hole with the starting memory of the last mapping using
-    // the start of the file to make it be at the start.
-    //
-    // I'd guess that this next mapping could end up not next to the first
-    // mapping, but we'll have a failed assertion if it does not.
-    ASSERT(x + (*len) == (uint8_t *) mmap(x + (*len), *overhang,
-            PROT_WRITE|PROT_READ, MAP_SHARED,
-            fd,  0/*file offset*/),
-            "mmap() failed to return the address we wanted");
+        ASSERT(close(fd) == 0);
+    }
 
-    ASSERT(close(fd) == 0);
+    if(numaNode > -1)
+        Bind(x, *len, numaNode);
 
-    ASSERT(shm_unlink(tmp) == 0, "shm_unlink(\"%s\") failed", tmp);
+    DSPEW("Made ring buffer len=%zu overhang=%zu", *len, *overhang);
 
     return x;
 }
@@ -201,3 +390,108 @@ void freeRingBuffer(void *x, size_t len, size_t overhang)
     ASSERT(0 == munmap(x, len));
     ASSERT(0 == munmap((uint8_t *) x + len, overhang));
 }
+
+
+// Make a stream buffer from the length bytes at offset in the regular
+// file fd.  The buffer is len bytes, followed by overhang bytes, like a
+// ring buffer from makeRingBuffer(), but it does not wrap around; it's
+// the file data followed by zeros if len is larger than length.  The
+// file is mapped private, so writing to the buffer does not change the
+// file.
+//
+// Returns a pointer to the start of the file data, which is not at the
+// start of a page unless offset is.  *map and *mapLength are set to
+// what to pass to freeFileBuffer().
+//
+void *makeFileBuffer(int fd, off_t offset, size_t length,
+        size_t len, size_t overhang, void **map, size_t *mapLength)
+{
+    DASSERT(fd > -1);
+    DASSERT(length);
+    DASSERT(len >= length);
+    DASSERT(map);
+    DASSERT(mapLength);
+
+    if(!pagesize)
+        pagesize = getpagesize();
+
+    // mmap(2) needs a page aligned file offset.
+    size_t head = offset % pagesize;
+    size_t total = head + len + overhang;
+    bumpSize(&total, pagesize);
+
+    uint8_t *x;
+    ASSERT(MAP_FAILED != (x = mmap(0, total, PROT_READ|PROT_WRITE,
+            MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0)),
+            "mmap(0,%zu,,) failed", total);
+
+    // The file pages go over the start of the anonymous mapping.
+    ASSERT(MAP_FAILED != mmap(x, head + length, PROT_READ|PROT_WRITE,
+            MAP_PRIVATE|MAP_FIXED, fd, offset - head),
+            "mmap(%p,%zu,,,%d,%jd) failed", x, head + length, fd,
+            (intmax_t) (offset - head));
+
+    // The stream reads it from start to end, so the kernel can read
+    // ahead more and drop the pages behind.
+    madvise(x, head + length, MADV_SEQUENTIAL);
+
+    *map = x;
+    *mapLength = total;
+
+    DSPEW("Mapped %zu bytes of file fd=%d at offset %jd to a %zu byte "
+            "buffer", length, fd, (intmax_t) offset, len);
+
+    return x + head;
+}
+
+
+// Make a ring buffer from the length bytes at offset in the shared
+// memory file fd, that another process can map too.  See
+// qsMapOutputShared().  It's like makeRingBuffer() but the memory is
+// the file's, so the ring buffer is length bytes and the file keeps what
+// is written to it.  offset and length must be multiples of the page
+// size, and *overhang gets increased to the nearest page size and must
+// not be more than length.
+//
+// Returns a pointer to the start of the first mapping.  *map and
+// *mapLength are set to what to pass to freeFileBuffer().
+//
+void *makeSharedBuffer(int fd, off_t offset, size_t length,
+        size_t *overhang, void **map, size_t *mapLength)
+{
+    DASSERT(fd > -1);
+    DASSERT(overhang);
+    DASSERT(map);
+    DASSERT(mapLength);
+
+    if(!pagesize)
+        pagesize = getpagesize();
+
+    bumpSize(overhang, pagesize);
+    DASSERT(offset % pagesize == 0);
+    DASSERT(length % pagesize == 0);
+    DASSERT(*overhang <= length);
+
+    uint8_t *x = Reserve(length + *overhang, pagesize);
+
+    ASSERT(MapRing(x, length, *overhang, fd, offset),
+            "mmap(,%zu,,,%d,%jd) failed", length, fd, (intmax_t) offset);
+
+    *map = x;
+    *mapLength = length + *overhang;
+
+    DSPEW("Mapped %zu bytes of shared memory fd=%d at offset %jd to a "
+            "ring buffer with overhang=%zu", length, fd,
+            (intmax_t) offset, *overhang);
+
+    return x;
+}
+
+
+void freeFileBuffer(void *map, size_t mapLength)
+{
+    DASSERT(map);
+    DASSERT(mapLength);
+
+    ASSERT(0 == munmap(map, mapLength));
+}
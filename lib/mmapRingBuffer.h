@@ -1,7 +1,52 @@
 
+// How makeRingBuffer() gets the shared memory for the ring buffers.
+enum QsRingBufferMode {
+
+    QsRingBuffer_shm = 0,
+    QsRingBuffer_memfd,
+    QsRingBuffer_hugetlb
+};
+
+
+// Set from env QS_RING_BUFFER.
+extern
+enum QsRingBufferMode ringBufferMode;
+
+
+// Returns the mode with name like "memfd", or -1 if there is no such
+// mode.
+extern
+int RingBufferMode(const char *name);
+
+// Returns the name of the mode, like "memfd".
+extern
+const char *RingBufferModeName(enum QsRingBufferMode mode);
+
+
+// numaNode is -1 to not bind the memory to a NUMA node.
 extern
-void *makeRingBuffer(size_t *len, size_t *overhang);
+void *makeRingBuffer(size_t *len, size_t *overhang, int numaNode,
+        enum QsRingBufferMode mode);
 
 
 extern
 void freeRingBuffer(void *x, size_t len, size_t overhang);
+
+
+// A stream buffer that is a private mapping of a file.  See
+// qsMapOutputFile().
+extern
+void *makeFileBuffer(int fd, off_t offset, size_t length,
+        size_t len, size_t overhang, void **map, size_t *mapLength);
+
+
+// A ring buffer that is a shared mapping of a file that another process
+// may map too.  See qsMapOutputShared().  It's freed with
+// freeFileBuffer().
+extern
+void *makeSharedBuffer(int fd, off_t offset, size_t length,
+        size_t *overhang, void **map, size_t *mapLength);
+
+
+extern
+void freeFileBuffer(void *map, size_t mapLength);
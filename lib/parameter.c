@@ -22,62 +22,123 @@
 #include "parseBool.h"
 
 
-// We use this mutex for all setters before they are connected.
-// We do not need more than one mutex for this case.
+// The value in the group ring buffer for the write number count.  The
+// number of values in the ring buffer is a power of 2, so this works when
+// the counter wraps through 0.
 //
-// There is only a "master" thread (non-worker thread) that may set the
-// setter value when the setter is not connected to a parameter connection
-// group.
+static inline void *Slot(const struct QsGroup *g, uint32_t count) {
+
+    return g->values + (count & (g->numValues - 1))*g->size;
+}
+
+
+// The group ring buffer sequence number for a finished write of the value
+// with write number count.  While the value is being written the
+// sequence number is one less than that, an odd number.
 //
-static
-pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static inline uint32_t Seq(uint32_t count) {
 
-// We stop rapid writes to setters, and effectively serialize the writing
-// to setters from the non-worker thread (master-like thread).
+    return 2*count + 2;
+}
+
+
+// Write a value into the group ring buffer.  There is only one writer at
+// a time: the getter block in a worker thread, or the master thread
+// (non-worker thread) with the graph mutex lock when there is no
+// getter, or the master thread with the group thread pools halted.  So
+// the writer needs no lock.  The setters may be reading at the same
+// time, so we use the per value sequence numbers like a seqlock; see
+// ReadGroupValue().
 //
-// I can across a "bug" when setting one setter in two successive commands
-// with the command line quickstream program.  Most of the time only
-// one value was set and the other command was effectively skipped.
-// The conditional variable and two flags, busy and waiting effectively
-// serialize the setting of the setter and the reading of it by the
-// block (in the thread pool worker thread.
-static
-pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static inline void
+WriteGroupValue(struct QsGroup *g, const void *val) {
 
-static
-bool busy = false, waiting = false;
+    DASSERT(g->values);
+    DASSERT(g->seqs);
+
+    uint32_t count = atomic_load_explicit(&g->writeCount,
+            memory_order_relaxed);
+    uint32_t i = count & (g->numValues - 1);
 
+    atomic_store_explicit(g->seqs + i, Seq(count) - 1,
+            memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
 
+    memcpy(Slot(g, count), val, g->size);
+
+    atomic_store_explicit(g->seqs + i, Seq(count), memory_order_release);
+
+    // g->value is the next value that will be written, and a flag that
+    // says we have a value.  The setters do not use it.
+    __atomic_store_n(&g->value, Slot(g, count + 1), __ATOMIC_RELAXED);
+
+    // This must be sequentially consistent with the setter idle flags;
+    // see PushGroupValue() and Work().
+    atomic_store(&g->writeCount, count + 1);
+}
 
 
+// The setter read the values too slowly and the getter wrote over the
+// values that it did not read yet.  We skip to readCount.
+//
 static inline void
-CheckForOverRun(struct QsParameter *p, struct QsSetter *s,
-        struct QsGroup *g) {
+SkipValues(struct QsParameter *p, struct QsSetter *s,
+        struct QsGroup *g, uint32_t readCount) {
 
-    DASSERT(g->value);
+    WARN("block:parameter %s:%s queue over-run (queue length = %"
+            PRIu32 ") lost %" PRIu32 " values",
+            p->port.block->name, p->port.name,
+            g->numValues, readCount - s->readCount);
 
-    if(g->writeCount - s->readCount > g->numValues) {
+    s->readCount = readCount;
+}
 
-        // This setter read the values too slowly and the buffer
-        // over-ran the setter read pointer, p->value.
-        //
-        WARN("block:parameter %s:%s queue over-run (queue length = %"
-                PRIu32 ") lost %" PRIu32 " values",
-                p->port.block->name, p->port.name,
-                parameterQueueLength,
-                g->writeCount - s->readCount - g->numValues);
-
-        s->readCount = g->writeCount - g->numValues;
-        // go to the current group value that is next;
-        // which is the oldest value that was written in the ring buffer.
-        //
-        // When we read all the values in the ring buffer we will be back
-        // to this value pointer and the Counters will match.
-        p->value = g->value;
+
+// Copy the value with write number s->readCount from the group ring
+// buffer into val, without the group mutex lock.  The writer may be
+// writing at the same time.  We check the value sequence number before
+// and after we copy it, like a seqlock.  If the value was written over,
+// we lost values, so we skip ahead, like in an over-run, and try again.
+//
+static inline void
+ReadGroupValue(struct QsParameter *p, struct QsSetter *s,
+        struct QsGroup *g, void *val) {
+
+    for(;;) {
+
+        uint32_t writeCount = atomic_load_explicit(&g->writeCount,
+                memory_order_acquire);
+        DASSERT(writeCount != s->readCount);
+
+        if(writeCount - s->readCount > g->numValues)
+            // Go to the oldest value that was written in the ring
+            // buffer.
+            SkipValues(p, s, g, writeCount - g->numValues);
+
+        _Atomic uint32_t *seq = g->seqs + (s->readCount & (g->numValues - 1));
+        uint32_t seq1 = atomic_load_explicit(seq, memory_order_acquire);
+
+        if(seq1 == Seq(s->readCount)) {
+            memcpy(val, Slot(g, s->readCount), g->size);
+            atomic_thread_fence(memory_order_acquire);
+            if(atomic_load_explicit(seq, memory_order_relaxed) == seq1)
+                return;
+        }
+
+        // The writer is writing, or wrote, over this value.  The writer
+        // can only be writing the oldest value, so we skip it too.
+        writeCount = atomic_load_explicit(&g->writeCount,
+                memory_order_acquire);
+        uint32_t readCount = writeCount - g->numValues + 1;
+        if((int32_t) (readCount - s->readCount) <= 0)
+            readCount = s->readCount + 1;
+        SkipValues(p, s, g, readCount);
     }
 }
 
 
+// The setter will read the last value written, and only that, next.
+//
 static inline void
 SetSetterToLastGroupValue(struct QsSetter *s, struct QsGroup *g) {
 
@@ -94,20 +155,8 @@ SetSetterToLastGroupValue(struct QsSetter *s, struct QsGroup *g) {
     // not know how many values are present at this point.  But we know
     // there is at least one value, because g->value is set.
     //
-
-    // The group write pointer should not under-run or overrun the
-    // array (ring buffer):
-    DASSERT(g->value >= g->values);
-    DASSERT(g->value < g->values + g->numValues * g->size);
-
-    p->value = g->value - g->size;
-    s->readCount = g->writeCount - 1;
-
-    if(p->value < g->values)
-        // We indexed too far back, so wrap in the ring buffer forward the
-        // total length of the array.  p->value will point to the last
-        // element:
-        p->value += g->numValues * g->size;
+    s->readCount = atomic_load(&g->writeCount) - 1;
+    p->value = Slot(g, s->readCount);
 }
 
 
@@ -116,6 +165,11 @@ SetSetterToLastGroupValue(struct QsSetter *s, struct QsGroup *g) {
 //
 // Hence this is called by a thread pool worker thread.
 //
+// We get called with the group mutex lock, from the job lock, but we do
+// not need it to read the values.  We just need it when we decide to
+// stop, so that the job framework and PushGroupValue() see a consistent
+// setter job state.
+//
 static bool Work(struct QsJob *j) {
 
     struct QsSetter *s = ((void *)j) - offsetof(struct QsSetter, job);
@@ -124,51 +178,66 @@ static bool Work(struct QsJob *j) {
     struct QsGroup *g = p->group;
     DASSERT(g, "Parameter group not set");
 
-    DASSERT(g->writeCount != s->readCount);
-
-    CheckForOverRun(p, s, g);
-
-    if(!p->value)
-        // This is the first time this setter has a value to read.
-        SetSetterToLastGroupValue((void *) p, g);
-
-    // Copy the "parameter" value into stack memory.
-    uint8_t val[p->size];
-    memcpy(val, p->value, p->size);
-
-    // Setup the ring buffer read pointer and counter for next time.
-    ++s->readCount;
-    p->value += p->size;
-    if(p->value >= g->values + g->numValues*p->size)
-        // Loop the ring buffer read pointer back.
-        p->value -= g->numValues*p->size;
-
-
     qsJob_unlock(j); // Unlock the parameter group mutex.
 
-    struct QsWhichBlock stackSave;
-    SetBlockCallback((void *) j->jobsBlock,
-                CB_SET, &stackSave);
-
-    // Call the callback() passing a pointer to stack memory, so no mutex
-    // lock is needed when calling.  That's the whole point of this
-    // "control parameter" interface.
-    //
-    // We pass readCount and writeCount so that the user can detect an
-    // overrun.
-    //
-    s->callback(p, val, s->readCount, g->writeCount,
-            p->port.block->userData);
+    // We can get called with no new value, if we got queued after we
+    // read the last value; see PushGroupValue().
+    if(s->readCount != atomic_load_explicit(&g->writeCount,
+                memory_order_acquire)) {
+
+        if(!p->value)
+            // This is the first time this setter has a value to read.
+            SetSetterToLastGroupValue(s, g);
+        else if(s->latestOnly)
+            // Skip to the newest value.  It's not an over-run, so we do
+            // not spew.  The setter sees readCount jump ahead.
+            s->readCount = atomic_load_explicit(&g->writeCount,
+                    memory_order_acquire) - 1;
+
+        // Copy the "parameter" value into stack memory.
+        uint8_t val[p->size];
+        ReadGroupValue(p, s, g, val);
+
+        // Setup the ring buffer read counter for next time.
+        ++s->readCount;
+        p->value = Slot(g, s->readCount);
+
+        struct QsWhichBlock stackSave;
+        SetBlockCallback((void *) j->jobsBlock,
+                    CB_SET, &stackSave);
+
+        // Call the callback() passing a pointer to stack memory, so no
+        // mutex lock is needed when calling.  That's the whole point of
+        // this "control parameter" interface.
+        //
+        // We pass readCount and writeCount so that the user can detect
+        // an overrun.
+        //
+        s->callback(p, val, s->readCount, atomic_load_explicit(
+                    &g->writeCount, memory_order_acquire),
+                p->port.block->userData);
 
-    RestoreBlockCallback(&stackSave);
+        RestoreBlockCallback(&stackSave);
+    }
 
     qsJob_lock(j);
 
 
-    if(s->readCount != g->writeCount)
+    if(s->readCount != atomic_load(&g->writeCount))
         // keep calling.
         return true;
 
+    // We are going idle.  The writer sets writeCount and then takes the
+    // idle flag, and we set the idle flag and then look at writeCount;
+    // so either we see the new value here, or the writer sees that we
+    // are idle and queues this job again.
+    atomic_store(&s->idle, true);
+
+    if(s->readCount != atomic_load(&g->writeCount) &&
+            atomic_exchange(&s->idle, false))
+        // We got a new value, and the writer did not see us idle.
+        return true;
+
     return false;
 }
 
@@ -183,6 +252,7 @@ DestroyGroup(struct QsGroup *g, size_t size) {
 
     DZMEM(g->values, g->numValues*size);
     free(g->values);
+    free(g->seqs);
 
     DZMEM(g, sizeof(*g));
     free(g);
@@ -210,7 +280,7 @@ bool setterWork(struct QsJob *j) {
     uint8_t val[p->size];
     memcpy(val, p->value, p->size);
 
-    busy = true;
+    s->busy = true;
 
     qsJob_unlock(j);
 
@@ -225,10 +295,10 @@ bool setterWork(struct QsJob *j) {
 
     qsJob_lock(j);
 
-    busy = false;
+    s->busy = false;
 
-    if(waiting)
-        CHECK(pthread_cond_signal(&cond));
+    if(s->waiting)
+        CHECK(pthread_cond_signal(&s->cond));
 
     // Check if we got another value while calling s->callback().
     if(s->readCount != readCount)
@@ -253,7 +323,7 @@ DisconnectParameter(struct QsParameter *p, struct QsGroup *g) {
         struct QsJob *j = ((void *) p) + offsetof(struct QsSetter, job);
         qsJob_cleanup(j);
         qsJob_init(j, (void *) p->port.block, setterWork, 0, 0);
-        qsJob_addMutex(j, &mutex);
+        qsJob_addMutex(j, &p->mutex);
 
     } else {
         DASSERT(p->port.portType == QsPortType_getter);
@@ -267,9 +337,7 @@ DisconnectParameter(struct QsParameter *p, struct QsGroup *g) {
 
     if(g->value) {
         // Get the last value from the group ring buffer.
-        void *lastValue = g->value - p->size;
-        if(lastValue < g->values)
-            lastValue = g->values + (g->numValues - 1)*p->size;
+        void *lastValue = Slot(g, g->writeCount - 1);
         p->value = malloc(p->size);
         ASSERT(p->value, "malloc(%zu) failed", p->size);
         memcpy(p->value, lastValue, p->size);
@@ -324,8 +392,11 @@ DestroyParameter(struct QsParameter *p) {
     }
 
 
-    if(p->port.portType == QsPortType_setter)
+    if(p->port.portType == QsPortType_setter) {
         qsJob_cleanup(((void *) p) + offsetof(struct QsSetter, job));
+        CHECK(pthread_cond_destroy(&((struct QsSetter *) p)->cond));
+    }
+    CHECK(pthread_mutex_destroy(&p->mutex));
 
 
     DZMEM(p->port.name, strlen(p->port.name));
@@ -359,6 +430,7 @@ void *CreateParameter(size_t psize/* struct size */,
     ASSERT(p, "calloc(1,%zu) failed", psize);
     p->valueType = vtype;
     p->size = vsize;
+    CHECK(pthread_mutex_init(&p->mutex, 0));
 
     p->port.name = GetUniqueName(dict, 0, name, 0);
     ASSERT(p->port.name);
@@ -475,14 +547,35 @@ struct QsParameter *qsCreateSetter(const char *name, size_t size,
     s->parameter.port.portType = QsPortType_setter;
     s->callback = callback;
 
+    CHECK(pthread_cond_init(&s->cond, 0));
+
     qsJob_init(&s->job, (void *) b, setterWork, 0, 0);
-    qsJob_addMutex(&s->job, &mutex);
+    qsJob_addMutex(&s->job, &s->parameter.mutex);
 
 
     return (struct QsParameter *) s;
 }
 
 
+void qsSetterLatestOnly(struct QsParameter *setter, bool latestOnly) {
+
+    NotWorkerThread();
+
+    DASSERT(setter);
+    ASSERT(setter->port.portType == QsPortType_setter, "Not a setter");
+
+    struct QsSimpleBlock *b = GetBlock(CB_DECLARE|CB_CONFIG, 0,
+            QsBlockType_simple);
+    ASSERT((void *) b == (void *) setter->port.block,
+            "Setter \"%s\" is not from block \"%s\"",
+            setter->port.name, b->jobsBlock.block.name);
+
+    // The block's thread pool is halted in config callbacks, so the
+    // setter job is not running now.
+    ((struct QsSetter *) setter)->latestOnly = latestOnly;
+}
+
+
 struct QsParameter *qsCreateGetter(const char *name, size_t size,
         enum QsValueType vtype, const void *initValue) {
 
@@ -507,34 +600,66 @@ struct QsParameter *qsCreateGetter(const char *name, size_t size,
 }
 
 
+// Returns the setter that has the job j.
+//
+static inline struct QsSetter *GetSetter(struct QsJob *j) {
+
+    return ((void *) j) - offsetof(struct QsSetter, job);
+}
+
+
+// Queue a setter job that is in a group.  We need the group mutex lock or
+// the thread pool halted.
+//
+static inline void QueueSetter(struct QsSetter *s) {
+
+    atomic_store(&s->idle, false);
+    qsJob_queueJob(&s->job);
+}
+
+
+// Make a setter job be in the group g; not queued.
+//
+static inline void InitGroupSetter(struct QsSetter *s, struct QsGroup *g) {
+
+    qsJob_init(&s->job, (void *) s->parameter.port.block, Work, 0,
+            &g->sharedPeers);
+    qsJob_addMutex(&s->job, &g->mutex);
+    atomic_store(&s->idle, true);
+}
+
+
+// The getter (or master thread) writes a value to the group, and we
+// queue the setter jobs that are not already working on the values.
+//
+// We only need the group mutex to queue setter jobs that are idle.  At
+// high rates the setters are likely to be still reading, so the writer
+// does not get the mutex lock.
+//
 static inline void
 PushGroupValue(struct QsGroup *g, const void *val, size_t size) {
 
-    CHECK(pthread_mutex_lock(&g->mutex));
-
     DASSERT(g->values);
     DASSERT(g->sharedPeers);
     DASSERT(*g->sharedPeers);
     DASSERT(g->numValues);
-    DASSERT(g->value < g->values + g->numValues*size);
+    DASSERT(g->size == size);
 
-    if(!g->value) {
-        DASSERT(g->writeCount == 0);
-        g->value = g->values;
-    }
+    WriteGroupValue(g, val);
 
-    DASSERT(g->value >= g->values);
+    bool wake = false;
 
-    // * Write the value.
-    memcpy(g->value, val, size);
-    ++g->writeCount;
+    for(struct QsJob **j = g->sharedPeers; *j; ++j)
+        if(atomic_exchange(&GetSetter(*j)->idle, false))
+            wake = true;
+
+    if(!wake) return;
 
-    // * go to the next values[]
-    g->value += size;
-    if(g->value >= g->values + g->numValues*size)
-        // We are at the end; go to the first element.
-        g->value = g->values;
+    CHECK(pthread_mutex_lock(&g->mutex));
 
+    // qsJob_queueJob() will not queue setter jobs that are queued or
+    // busy already.  The setter jobs that are not queued or busy are the
+    // ones that were idle.
     for(struct QsJob **j = g->sharedPeers; *j; ++j)
         qsJob_queueJob(*j);
 
@@ -597,7 +722,9 @@ void qsGetterPush(struct QsParameter *getter, const void *val) {
 
     // In this case we are just storing the value for when and if this
     // getter gets connected to some setter parameters.
+    CHECK(pthread_mutex_lock(&getter->mutex));
     memcpy(getter->value, val, getter->size);
+    CHECK(pthread_mutex_unlock(&getter->mutex));
 }
 
 
@@ -801,7 +928,8 @@ void qsParameter_setValue(struct QsParameter *p, const void *val) {
     }
 
     // else: This is a setter with no connection yet
-    struct QsJob *j = (void *)p + offsetof(struct QsSetter, job);
+    struct QsSetter *s = (void *) p;
+    struct QsJob *j = &s->job;
 
     if(!p->value) {
 
@@ -811,20 +939,20 @@ void qsParameter_setValue(struct QsParameter *p, const void *val) {
     } else
         qsJob_lock(j);
 
-    waiting = true;
+    s->waiting = true;
 
     // This is a little tricky.
     //
-    if(busy || j->busy ||
+    if(s->busy || j->busy ||
             (j->inQueue && !(j->jobsBlock->threadPool->halt))) {
         // There is a thread pool worker thread for a block reading the
         // setter in setterWork() or there will be; otherwise the user is
         // a dumb-ass with a halted thread pool and is effectively setting
         // the setter to two values at once (or too quickly) and in the
         // that case not getting both values may be fine.
-        CHECK(pthread_cond_wait(&cond, &mutex));
-        waiting = false;
+        CHECK(pthread_cond_wait(&s->cond, &p->mutex));
     }
+    s->waiting = false;
 
     // Save the value.
     memcpy(p->value, val, p->size);
@@ -834,7 +962,7 @@ void qsParameter_setValue(struct QsParameter *p, const void *val) {
     // We use the setter readCount to show that we have a new value, for
     // in the case if the block was in the setter callback() while we are
     // here.
-    ++((struct QsSetter *)p)->readCount;
+    ++s->readCount;
 
     qsJob_unlock(j);
 
@@ -881,30 +1009,65 @@ bool qsParameter_isGetterGroup(struct QsParameter *p) {
 }
 
 
+// Copy the last value written to the group into val, without the group
+// mutex lock; like in ReadGroupValue().  Returns false if there are no
+// values yet.
+//
+static inline bool
+ReadLastGroupValue(const struct QsGroup *g, void *val) {
+
+    if(!__atomic_load_n(&g->value, __ATOMIC_RELAXED))
+        return false;
+
+    for(;;) {
+
+        uint32_t count = atomic_load_explicit(&g->writeCount,
+                memory_order_acquire) - 1;
+        _Atomic uint32_t *seq = g->seqs + (count & (g->numValues - 1));
+        uint32_t seq1 = atomic_load_explicit(seq, memory_order_acquire);
+
+        if(seq1 == Seq(count)) {
+            memcpy(val, Slot(g, count), g->size);
+            atomic_thread_fence(memory_order_acquire);
+            if(atomic_load_explicit(seq, memory_order_relaxed) == seq1)
+                return true;
+        }
+        // The writer wrote another value.  Get that one.
+    }
+}
+
+
 size_t qsParameter_getValue(const struct QsParameter *p,
         void *val, size_t size) {
 
-    if(p->group)
-        CHECK(pthread_mutex_lock(&p->group->mutex));
-    else
-        CHECK(pthread_mutex_lock(&mutex));
+    if(p->size < size)
+        size = p->size;
+
+    if(p->group) {
+        // We get the last value written to the group.
+        uint8_t value[p->size];
+        if(!ReadLastGroupValue(p->group, value))
+            return 0;
+        memcpy(val, value, size);
+        return size;
+    }
+
+    // The parameter mutex is not part of the parameter's value, so we
+    // can lock it with p being const.
+    pthread_mutex_t *mutex = (pthread_mutex_t *) &p->mutex;
+
+    CHECK(pthread_mutex_lock(mutex));
 
     if(!p->value) {
         size = 0;
         goto finish;
     }
 
-    if(p->size < size)
-        size = p->size;
-
     memcpy(val, p->value, size);
 
 finish:
 
-    if(p->group)
-        CHECK(pthread_mutex_unlock(&p->group->mutex));
-    else
-        CHECK(pthread_mutex_unlock(&mutex));
+    CHECK(pthread_mutex_unlock(mutex));
 
     return size;
 }
@@ -999,23 +1162,22 @@ SetGroupValue(struct QsGroup *g, void *value) {
     DASSERT(g);
     DASSERT(g->size);
 
-    // Did we have a value yet?
-    if(!g->value) {
-        DASSERT(g->writeCount == 0);
-        // This is where the first value will go:
-        g->value = g->values;
-    }
+    WriteGroupValue(g, value);
+}
 
-    DASSERT(g->value < g->values + g->numValues*g->size);
-    DASSERT(g->value >= g->values);
 
-    memcpy(g->value, value, g->size);
-    g->value += g->size;
-    ++g->writeCount;
+// The getter writes to the group without a lock, so we halt its' thread
+// pool when we change the group setter jobs list that it reads.  Returns
+// the number of thread pool halts, like qsBlock_threadPoolHaltLock().
+//
+static inline
+uint32_t HaltGroupGetter(struct QsGroup *g) {
+
+    if(!g->getter)
+        return 0;
 
-    if(g->value >= g->values + g->numValues*g->size)
-        // Wrap back to the first element in the buffer.
-        g->value = g->values;
+    return qsBlock_threadPoolHaltLock(
+            (void *) g->getter->parameter.port.block);
 }
 
 
@@ -1043,6 +1205,7 @@ uint32_t MergeGroups(struct QsGroup *g1, struct QsGroup *g2) {
         numHalts += qsBlock_threadPoolHaltLock((*j)->jobsBlock);
     for(struct QsJob **j = g2->sharedPeers; *j; ++j)
         numHalts += qsBlock_threadPoolHaltLock((*j)->jobsBlock);
+    numHalts += HaltGroupGetter(g1);
 
 
     // Reinitialize the all the jobs in group g2, and make they be in
@@ -1050,7 +1213,6 @@ uint32_t MergeGroups(struct QsGroup *g1, struct QsGroup *g2) {
     //
     while(g2->sharedPeers) {
         struct QsJob *j = *g2->sharedPeers;
-        struct QsJobsBlock *b = j->jobsBlock;
         // This will remove the job, j, from the array of jobs in group g2.
         //
         // When the last job, j, in the sharedPeers list is cleaned up
@@ -1059,22 +1221,21 @@ uint32_t MergeGroups(struct QsGroup *g1, struct QsGroup *g2) {
         qsJob_cleanup(j);
         // This will add the job, j, to the other array of jobs in the
         // group g1.
-        qsJob_init(j, b, Work, 0, &g1->sharedPeers);
-        qsJob_addMutex(j, &g1->mutex);
+        struct QsSetter *s = GetSetter(j);
+        InitGroupSetter(s, g1);
         ++g1->numParameters;
 
-        struct QsSetter *s = ((void *) j) -
-            offsetof(struct QsSetter, job);
         // We need to mark this setter as having a value that
         // needs updating if there are values yet.
         s->parameter.value = 0;
         s->parameter.group = g1;
 
-        if(g1->value)
+        if(g1->value) {
             SetSetterToLastGroupValue((void *) s, g1);
-
-        // The thread pools are halted so we should not need a lock.
-        qsJob_queueJob(j);
+            // The thread pools are halted so we should not need a lock.
+            QueueSetter(s);
+        } else
+            s->readCount = g1->writeCount;
     }
 
     // So now every job in the group is a peer to all jobs in this
@@ -1104,6 +1265,7 @@ uint32_t AddParameterToGroup(struct QsGroup *g, struct QsParameter *p) {
     for(struct QsJob **jj = g->sharedPeers; *jj; ++jj)
         numHalts += qsBlock_threadPoolHaltLock((*jj)->jobsBlock);
     numHalts += qsBlock_threadPoolHaltLock((void *) p->port.block);
+    numHalts += HaltGroupGetter(g);
 
 
     struct QsJob *j = 0;
@@ -1129,8 +1291,7 @@ uint32_t AddParameterToGroup(struct QsGroup *g, struct QsParameter *p) {
         // We will reinitialize this:
         s->readCount = 0;
 
-        qsJob_init(j, (void *) p->port.block, Work, 0, &g->sharedPeers);
-        qsJob_addMutex(j, &g->mutex);
+        InitGroupSetter(s, g);
 
         if(g->value) {
             //
@@ -1152,7 +1313,7 @@ uint32_t AddParameterToGroup(struct QsGroup *g, struct QsParameter *p) {
             SetSetterToLastGroupValue((void *) p, g);
 
             qsJob_lock(j);
-            qsJob_queueJob(j);
+            QueueSetter(s);
             qsJob_unlock(j);
         }
 
@@ -1216,11 +1377,21 @@ uint32_t MakeNewGroup(struct QsParameter *p1, struct QsParameter *p2) {
     p1->group = g;
     p2->group = g;
 
-    g->values = calloc(parameterQueueLength, g->size);
+    // We use a power of 2 number of values, so that the ring buffer
+    // index from the write count works when the count wraps through 0.
+    // See Slot().  We need at least 2, so that a setter can read a value
+    // while the writer writes another; see ReadGroupValue().
+    g->numValues = 2;
+    while(g->numValues < parameterQueueLength)
+        g->numValues <<= 1;
+
+    g->values = calloc(g->numValues, g->size);
     ASSERT(g->values, "calloc(%" PRIu32 ",%zu) failed",
-            parameterQueueLength, g->size);
+            g->numValues, g->size);
     // g->value = 0; // via calloc().
-    g->numValues = parameterQueueLength;
+    g->seqs = calloc(g->numValues, sizeof(*g->seqs));
+    ASSERT(g->seqs, "calloc(%" PRIu32 ",%zu) failed",
+            g->numValues, sizeof(*g->seqs));
 
     // TODO: Okay so we have-to address the problem of which parameter
     // values has priority, or should we discard one of the parameter
@@ -1246,12 +1417,9 @@ uint32_t MakeNewGroup(struct QsParameter *p1, struct QsParameter *p2) {
     }
 
 
-    if(j1) {
-        qsJob_init(j1, (void *) p1->port.block, Work, 0, &g->sharedPeers);
-        qsJob_addMutex(j1, &g->mutex);
-    }
-    qsJob_init(j2, (void *) p2->port.block, Work, 0, &g->sharedPeers);
-    qsJob_addMutex(j2, &g->mutex);
+    if(j1)
+        InitGroupSetter(GetSetter(j1), g);
+    InitGroupSetter(GetSetter(j2), g);
 
     g->numParameters = 2;
 
@@ -1265,12 +1433,12 @@ uint32_t MakeNewGroup(struct QsParameter *p1, struct QsParameter *p2) {
         if(j1) {
             // This p1 is a setter.
             SetSetterToLastGroupValue((void *) p1, g);
-            qsJob_queueJob(j1);
+            QueueSetter((void *) p1);
         }
 
         // This p2 is a setter.
         SetSetterToLastGroupValue((void *) p2, g);
-        qsJob_queueJob(j2);
+        QueueSetter((void *) p2);
     }
 
     return numHalts;
@@ -1378,6 +1546,7 @@ int qsParameter_disconnect(struct QsParameter *p) {
     }
 
     numHalts += qsBlock_threadPoolHaltLock((void *) p->port.block);
+    numHalts += HaltGroupGetter(p->group);
 
     DisconnectParameter(p, p->group);
 
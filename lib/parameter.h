@@ -15,6 +15,16 @@ struct QsParameter {
 
     struct QsGroup *group;
 
+    // Multi-threaded access control mutex for when this parameter is not
+    // connected; that is when group is 0.  When the parameter is in a
+    // group we use the group mutex.
+    //
+    // Every parameter has its' own, so that setting parameters in one
+    // block (or graph) does not contend with setting parameters in
+    // another.  It's like a group of one.
+    //
+    pthread_mutex_t mutex;
+
     enum QsValueType valueType;
 
     size_t size;
@@ -54,6 +64,30 @@ struct QsSetter {
     // make the above job useless.
     int (*callback)(const struct QsParameter *p, const void *value,
             uint32_t readCount, uint32_t writeCount, void *userData);
+
+    // For when this setter is not connected.  We stop rapid writes to
+    // the setter, and effectively serialize the writing to the setter
+    // from the non-worker thread (master-like thread) with the reading
+    // of it by the block in the thread pool worker thread, in
+    // setterWork().  See qsParameter_setValue().
+    //
+    // Protected by the parameter mutex, parameter.mutex.
+    //
+    pthread_cond_t cond;
+    bool busy, waiting;
+
+    // Set with qsSetterLatestOnly().  When set the setter job skips to the
+    // newest value in the group, and does not call the callback for the
+    // older values.
+    bool latestOnly;
+
+    // For when this setter is in a group.  Set when the setter job read
+    // all the group values and stopped, so that the group writer knows
+    // that it needs to queue the setter job.  The writer takes it back
+    // with atomic_exchange() so that only one of them queues the job.
+    // See PushGroupValue() and Work() in parameter.c.
+    //
+    atomic_bool idle;
 };
 
 
@@ -98,13 +132,18 @@ struct QsGroup {
     // It's the difference in counter values that matter and not absolute
     // values.
     //
-    uint32_t writeCount;
+    // Only the one writer changes it, after it writes the value, and the
+    // setters read it without the group mutex lock.
+    //
+    _Atomic uint32_t writeCount;
 
     // The number of values stored in the ring buffer before it wraps back
     // over itself.  Is the array size of values[] below.
     //
     // Not to confused with the stream ring buffer.
     //
+    // It's a power of 2.  parameterQueueLength rounded up.
+    //
     uint32_t numValues;
 
     // Points to the next value that will be written in the ring
@@ -132,6 +171,14 @@ struct QsGroup {
     //
     void *values;
 
+    // A sequence number for each value in values[].  The writer makes it
+    // odd while it writes the value and then sets it from the write
+    // count, so that the setters can read the values without a lock and
+    // see if the value changed while they read it, like in a seqlock.
+    // See WriteGroupValue() and ReadGroupValue() in parameter.c.
+    //
+    _Atomic uint32_t *seqs;
+
     // The number of parameters in the group including the getter if there
     // is one.
     uint32_t numParameters;
@@ -18,7 +18,7 @@
 #include "job.h"
 #include "port.h"
 #include "FindFullPath.h"
-#include "LoadDSOFromTmpFile.h"
+#include "LoadDSOCopy.h"
 #include "stream.h"
 #include "dir.h"
 
@@ -164,8 +164,8 @@ int GraphFindHandle_cb(const char *graphName, struct QsGraph *g,
 
 
 // This will load a copy if this DSO if it is already loaded;
-// unless loadCopy is false or disableDSOLoadCopy is set in
-// the DSO "options".
+// unless loadCopy is false, disableDSOLoadCopy is set in
+// the DSO "options", or the DSO defines qsBlockIsReentrant true.
 //
 // We must have a graph mutex to call this.
 static
@@ -198,6 +198,14 @@ void *GetDLHandle(const char *path, bool loadCopy) {
         return dlhandle;
     }
 
+    const bool *reentrant = dlsym(dlhandle, "qsBlockIsReentrant");
+    if(reentrant && *reentrant)
+        // This block keeps all its state in the userData that it sets
+        // with qsSetUserData(), so all the blocks that have the same DSO
+        // file can share this one loaded DSO.  That saves copying the
+        // DSO file and loading its code and relocations for each block.
+        return dlhandle;
+
 
     ///////////////////////////////////////////////////////////////////
     // check if already dlopen()ed and fix if we need to.
@@ -224,21 +232,12 @@ void *GetDLHandle(const char *path, bool loadCopy) {
 
     if(dlhandle == 0) {
 
-        // We make a temporary copy of the DSO and load it as a different
-        // set of independent functions that do not share functions (any
-        // symbols) with a block that is already loaded.  The temporary
-        // file is automatically removed by the OS when this program
-        // exits.  This is a really cool trick.  Using dlmopen() will only
-        // let us load 16 copies of a DSO; where this loading a copy has
-        // no such coded limit.
-        //
-        // Ya, 16 is likely enough, but we figured out this solution
-        // before we found dlmopen().
-        //
-        // man dlmopen shows:
-        // The glibc implementation supports a maximum of 16 namespaces.
+        // We make a copy of the DSO and load it as a different set of
+        // independent functions that do not share functions (any
+        // symbols) with a block that is already loaded.  See
+        // LoadDSOCopy.c for why we do not use dlmopen().
         //
-        dlhandle = LoadDSOFromTmpFile(path);
+        dlhandle = LoadDSOCopy(path);
     }
 
     return dlhandle;
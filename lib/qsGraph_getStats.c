@@ -0,0 +1,178 @@
+#include <string.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "../include/quickstream.h"
+
+#include "debug.h"
+#include "Dictionary.h"
+
+#include "c-rbtree.h"
+#include "name.h"
+#include "threadPool.h"
+#include "block.h"
+#include "graph.h"
+#include "job.h"
+#include "port.h"
+#include "stream.h"
+
+
+
+// Returns the stream job of a simple block that ran, or can run, in the
+// stream; else 0.
+//
+static inline struct QsStreamJob *
+GetRunStreamJob(struct QsBlock *b) {
+
+    if(b->type != QsBlockType_simple)
+        return 0;
+
+    struct QsStreamJob *j = ((struct QsSimpleBlock *) b)->streamJob;
+
+    if(!j || !(j->numInputs || j->numOutputs))
+        return 0;
+
+    return j;
+}
+
+
+// This function is recursive.  It counts the stream blocks and outputs.
+//
+static void
+Count(struct QsBlock *b, struct QsGraphStats *s) {
+
+    struct QsStreamJob *j = GetRunStreamJob(b);
+
+    if(j) {
+        ++s->numBlocks;
+        s->numOutputs += j->numOutputs;
+    } else if(b->type & QS_TYPE_PARENT)
+        for(struct QsBlock *child = ((struct QsParentBlock *) b)->firstChild;
+                child; child = child->nextSibling)
+            Count(child, s);
+}
+
+
+static inline char *Strdup(const char *str) {
+
+    char *ret = strdup(str);
+    ASSERT(ret, "strdup() failed");
+    return ret;
+}
+
+
+// This function is recursive.  It fills in the stats arrays, in the same
+// order as Count().
+//
+static void
+Fill(struct QsBlock *b, struct QsGraphStats *s,
+        uint32_t *blockI, uint32_t *outputI) {
+
+    struct QsStreamJob *j = GetRunStreamJob(b);
+
+    if(!j) {
+        if(b->type & QS_TYPE_PARENT)
+            for(struct QsBlock *child =
+                    ((struct QsParentBlock *) b)->firstChild;
+                    child; child = child->nextSibling)
+                Fill(child, s, blockI, outputI);
+        return;
+    }
+
+    DASSERT(*blockI < s->numBlocks);
+    DASSERT(*outputI + j->numOutputs <= s->numOutputs);
+
+    struct QsBlockStats *bs = s->blocks + (*blockI)++;
+
+    // The worker thread that runs the stream job changes the stats with
+    // the stream job lock.
+    qsJob_lock((void *) j);
+
+    bs->name = Strdup(b->name);
+    bs->calls = j->calls;
+    bs->stalls = j->stalls;
+    bs->busyNanoseconds = j->busyNs;
+    bs->waitNanoseconds = j->waitNs;
+
+    for(uint32_t i = 0; i < j->numInputs; ++i)
+        bs->bytesIn += atomic_load_explicit(&j->inputs[i].readCount,
+                memory_order_relaxed);
+
+    for(uint32_t i = 0; i < j->numOutputs; ++i) {
+        struct QsOutput *out = j->outputs + i;
+        struct QsOutputStats *os = s->outputs + (*outputI)++;
+        os->name = Strdup(b->name);
+        os->port = i;
+        os->numReaders = out->numInputs;
+        os->bytes = atomic_load_explicit(&out->writeCount,
+                memory_order_relaxed);
+        os->highWater = out->highWater;
+        os->bufferLength = out->bufferLength;
+        os->clogs = out->clogs;
+        bs->bytesOut += os->bytes;
+    }
+
+    qsJob_unlock((void *) j);
+}
+
+
+struct QsGraphStats *qsGraph_getStats(struct QsGraph *g) {
+
+    NotWorkerThread();
+    DASSERT(g);
+
+    struct QsGraphStats *s = calloc(1, sizeof(*s));
+    ASSERT(s, "calloc(1,%zu) failed", sizeof(*s));
+
+    // g->mutex is a recursive mutex.
+    CHECK(pthread_mutex_lock(&g->mutex));
+
+    s->running = g->runningStreams;
+
+    if(g->streamStartTime) {
+        uint64_t end = g->runningStreams?GetNanoseconds():g->streamStopTime;
+        s->seconds = (end - g->streamStartTime)/1.0e9;
+    }
+
+    Count((void *) g, s);
+
+    if(s->numBlocks) {
+        s->blocks = calloc(s->numBlocks, sizeof(*s->blocks));
+        ASSERT(s->blocks, "calloc(%" PRIu32 ",%zu) failed",
+                s->numBlocks, sizeof(*s->blocks));
+    }
+    if(s->numOutputs) {
+        s->outputs = calloc(s->numOutputs, sizeof(*s->outputs));
+        ASSERT(s->outputs, "calloc(%" PRIu32 ",%zu) failed",
+                s->numOutputs, sizeof(*s->outputs));
+    }
+
+    uint32_t blockI = 0, outputI = 0;
+    Fill((void *) g, s, &blockI, &outputI);
+    DASSERT(blockI == s->numBlocks);
+    DASSERT(outputI == s->numOutputs);
+
+    CHECK(pthread_mutex_unlock(&g->mutex));
+
+    return s;
+}
+
+
+void qsGraphStats_destroy(struct QsGraphStats *s) {
+
+    DASSERT(s);
+
+    for(uint32_t i = 0; i < s->numBlocks; ++i)
+        free(s->blocks[i].name);
+    for(uint32_t i = 0; i < s->numOutputs; ++i)
+        free(s->outputs[i].name);
+
+    free(s->blocks);
+    free(s->outputs);
+    DZMEM(s, sizeof(*s));
+    free(s);
+}
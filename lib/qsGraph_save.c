@@ -23,6 +23,7 @@
 #include "parameter.h"
 #include "stream.h"
 #include "config.h"
+#include "mmapRingBuffer.h"
 
 #include "graphConnect.h"
 
@@ -60,6 +61,38 @@ PrintThreadPoolAssignments(const struct QsParentBlock *p, FILE *f) {
 }
 
 
+// Print the CPU affinity, scheduling policy, and ring buffer memory
+// settings of the thread pools that have them set.
+//
+static void
+PrintThreadPoolSettings(const struct QsGraph *g, FILE *f) {
+
+    for(struct QsThreadPool *tp = g->threadPoolStack; tp; tp = tp->next) {
+        DASSERT(tp->name);
+        if(tp->cpus)
+            fprintf(f,
+"threads-affinity %s %s\n"
+                , tp->name, tp->cpus);
+        if(tp->schedPolicy || tp->schedPriority) {
+            DASSERT(SchedPolicyName(tp->schedPolicy));
+            fprintf(f,
+"threads-sched %s %s %d\n"
+                , tp->name, SchedPolicyName(tp->schedPolicy),
+                tp->schedPriority);
+        }
+        if(tp->numaNode > -1 || tp->ringBufferMode > -1) {
+            char node[16] = "auto";
+            if(tp->numaNode > -1)
+                snprintf(node, sizeof(node), "%d", tp->numaNode);
+            fprintf(f,
+"threads-memory %s %s %s\n"
+                , tp->name, node, (tp->ringBufferMode > -1)?
+                RingBufferModeName(tp->ringBufferMode):"default");
+        }
+    }
+}
+
+
 static inline
 int _qsGraph_save(const struct QsGraph *g,
         const char *path, const char *gpath_in,
@@ -141,6 +174,8 @@ int _qsGraph_save(const struct QsGraph *g,
         , tp->maxThreads, tp->name);
     }
 
+    PrintThreadPoolSettings(g, f);
+
     fprintf(f,
 "############################################\n"
 "# Assign Blocks to Thread Pools\n"
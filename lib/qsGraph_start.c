@@ -5,6 +5,7 @@
 #include <inttypes.h>
 #include <pthread.h>
 #include <stdatomic.h>
+#include <unistd.h>
 
 #include "../include/quickstream.h"
 
@@ -20,6 +21,7 @@
 #include "port.h"
 #include "FindFullPath.h"
 #include "stream.h"
+#include "epoll.h"
 #include "mmapRingBuffer.h"
 
 
@@ -82,7 +84,8 @@ uint32_t HaltStreamBlocks(struct QsBlock *b) {
 }
 
 
-// Return true if there is a missing connection that is required.
+// Return true if there is a missing connection that is required, or a
+// connection between stream ports of different types.
 //
 // Also calculate j->numOutputs and j->numInputs if saveNums is set.
 //
@@ -96,14 +99,8 @@ bool CheckForStreamGap(struct QsStreamJob *j, bool saveNums) {
     j->numOutputs = 0;
 
 
-    // The stream for this graph should not be setup yet.
-    DASSERT(!j->inputBuffers);
-    DASSERT(!j->inputLens);
-    DASSERT(!j->advanceInputs);
-
-    DASSERT(!j->outputBuffers);
-    DASSERT(!j->outputLens);
-    DASSERT(!j->advanceOutputs);
+    // The flow() argument arrays may be left from the last stream run,
+    // but they are not in use.
 
 
     // Count outputs that are connected and check for gaps in output
@@ -166,13 +163,21 @@ bool CheckForStreamGap(struct QsStreamJob *j, bool saveNums) {
     if(saveNums)
         j->numInputs = num;
 
+    // The blocks may have changed their stream types since the ports
+    // were connected.
+    for(i = 0; i < num; ++i)
+        if(CheckStreamTypes(j->inputs + i, j->inputs[i].output))
+            goto fail;
+
 
     return false; // false is success.
 
 fail:
 
-    if(saveNums)
+    if(saveNums) {
         j->numOutputs = 0;
+        j->numInputs = 0;
+    }
 
     return true; // true is failure.
 }
@@ -287,6 +292,142 @@ CreateBlockPassThroughs(struct QsBlock *b) {
 }
 
 
+// Returns len rounded up to a multiple of size.
+//
+static inline size_t
+RoundUp(size_t len, size_t size) {
+
+    DASSERT(size);
+
+    if(size == 1)
+        return len;
+
+    return ((len + size - 1)/size)*size;
+}
+
+
+// Returns true if the output, out, is in a pass-through buffer, before
+// the pass-through links are made in CreateBlockPassThroughs().
+//
+static inline bool
+IsPassThrough(const struct QsOutput *out) {
+
+    for(uint32_t i = 0; i < out->numInputs; ++i) {
+        const struct QsInput *in = out->inputs[i];
+        if(in->passThrough && in->passThrough->numInputs)
+            // out feeds a pass-through.
+            return true;
+    }
+
+    const struct QsStreamJob *j =
+        ((struct QsSimpleBlock *) out->port.block)->streamJob;
+    DASSERT(j);
+    for(uint32_t i = 0; i < j->numInputs; ++i)
+        if(j->inputs[i].passThrough == out && j->inputs[i].output)
+            // out is fed by a pass-through.
+            return true;
+
+    return false;
+}
+
+
+// Move a qsMapInputShared() file to the output that feeds the input, and
+// check that the ring buffer of an output from qsMapOutputShared() or
+// qsMapInputShared() can be in the shared memory.  The lengths are
+// gotten like in CreateOutputRingBuffer().  Returns true on error.
+//
+static inline bool
+CheckSharedOutput(struct QsOutput *out) {
+
+    DASSERT(out->inputs);
+    const char *bname = out->port.block->name;
+
+    for(uint32_t i = 0; i < out->numInputs; ++i) {
+        struct QsInput *in = out->inputs[i];
+        if(in->fileFd < 0)
+            continue;
+        if(out->fileFd > -1) {
+            ERROR("Block \"%s\" output %" PRIu32 " is mapped to a "
+                    "file already", bname, out->portNum);
+            return true;
+        }
+        out->fileFd = in->fileFd;
+        out->fileOffset = in->fileOffset;
+        out->fileLength = in->fileLength;
+        out->fileShared = true;
+        in->fileFd = -1;
+    }
+
+    if(out->fileFd < 0 || !out->fileShared)
+        return false;
+
+    // The blocks that write and read the buffer need to know.
+    ((struct QsSimpleBlock *) out->port.block)->streamJob->sharedBuffer =
+        true;
+    for(uint32_t i = 0; i < out->numInputs; ++i)
+        ((struct QsSimpleBlock *) out->inputs[i]->port.block)->
+            streamJob->sharedBuffer = true;
+
+    if(IsPassThrough(out)) {
+        ERROR("Block \"%s\" output %" PRIu32 " is in a pass-through"
+                " buffer and cannot be in shared memory",
+                bname, out->portNum);
+        return true;
+    }
+
+    size_t maxWrite = RoundUp(out->nextMaxWrite, out->nextElementSize);
+    size_t maxMaxRead = 0;
+    for(uint32_t i = 0; i < out->numInputs; ++i) {
+        struct QsInput *in = out->inputs[i];
+        if(in->nextLossy) {
+            ERROR("Block \"%s\" input %" PRIu32 " is lossy and cannot "
+                    "read shared memory", in->port.block->name,
+                    in->portNum);
+            return true;
+        }
+        size_t maxRead = RoundUp(in->nextMaxRead, in->nextElementSize);
+        if(maxMaxRead < maxRead)
+            maxMaxRead = maxRead;
+    }
+
+    size_t overhangLen = (maxWrite > maxMaxRead)?maxWrite:maxMaxRead;
+
+    if(maxWrite + maxMaxRead >= out->fileLength ||
+            RoundUp(overhangLen, getpagesize()) > out->fileLength) {
+        ERROR("Block \"%s\" output %" PRIu32 " ring buffer needs more"
+                " than the %zu bytes of shared memory",
+                bname, out->portNum, out->fileLength);
+        return true;
+    }
+
+    return false;
+}
+
+
+static bool
+CheckSharedBuffers(struct QsBlock *b) {
+
+    bool ret = false;
+
+    if(b->type == QsBlockType_simple) {
+        struct QsSimpleBlock *sb = (void *) b;
+        if(sb->streamJob) {
+            struct QsStreamJob *sj = sb->streamJob;
+            for(uint32_t i = 0; i < sj->numOutputs; ++i)
+                if(CheckSharedOutput(sj->outputs + i))
+                    ret = true;
+        }
+    } else if(b->type & QS_TYPE_PARENT) {
+        struct QsParentBlock *p = (void *) b;
+        for(b = p->firstChild; b; b = b->nextSibling)
+            if(CheckSharedBuffers(b))
+                ret = true;
+    }
+
+    return ret;
+}
+
+
 static inline
 void CreateOutputRingBuffer(struct QsOutput *out) {
 
@@ -294,7 +435,8 @@ void CreateOutputRingBuffer(struct QsOutput *out) {
 
     if(!out->inputs) {
         DASSERT(!out->numInputs);
-        // Not connected.
+        // Not connected.  A qsMapOutputFile() is just for this start.
+        out->fileFd = -1;
         return;
     }
     DASSERT(out->numInputs);
@@ -326,25 +468,49 @@ void CreateOutputRingBuffer(struct QsOutput *out) {
 
     size_t len = 0;
     size_t overhangLen = 0;
+    // The largest maxRead of the lossy inputs, if there are any.
+    size_t lossyMaxRead = 0;
 
     while(out) {
         DASSERT(out->nextMaxWrite);
         DASSERT(out->maxWrite);
-        if(out->maxWrite != out->nextMaxWrite)
-            // The block changed this setting before this stream start
-            // (before now).
-            out->maxWrite = out->nextMaxWrite;
+        // The block may have changed these settings before this stream
+        // start (before now).  The maximum read and write lengths must
+        // be a multiple of the element size.  See qsSetInputType().
+        out->elementSize = out->nextElementSize;
+        out->maxWrite = RoundUp(out->nextMaxWrite, out->elementSize);
         out->maxMaxRead = 0;
-        for(uint32_t i = out->numInputs - 1; i != -i; --i) {
+        for(uint32_t i = out->numInputs - 1; i != -1; --i) {
             struct QsInput *in = *(out->inputs + i);
             DASSERT(in->maxRead);
             DASSERT(in->nextMaxRead);
-            if(in->maxRead != in->nextMaxRead)
-                in->maxRead = in->nextMaxRead;
+            in->elementSize = in->nextElementSize;
+            in->maxRead = RoundUp(in->nextMaxRead, in->elementSize);
+            in->threshold = in->nextThreshold;
+            // Lossy skips must keep the read pointer on an element.
+            in->lossy = RoundUp(in->nextLossy, in->elementSize);
+            in->dropped = 0;
+            if(in->lossy && o->next) {
+                // A lossy reader could see data that a pass-through
+                // block changed, or it could be the pass-through block.
+                // We do not do that.
+                WARN("Block \"%s\" input %" PRIu32 " is in a "
+                        "pass-through buffer and cannot be lossy",
+                        in->port.block->name, in->portNum);
+                in->lossy = 0;
+            }
+            if(in->lossy && lossyMaxRead < in->maxRead)
+                lossyMaxRead = in->maxRead;
 
             if(out->maxMaxRead < in->maxRead )
                out->maxMaxRead = in->maxRead;
         }
+        if(out != o && out->fileFd > -1) {
+            WARN("Block \"%s\" output %" PRIu32 " is in a pass-through"
+                    " buffer and cannot be mapped to a file",
+                    out->port.block->name, out->portNum);
+            out->fileFd = -1;
+        }
         len += out->maxMaxRead + out->maxWrite;
         // The overhang length is the largest read or write possible
         // to the ring buffer.
@@ -357,21 +523,97 @@ void CreateOutputRingBuffer(struct QsOutput *out) {
         // For a non-pass-through buffer out will be zero.
     }
 
+    if(lossyMaxRead)
+        // Lossy readers do not hold back the writer, so we add room for
+        // the writer to write while a lossy reader reads, without
+        // writing over what it's reading, after it skips ahead.  See
+        // SkipLossyInputs() in streamWork.c.
+        len += o->maxWrite + lossyMaxRead;
+
     // Now we have the ring buffer memory mapping lengths:
     // len and overhangLen.
 
     // Reset to top output.
     out = o;
 
-    struct QsBuffer *b = calloc(1, sizeof(*b));
-    ASSERT(b, "calloc(1,%zu) failed", sizeof(*b));
-
-    // This will ASSERT if it fails.
-    void *start = makeRingBuffer(&len, &overhangLen);
-
-    b->end = start + len;
-    b->mapLength = len;
-    b->overhangLength = overhangLen;
+    struct QsBuffer *b;
+
+    // The block that writes to the buffer is the block with the top
+    // output, o.
+    DASSERT(o->port.block);
+    DASSERT(o->port.block->type == QsBlockType_simple);
+    struct QsThreadPool *tp =
+        ((struct QsSimpleBlock *) o->port.block)->jobsBlock.threadPool;
+    DASSERT(tp);
+    int numaNode = GetNumaNode(tp);
+    enum QsRingBufferMode mode = (tp->ringBufferMode > -1)?
+        tp->ringBufferMode:ringBufferMode;
+
+    // Use the smallest unused ring buffer from the last stream run that
+    // is big enough, if there is one.
+    struct QsGraph *g = o->port.block->graph;
+    struct QsBuffer **best = 0;
+    for(struct QsBuffer **pb = &g->bufferPool; *pb; pb = &(*pb)->next)
+        if((*pb)->numaNode == numaNode &&
+                (*pb)->ringBufferMode == mode &&
+                (*pb)->mapLength >= len &&
+                (*pb)->overhangLength >= overhangLen &&
+                (!best || (*pb)->mapLength < (*best)->mapLength))
+            best = pb;
+
+    if(o->fileFd > -1 && o->fileShared) {
+        // From qsMapOutputShared() or qsMapInputShared().  The ring
+        // buffer is all the shared memory, so that the byte positions
+        // in it are the same as in the other process.
+        // CheckSharedBuffers() checked the lengths.
+        b = calloc(1, sizeof(*b));
+        ASSERT(b, "calloc(1,%zu) failed", sizeof(*b));
+        void *start = makeSharedBuffer(o->fileFd, o->fileOffset,
+                o->fileLength, &overhangLen,
+                &b->fileMap, &b->fileMapLength);
+        b->end = start + o->fileLength;
+        b->mapLength = o->fileLength;
+        b->overhangLength = overhangLen;
+        b->numaNode = -1;
+        o->fileFd = -1;
+        o->fileShared = false;
+    } else if(o->fileFd > -1) {
+        // The block called qsMapOutputFile() in start().  The buffer
+        // must hold the whole file part, since it does not wrap.
+        if(len < o->fileLength)
+            len = o->fileLength;
+        b = calloc(1, sizeof(*b));
+        ASSERT(b, "calloc(1,%zu) failed", sizeof(*b));
+        void *start = makeFileBuffer(o->fileFd, o->fileOffset,
+                o->fileLength, len, overhangLen,
+                &b->fileMap, &b->fileMapLength);
+        // qsMapOutputFile() checked the file offset.
+        ASSERT(((uintptr_t) start) % OutputAlignment(o, false) == 0);
+        b->end = start + len;
+        b->mapLength = len;
+        b->overhangLength = overhangLen;
+        b->numaNode = -1;
+        o->fileFd = -1;
+    } else if(best) {
+        // Take it out of the pool.
+        b = *best;
+        *best = b->next;
+        b->next = 0;
+    } else {
+        b = calloc(1, sizeof(*b));
+        ASSERT(b, "calloc(1,%zu) failed", sizeof(*b));
+
+        // This will ASSERT if it fails.
+        void *start = makeRingBuffer(&len, &overhangLen, numaNode, mode);
+
+        ASSERT(((uintptr_t) start) % QS_STREAM_BUFFER_ALIGNMENT == 0);
+
+        b->end = start + len;
+        b->mapLength = len;
+        b->overhangLength = overhangLen;
+        b->numaNode = numaNode;
+        b->ringBufferMode = mode;
+    }
 
     // Set the ring buffer for all outputs that share it.
     while(out) {
@@ -401,39 +643,75 @@ void CreateBlockRingBuffers(struct QsBlock *b) {
 }
 
 
+// Set j->fuseNext if this stream job is a link in a linear chain that the
+// thread pool can run in one worker thread.  See QsStreamJob::fuseNext.
+//
 static inline
-void CreateStreamArgs(struct QsStreamJob *j) {
+void SetFuseNext(struct QsStreamJob *j) {
 
-    DASSERT(j);
+    j->fuseNext = 0;
 
-    DASSERT(!j->inputBuffers);
-    DASSERT(!j->inputLens);
-    DASSERT(!j->advanceInputs);
+    if(j->numOutputs != 1 || j->outputs[0].numInputs != 1)
+        return;
 
-    DASSERT(!j->outputBuffers);
-    DASSERT(!j->outputLens);
-    DASSERT(!j->advanceOutputs);
+    struct QsThreadPool *tp = ((struct QsJob *) j)->jobsBlock->threadPool;
+    DASSERT(tp);
+    if(!tp->fuseChains)
+        return;
 
+    struct QsInput *in = j->outputs[0].inputs[0];
+    struct QsSimpleBlock *rb = (void *) in->port.block;
+    DASSERT(rb);
+    DASSERT(rb->streamJob);
+
+    if(rb->streamJob->numInputs != 1 || rb->jobsBlock.threadPool != tp)
+        return;
+
+    j->fuseNext = rb->streamJob;
+
+    DSPEW("Fusing block \"%s\" to \"%s\" in thread pool \"%s\"",
+            ((struct QsJob *) j)->jobsBlock->block.name,
+            rb->jobsBlock.block.name, tp->name);
+}
+
+
+static inline
+void CreateStreamArgs(struct QsStreamJob *j) {
+
+    DASSERT(j);
+
+    // The flow() argument arrays may be left from the last stream run.
+    // If they are big enough we use them again.  They were zeroed at the
+    // last stop.
 
     if(j->numInputs) {
         DASSERT(j->inputs);
         DASSERT(j->maxInputs);
 
-        j->inputBuffers = calloc(j->numInputs,
-                sizeof(*j->inputBuffers));
-        ASSERT(j->inputBuffers,
-                "calloc(%" PRIu32 ",%zu) failed",
-                j->numInputs, sizeof(*j->inputBuffers));
-        j->inputLens = calloc(j->numInputs,
-                sizeof(*j->inputLens));
-        ASSERT(j->inputLens,
-                "calloc(%" PRIu32 ",%zu) failed",
-                j->numInputs, sizeof(*j->inputLens));
-        j->advanceInputs = calloc(j->numInputs,
-                sizeof(*j->advanceInputs));
-        ASSERT(j->advanceInputs,
-                "calloc(%" PRIu32 ",%zu) failed",
-                j->numInputs, sizeof(*j->advanceInputs));
+        if(j->numInputs > j->argsNumInputs) {
+            // We need bigger arrays than we had from the last start, if
+            // any.
+            free(j->inputBuffers);
+            free(j->inputLens);
+            free(j->advanceInputs);
+
+            j->inputBuffers = calloc(j->numInputs,
+                    sizeof(*j->inputBuffers));
+            ASSERT(j->inputBuffers,
+                    "calloc(%" PRIu32 ",%zu) failed",
+                    j->numInputs, sizeof(*j->inputBuffers));
+            j->inputLens = calloc(j->numInputs,
+                    sizeof(*j->inputLens));
+            ASSERT(j->inputLens,
+                    "calloc(%" PRIu32 ",%zu) failed",
+                    j->numInputs, sizeof(*j->inputLens));
+            j->advanceInputs = calloc(j->numInputs,
+                    sizeof(*j->advanceInputs));
+            ASSERT(j->advanceInputs,
+                    "calloc(%" PRIu32 ",%zu) failed",
+                    j->numInputs, sizeof(*j->advanceInputs));
+            j->argsNumInputs = j->numInputs;
+        }
 
         // Set the read pointers for these inputs.
         //
@@ -454,7 +732,7 @@ void CreateStreamArgs(struct QsStreamJob *j) {
             j->inputBuffers[i] = buffer->end - buffer->mapLength;
             // j->inputLens[i] already 0
             // j->advanceInputs[i] is 0 already.
-            j->inputs[i].readLength = 0;
+            j->inputs[i].readCount = 0;
         }
     }
 
@@ -462,21 +740,28 @@ void CreateStreamArgs(struct QsStreamJob *j) {
         DASSERT(j->outputs);
         DASSERT(j->maxOutputs);
 
-        j->outputBuffers = calloc(j->numOutputs,
-                sizeof(*j->outputBuffers));
-        ASSERT(j->outputBuffers,
-                "calloc(%" PRIu32 ",%zu) failed",
-                j->numOutputs, sizeof(*j->outputBuffers));
-        j->outputLens = calloc(j->numOutputs,
-                sizeof(*j->outputLens));
-        ASSERT(j->outputLens,
-                "calloc(%" PRIu32 ",%zu) failed",
-                j->numOutputs, sizeof(*j->outputLens));
-        j->advanceOutputs = calloc(j->numOutputs,
-                sizeof(*j->advanceOutputs));
-        ASSERT(j->advanceOutputs,
-                "calloc(%" PRIu32 ",%zu) failed",
-                j->numOutputs, sizeof(*j->advanceOutputs));
+        if(j->numOutputs > j->argsNumOutputs) {
+            free(j->outputBuffers);
+            free(j->outputLens);
+            free(j->advanceOutputs);
+
+            j->outputBuffers = calloc(j->numOutputs,
+                    sizeof(*j->outputBuffers));
+            ASSERT(j->outputBuffers,
+                    "calloc(%" PRIu32 ",%zu) failed",
+                    j->numOutputs, sizeof(*j->outputBuffers));
+            j->outputLens = calloc(j->numOutputs,
+                    sizeof(*j->outputLens));
+            ASSERT(j->outputLens,
+                    "calloc(%" PRIu32 ",%zu) failed",
+                    j->numOutputs, sizeof(*j->outputLens));
+            j->advanceOutputs = calloc(j->numOutputs,
+                    sizeof(*j->advanceOutputs));
+            ASSERT(j->advanceOutputs,
+                    "calloc(%" PRIu32 ",%zu) failed",
+                    j->numOutputs, sizeof(*j->advanceOutputs));
+            j->argsNumOutputs = j->numOutputs;
+        }
 
         // Initialize the args:
         //
@@ -501,10 +786,24 @@ void CreateStreamArgs(struct QsStreamJob *j) {
             // written yet.
             //
             j->outputs[i].isFlushing = false;
+            j->outputs[i].isDone = false;
+            j->outputs[i].writeCount = 0;
+            j->outputs[i].highWater = 0;
+            j->outputs[i].fill = 0;
+            j->outputs[i].clogs = 0;
+            j->outputs[i].bufferLength = buffer->mapLength;
         }
     }
 
     j->isFinished = false;
+
+    j->calls = 0;
+    j->busyNs = 0;
+    j->stalls = 0;
+    j->waitNs = 0;
+    j->queuedAt = 0;
+
+    SetFuseNext(j);
 }
 
 
@@ -608,6 +907,19 @@ CallBlockStart(struct QsSimpleBlock *b, struct QsStreamJob *j) {
     }
 
 
+    if(b->streamJob) {
+        // Only a qsMapOutputFile(), qsMapOutputShared(), or
+        // qsMapInputShared() in this start() counts.
+        for(uint32_t i = 0; i < b->streamJob->maxOutputs; ++i) {
+            b->streamJob->outputs[i].fileFd = -1;
+            b->streamJob->outputs[i].fileShared = false;
+        }
+        for(uint32_t i = 0; i < b->streamJob->maxInputs; ++i)
+            b->streamJob->inputs[i].fileFd = -1;
+        b->streamJob->sharedBuffer = false;
+        b->streamJob->peerAdvanced = false;
+    }
+
     if(b->start && !b->donotFinish) {
         int ret;
         // This code is reentrant.  In this case it does not need to be.
@@ -749,6 +1061,7 @@ int qsGraph_start(struct QsGraph *g) {
     g->streamBlockCount = 0; // We'll add them up.
 
     g->runningStreams = true;
+    g->streamStartTime = GetNanoseconds();
 
     // The block's start() functions must be called before the stream
     // ring buffers are allocated, so that the block can know the
@@ -769,12 +1082,27 @@ int qsGraph_start(struct QsGraph *g) {
     }
 
 
+    if(CheckSharedBuffers((void *) g)) {
+        ret = 6;
+        WARN("A stream buffer cannot be in shared memory");
+        CHECK(pthread_mutex_unlock(&g->cqMutex));
+        UnsetNumInputsAndNumOutputs((void *) g);
+        goto finish1;
+    }
+
     CreateBlockPassThroughs((void *) g); // loop 4
     CreateBlockRingBuffers( (void *) g); // loop 5
+    // Free the ring buffers from the last stream run that we did not
+    // use again.
+    FreeBufferPool(g);
     CreateBlockStreamArgs(  (void *) g); // loop 6
 
     CHECK(pthread_mutex_unlock(&g->cqMutex));
 
+    // Start waiting on the file descriptors of blocks that called
+    // qsAddEpollReadJob() or qsAddEpollWriteJob() in start().
+    StartEpollClients(g);
+
     QueueSourceJobs((void *) g); // loop 7
 
 finish1:
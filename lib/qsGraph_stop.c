@@ -19,6 +19,7 @@
 #include "job.h"
 #include "port.h"
 #include "stream.h"
+#include "epoll.h"
 #include "mmapRingBuffer.h"
 
 
@@ -36,8 +37,21 @@ DequeueBlockStreamJobs(struct QsBlock *b) {
         // run.
         sj->isFinished = false;
         sj->busy = false;
+        sj->flowing = false;
+        sj->draining = false;
         sj->didIOAdvance = false;
         sj->lastAvailableCount = 0;
+        // The block may have closed the file from a qsMapOutputFile(),
+        // qsMapOutputShared(), or qsMapInputShared() in a start() that
+        // failed.
+        for(uint32_t i = 0; i < sj->maxOutputs; ++i) {
+            sj->outputs[i].fileFd = -1;
+            sj->outputs[i].fileShared = false;
+        }
+        for(uint32_t i = 0; i < sj->maxInputs; ++i)
+            sj->inputs[i].fileFd = -1;
+        sj->sharedBuffer = false;
+        sj->peerAdvanced = false;
     }
 
     if(b->type & QS_TYPE_PARENT) {
@@ -137,6 +151,9 @@ bool Stop(struct QsBlock *b) {
 }
 
 
+// We keep the flow() argument arrays for the next start; we just zero
+// them.  The read and write pointers get reset at the next start.
+//
 static inline
 void DestroyStreamArgs(struct QsStreamJob *j) {
 
@@ -148,10 +165,45 @@ void DestroyStreamArgs(struct QsStreamJob *j) {
         DASSERT(j->inputBuffers);
         DASSERT(j->inputLens);
         DASSERT(j->advanceInputs);
+        DASSERT(j->numInputs <= j->argsNumInputs);
+
+        memset(j->inputBuffers, 0, j->numInputs*sizeof(*j->inputBuffers));
+        memset(j->inputLens, 0, j->numInputs*sizeof(*j->inputLens));
+        memset(j->advanceInputs, 0,
+                j->numInputs*sizeof(*j->advanceInputs));
+    }
+
+    if(j->numOutputs) {
+
+        DASSERT(j->outputs);
+        DASSERT(j->outputBuffers);
+        DASSERT(j->outputLens);
+        DASSERT(j->advanceOutputs);
+        DASSERT(j->numOutputs <= j->argsNumOutputs);
+
+        memset(j->outputBuffers, 0,
+                j->numOutputs*sizeof(*j->outputBuffers));
+        memset(j->outputLens, 0, j->numOutputs*sizeof(*j->outputLens));
+        memset(j->advanceOutputs, 0,
+                j->numOutputs*sizeof(*j->advanceOutputs));
+    }
+}
+
+
+void FreeStreamArgs(struct QsStreamJob *j) {
+
+    DASSERT(j);
+
+    if(j->argsNumInputs) {
+
+        DASSERT(j->inputBuffers);
+        DASSERT(j->inputLens);
+        DASSERT(j->advanceInputs);
 
-        DZMEM(j->inputBuffers,  j->numInputs*sizeof(*j->inputBuffers));
-        DZMEM(j->inputLens,     j->numInputs*sizeof(*j->inputLens));
-        DZMEM(j->advanceInputs, j->numInputs*sizeof(*j->advanceInputs));
+        DZMEM(j->inputBuffers, j->argsNumInputs*sizeof(*j->inputBuffers));
+        DZMEM(j->inputLens, j->argsNumInputs*sizeof(*j->inputLens));
+        DZMEM(j->advanceInputs,
+                j->argsNumInputs*sizeof(*j->advanceInputs));
         free(j->inputBuffers);
         free(j->inputLens);
         free(j->advanceInputs);
@@ -159,6 +211,7 @@ void DestroyStreamArgs(struct QsStreamJob *j) {
         j->inputBuffers = 0;
         j->inputLens = 0;
         j->advanceInputs = 0;
+        j->argsNumInputs = 0;
     }
 
     DASSERT(!j->inputBuffers);
@@ -166,16 +219,17 @@ void DestroyStreamArgs(struct QsStreamJob *j) {
     DASSERT(!j->advanceInputs);
 
 
-    if(j->numOutputs) {
+    if(j->argsNumOutputs) {
 
-        DASSERT(j->outputs);
         DASSERT(j->outputBuffers);
         DASSERT(j->outputLens);
         DASSERT(j->advanceOutputs);
 
-        DZMEM(j->outputBuffers,  j->numOutputs*sizeof(*j->outputBuffers));
-        DZMEM(j->outputLens,     j->numOutputs*sizeof(*j->outputLens));
-        DZMEM(j->advanceOutputs, j->numOutputs*sizeof(*j->advanceOutputs));
+        DZMEM(j->outputBuffers,
+                j->argsNumOutputs*sizeof(*j->outputBuffers));
+        DZMEM(j->outputLens, j->argsNumOutputs*sizeof(*j->outputLens));
+        DZMEM(j->advanceOutputs,
+                j->argsNumOutputs*sizeof(*j->advanceOutputs));
         free(j->outputBuffers);
         free(j->outputLens);
         free(j->advanceOutputs);
@@ -183,6 +237,7 @@ void DestroyStreamArgs(struct QsStreamJob *j) {
         j->outputBuffers = 0;
         j->outputLens = 0;
         j->advanceOutputs = 0;
+        j->argsNumOutputs = 0;
     }
 
     DASSERT(!j->outputBuffers);
@@ -265,11 +320,15 @@ void DestroyOutputRingBuffer(struct QsOutput *out,
     struct QsBuffer *b = out->buffer;
     DASSERT(b);
 
-    freeRingBuffer(b->end - b->mapLength, b->mapLength,
-            b->overhangLength);
-
-    DZMEM(b, sizeof(*b));
-    free(b);
+    // Keep the ring buffer memory mappings for the next stream start,
+    // unless it's a file from qsMapOutputFile() or shared memory from
+    // qsMapOutputShared() which are just for one stream run.
+    struct QsGraph *g = out->port.block->graph;
+    DASSERT(g);
+    if(!b->fileMap) {
+        b->next = g->bufferPool;
+        g->bufferPool = b;
+    }
 
     // Unset the ring buffer for all outputs that share it.
     while(out) {
@@ -296,10 +355,31 @@ void DestroyOutputRingBuffer(struct QsOutput *out,
         // Go to the next output that is now not linked back.
         out = next;
     }
+
+    if(b->fileMap) {
+        freeFileBuffer(b->fileMap, b->fileMapLength);
+        DZMEM(b, sizeof(*b));
+        free(b);
+    }
 }
 
 
 
+void FreeBufferPool(struct QsGraph *g) {
+
+    DASSERT(g);
+
+    while(g->bufferPool) {
+        struct QsBuffer *b = g->bufferPool;
+        g->bufferPool = b->next;
+        freeRingBuffer(b->end - b->mapLength, b->mapLength,
+                b->overhangLength);
+        DZMEM(b, sizeof(*b));
+        free(b);
+    }
+}
+
+
 static
 void DestroyBlockRingBuffers(struct QsBlock *b) {
 
@@ -339,11 +419,16 @@ int qsGraph_stop(struct QsGraph *g) {
     DSPEW("Stopping graph \"%s\" stream", g->name);
 
     g->runningStreams = false;
+    g->streamStopTime = GetNanoseconds();
 
     // Halt just the stream job blocks and their peers.
     //
     uint32_t numHalts = HaltStreamBlocks((void *) g);
 
+    // Stop the epoll thread from queuing stream jobs, before the blocks
+    // stop() callbacks close the file descriptors.
+    StopEpollClients(g);
+
     g->streamJobCount = 0;
 
     DequeueBlockStreamJobs((void *) g);
@@ -1,13 +1,648 @@
+// A polyphase rational resampler.  It changes the sample rate by
+// L/M, interpolation L and decimation M, for real float (f32) or complex
+// float (cf32) streams.
+//
+// The filter taps are at the rate of L times the input rate.  They are
+// either designed, as a Blackman windowed sinc low pass filter with
+// "FilterSize" times max(L,M) taps, a gain of L, and a cutoff of
+// "Bandwidth" times the lower of the input and output Nyquist
+// frequencies, or they are read from a text file of numbers with
+// "TapsFile", like the taps that GNU Radio filter design tools make.
+//
+// We split the taps into L phases, each with Tpad taps, so for each
+// output we do just one inner product of Tpad taps with the last Tpad
+// input samples; where Tpad is the number of taps per phase rounded up to
+// a multiple of 8 so the inner product is all vector operations.  The
+// inner product function is compiled for AVX2 and for the default CPU
+// and the dynamic linker picks the one that this CPU can run
+// (target_clones).
+//
+// With "Overhang true" (the default) we keep the filter history in the
+// input ring buffer, by not advancing the input past the last Tpad - 1
+// samples, and read it straight from there.  The ring buffer wrap
+// mapping (the overhang) makes the input memory contiguous, so there is
+// no copying at all.  That needs the input maximum read length to be
+// larger than the filter history, so we make it at least 2*Tpad samples
+// in start().  With "Overhang false", or when the rate is changed while
+// running and the new filter history does not fit, we copy the input to
+// a buffer in this block that keeps the history.
+//
+// We do not make up zeros for samples before the first input, so the
+// first output is for input sample Tpad - 1, in both modes.
+//
+// The rate can be changed while the stream is running with the "rate"
+// control parameter setter, with the 2 values L and M.
+//
+#include <string.h>
+#include <math.h>
 
 #include "../../../../include/quickstream.h"
 #include "../../../debug.h"
+#include "../../../mprintf.h"
 
+#define STR(s)   XSTR(s)
+#define XSTR(s)  #s
+
+
+#define DEFAULT_INPUTMAX     4096
+#define DEFAULT_FILTERSIZE   16
+#define DEFAULT_BANDWIDTH    0.9
+
+// Taps per phase are rounded up to a multiple of this, the number of
+// floats in a vector.
+#define VLEN                 8
+
+
+// Configuration.
+static uint64_t L = 1, M = 1;
+// 1 for f32, 2 for cf32
+static uint32_t numParts = 1;
+static size_t filterSize = DEFAULT_FILTERSIZE;
+static double bandwidth = DEFAULT_BANDWIDTH;
+static bool overhang = true;
+static size_t maxRead = DEFAULT_INPUTMAX;
+// Taps from "TapsFile", or 0 to design them.
+static float *fileTaps = 0;
+static size_t numFileTaps = 0;
+static char *tapsFilename = 0;
+
+
+// The stream state.
+//
+// The polyphase taps, numParts*Tpad floats per phase, with the taps in
+// each phase reversed, so that the inner product goes from the oldest
+// input sample to the newest.  For complex input each tap is repeated
+// for the real and imaginary parts.
+static float *taps = 0;
+static size_t Tpad;
+// The phase of the next output, 0 to L-1.
+static uint64_t phase;
+// The index of the newest input sample for the next output, counting
+// from the oldest sample that we have not consumed; n >= Tpad - 1.
+static size_t n;
+// We are copying the input to buf.
+static bool copying;
+// The copy of the input with the history, for when we are copying.
+// bufLen and bufCap are in samples.
+static float *buf = 0;
+static size_t bufLen, bufCap;
+static size_t sampleSize; // bytes
+// The input maximum read length that we set in start().
+static size_t inMax;
+static bool running = false;
+
+
+static inline uint64_t Gcd(uint64_t a, uint64_t b) {
+
+    while(b) {
+        uint64_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+
+static inline void SetRate(uint64_t l, uint64_t m) {
+
+    uint64_t d = Gcd(l, m);
+    L = l/d;
+    M = m/d;
+}
+
+
+// Returns the prototype filter taps in *h, that the caller frees if
+// *h != fileTaps.
+//
+static size_t GetPrototype(float **h) {
+
+    if(fileTaps) {
+        *h = fileTaps;
+        return numFileTaps;
+    }
+
+    uint64_t r = (L > M)?L:M;
+    size_t len = filterSize*r + 1;
+    float *x = malloc(len*sizeof(*x));
+    ASSERT(x, "malloc(%zu) failed", len*sizeof(*x));
+
+    // Cutoff in cycles per sample at the rate L times the input.
+    double fc = bandwidth*0.5/r;
+    double mid = (len - 1)/2.0;
+    double sum = 0.0;
+
+    for(size_t i = 0; i < len; ++i) {
+        double t = i - mid;
+        double s = (t == 0.0)?(2.0*fc):(sin(2.0*M_PI*fc*t)/(M_PI*t));
+        double w = 1.0;
+        if(len > 1)
+            w = 0.42 - 0.5*cos(2.0*M_PI*i/(len - 1)) +
+                0.08*cos(4.0*M_PI*i/(len - 1));
+        x[i] = s*w;
+        sum += x[i];
+    }
+
+    // Each of the L phases has about 1/L of the DC gain, so we make it
+    // L for a gain of 1 through the resampler.
+    for(size_t i = 0; i < len; ++i)
+        x[i] *= L/sum;
+
+    *h = x;
+    return len;
+}
+
+
+// Make the polyphase taps for the current L and M.
+//
+static void MakeTaps(void) {
+
+    float *h;
+    size_t len = GetPrototype(&h);
+    DASSERT(len);
+
+    size_t T = (len + L - 1)/L;
+    Tpad = ((T + VLEN - 1)/VLEN)*VLEN;
+
+    size_t size = L*numParts*Tpad*sizeof(*taps);
+    float *t = realloc(taps, size);
+    ASSERT(t, "realloc(,%zu) failed", size);
+    taps = t;
+
+    for(uint64_t p = 0; p < L; ++p)
+        for(size_t i = 0; i < Tpad; ++i) {
+            size_t j = p + (Tpad - 1 - i)*L;
+            float val = (j < len)?h[j]:0.0F;
+            for(uint32_t k = 0; k < numParts; ++k)
+                *t++ = val;
+        }
+
+    if(h != fileTaps)
+        free(h);
+
+    DSPEW("L=%" PRIu64 " M=%" PRIu64 " with %zu taps, %zu per phase",
+            L, M, len, Tpad);
+}
+
+
+// Makes sure that buf can hold the filter history and a maxRead of
+// input.
+//
+static void CheckBuf(void) {
+
+    size_t cap = Tpad - 1 + maxRead/sampleSize + 1;
+    if(cap <= bufCap && buf)
+        return;
+    float *b = realloc(buf, cap*sampleSize);
+    ASSERT(b, "realloc(,%zu) failed", cap*sampleSize);
+    buf = b;
+    bufCap = cap;
+}
+
+
+// The inner product of len floats of x and h.  The even and odd elements
+// are summed separately, for the real and imaginary parts of complex
+// samples; for real samples the caller adds them.  len is a multiple of
+// VLEN.
+//
+__attribute__((target_clones("avx2", "default")))
+static void Dot(const float *x, const float *h, size_t len, float sum[2]) {
+
+    typedef float V __attribute__((vector_size(VLEN*sizeof(float))));
+    // The stream buffers are not aligned.
+    typedef float Vu __attribute__((vector_size(VLEN*sizeof(float)),
+                aligned(1), may_alias));
+
+    V acc = { 0 };
+    for(const float *end = x + len; x < end; x += VLEN, h += VLEN)
+        acc += *((const Vu *) x) * *((const Vu *) h);
+
+    sum[0] = acc[0] + acc[2] + acc[4] + acc[6];
+    sum[1] = acc[1] + acc[3] + acc[5] + acc[7];
+}
+
+
+// Writes up to maxOut output samples to y from the numIn input samples
+// in x, and returns the number written.
+//
+static size_t Resample(const float *x, size_t numIn,
+        float *y, size_t maxOut) {
+
+    DASSERT(n >= Tpad - 1);
+
+    size_t k = 0;
+    const size_t stride = numParts*Tpad;
+
+    for(; k < maxOut && n < numIn; ++k) {
+        float sum[2];
+        Dot(x + (n + 1 - Tpad)*numParts, taps + phase*stride,
+                stride, sum);
+        if(numParts == 1)
+            *y++ = sum[0] + sum[1];
+        else {
+            *y++ = sum[0];
+            *y++ = sum[1];
+        }
+        phase += M;
+        n += phase/L;
+        phase %= L;
+    }
+
+    return k;
+}
+
+
+// Returns the number of output bytes written, and the number of input
+// bytes to advance in *inAdv.
+//
+static size_t Work(const void *in, size_t inLen, void *out, size_t outLen,
+        size_t *inAdv) {
+
+    size_t numIn = inLen/sampleSize;
+    size_t maxOut = outLen/sampleSize;
+    size_t adv;
+
+    if(!copying) {
+        size_t k = Resample(in, numIn, out, maxOut);
+        // Keep the last Tpad - 1 samples that we need as history in the
+        // input ring buffer.
+        adv = n + 1 - Tpad;
+        if(adv > numIn)
+            adv = numIn;
+        n -= adv;
+        *inAdv = adv*sampleSize;
+        return k*sampleSize;
+    }
+
+    // Copy what input we can to the end of buf.
+    adv = bufCap - bufLen;
+    if(adv > numIn)
+        adv = numIn;
+    memcpy(buf + bufLen*numParts, in, adv*sampleSize);
+    bufLen += adv;
+    *inAdv = adv*sampleSize;
+
+    size_t k = Resample(buf, bufLen, out, maxOut);
+
+    // Keep the last Tpad - 1 samples that we need as history in buf.
+    adv = n + 1 - Tpad;
+    if(adv > bufLen)
+        adv = bufLen;
+    if(adv) {
+        n -= adv;
+        bufLen -= adv;
+        memmove(buf, buf + adv*numParts, bufLen*sampleSize);
+    }
+
+    return k*sampleSize;
+}
+
+
+static
+int Rate_setter(const struct QsParameter *p, const uint64_t *value,
+            uint32_t readCount, uint32_t queueCount,
+            void *userData) {
+
+    if(!value[0] || !value[1]) {
+        WARN("Bad rate %" PRIu64 "/%" PRIu64, value[0], value[1]);
+        return 0;
+    }
+
+    SetRate(value[0], value[1]);
+
+    if(!running)
+        // start() will make the taps.
+        return 0;
+
+    size_t oldTpad = Tpad;
+    MakeTaps();
+    phase = 0;
+    // We have at least the oldTpad - 1 samples of history.
+    if(Tpad > oldTpad)
+        n += Tpad - oldTpad;
+
+    if(copying)
+        CheckBuf();
+    else if(2*Tpad*sampleSize > inMax) {
+        // The new filter history does not fit in the input buffer, and
+        // we cannot change the input buffer while the stream is running.
+        // The input that we have not consumed becomes the start of buf.
+        DSPEW("Copying input to fit %zu taps per phase", Tpad);
+        copying = true;
+        bufLen = 0;
+        CheckBuf();
+    }
+
+    return 0;
+}
+
+
+static
+char *Rate_config(int argc, const char * const *argv, void *userData) {
+
+    size_t val[2] = { 1, 1 };
+
+    qsParseSizetArray(1, val, 2);
+
+    if(!val[0] || !val[1]) {
+        ERROR("Rate values must be greater than 0");
+        return QS_CONFIG_FAIL;
+    }
+
+    SetRate(val[0], val[1]);
+
+    return mprintf("Rate %" PRIu64 " %" PRIu64, L, M);
+}
+
+
+static
+char *Type_config(int argc, const char * const *argv, void *userData) {
+
+    if(argc < 2) {
+        ERROR("Need a type");
+        return QS_CONFIG_FAIL;
+    }
+
+    if(!strcmp(argv[1], "f32"))
+        numParts = 1;
+    else if(!strcmp(argv[1], "cf32"))
+        numParts = 2;
+    else {
+        ERROR("Unknown type \"%s\"", argv[1]);
+        return QS_CONFIG_FAIL;
+    }
+
+    return mprintf("Type %s", argv[1]);
+}
+
+
+static
+char *FilterSize_config(int argc, const char * const *argv,
+        void *userData) {
+
+    filterSize = qsParseSizet(DEFAULT_FILTERSIZE);
+    if(filterSize < 1)
+        filterSize = 1;
+
+    return mprintf("FilterSize %zu", filterSize);
+}
+
+
+static
+char *Bandwidth_config(int argc, const char * const *argv,
+        void *userData) {
+
+    double val = qsParseDouble(DEFAULT_BANDWIDTH);
+
+    if(val <= 0.0 || val > 1.0) {
+        ERROR("Bandwidth %lg is not in (0, 1]", val);
+        return QS_CONFIG_FAIL;
+    }
+
+    bandwidth = val;
+
+    return mprintf("Bandwidth %lg", bandwidth);
+}
+
+
+static void FreeFileTaps(void) {
+
+    if(fileTaps) {
+        free(fileTaps);
+        fileTaps = 0;
+        numFileTaps = 0;
+    }
+    if(tapsFilename) {
+        free(tapsFilename);
+        tapsFilename = 0;
+    }
+}
+
+
+static
+char *TapsFile_config(int argc, const char * const *argv,
+        void *userData) {
+
+    if(argc < 2) {
+        // Go back to designing the taps.
+        FreeFileTaps();
+        return 0;
+    }
+
+    FILE *file = fopen(argv[1], "r");
+    if(!file) {
+        ERROR("fopen(\"%s\",\"r\") failed", argv[1]);
+        return QS_CONFIG_FAIL;
+    }
+
+    float *x = 0;
+    size_t len = 0, cap = 0;
+    float val;
+
+    // Numbers separated by white space or commas.
+    while(fscanf(file, " %f ,", &val) == 1) {
+        if(len == cap) {
+            cap += 128;
+            x = realloc(x, cap*sizeof(*x));
+            ASSERT(x, "realloc(,%zu) failed", cap*sizeof(*x));
+        }
+        x[len++] = val;
+    }
+
+    bool bad = !feof(file);
+    fclose(file);
+
+    if(bad || !len) {
+        ERROR("Failed to read taps from \"%s\"", argv[1]);
+        free(x);
+        return QS_CONFIG_FAIL;
+    }
+
+    FreeFileTaps();
+    fileTaps = x;
+    numFileTaps = len;
+    tapsFilename = strdup(argv[1]);
+    ASSERT(tapsFilename, "strdup() failed");
+
+    return mprintf("TapsFile %s", tapsFilename);
+}
+
+
+static
+char *Overhang_config(int argc, const char * const *argv,
+        void *userData) {
+
+    qsParseBoolArray(true, &overhang, 1);
+
+    return mprintf("Overhang %s", overhang?"true":"false");
+}
+
+
+static
+char *InputMax_config(int argc, const char * const *argv,
+        void *userData) {
+
+    maxRead = qsParseSizet(DEFAULT_INPUTMAX);
+    if(maxRead < 2*sizeof(float))
+        maxRead = 2*sizeof(float);
+
+    return mprintf("MaxRead %zu", maxRead);
+}
 
 
 int declare(void) {
 
-ERROR("Write more code here!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!");
+    qsSetNumInputs(1/*min*/, 1/*max*/);
+    qsSetNumOutputs(1/*min*/, 1/*max*/);
+
+    struct QsParameter *p = qsCreateSetter("rate",
+        2*sizeof(uint64_t), QsValueType_uint64, 0/*0=no initial value*/,
+        (int (*)(const struct QsParameter *, const void *,
+            uint32_t readCount, uint32_t queueCount,
+            void *)) Rate_setter);
+    // Old rates are of no use to us.
+    qsSetterLatestOnly(p, true);
+
+    qsAddConfig(Rate_config, "Rate",
+            "Set the resampling rate to INTERPOLATION/DECIMATION",
+            "Rate INTERPOLATION DECIMATION",
+            "Rate 1 1");
+
+    qsAddConfig(Type_config, "Type",
+            "Set the stream type: f32 or cf32 (complex)",
+            "Type TYPE",
+            "Type f32");
+
+    qsAddConfig(FilterSize_config, "FilterSize",
+            "Designed filters have FilterSize times max(L,M) taps",
+            "FilterSize NUM",
+            "FilterSize " STR(DEFAULT_FILTERSIZE));
+
+    qsAddConfig(Bandwidth_config, "Bandwidth",
+            "Designed filter cutoff as a fraction of the lower "
+            "Nyquist frequency",
+            "Bandwidth FRACTION",
+            "Bandwidth " STR(DEFAULT_BANDWIDTH));
+
+    qsAddConfig(TapsFile_config, "TapsFile",
+            "Read the filter taps from a text file of numbers, at L "
+            "times the input rate, in place of designing them; no "
+            "FILENAME to design them again",
+            "TapsFile [FILENAME]",
+            "TapsFile");
+
+    qsAddConfig(Overhang_config, "Overhang",
+            "Read the filter history from the input ring buffer "
+            "without copying it",
+            "Overhang [BOOL]",
+            "Overhang true");
+
+    qsAddConfig(InputMax_config, "MaxRead",
+            "The maximum bytes requested for each stream input read",
+            "MaxRead NUM_BYTES",
+            "MaxRead " STR(DEFAULT_INPUTMAX));
+
+    return 0;
+}
+
+
+int start(uint32_t numInputs, uint32_t numOutputs, void *userData) {
+
+    sampleSize = numParts*sizeof(float);
+
+    MakeTaps();
+
+    phase = 0;
+    n = Tpad - 1;
+    bufLen = 0;
+    copying = !overhang;
+
+    inMax = maxRead;
+    if(copying)
+        CheckBuf();
+    else if(inMax < 2*Tpad*sampleSize)
+        inMax = 2*Tpad*sampleSize;
+
+    qsSetInputMax(0, inMax);
+    // Do not bother calling flow() until we can make an output.
+    if(!copying)
+        qsSetInputThreshold(0, Tpad*sampleSize);
+    else
+        qsSetInputThreshold(0, 0);
+    qsSetOutputMax(0, ((inMax/sampleSize)*L/M + 1)*sampleSize);
+
+    running = true;
+
+    return 0;
+}
+
+
+int stop(uint32_t numInputs, uint32_t numOutputs, void *userData) {
+
+    running = false;
+
+    return 0;
+}
+
+
+int flow(const void * const in[], const size_t inLens[],
+        uint32_t numIn,
+        void * const out[], const size_t outLens[], uint32_t numOut,
+        void *userData) {
+
+    DASSERT(numIn == 1);
+    DASSERT(numOut == 1);
+
+    size_t inAdv;
+    size_t len = Work(in[0], inLens[0], out[0], outLens[0], &inAdv);
+    if(inAdv)
+        qsAdvanceInput(0, inAdv);
+    if(len)
+        qsAdvanceOutput(0, len);
+
+    return 0;
+}
+
+
+int flush(const void * const in[], const size_t inLens[],
+        uint32_t numIn,
+        void * const out[], const size_t outLens[], uint32_t numOut,
+        void *userData) {
+
+    size_t inAdv;
+    size_t len = Work(in[0], inLens[0], out[0], outLens[0], &inAdv);
+
+    // We are done if we had room to write and could not, and there is
+    // no more input that we could use.  In copying mode that's after
+    // we copied all the input to buf.  We do not pad the end with zeros.
+    bool done = (!len && outLens[0] >= sampleSize &&
+            (!copying || inAdv == (inLens[0]/sampleSize)*sampleSize));
+
+    if(done) {
+        inAdv = inLens[0];
+        bufLen = 0;
+    }
+
+    if(inAdv)
+        qsAdvanceInput(0, inAdv);
+    if(len)
+        qsAdvanceOutput(0, len);
+
+    return done?1:0;
+}
+
+
+int undeclare(void *userData) {
 
+    FreeFileTaps();
+    if(taps) {
+        free(taps);
+        taps = 0;
+    }
+    if(buf) {
+        free(buf);
+        buf = 0;
+    }
+    bufCap = 0;
 
     return 0;
 }
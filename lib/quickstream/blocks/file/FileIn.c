@@ -6,22 +6,34 @@
 // stream.  The user may set the file descriptor or a file path to
 // open(2).
 
-// TODO: Add a non-blocking read version/option that uses the qs
-// epoll_wait(2) thread.
+// If the file descriptor is a pipe or socket the flow() is only called
+// when the graph's epoll_wait(2) thread sees that we can read it; see
+// qsAddEpollReadJob().
+//
+// With the "IoUring" configuration, and a regular file or block device,
+// we keep a number of large reads in flight directly into the output
+// ring buffer using io_uring(7); see Uring.h.  If we cannot make an
+// io_uring we fall back to using read(2).
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 
 #include "../../../debug.h"
 
 #include "../../../../include/quickstream.h"
 
+#include "Uring.h"
+
 #define DEFAULT_OUTPUTMAX 2048
+#define DEFAULT_URING_LENGTH  ((size_t) 256*1024)
 #define STR(s)   XSTR(s)
 #define XSTR(s)  #s
 
@@ -40,6 +52,13 @@ struct FileIn {
     char *filename;  // filename, if used
     int fd;          // file descriptor
     bool weOpened;   // did we open the file
+
+    // Number of io_uring reads in flight, or 0 to not use io_uring, and
+    // the length of each read.
+    uint32_t uringDepth;
+    size_t uringLength;
+    // uring.fd is -1 if we are not using io_uring in this run.
+    struct Uring uring;
 };
 
 
@@ -88,6 +107,29 @@ char *OutputMax_config(int argc, const char * const *argv,
 }
 
 
+static
+char *IoUring_config(int argc, const char * const *argv,
+        struct FileIn *f) {
+
+    DASSERT(f);
+
+    if(argc < 2)
+        return 0;
+
+    f->uringDepth = strtoul(argv[1], 0, 10);
+    if(argc > 2)
+        f->uringLength = strtoul(argv[2], 0, 10);
+    if(f->uringLength < 1)
+        f->uringLength = DEFAULT_URING_LENGTH;
+
+    if(f->uringDepth)
+        // All the reads in flight are in the output ring buffer at once.
+        qsSetOutputMax(0, f->uringDepth*f->uringLength);
+
+    return 0;
+}
+
+
 static
 char *Filename_config(int argc, const char * const *argv,
         struct FileIn *f) {
@@ -138,6 +180,8 @@ int FileIn_declare(void) {
     // Defaults
     DASSERT(STDIN_FILENO == 0);
     f->fd = STDIN_FILENO; // Why the hell do they define this?
+    f->uringLength = DEFAULT_URING_LENGTH;
+    f->uring.fd = -1;
 
     qsSetUserData(f);
 
@@ -172,10 +216,69 @@ int FileIn_declare(void) {
             "FileDescriptor NUM",
             "FileDescriptor 0");
 
+    qsAddConfig(
+            (char *(*)(int, const char * const *, void *))
+            IoUring_config, "IoUring",
+            "Use io_uring(7) to keep DEPTH reads of LENGTH bytes in"
+            " flight, if the file is a regular file or block device."
+            "  DEPTH 0 uses read(2).  This sets OutputMax to"
+            " DEPTH times LENGTH",
+            "IoUring DEPTH [LENGTH]",
+            "IoUring 0 " STR(DEFAULT_URING_LENGTH));
+
     return 0; // success
 }
 
 
+// Returns true if we are using io_uring.
+//
+static bool StartUring(struct FileIn *f) {
+
+    struct stat st;
+    ASSERT(fstat(f->fd, &st) == 0);
+    if(!S_ISREG(st.st_mode) && !S_ISBLK(st.st_mode))
+        // A pipe or socket will use epoll with read(2).
+        return false;
+
+    off_t offset = lseek(f->fd, 0, SEEK_CUR);
+    if(offset < 0)
+        return false;
+
+    if(UringInit(&f->uring, f->uringDepth)) {
+        INFO("Cannot make an io_uring; using read(2)");
+        return false;
+    }
+    f->uring.offset = offset;
+
+    DSPEW("Using io_uring fd=%d with %" PRIu32 " reads of %zu bytes",
+            f->uring.fd, f->uringDepth, f->uringLength);
+
+    // The first flow() call submits a no-op, if it gets no room to read
+    // into, so we need something to make the first call.
+    UringSubmitNop(&f->uring);
+    if(UringEnter(&f->uring, false)) {
+        UringDestroy(&f->uring);
+        return false;
+    }
+
+    // Completions make flow() get called.
+    qsAddEpollReadJob(f->uring.fd, 0);
+
+    return true;
+}
+
+
+static void StopUring(struct FileIn *f) {
+
+    if(f->uring.fd < 0) return;
+
+    UringDrain(&f->uring);
+    // Leave the file position after what we read, like read(2) would.
+    lseek(f->fd, f->uring.offset, SEEK_SET);
+    UringDestroy(&f->uring);
+}
+
+
 int FileIn_start(uint32_t numInputs, uint32_t numOutputs,
         struct FileIn *f) {
 
@@ -203,6 +306,56 @@ int FileIn_start(uint32_t numInputs, uint32_t numOutputs,
 
     DSPEW("f->filename=\"%s\"  fd=%d", f->filename, f->fd);
 
+    if(f->uringDepth && StartUring(f))
+        return 0;
+
+    // If it's a pipe or socket, only call flow() when there is something
+    // to read.
+    qsAddEpollReadJob(f->fd, 0);
+
+    return 0;
+}
+
+
+static int UringFlow(void *out, size_t outLen, struct FileIn *f) {
+
+    struct Uring *u = &f->uring;
+
+    int err = UringReap(u);
+
+    if(err) {
+        // We got end of file or an error.  We get all the reads that are
+        // in flight, and keep the data up to the first read that did not
+        // get all it asked for.
+        UringDrain(u);
+        size_t len = UringPopDone(u);
+        struct UringSlot *s = u->slots + u->firstSlot;
+        if(u->numSlots && s->done) {
+            len += s->done;
+            u->offset += s->done;
+        }
+        if(len)
+            qsAdvanceOutput(0, len);
+        if(err < 0) {
+            errno = -err;
+            WARN("io_uring read(%d,,) failed", f->fd);
+        } else
+            INFO("io_uring read(%d,,) got end of file", f->fd);
+        return 1; // done for this flow cycle.
+    }
+
+    size_t len = UringPopDone(u);
+    if(len)
+        qsAdvanceOutput(0, len);
+
+    UringQueue(u, IORING_OP_READ, f->fd, ((uint8_t *) out) + len,
+            outLen - len, f->uringLength);
+
+    if(UringEnter(u, false)) {
+        UringDrain(u);
+        return 1;
+    }
+
     return 0;
 }
 
@@ -214,12 +367,19 @@ int FileIn_flow(const void * const in[], const size_t inLens[],
 
     DASSERT(f->fd >= 0);
 
+    if(f->uring.fd > -1)
+        return UringFlow(*out, *outLens, f);
+
     if(!(*outLens))
         // Got no room to write output to.
         return 0;
 
     ssize_t ret = read(f->fd, *out, *outLens);
 
+    if(ret < 0 && errno == EAGAIN)
+        // Nothing to read after all.
+        return 0;
+
     if(ret <= 0) {
         if(ret < 0)
             WARN("read(%d,%p,%zu)=%zd failed", f->fd, *out, *outLens, ret);
@@ -240,6 +400,7 @@ int FileIn_stop(uint32_t numInputs, uint32_t numOutputs,
 
     DSPEW();
 
+    StopUring(f);
     CleanUpFd(f);
 
     return 0;
@@ -6,16 +6,25 @@
 // stream.  The user may set the file descriptor or a file path to
 // open(2).
 //
-// TODO: Add a non-blocking read version/option that uses the qs
-// epoll_wait(2) thread.
+// If the file descriptor is a pipe or socket the flow() is only called
+// when the graph's epoll_wait(2) thread sees that we can write it; see
+// qsAddEpollWriteJob().
+//
+// With the "IoUring" configuration, and a regular file or block device,
+// we keep a number of large writes in flight directly out of the input
+// ring buffer using io_uring(7); see Uring.h.  If we cannot make an
+// io_uring we fall back to using write(2).
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <limits.h>
 #include <stdarg.h>
 
@@ -23,8 +32,11 @@
 #include "../../../mprintf.h"
 #include "../../../../include/quickstream.h"
 
+#include "Uring.h"
+
 
 #define DEFAULT_INPUTMAX 2048
+#define DEFAULT_URING_LENGTH  ((size_t) 256*1024)
 #define STR(s)   XSTR(s)
 #define XSTR(s)  #s
 
@@ -44,6 +56,16 @@ struct FileOut {
     char *filename; // filename, if used
     int fd;         // file descriptor
     bool weOpened;  // did we open the file?
+
+    // Number of io_uring writes in flight, or 0 to not use io_uring, and
+    // the length of each write.
+    uint32_t uringDepth;
+    size_t uringLength;
+    // uring.fd is -1 if we are not using io_uring in this run.
+    struct Uring uring;
+    // The file status flags from before we took off O_APPEND, which we
+    // only do to a file that we opened.
+    int fileFlags;
 };
 
 
@@ -92,6 +114,30 @@ char *InputMax_config(int argc, const char * const *argv,
 }
 
 
+static
+char *IoUring_config(int argc, const char * const *argv,
+        struct FileOut *f) {
+
+    DASSERT(f);
+
+    if(argc < 2)
+        return 0;
+
+    f->uringDepth = strtoul(argv[1], 0, 10);
+    if(argc > 2)
+        f->uringLength = strtoul(argv[2], 0, 10);
+    if(f->uringLength < 1)
+        f->uringLength = DEFAULT_URING_LENGTH;
+
+    if(f->uringDepth)
+        // All the writes in flight are in the input ring buffer at once.
+        qsSetInputMax(0, f->uringDepth*f->uringLength);
+
+    return mprintf("IoUring %" PRIu32 " %zu", f->uringDepth,
+            f->uringLength);
+}
+
+
 static
 char *Filename_config(int argc, const char * const *argv,
         struct FileOut *f) {
@@ -154,6 +200,8 @@ int FileOut_declare(void) {
     // Defaults
     DASSERT(STDOUT_FILENO == 1);
     f->fd = STDOUT_FILENO; // Why the hell do they define this?
+    f->uringLength = DEFAULT_URING_LENGTH;
+    f->uring.fd = -1;
 
     qsSetUserData(f);
 
@@ -188,10 +236,127 @@ int FileOut_declare(void) {
             "FileDescriptor NUM",
             "FileDescriptor 1");
 
+    qsAddConfig(
+            (char *(*)(int, const char * const *, void *))
+            IoUring_config, "IoUring",
+            "Use io_uring(7) to keep DEPTH writes of LENGTH bytes in"
+            " flight, if the file is a regular file or block device."
+            "  DEPTH 0 uses write(2).  This sets InputMax to"
+            " DEPTH times LENGTH",
+            "IoUring DEPTH [LENGTH]",
+            "IoUring 0 " STR(DEFAULT_URING_LENGTH));
+
     return 0; // success
 }
 
 
+// Returns true if we are using io_uring.
+//
+static bool StartUring(struct FileOut *f) {
+
+    struct stat st;
+    ASSERT(fstat(f->fd, &st) == 0);
+    if(!S_ISREG(st.st_mode) && !S_ISBLK(st.st_mode))
+        // A pipe or socket will use epoll with write(2).
+        return false;
+
+    f->fileFlags = fcntl(f->fd, F_GETFL, 0);
+    ASSERT(f->fileFlags != -1);
+
+    // The writes in flight may finish in any order, so they need file
+    // offsets.  The kernel ignores the offsets with O_APPEND, so we
+    // append by starting at the end of the file and take off O_APPEND
+    // until stop().  The file status flags belong to the open file
+    // description, so we can't do that to a file descriptor that we
+    // did not open; the other processes that share it may be appending
+    // to it too.
+    if((f->fileFlags & O_APPEND) && !f->weOpened) {
+        INFO("File descriptor %d is in append mode; using write(2)",
+                f->fd);
+        return false;
+    }
+
+    off_t offset = lseek(f->fd, 0,
+            (f->fileFlags & O_APPEND)?SEEK_END:SEEK_CUR);
+    if(offset < 0)
+        return false;
+
+    if(UringInit(&f->uring, f->uringDepth)) {
+        INFO("Cannot make an io_uring; using write(2)");
+        return false;
+    }
+    f->uring.offset = offset;
+
+    if(f->fileFlags & O_APPEND)
+        ASSERT(-1 != fcntl(f->fd, F_SETFL, f->fileFlags & ~O_APPEND));
+
+    DSPEW("Using io_uring fd=%d with %" PRIu32 " writes of %zu bytes",
+            f->uring.fd, f->uringDepth, f->uringLength);
+
+    // The first flow() call is made when there is a completion, so we
+    // start with one.
+    UringSubmitNop(&f->uring);
+    if(UringEnter(&f->uring, false)) {
+        UringDestroy(&f->uring);
+        if(f->fileFlags & O_APPEND)
+            fcntl(f->fd, F_SETFL, f->fileFlags);
+        return false;
+    }
+
+    // Completions make flow() get called.
+    qsAddEpollReadJob(f->uring.fd, 0);
+
+    return true;
+}
+
+
+static void StopUring(struct FileOut *f) {
+
+    if(f->uring.fd < 0) return;
+
+    UringDrain(&f->uring);
+    // Leave the file position after what we wrote, like write(2) would.
+    lseek(f->fd, f->uring.offset, SEEK_SET);
+    if(f->fileFlags & O_APPEND)
+        fcntl(f->fd, F_SETFL, f->fileFlags);
+    UringDestroy(&f->uring);
+}
+
+
+static int UringFlow(const void *in, size_t inLen, struct FileOut *f) {
+
+    struct Uring *u = &f->uring;
+
+    int err = UringReap(u);
+
+    size_t len = UringPopDone(u);
+    if(len)
+        qsAdvanceInput(0, len);
+
+    if(err) {
+        if(err < 0) {
+            errno = -err;
+            WARN("io_uring write(%d,,) failed", f->fd);
+        } else
+            // Returned 0.  I'm not sure what this means.
+            WARN("io_uring write(%d,,) returned 0", f->fd);
+        UringDrain(u);
+        return 1; // done for this flow cycle.
+    }
+
+    // The kernel only reads this memory.
+    UringQueue(u, IORING_OP_WRITE, f->fd, ((uint8_t *) in) + len,
+            inLen - len, f->uringLength);
+
+    if(UringEnter(u, false)) {
+        UringDrain(u);
+        return 1;
+    }
+
+    return 0;
+}
+
+
 int FileOut_start(uint32_t numInputs, uint32_t numOutputs,
         struct FileOut *f) {
 
@@ -220,6 +385,12 @@ int FileOut_start(uint32_t numInputs, uint32_t numOutputs,
 
     DSPEW("f->filename=\"%s\"  fd=%d", f->filename, f->fd);
 
+    if(f->uringDepth && StartUring(f))
+        return 0;
+
+    // If it's a pipe or socket, only call flow() when we can write.
+    qsAddEpollWriteJob(f->fd, 0);
+
     return 0;
 }
 
@@ -231,6 +402,9 @@ int FileOut_flow(const void * const in[], const size_t inLens[],
 
     DASSERT(f->fd >= 0);
 
+    if(f->uring.fd > -1)
+        return UringFlow(*in, *inLens, f);
+
     if(!(*inLens))
         // Got nothing to write out to the file.
         return 0;
@@ -238,6 +412,10 @@ int FileOut_flow(const void * const in[], const size_t inLens[],
 
     ssize_t ret = write(f->fd, *in, *inLens);
 
+    if(ret < 0 && errno == EAGAIN)
+        // No room to write after all.
+        return 0;
+
     if(ret <= 0) {
         if(ret < 0)
             WARN("write(%d,%p,%zu)=%zd failed", f->fd, *in, *inLens, ret);
@@ -258,6 +436,7 @@ int FileOut_stop(uint32_t numInputs, uint32_t numOutputs,
 
     DSPEW();
 
+    StopUring(f);
     CleanUpFd(f);
 
     return 0;
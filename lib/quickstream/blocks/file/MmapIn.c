@@ -0,0 +1,372 @@
+// A source block that reads a regular file by mapping it to memory with
+// mmap(2), for replaying large captured files.
+//
+// If the file part is played once, the output buffer is the memory
+// mapping of the file (see qsMapOutputFile()), so the data that the
+// blocks downstream read are the page cache pages of the file; there is
+// no copying at all, flow() just advances the output.
+//
+// If the file part is played more than once ("Loop"), the output must be
+// a ring buffer that wraps around, so we copy from our own memory
+// mapping of the file to the output; that is one memcpy() and no
+// read(2) system calls.
+//
+// Either way we madvise(2) the kernel that we will need the next part of
+// the file, so that the blocks downstream do not wait in page faults.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+struct MmapIn;
+#define QS_USER_DATA_TYPE  struct MmapIn *
+#include "../../../../include/quickstream.h"
+#include "../../../debug.h"
+#include "../../../mprintf.h"
+
+
+#define DEFAULT_OUTPUTMAX  ((size_t) 1024*1024)
+#define STR(s)   XSTR(s)
+#define XSTR(s)  #s
+
+
+struct MmapIn {
+
+    char *filename;
+
+    // The part of the file to play, from the configuration.  length 0 is
+    // to the end of the file.
+    off_t offset;
+    size_t length;
+
+    // Number of times to play the file part, 0 for forever.
+    size_t loop;
+
+    size_t outputMax;
+
+    // The rest is for a stream run.
+
+    int fd;
+
+    // The length of the file part, for this run.
+    size_t len;
+
+    // Bytes of the file part played in this loop, and the number of
+    // loops done.
+    size_t pos;
+    size_t loopCount;
+
+    // Our mapping of the file, if we copy, and the start of the file
+    // part in it.
+    uint8_t *map;
+    size_t mapLength;
+    const uint8_t *data;
+};
+
+
+static
+char *Filename_config(int argc, const char * const *argv,
+        struct MmapIn *m) {
+
+    if(argc < 2 || !argv[1][0]) {
+        ERROR("Need a filename");
+        return QS_CONFIG_FAIL;
+    }
+
+    if(m->filename)
+        free(m->filename);
+    m->filename = strdup(argv[1]);
+    ASSERT(m->filename, "strdup() failed");
+
+    return mprintf("Filename %s", m->filename);
+}
+
+
+static
+char *Offset_config(int argc, const char * const *argv,
+        struct MmapIn *m) {
+
+    m->offset = qsParseSizet(0);
+
+    return mprintf("Offset %jd", (intmax_t) m->offset);
+}
+
+
+static
+char *Length_config(int argc, const char * const *argv,
+        struct MmapIn *m) {
+
+    m->length = qsParseSizet(0);
+
+    return mprintf("Length %zu", m->length);
+}
+
+
+static
+char *Loop_config(int argc, const char * const *argv,
+        struct MmapIn *m) {
+
+    m->loop = qsParseSizet(1);
+
+    return mprintf("Loop %zu", m->loop);
+}
+
+
+static
+char *OutputMax_config(int argc, const char * const *argv,
+        struct MmapIn *m) {
+
+    m->outputMax = qsParseSizet(DEFAULT_OUTPUTMAX);
+
+    if(m->outputMax < 1)
+        m->outputMax = 1;
+
+    qsSetOutputMax(0, m->outputMax);
+
+    return mprintf("OutputMax %zu", m->outputMax);
+}
+
+
+int declare(void) {
+
+    struct MmapIn *m = calloc(1, sizeof(*m));
+    ASSERT(m, "calloc(1,%zu) failed", sizeof(*m));
+    m->loop = 1;
+    m->outputMax = DEFAULT_OUTPUTMAX;
+    m->fd = -1;
+
+    qsSetUserData(m);
+
+    // This block is a source with a single output stream
+    qsSetNumOutputs(1, 1);
+
+    qsSetOutputMax(0/*port*/, DEFAULT_OUTPUTMAX);
+
+    qsAddConfig((char *(*)(int, const char * const *, void *))
+            Filename_config, "Filename",
+            "The regular file to read.  Filename must be set",
+            "Filename FILENAME",
+            "Filename");
+
+    qsAddConfig((char *(*)(int, const char * const *, void *))
+            Offset_config, "Offset",
+            "The byte offset in the file to start reading at",
+            "Offset BYTES",
+            "Offset 0");
+
+    qsAddConfig((char *(*)(int, const char * const *, void *))
+            Length_config, "Length",
+            "The number of bytes to read after the Offset.  0 is to the"
+            " end of the file",
+            "Length BYTES",
+            "Length 0");
+
+    qsAddConfig((char *(*)(int, const char * const *, void *))
+            Loop_config, "Loop",
+            "The number of times to play the file part.  0 plays it"
+            " forever.  More than 1 copies the data from the file mapping"
+            " to the output",
+            "Loop NUM",
+            "Loop 1");
+
+    qsAddConfig((char *(*)(int, const char * const *, void *))
+            OutputMax_config, "OutputMax",
+            "Bytes written per flow() call",
+            "OutputMax BYTES",
+            "OutputMax " STR(DEFAULT_OUTPUTMAX));
+
+    return 0;
+}
+
+
+static void CleanUp(struct MmapIn *m) {
+
+    if(m->map) {
+        munmap(m->map, m->mapLength);
+        m->map = 0;
+        m->data = 0;
+    }
+    if(m->fd > -1) {
+        close(m->fd);
+        m->fd = -1;
+    }
+}
+
+
+int start(uint32_t numInputs, uint32_t numOutputs, struct MmapIn *m) {
+
+    if(!m->filename) {
+        ERROR("The Filename was not configured");
+        return -1;
+    }
+
+    m->fd = open(m->filename, O_RDONLY|O_CLOEXEC);
+    if(m->fd < 0) {
+        ERROR("open(\"%s\", O_RDONLY) failed", m->filename);
+        return -1;
+    }
+
+    struct stat st;
+    ASSERT(fstat(m->fd, &st) == 0);
+    if(!S_ISREG(st.st_mode)) {
+        ERROR("\"%s\" is not a regular file", m->filename);
+        goto fail;
+    }
+    if(m->offset > st.st_size) {
+        ERROR("Offset %jd is past the end of the %jd byte file \"%s\"",
+                (intmax_t) m->offset, (intmax_t) st.st_size,
+                m->filename);
+        goto fail;
+    }
+
+    m->len = st.st_size - m->offset;
+    if(m->length && m->length < m->len)
+        m->len = m->length;
+    m->pos = 0;
+    m->loopCount = 0;
+
+    if(!m->len) {
+        // Nothing to read.  flow() will finish.
+        CleanUp(m);
+        return 0;
+    }
+
+    if(m->loop == 1) {
+        if(qsMapOutputFile(0, m->fd, m->offset, m->len))
+            goto fail;
+        DSPEW("Mapping %zu bytes of \"%s\" to the output",
+                m->len, m->filename);
+        return 0;
+    }
+
+    size_t pagesize = getpagesize();
+    size_t head = m->offset % pagesize;
+    m->mapLength = head + m->len;
+    m->map = mmap(0, m->mapLength, PROT_READ, MAP_PRIVATE,
+            m->fd, m->offset - head);
+    if(m->map == MAP_FAILED) {
+        m->map = 0;
+        ERROR("mmap() \"%s\" failed", m->filename);
+        goto fail;
+    }
+    m->data = m->map + head;
+    madvise(m->map, m->mapLength, MADV_SEQUENTIAL);
+
+    DSPEW("Copying %zu bytes of \"%s\" %zu times",
+            m->len, m->filename, m->loop);
+
+    return 0;
+
+fail:
+
+    CleanUp(m);
+    return -1;
+}
+
+
+// Tell the kernel that we will need the len bytes at p soon.
+//
+static inline void WillNeed(const uint8_t *p, size_t len) {
+
+    if(!len) return;
+
+    size_t pagesize = getpagesize();
+    size_t head = ((uintptr_t) p) % pagesize;
+    madvise((void *) (p - head), head + len, MADV_WILLNEED);
+}
+
+
+int flow(const void * const in[], const size_t inLens[],
+        uint32_t numIn,
+        void * const out[], const size_t outLens[], uint32_t numOut,
+        struct MmapIn *m) {
+
+    if(m->pos == m->len && !m->map)
+        // We are done, or there was nothing to read.
+        return 1;
+
+    size_t len = outLens[0];
+    if(!len)
+        return 0;
+
+    if(!m->map) {
+        // The output is the file.  There is nothing to do but let the
+        // readers have it.
+        if(len > m->len - m->pos)
+            len = m->len - m->pos;
+        m->pos += len;
+        size_t ahead = m->len - m->pos;
+        if(ahead > m->outputMax)
+            ahead = m->outputMax;
+        WillNeed(((const uint8_t *) out[0]) + len, ahead);
+        qsAdvanceOutput(0, len);
+        return 0;
+    }
+
+    // Copy from our mapping, looping back to the start of the file part.
+    size_t n = 0;
+    while(n < len) {
+        size_t l = m->len - m->pos;
+        if(l > len - n)
+            l = len - n;
+        memcpy(((uint8_t *) out[0]) + n, m->data + m->pos, l);
+        n += l;
+        m->pos += l;
+        if(m->pos == m->len) {
+            m->pos = 0;
+            if(m->loop && ++m->loopCount == m->loop) {
+                // That was the last loop.
+                m->pos = m->len;
+                munmap(m->map, m->mapLength);
+                m->map = 0;
+                m->data = 0;
+                break;
+            }
+        }
+    }
+
+    if(m->map) {
+        size_t ahead = m->len - m->pos;
+        if(ahead > m->outputMax)
+            ahead = m->outputMax;
+        WillNeed(m->data + m->pos, ahead);
+    }
+
+    qsAdvanceOutput(0, n);
+
+    return 0;
+}
+
+
+int stop(uint32_t numInputs, uint32_t numOutputs, struct MmapIn *m) {
+
+    CleanUp(m);
+
+    return 0;
+}
+
+
+int undeclare(struct MmapIn *m) {
+
+    DASSERT(m);
+
+    CleanUp(m);
+
+    if(m->filename)
+        free(m->filename);
+
+#ifdef DEBUG
+    memset(m, 0, sizeof(*m));
+#endif
+    free(m);
+
+    return 0;
+}
@@ -1,12 +1,27 @@
 // This is the source code to a built-in block that is compiled into
 // lib/libquickstream.so
 //
-// TODO: Add a non-blocking read version/option that uses the qs
-// epoll_wait(2) thread.
+// The flow() is only called when the graph's epoll_wait(2) thread sees
+// that we can read the pipe; see qsAddEpollReadJob().
 //
 // quickstream built-in block that launches a program at construct() or
 // start(), then reads a pipe which may be feed by the program.
-
+//
+// With the SpliceProgram configured we launch a second program and move
+// the output of the first program to the input of the second with
+// splice(2), so the data goes from pipe to pipe in the kernel and is
+// never copied into this process.  If the blocks connected to our output
+// want the data too, we tee(2) it to the second program and read(2) the
+// same bytes to our output.
+//
+// When we splice, flow() may wait on either pipe: for the first program
+// to write, or for the second program to read.  The graph's epoll thread
+// watches one file descriptor for a block, so we give it an epoll(7)
+// file descriptor of our own, that watches the pipe that we are waiting
+// on; see SpliceWait().  So a slow SpliceProgram does not keep a worker
+// thread waiting in flow().
+
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
@@ -15,7 +30,10 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/wait.h>
+#include <poll.h>
+#include <sys/epoll.h>
 
 #include "../../../debug.h"
 #include "../../../parseBool.h"
@@ -25,6 +43,8 @@
 
 
 #define DEFAULT_OUTPUTMAX 2048
+// Bytes per splice(2) call, when we do not tee(2) to our output.
+#define SPLICE_LEN       ((size_t) 1024*1024)
 #define STR(s)   XSTR(s)
 #define XSTR(s)  #s
 
@@ -38,17 +58,27 @@ struct PipeIn {
     int signalNum;   // signal at stop() or destroy() 0 => none
     bool atStart;    // or at construct()
     bool doWait;
-};
 
+    size_t pipeSize; // for F_SETPIPE_SZ, 0 => the system default
 
+    char **spliceProgram; // program we splice to, or 0 => none
+    pid_t splicePid;
+    int spliceFd;    // write end of the pipe to spliceProgram
+    bool spliceOnly; // do not tee(2) to our output
+
+    // The epoll(7) file descriptor that the graph's epoll thread watches
+    // when we splice, and if it's watching spliceFd and not fd.
+    int spliceEpfd;
+    bool waitOnSplice;
+};
 
-static void CleanUpProgram(struct PipeIn *p) {
 
-    DASSERT(p);
 
-    if(p->program) {
+static void FreeArgv(char **argv) {
 
-        for(char **str = p->program; *str; ++str) {
+    if(argv) {
+
+        for(char **str = argv; *str; ++str) {
 #ifdef DEBUG
             memset(*str, 0, strlen(*str));
 #endif
@@ -57,9 +87,39 @@ static void CleanUpProgram(struct PipeIn *p) {
             *str = 0;
 #endif
         }
-        free(p->program);
-        p->program = 0;
+        free(argv);
+    }
+}
+
+
+static void CleanUpProgram(struct PipeIn *p) {
+
+    DASSERT(p);
+
+    FreeArgv(p->program);
+    p->program = 0;
+    FreeArgv(p->spliceProgram);
+    p->spliceProgram = 0;
+}
+
+
+// Returns a copy of argv[1], argv[2], ... with a Null terminator.
+//
+static char **CopyArgv(int argc, const char * const *argv) {
+
+    DASSERT(argc > 1);
+
+    char **ret = calloc(argc, sizeof(*ret));
+    ASSERT(ret, "calloc(%d,%zu) failed", argc, sizeof(*ret));
+
+    for(int i=1; i<argc; ++i) {
+        ret[i-1] = strdup(argv[i]);
+        ASSERT(ret[i-1], "strdup() failed");
     }
+    // Terminate the array of strings with a Null terminator.
+    ret[argc-1] = 0;
+
+    return ret;
 }
 
 
@@ -133,19 +193,8 @@ char *Program_config(int argc, const char * const *argv,
         // Kind of pointless of the user to do this?
         return 0;
 
-    if(p->program)
-        CleanUpProgram(p);
-
-
-    p->program = calloc(argc, sizeof(*p->program));
-    ASSERT(p->program, "calloc(%d,%zu) failed", argc, sizeof(*p->program));
-
-    for(int i=1; i<argc; ++i) {
-        p->program[i-1] = strdup(argv[i]);
-        ASSERT(p->program[i-1], "strdup() failed");
-    }
-    // Terminate the array of strings with a Null terminator.
-    p->program[argc-1] = 0;
+    FreeArgv(p->program);
+    p->program = CopyArgv(argc, argv);
 
 #if 0
     fprintf(stderr, "program=");
@@ -159,6 +208,54 @@ WARN("p=%p p->childPid=%u", p, p->childPid);
 }
 
 
+static
+char *SpliceProgram_config(int argc, const char * const *argv,
+        struct PipeIn *p) {
+
+    DASSERT(p);
+
+    FreeArgv(p->spliceProgram);
+    p->spliceProgram = 0;
+
+    if(argc < 2)
+        // No program to splice to.
+        return 0;
+
+    p->spliceProgram = CopyArgv(argc, argv);
+
+    return 0; // success
+}
+
+
+static
+char *SpliceOnly_config(int argc, const char * const *argv,
+        struct PipeIn *p) {
+
+    DASSERT(p);
+
+    if(argc < 2) {
+        p->spliceOnly = true;
+        return 0;
+    }
+
+    p->spliceOnly = qsParseBool(argv[1]);
+
+    return 0;
+}
+
+
+static
+char *PipeSize_config(int argc, const char * const *argv,
+        struct PipeIn *p) {
+
+    DASSERT(p);
+
+    p->pipeSize = qsParseSizet(0);
+
+    return 0;
+}
+
+
 
 int PipeIn_declare(void) {
 
@@ -167,6 +264,8 @@ int PipeIn_declare(void) {
 
     // Defaults
     p->fd = -1;
+    p->spliceFd = -1;
+    p->spliceEpfd = -1;
     p->signalNum = SIGTERM;
     p->doWait = true;
 
@@ -210,11 +309,104 @@ int PipeIn_declare(void) {
             "Program COMMAND [ARG1 ...]",
             "Program cat");
 
+    qsAddConfig(
+            (char *(*)(int, const char * const *, void *))
+            SpliceProgram_config, "SpliceProgram",
+            "Launch a second program with the first program, and"
+            " splice(2) the output of the first program to the input of"
+            " the second program.  The data does not get copied into this"
+            " process, unless we write it to our output too; see"
+            " SpliceOnly.  With no COMMAND there is no second program",
+            "SpliceProgram [COMMAND [ARG1 ...]]",
+            "SpliceProgram");
+
+    qsAddConfig(
+            (char *(*)(int, const char * const *, void *))
+            SpliceOnly_config, "SpliceOnly",
+            "With a SpliceProgram, only splice(2) the data to the"
+            " SpliceProgram and write nothing to our output.  Otherwise"
+            " we tee(2) the data to the SpliceProgram and read(2) it to"
+            " our output too",
+            "SpliceOnly [BOOL]",
+            "SpliceOnly False");
+
+    qsAddConfig(
+            (char *(*)(int, const char * const *, void *))
+            PipeSize_config, "PipeSize",
+            "Set the size of the pipes in bytes with fcntl(F_SETPIPE_SZ)."
+            "  Bigger pipes mean fewer system calls and context switches."
+            "  0 is the system default",
+            "PipeSize BYTES",
+            "PipeSize 0");
+
 
     return 0; // success
 }
 
 
+static void SignalCatcher(int sig) {
+
+    INFO("----------------caught signal %d", sig);
+}
+
+
+static inline void
+SetPipeSize(struct PipeIn *p, int fd) {
+
+    if(p->pipeSize && fcntl(fd, F_SETPIPE_SZ, (int) p->pipeSize) < 0)
+        // Unprivileged users can't go over /proc/sys/fs/pipe-max-size.
+        WARN("fcntl(%d, F_SETPIPE_SZ, %zu) failed", fd, p->pipeSize);
+}
+
+
+// Launch the program that we splice to.
+//
+static inline int
+StartSplice(struct PipeIn *p) {
+
+    DASSERT(p->spliceProgram);
+    DASSERT(p->splicePid == 0);
+    DASSERT(p->spliceFd < 0);
+
+    int fd[2];
+    ASSERT(pipe(fd) == 0);
+    SetPipeSize(p, fd[1]);
+
+    {
+        // Like in PipeOut.c.  We handle the splice() broken pipe error
+        // and we get the return status of the child.
+        struct sigaction act = {
+            .sa_handler = SignalCatcher,
+            .sa_flags = SA_NODEFER
+        };
+        CHECK(sigaction(SIGCHLD, &act, 0));
+        CHECK(sigaction(SIGPIPE, &act, 0));
+    }
+
+    p->splicePid = fork();
+    ASSERT(p->splicePid >= 0, "fork() failed");
+    if(p->splicePid) {
+        // I'm the parent.
+        p->spliceFd = fd[1];
+        close(fd[0]);
+        return 0;
+    }
+
+    // else I'm the child:
+    close(fd[1]);
+    // The first program's pipe is not for us.
+    close(p->fd);
+    DASSERT(STDIN_FILENO == 0);
+    ASSERT(dup2(fd[0], STDIN_FILENO) != -1);
+
+    execvp(p->spliceProgram[0], p->spliceProgram);
+
+    ERROR("execlp(\"%s\",,0) failed", p->spliceProgram[0]);
+
+    return -1;
+}
+
+
 static inline int
 Start(struct PipeIn *p) {
 
@@ -225,6 +417,7 @@ Start(struct PipeIn *p) {
 
     int fd[2];
     ASSERT(pipe(fd) == 0);
+    SetPipeSize(p, fd[0]);
 
     p->childPid = fork();
     ASSERT(p->childPid >= 0, "fork() failed");
@@ -232,6 +425,8 @@ Start(struct PipeIn *p) {
         // I'm the parent.
         p->fd = fd[0];
         close(fd[1]);
+        if(p->spliceProgram)
+            return StartSplice(p);
         return 0;
     }
 
@@ -276,6 +471,30 @@ Stop(struct PipeIn *p) {
     p->childPid = 0;
     p->fd = -1;
 
+    if(!p->splicePid)
+        return 0;
+
+    // Closing the pipe is the end of file for the program that we
+    // splice to.
+    close(p->spliceFd);
+
+    if(p->signalNum)
+        if(kill(p->splicePid, p->signalNum))
+            WARN("kill(%u,%d) failed", p->splicePid, p->signalNum);
+
+    if(p->doWait) {
+        int status = 0;
+        pid_t pid = waitpid(p->splicePid, &status, 0);
+        if(pid < 0)
+            WARN("waitpid(%u,,0) returned %u", p->splicePid, pid);
+        else
+            DSPEW("waitpid(%u,,0) returned status %d",
+                    p->splicePid, status);
+    }
+
+    p->splicePid = 0;
+    p->spliceFd = -1;
+
     return 0;
 }
 
@@ -295,13 +514,118 @@ int PipeIn_start(uint32_t numInputs, uint32_t numOutputs,
 
     DASSERT(p);
 
-    if(p->program && p->atStart)
-        return Start(p);
+    if(p->program && p->atStart && Start(p))
+        return -1;
+
+    if(p->fd > -1 && p->spliceFd > -1) {
+        // Only call flow() when there is something to read and room to
+        // splice it to.  We start waiting to read.
+        p->spliceEpfd = epoll_create1(EPOLL_CLOEXEC);
+        ASSERT(p->spliceEpfd > -1, "epoll_create1() failed");
+        struct epoll_event ev = { .events = EPOLLIN };
+        ASSERT(epoll_ctl(p->spliceEpfd, EPOLL_CTL_ADD, p->fd, &ev) == 0);
+        ev.events = 0;
+        ASSERT(epoll_ctl(p->spliceEpfd, EPOLL_CTL_ADD, p->spliceFd,
+                &ev) == 0);
+        p->waitOnSplice = false;
+        qsAddEpollReadJob(p->spliceEpfd, 0);
+    } else if(p->fd > -1)
+        // Only call flow() when there is something to read, so a slow
+        // program does not hold a worker thread in read(2).
+        qsAddEpollReadJob(p->fd, 0);
 
     return 0;
 }
 
 
+// Make our epoll file descriptor watch the pipe to the SpliceProgram for
+// room to write if onSplice is set, else the pipe from the Program for
+// something to read.  When we wait to read, the pipe to the
+// SpliceProgram is still watched for errors, like if the SpliceProgram
+// exits, which makes the next splice(2) fail.  When we wait to write, we
+// take the pipe from the Program out, since epoll(7) always reports
+// EPOLLHUP, and the Program may have exited with data still in the
+// pipe; that would call flow() again and again until the SpliceProgram
+// made room.
+//
+static inline void
+SpliceWait(struct PipeIn *p, bool onSplice) {
+
+    if(onSplice == p->waitOnSplice)
+        return;
+
+    struct epoll_event ev = { .events = EPOLLIN };
+    if(onSplice)
+        ASSERT(epoll_ctl(p->spliceEpfd, EPOLL_CTL_DEL, p->fd, 0) == 0);
+    else
+        ASSERT(epoll_ctl(p->spliceEpfd, EPOLL_CTL_ADD, p->fd, &ev) == 0);
+    ev.events = onSplice?EPOLLOUT:0;
+    ASSERT(epoll_ctl(p->spliceEpfd, EPOLL_CTL_MOD, p->spliceFd, &ev) == 0);
+
+    p->waitOnSplice = onSplice;
+}
+
+
+// Move the program output to the SpliceProgram.
+//
+static inline int
+SpliceFlow(struct PipeIn *p, void *out, size_t outLen) {
+
+    ssize_t ret;
+
+    if(p->spliceOnly)
+        ret = splice(p->fd, 0, p->spliceFd, 0, SPLICE_LEN,
+                SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+    else {
+        if(!outLen)
+            // Got no room to write output to.
+            return 0;
+        // Copy the pipe buffer references, without reading them.
+        ret = tee(p->fd, p->spliceFd, outLen, SPLICE_F_NONBLOCK);
+    }
+
+    if(ret < 0 && errno == EAGAIN) {
+        // Nothing to read after all, or the pipe to the SpliceProgram is
+        // full.  We look, without waiting, to see which, and we have the
+        // epoll thread wait on that pipe.
+        struct pollfd pfd = { .fd = p->spliceFd, .events = POLLOUT };
+        SpliceWait(p, poll(&pfd, 1, 0) == 0);
+        return 0;
+    }
+
+    // We moved some data, so there was room.
+    SpliceWait(p, false);
+
+    if(ret <= 0) {
+        if(ret < 0)
+            WARN("%s(%d,,%d,)=%zd failed",
+                    p->spliceOnly?"splice":"tee", p->fd, p->spliceFd, ret);
+        else
+            // Returned 0.  End of file.
+            INFO("%s(%d,,%d,) returned 0",
+                    p->spliceOnly?"splice":"tee", p->fd, p->spliceFd);
+        return 1; // done for this flow cycle.
+    }
+
+    if(p->spliceOnly) {
+        // We did not advance our output, so we tell the stream that we
+        // moved data, so that flow() gets called again without waiting
+        // for epoll, until the splice(2) would block.
+        qsEpollAdvance();
+        return 0;
+    }
+
+    // Now read the same bytes that we just tee-ed.  They are in the pipe,
+    // and we are the only reader.
+    ssize_t rd = read(p->fd, out, ret);
+    ASSERT(rd == ret, "read(%d,%p,%zd)=%zd failed", p->fd, out, ret, rd);
+
+    qsAdvanceOutput(0, ret);
+
+    return 0; // success
+}
+
+
 int PipeIn_flow(const void * const in[], const size_t inLens[],
         uint32_t numIn,
         void * const out[], const size_t outLens[], uint32_t numOut,
@@ -309,6 +633,9 @@ int PipeIn_flow(const void * const in[], const size_t inLens[],
 
     DASSERT(p->fd >= 0);
 
+    if(p->spliceFd > -1)
+        return SpliceFlow(p, *out, *outLens);
+
     if(!(*outLens))
         // Got no room to write output to.
         return 0;
@@ -316,6 +643,10 @@ int PipeIn_flow(const void * const in[], const size_t inLens[],
 
     ssize_t ret = read(p->fd, *out, *outLens);
 
+    if(ret < 0 && errno == EAGAIN)
+        // Nothing to read after all.
+        return 0;
+
     if(ret <= 0) {
         if(ret < 0)
             WARN("read(%d,%p,%zu)=%zd failed", p->fd, *out, *outLens, ret);
@@ -334,6 +665,11 @@ int PipeIn_flow(const void * const in[], const size_t inLens[],
 int PipeIn_stop(uint32_t numInputs, uint32_t numOutputs,
         struct PipeIn *p) {
 
+    if(p->spliceEpfd > -1) {
+        close(p->spliceEpfd);
+        p->spliceEpfd = -1;
+    }
+
     if(p->program && p->atStart)
         return Stop(p);
 
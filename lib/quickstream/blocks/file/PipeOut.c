@@ -1,12 +1,19 @@
 // This is the source code to a built-in block that is compiled into
 // lib/libquickstream.so
 //
-// TODO: Add a non-blocking read version/option that uses the qs
-// epoll_wait(2) thread.
+// The flow() is only called when the graph's epoll_wait(2) thread sees
+// that we can write the pipe; see qsAddEpollWriteJob().
 //
 // quickstream built-in block that launches a program at construct() or
 // start(), then writes a pipe which may be read by the program.
+//
+// We write(2) and do not vmsplice(2) the input to the pipe.  vmsplice(2)
+// puts references to our ring buffer pages in the pipe, and the pages
+// get written with new stream data long before the program reads them;
+// the stream does not know when the program reads them.  A bigger pipe
+// (PipeSize) gets more done per system call.
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
@@ -15,6 +22,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/wait.h>
 #include <stdarg.h>
 
@@ -42,6 +50,7 @@ struct PipeOut {
     int signalNum;   // signal at stop() or destroy() 0 => none
     bool atStart;    // or at construct()
     bool doWait;
+    size_t pipeSize; // for F_SETPIPE_SZ, 0 => the system default
 };
 
 
@@ -124,6 +133,18 @@ char *SignalNum_config(int argc, const char * const *argv,
 }
 
 
+static
+char *PipeSize_config(int argc, const char * const *argv,
+        struct PipeOut *p) {
+
+    DASSERT(p);
+
+    p->pipeSize = qsParseSizet(0);
+
+    return 0;
+}
+
+
 static
 char *AtStart_config(int argc, const char * const *argv,
         struct PipeOut *p) {
@@ -243,6 +264,15 @@ int PipeOut_declare(void) {
             "Program COMMAND [ARG1 ...]",
             "Program cat");
 
+    qsAddConfig(
+            (char *(*)(int, const char * const *, void *))
+            PipeSize_config, "PipeSize",
+            "Set the size of the pipe in bytes with fcntl(F_SETPIPE_SZ)."
+            "  Bigger pipes mean fewer system calls and context switches."
+            "  0 is the system default",
+            "PipeSize BYTES",
+            "PipeSize 0");
+
     char *helpText = mprintf(
             "Prepend a directory to the PATH used to launch the program. "
             "If the directory given is not a full file path, prepend the "
@@ -284,6 +314,10 @@ Start(struct PipeOut *p) {
     int fd[2];
     ASSERT(pipe(fd) == 0);
 
+    if(p->pipeSize && fcntl(fd[1], F_SETPIPE_SZ, (int) p->pipeSize) < 0)
+        // Unprivileged users can't go over /proc/sys/fs/pipe-max-size.
+        WARN("fcntl(%d, F_SETPIPE_SZ, %zu) failed", fd[1], p->pipeSize);
+
     {
         struct sigaction act = {
             .sa_handler = SignalCatcher,
@@ -399,8 +433,13 @@ int PipeOut_start(uint32_t numInputs, uint32_t numOutputs,
 
     DASSERT(p);
 
-    if(p->program && p->atStart)
-        return Start(p);
+    if(p->program && p->atStart && Start(p))
+        return -1;
+
+    if(p->fd > -1)
+        // Only call flow() when the pipe has room, so a slow program
+        // does not hold a worker thread in write(2).
+        qsAddEpollWriteJob(p->fd, 0);
 
     return 0;
 }
@@ -419,6 +458,10 @@ int PipeOut_flow(const void * const in[], const size_t inLens[],
 
     ssize_t ret = write(p->fd, *in, *inLens);
 
+    if(ret < 0 && errno == EAGAIN)
+        // The pipe is full after all.
+        return 0;
+
     if(ret <= 0) {
         if(ret < 0)
             WARN("write(%d,%p,%zu)=%zd failed", p->fd, *in, *inLens, ret);
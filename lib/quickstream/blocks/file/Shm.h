@@ -0,0 +1,300 @@
+// The shared memory segment that the ShmOut and ShmIn blocks use to pass
+// a stream from one quickstream process to another.  This is included in
+// ShmOut.c and ShmIn.c.
+//
+// A ShmOut block in one process writes to a named segment and a ShmIn
+// block, with the same "Name" configured, in another process reads it.
+// The segment is a page with the struct ShmHeader in it and then a ring
+// buffer.  The write and read counts in the header are like the
+// QsOutput::writeCount and QsInput::readCount in libquickstream.so, but
+// they are shared between processes.
+//
+// The ring buffer is the stream ring buffer in both processes: ShmOut
+// calls qsMapInputShared() so that the block that feeds it writes into
+// the segment, and ShmIn calls qsMapOutputShared() so that the blocks
+// that read it read from the segment.  Byte number n of the stream is at
+// n % length in the ring buffer in both processes.  So the blocks do not
+// copy the data, they just pass the write and read counts along, and so
+// long as the two blocks keep up with each other there are no system
+// calls.
+//
+// When one side has to wait for the other (the ring buffer is full for
+// the writer, or empty for the reader) it sets its' "waiting" flag in the
+// header and waits on a "doorbell", and the other side rings the doorbell
+// when it sees the flag.  We wanted the block's flow() to be called by
+// the graph's epoll thread when the doorbell rings, and not have a
+// worker thread block in a futex(2) wait; epoll(7) cannot wait on a
+// futex, and an eventfd(2) cannot be opened by name by another process
+// (it would need to be passed in a unix domain socket).  So the doorbells
+// are named FIFOs next to the segment in /dev/shm/.  The doorbell is
+// "ringing" while there is a byte in the FIFO.  We keep our own doorbell
+// ringing while we have work to do, so that the epoll thread keeps
+// letting flow() be called; and we empty it just before we set our
+// waiting flag, so that a ring after that is not lost.
+//
+// The segment and the FIFOs are removed when the last of the two blocks
+// detaches, at the block's stop().  So the segment is good for one stream
+// run.
+
+
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+
+// shm_open(3) on GNU/Linux makes the files in this directory.  We make
+// the doorbell FIFOs there too.
+#define SHM_DIR  "/dev/shm"
+
+#define SHM_MAGIC  ((uint64_t) 0x71734d4853000001) // "qsMHS" version 1
+
+#define DEFAULT_LENGTH  ((size_t) 4*1024*1024)
+
+
+struct ShmHeader {
+
+    uint64_t magic;
+
+    // The length of the ring buffer in bytes.
+    uint64_t length;
+
+    // The number of ShmOut and ShmIn blocks attached; 0 or 1 each.
+    uint32_t writers, readers;
+
+    // The writer and reader parts are in different cache lines, so the
+    // two processes do not keep taking the cache line from each other.
+
+    _Alignas(64)
+    // Total bytes written.  Only the writer adds to it.
+    _Atomic uint64_t writeCount;
+    // Set by the writer after the last write.
+    atomic_bool writerDone;
+    // Set by the writer when it waits for room to write.
+    atomic_bool writerWaiting;
+
+    _Alignas(64)
+    // Total bytes read.  Only the reader adds to it.
+    _Atomic uint64_t readCount;
+    // Set by the reader when it waits for data to read.
+    atomic_bool readerWaiting;
+};
+
+
+struct Shm {
+
+    // We map just the header page.  libquickstream.so maps the ring
+    // buffer, at the next page in the file, fd.
+    struct ShmHeader *header;
+    size_t mapLength;
+    int fd;
+
+    // File descriptors for our doorbell FIFO, which we read, and the
+    // doorbell FIFO of the other block, which we write.
+    int myBell, otherBell;
+
+    bool isWriter;
+
+    // The paths to the segment and the FIFOs.
+    char shmName[64];
+    char writerBell[80];
+    char readerBell[80];
+};
+
+
+static inline void RingBell(int fd) {
+
+    uint8_t b = 1;
+    // If the FIFO is full (EAGAIN) it's ringing already.
+    if(write(fd, &b, 1) < 0 && errno != EAGAIN)
+        WARN("write() to doorbell FIFO failed");
+}
+
+
+static inline void EmptyBell(int fd) {
+
+    uint8_t buf[64];
+    while(read(fd, buf, sizeof(buf)) > 0);
+}
+
+
+// Open a doorbell FIFO, making it if need be.  We open it read and write,
+// so that opening does not block waiting for the other end, and reading
+// it never gets end of file.
+//
+static inline int OpenBell(const char *path) {
+
+    if(mkfifo(path, S_IRUSR|S_IWUSR) && errno != EEXIST) {
+        ERROR("mkfifo(\"%s\",) failed", path);
+        return -1;
+    }
+
+    int fd = open(path, O_RDWR|O_NONBLOCK|O_CLOEXEC);
+    if(fd < 0)
+        ERROR("open(\"%s\",O_RDWR) failed", path);
+
+    return fd;
+}
+
+
+static inline void
+ShmDetach(struct Shm *s) {
+
+    if(!s->header) return;
+
+    struct ShmHeader *h = s->header;
+
+    flock(s->fd, LOCK_EX);
+
+    if(s->isWriter)
+        --h->writers;
+    else
+        --h->readers;
+
+    if(!h->writers && !h->readers) {
+        // We are the last one, so we remove it all.
+        DSPEW("Removing shared memory \"%s\"", s->shmName);
+        shm_unlink(s->shmName);
+        unlink(s->writerBell);
+        unlink(s->readerBell);
+    }
+
+    flock(s->fd, LOCK_UN);
+    close(s->fd);
+    s->fd = -1;
+
+    munmap(s->header, s->mapLength);
+    s->header = 0;
+
+    if(s->myBell > -1) {
+        close(s->myBell);
+        s->myBell = -1;
+    }
+    if(s->otherBell > -1) {
+        close(s->otherBell);
+        s->otherBell = -1;
+    }
+}
+
+
+// Attach to, or make, the shared memory segment with name.  length is
+// the ring buffer length that we make it with if we are the first to
+// attach, else we use the length that the other block made it with.  We
+// keep the file open in s->fd for qsMapInputShared() or
+// qsMapOutputShared().  Returns true on error.
+//
+static inline bool
+ShmAttach(struct Shm *s, const char *name, size_t length, bool isWriter) {
+
+    DASSERT(!s->header);
+
+    s->isWriter = isWriter;
+    s->myBell = -1;
+    s->otherBell = -1;
+
+    if(!name || !name[0] || strchr(name, '/') ||
+            strlen(name) > sizeof(s->shmName) - 8) {
+        ERROR("Bad shared memory name \"%s\"", name?name:"");
+        return true;
+    }
+
+    snprintf(s->shmName, sizeof(s->shmName), "/qs_%s", name);
+    snprintf(s->writerBell, sizeof(s->writerBell),
+            SHM_DIR "/qs_%s.wbell", name);
+    snprintf(s->readerBell, sizeof(s->readerBell),
+            SHM_DIR "/qs_%s.rbell", name);
+
+    int fd = shm_open(s->shmName, O_RDWR|O_CREAT|O_CLOEXEC,
+            S_IRUSR|S_IWUSR);
+    if(fd < 0) {
+        ERROR("shm_open(\"%s\",) failed", s->shmName);
+        return true;
+    }
+
+    // The other process may be doing this at the same time.
+    CHECK(flock(fd, LOCK_EX));
+
+    size_t pageSize = getpagesize();
+    struct stat st;
+    ASSERT(fstat(fd, &st) == 0);
+
+    if(st.st_size == 0) {
+        // We are first.  The header gets a page and the ring buffer
+        // starts at the next page.
+        length = ((length + pageSize - 1)/pageSize)*pageSize;
+        if(ftruncate(fd, pageSize + length)) {
+            ERROR("ftruncate(\"%s\",%zu) failed", s->shmName,
+                    pageSize + length);
+            goto fail;
+        }
+        st.st_size = pageSize + length;
+    }
+
+    s->mapLength = pageSize;
+    s->header = mmap(0, s->mapLength, PROT_READ|PROT_WRITE,
+            MAP_SHARED, fd, 0);
+    if(s->header == MAP_FAILED) {
+        s->header = 0;
+        ERROR("mmap(\"%s\") failed", s->shmName);
+        goto fail;
+    }
+    struct ShmHeader *h = s->header;
+
+    if(!h->magic) {
+        // ftruncate() made it all zeros.
+        h->length = st.st_size - pageSize;
+        h->magic = SHM_MAGIC;
+    } else if(h->magic != SHM_MAGIC ||
+            h->length != st.st_size - pageSize) {
+        ERROR("Shared memory \"%s\" is not from this version of"
+                " quickstream", s->shmName);
+        goto fail;
+    }
+
+    if(isWriter && (h->writers || h->writerDone)) {
+        // Maybe left over from a process that crashed.
+        ERROR("Shared memory \"%s\" has been written to already;"
+                " remove " SHM_DIR "%s if it's stale",
+                s->shmName, s->shmName);
+        goto fail;
+    }
+    if(!isWriter && h->readers) {
+        ERROR("Shared memory \"%s\" has a reader already", s->shmName);
+        goto fail;
+    }
+
+    s->myBell = OpenBell(isWriter?s->writerBell:s->readerBell);
+    s->otherBell = OpenBell(isWriter?s->readerBell:s->writerBell);
+    if(s->myBell < 0 || s->otherBell < 0)
+        goto fail;
+
+    if(isWriter)
+        ++h->writers;
+    else
+        ++h->readers;
+
+    DSPEW("Attached to shared memory \"%s\" as %s with a %" PRIu64
+            " byte ring buffer", s->shmName,
+            isWriter?"writer":"reader", h->length);
+
+    flock(fd, LOCK_UN);
+    s->fd = fd;
+
+    // We start with our doorbell ringing, so that flow() gets called.
+    RingBell(s->myBell);
+
+    return false;
+
+fail:
+
+    if(s->myBell > -1) close(s->myBell);
+    if(s->otherBell > -1) close(s->otherBell);
+    s->myBell = -1;
+    s->otherBell = -1;
+    if(s->header) {
+        munmap(s->header, s->mapLength);
+        s->header = 0;
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+    return true;
+}
@@ -0,0 +1,261 @@
+// A source block that reads a stream from a named shared memory segment
+// that a ShmOut block in another quickstream process writes.  See Shm.h.
+//
+// Our output ring buffer is in the segment (see qsMapOutputShared()), so
+// the writer in the other process writes into it, and we do not copy the
+// data; we just advance our output by what the writer wrote, and tell
+// the writer what the blocks that we feed have read, so that it can
+// write over it.
+//
+// The flow() is called when the graph's epoll_wait(2) thread sees our
+// doorbell FIFO ringing (see qsAddEpollReadJob()), and when the blocks
+// that we feed read, since that is in the shared memory too.  We keep
+// our doorbell ringing while there is data to read.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+struct ShmIn;
+#define QS_USER_DATA_TYPE  struct ShmIn *
+#include "../../../../include/quickstream.h"
+#include "../../../debug.h"
+#include "../../../mprintf.h"
+
+#include "Shm.h"
+
+
+#define DEFAULT_OUTPUTMAX  ((size_t) 64*1024)
+#define STR(s)   XSTR(s)
+#define XSTR(s)  #s
+
+
+struct ShmIn {
+
+    char *name;
+    size_t length;
+    size_t outputMax;
+
+    // The total bytes we advanced our output.
+    uint64_t writeCount;
+
+    struct Shm shm;
+};
+
+
+static
+char *Name_config(int argc, const char * const *argv,
+        struct ShmIn *s) {
+
+    if(argc < 2 || !argv[1][0] || strchr(argv[1], '/')) {
+        ERROR("Need a name without a /");
+        return QS_CONFIG_FAIL;
+    }
+
+    if(s->name)
+        free(s->name);
+    s->name = strdup(argv[1]);
+    ASSERT(s->name, "strdup() failed");
+
+    return mprintf("Name %s", s->name);
+}
+
+
+static
+char *Length_config(int argc, const char * const *argv,
+        struct ShmIn *s) {
+
+    s->length = qsParseSizet(DEFAULT_LENGTH);
+    if(s->length < 1)
+        s->length = 1;
+
+    return mprintf("Length %zu", s->length);
+}
+
+
+static
+char *OutputMax_config(int argc, const char * const *argv,
+        struct ShmIn *s) {
+
+    size_t outputMax = qsParseSizet(DEFAULT_OUTPUTMAX);
+
+    if(outputMax < 1)
+        outputMax = 1;
+
+    s->outputMax = outputMax;
+    qsSetOutputMax(0, outputMax);
+
+    return mprintf("OutputMax %zu", outputMax);
+}
+
+
+int declare(void) {
+
+    struct ShmIn *s = calloc(1, sizeof(*s));
+    ASSERT(s, "calloc(1,%zu) failed", sizeof(*s));
+    s->length = DEFAULT_LENGTH;
+    s->outputMax = DEFAULT_OUTPUTMAX;
+    s->shm.myBell = -1;
+    s->shm.otherBell = -1;
+    s->shm.fd = -1;
+
+    qsSetUserData(s);
+
+    // This block is a source with a single output stream
+    qsSetNumOutputs(1, 1);
+
+    qsSetOutputMax(0/*port*/, DEFAULT_OUTPUTMAX);
+
+    qsAddConfig((char *(*)(int, const char * const *, void *))
+            Name_config, "Name",
+            "The name of the shared memory.  We read what a ShmOut"
+            " block with the same name in another process writes."
+            "  Name must be set",
+            "Name NAME",
+            "Name qs_stream");
+
+    qsAddConfig((char *(*)(int, const char * const *, void *))
+            Length_config, "Length",
+            "The length in bytes of the shared memory ring buffer,"
+            " if this block makes it",
+            "Length BYTES",
+            "Length " STR(DEFAULT_LENGTH));
+
+    qsAddConfig((char *(*)(int, const char * const *, void *))
+            OutputMax_config, "OutputMax",
+            "Bytes written per flow() call; no more than half the ring"
+            " buffer length",
+            "OutputMax BYTES",
+            "OutputMax " STR(DEFAULT_OUTPUTMAX));
+
+    return 0;
+}
+
+
+int start(uint32_t numInputs, uint32_t numOutputs, struct ShmIn *s) {
+
+    if(!s->name) {
+        ERROR("The Name was not configured");
+        return -1;
+    }
+
+    if(ShmAttach(&s->shm, s->name, s->length, false/*reader*/))
+        return -1;
+
+    // The ring buffer is the shared memory, which must be longer than
+    // what we write plus the maximum read lengths of the blocks that we
+    // feed, so we may need to write less than the configured OutputMax.
+    size_t outputMax = s->outputMax;
+    if(outputMax > s->shm.header->length/2)
+        outputMax = s->shm.header->length/2;
+    qsSetOutputMax(0, outputMax);
+
+    if(qsMapOutputShared(0, s->shm.fd, getpagesize(),
+                s->shm.header->length)) {
+        ShmDetach(&s->shm);
+        return -1;
+    }
+
+    s->writeCount = 0;
+
+    qsAddEpollReadJob(s->shm.myBell, 0);
+
+    return 0;
+}
+
+
+int flow(const void * const in[], const size_t inLens[],
+        uint32_t numIn,
+        void * const out[], const size_t outLens[], uint32_t numOut,
+        struct ShmIn *s) {
+
+    struct ShmHeader *h = s->shm.header;
+
+    // The blocks that we feed read all but qsOutputUnread() of what we
+    // wrote, so the writer may write over that.
+    uint64_t readCount = s->writeCount - qsOutputUnread(0);
+    if(readCount != atomic_load_explicit(&h->readCount,
+                memory_order_relaxed)) {
+        atomic_store(&h->readCount, readCount);
+        if(atomic_exchange(&h->writerWaiting, false))
+            RingBell(s->shm.otherBell);
+    }
+
+    if(!outLens[0])
+        return 0;
+
+    size_t len = atomic_load_explicit(&h->writeCount,
+            memory_order_acquire) - s->writeCount;
+
+    if(!len) {
+        // writerDone is set after the last write count, so if it's set
+        // the write count we load after it is the last.
+        bool done = atomic_load_explicit(&h->writerDone,
+                memory_order_acquire);
+        len = atomic_load_explicit(&h->writeCount,
+                memory_order_acquire) - s->writeCount;
+        if(!len && done)
+            return 1; // We are done.
+
+        if(!len) {
+            // Wait for the writer, like in ShmOut.c Write().
+            EmptyBell(s->shm.myBell);
+            atomic_store(&h->readerWaiting, true);
+            done = atomic_load(&h->writerDone);
+            len = atomic_load(&h->writeCount) - s->writeCount;
+            if(!len && !done)
+                // The writer will ring our doorbell.
+                return 0;
+            atomic_store(&h->readerWaiting, false);
+            if(!len)
+                return 1; // We are done.
+            // There is data now.  Keep our doorbell ringing, so we get
+            // called again.
+            RingBell(s->shm.myBell);
+        }
+    }
+
+    if(len > outLens[0])
+        len = outLens[0];
+
+    // The writer wrote it in our output already.
+    s->writeCount += len;
+    qsAdvanceOutput(0, len);
+
+    return 0;
+}
+
+
+int stop(uint32_t numInputs, uint32_t numOutputs, struct ShmIn *s) {
+
+    if(s->shm.header)
+        ShmDetach(&s->shm);
+
+    return 0;
+}
+
+
+int undeclare(struct ShmIn *s) {
+
+    DASSERT(s);
+
+    if(s->shm.header)
+        ShmDetach(&s->shm);
+
+    if(s->name)
+        free(s->name);
+
+#ifdef DEBUG
+    memset(s, 0, sizeof(*s));
+#endif
+    free(s);
+
+    return 0;
+}
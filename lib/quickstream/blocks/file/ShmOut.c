@@ -0,0 +1,288 @@
+// A sink block that writes its' input stream to a named shared memory
+// segment, so that a ShmIn block in another quickstream process can read
+// it.  See Shm.h.
+//
+// The block that feeds us writes into the segment, since our input ring
+// buffer is in it (see qsMapInputShared()), so we do not copy the data;
+// we tell the reader how much there is to read, and we advance our input
+// as the reader reads it, so that the block that feeds us can write over
+// it.
+//
+// The flow() is called when the graph's epoll_wait(2) thread sees our
+// doorbell FIFO ringing (see qsAddEpollReadJob()), and when the block
+// that feeds us writes, since that is in the shared memory too.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+struct ShmOut;
+#define QS_USER_DATA_TYPE  struct ShmOut *
+#include "../../../../include/quickstream.h"
+#include "../../../debug.h"
+#include "../../../mprintf.h"
+
+#include "Shm.h"
+
+
+#define DEFAULT_INPUTMAX  ((size_t) 64*1024)
+#define STR(s)   XSTR(s)
+#define XSTR(s)  #s
+
+
+struct ShmOut {
+
+    char *name;
+    size_t length;
+    size_t inputMax;
+
+    // The total bytes we advanced our input.  In flow() it's the reader's
+    // read count from the last flow() call.
+    uint64_t readCount;
+
+    struct Shm shm;
+};
+
+
+static
+char *Name_config(int argc, const char * const *argv,
+        struct ShmOut *s) {
+
+    if(argc < 2 || !argv[1][0] || strchr(argv[1], '/')) {
+        ERROR("Need a name without a /");
+        return QS_CONFIG_FAIL;
+    }
+
+    if(s->name)
+        free(s->name);
+    s->name = strdup(argv[1]);
+    ASSERT(s->name, "strdup() failed");
+
+    return mprintf("Name %s", s->name);
+}
+
+
+static
+char *Length_config(int argc, const char * const *argv,
+        struct ShmOut *s) {
+
+    s->length = qsParseSizet(DEFAULT_LENGTH);
+    if(s->length < 1)
+        s->length = 1;
+
+    return mprintf("Length %zu", s->length);
+}
+
+
+static
+char *InputMax_config(int argc, const char * const *argv,
+        struct ShmOut *s) {
+
+    size_t inputMax = qsParseSizet(DEFAULT_INPUTMAX);
+
+    if(inputMax < 1)
+        inputMax = 1;
+
+    s->inputMax = inputMax;
+    qsSetInputMax(0, inputMax);
+
+    return mprintf("InputMax %zu", inputMax);
+}
+
+
+int declare(void) {
+
+    struct ShmOut *s = calloc(1, sizeof(*s));
+    ASSERT(s, "calloc(1,%zu) failed", sizeof(*s));
+    s->length = DEFAULT_LENGTH;
+    s->inputMax = DEFAULT_INPUTMAX;
+    s->shm.myBell = -1;
+    s->shm.otherBell = -1;
+    s->shm.fd = -1;
+
+    qsSetUserData(s);
+
+    // This block is a sink with a single input stream
+    qsSetNumInputs(1, 1);
+
+    qsSetInputMax(0/*port*/, DEFAULT_INPUTMAX);
+
+    qsAddConfig((char *(*)(int, const char * const *, void *))
+            Name_config, "Name",
+            "The name of the shared memory.  A ShmIn block in another"
+            " process with the same name reads what we write."
+            "  Name must be set",
+            "Name NAME",
+            "Name qs_stream");
+
+    qsAddConfig((char *(*)(int, const char * const *, void *))
+            Length_config, "Length",
+            "The length in bytes of the shared memory ring buffer,"
+            " if this block makes it",
+            "Length BYTES",
+            "Length " STR(DEFAULT_LENGTH));
+
+    qsAddConfig((char *(*)(int, const char * const *, void *))
+            InputMax_config, "InputMax",
+            "The most bytes that we tell the reader about, past what"
+            " it has read; no more than half the ring buffer length",
+            "InputMax BYTES",
+            "InputMax " STR(DEFAULT_INPUTMAX));
+
+    return 0;
+}
+
+
+int start(uint32_t numInputs, uint32_t numOutputs, struct ShmOut *s) {
+
+    if(!s->name) {
+        ERROR("The Name was not configured");
+        return -1;
+    }
+
+    if(ShmAttach(&s->shm, s->name, s->length, true/*writer*/))
+        return -1;
+
+    // The ring buffer is the shared memory, which must be longer than
+    // what we read plus the maximum write length of the block that feeds
+    // us, so we may need to read less than the configured InputMax.
+    size_t inputMax = s->inputMax;
+    if(inputMax > s->shm.header->length/2)
+        inputMax = s->shm.header->length/2;
+    qsSetInputMax(0, inputMax);
+
+    if(qsMapInputShared(0, s->shm.fd, getpagesize(),
+                s->shm.header->length)) {
+        ShmDetach(&s->shm);
+        return -1;
+    }
+
+    s->readCount = 0;
+
+    qsAddEpollReadJob(s->shm.myBell, 0);
+
+    return 0;
+}
+
+
+// Tell the reader about the inLen bytes of input that is in the ring
+// buffer, and advance our input by what the reader read.
+//
+static inline void
+Write(struct ShmOut *o, size_t inLen) {
+
+    struct Shm *s = &o->shm;
+    struct ShmHeader *h = s->header;
+
+    uint64_t writeCount = o->readCount + inLen;
+    if(writeCount > atomic_load_explicit(&h->writeCount,
+                memory_order_relaxed)) {
+        atomic_store(&h->writeCount, writeCount);
+        if(atomic_exchange(&h->readerWaiting, false))
+            RingBell(s->otherBell);
+    }
+
+    uint64_t readCount = atomic_load_explicit(&h->readCount,
+            memory_order_acquire);
+
+    if(readCount == o->readCount && inLen) {
+        // Wait for the reader to read what we told it about.  We empty
+        // our doorbell before we tell the reader we are waiting, so we do
+        // not lose the ring.  The sequentially consistent store and load
+        // pair with the ones in the reader, so that one of us sees the
+        // other.  The block that feeds us gets us called when it writes
+        // more; see QsStreamJob::peerAdvanced.
+        EmptyBell(s->myBell);
+        atomic_store(&h->writerWaiting, true);
+        readCount = atomic_load(&h->readCount);
+        if(readCount == o->readCount)
+            // The reader will ring our doorbell.
+            return;
+        atomic_store(&h->writerWaiting, false);
+    }
+
+    if(readCount != o->readCount) {
+        qsAdvanceInput(0, readCount - o->readCount);
+        o->readCount = readCount;
+    }
+}
+
+
+int flow(const void * const in[], const size_t inLens[],
+        uint32_t numIn,
+        void * const out[], const size_t outLens[], uint32_t numOut,
+        struct ShmOut *s) {
+
+    Write(s, inLens[0]);
+
+    return 0;
+}
+
+
+static inline void
+SetWriterDone(struct Shm *s) {
+
+    atomic_store(&s->header->writerDone, true);
+    if(atomic_exchange(&s->header->readerWaiting, false))
+        RingBell(s->otherBell);
+}
+
+
+// All the blocks that feed us are done, and inLens[0] is all the input
+// that is left.  Nothing will write over it, so we can tell the reader
+// about it all and advance our input without waiting for the reader.
+//
+int flush(const void * const in[], const size_t inLens[],
+        uint32_t numIn,
+        void * const out[], const size_t outLens[], uint32_t numOut,
+        struct ShmOut *s) {
+
+    if(inLens[0]) {
+        s->readCount += inLens[0];
+        atomic_store(&s->shm.header->writeCount, s->readCount);
+        qsAdvanceInput(0, inLens[0]);
+    }
+
+    SetWriterDone(&s->shm);
+
+    return 1; // We are done.
+}
+
+
+int stop(uint32_t numInputs, uint32_t numOutputs, struct ShmOut *s) {
+
+    if(s->shm.header) {
+        // If the stream was stopped before flush() finished, we tell the
+        // reader that there will be no more.
+        SetWriterDone(&s->shm);
+        ShmDetach(&s->shm);
+    }
+
+    return 0;
+}
+
+
+int undeclare(struct ShmOut *s) {
+
+    DASSERT(s);
+
+    if(s->shm.header)
+        ShmDetach(&s->shm);
+
+    if(s->name)
+        free(s->name);
+
+#ifdef DEBUG
+    memset(s, 0, sizeof(*s));
+#endif
+    free(s);
+
+    return 0;
+}
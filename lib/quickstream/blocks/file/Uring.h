@@ -0,0 +1,368 @@
+// A small io_uring(7) wrapper that the built-in FileIn and FileOut blocks
+// use to keep more than one large read(2) or write(2) in flight.  This is
+// included in FileIn.c and FileOut.c.
+//
+// We do not use liburing; it's not in every system that we build on,
+// and we need very little of it.  We just use the two system calls
+// io_uring_setup(2) and io_uring_enter(2) and the mmap(2)-ed queues, as
+// they are documented in linux/io_uring.h.
+//
+// The block's flow() is called by the graph's epoll thread when the
+// io_uring file descriptor is readable, that is when there is a
+// completion in the completion queue; see qsAddEpollReadJob().  So a
+// completion queues the stream job.  If the block has nothing in flight
+// at the end of flow(), it submits a no-op, so that flow() gets called
+// again after the ring buffer changes.
+//
+// The reads and writes go directly into and out of the stream ring
+// buffer.  They are in a queue of "slots" in file (and ring buffer)
+// order, and we only advance the stream over slots that are all done, so
+// completions may come in any order.
+
+
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <linux/io_uring.h>
+
+
+// The user_data of a no-op.  The reads and writes have the slot index.
+#define URING_NOP  ((uint64_t) -1)
+
+
+struct UringSlot {
+
+    // The file offset of the start of this read or write.
+    off_t offset;
+    // The number of bytes that we asked for, and the number of them that
+    // are done.  If a read or write completes short we submit the rest.
+    size_t len, done;
+
+    bool inFlight;
+};
+
+
+struct Uring {
+
+    int fd;
+
+    // The mmap(2)-ed submission queue and completion queue.
+    uint8_t *sqMap, *cqMap;
+    size_t sqMapLen, cqMapLen;
+    struct io_uring_sqe *sqes;
+    size_t sqesLen;
+
+    unsigned *sqHead, *sqTail, *sqMask;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_cqe *cqes;
+
+    // Our copy of the submission queue tail, with the submissions that
+    // we have not told the kernel about yet, and the number of them.
+    unsigned tail, toSubmit;
+
+    unsigned entries;
+
+    // The slots are a ring of "depth" entries, with "numSlots" starting
+    // at "firstSlot".  These are the reads or writes from the current
+    // stream position, "offset", on.
+    struct UringSlot *slots;
+    uint32_t depth, firstSlot, numSlots;
+    // Number of slots and no-ops that are in flight.
+    uint32_t numInFlight;
+
+    // The file offset that goes with the start of the stream buffer that
+    // flow() gets.
+    off_t offset;
+    // The number of bytes after offset that the slots have.
+    size_t queued;
+};
+
+
+static inline void UringDestroy(struct Uring *u) {
+
+    if(u->sqes)
+        munmap(u->sqes, u->sqesLen);
+    if(u->cqMap && u->cqMap != u->sqMap)
+        munmap(u->cqMap, u->cqMapLen);
+    if(u->sqMap)
+        munmap(u->sqMap, u->sqMapLen);
+    if(u->fd > -1)
+        close(u->fd);
+    if(u->slots) {
+        DZMEM(u->slots, u->depth*sizeof(*u->slots));
+        free(u->slots);
+    }
+    memset(u, 0, sizeof(*u));
+    u->fd = -1;
+}
+
+
+// Make an io_uring with room for depth reads or writes, and a no-op.
+// Returns true on error, like if the kernel does not have io_uring(7)
+// or we are not allowed to use it.
+//
+static inline bool UringInit(struct Uring *u, uint32_t depth) {
+
+    DASSERT(depth);
+
+    memset(u, 0, sizeof(*u));
+    u->fd = -1;
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    u->fd = syscall(__NR_io_uring_setup, depth + 1, &p);
+    if(u->fd < 0) {
+        u->fd = -1;
+        return true;
+    }
+
+    u->entries = p.sq_entries;
+
+    u->sqMapLen = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+    u->cqMapLen = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+    if(p.features & IORING_FEAT_SINGLE_MMAP) {
+        if(u->cqMapLen > u->sqMapLen)
+            u->sqMapLen = u->cqMapLen;
+        u->cqMapLen = u->sqMapLen;
+    }
+
+    u->sqMap = mmap(0, u->sqMapLen, PROT_READ|PROT_WRITE,
+            MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if(u->sqMap == MAP_FAILED) {
+        u->sqMap = 0;
+        goto fail;
+    }
+
+    if(p.features & IORING_FEAT_SINGLE_MMAP)
+        u->cqMap = u->sqMap;
+    else {
+        u->cqMap = mmap(0, u->cqMapLen, PROT_READ|PROT_WRITE,
+                MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+        if(u->cqMap == MAP_FAILED) {
+            u->cqMap = 0;
+            goto fail;
+        }
+    }
+
+    u->sqesLen = p.sq_entries*sizeof(struct io_uring_sqe);
+    u->sqes = mmap(0, u->sqesLen, PROT_READ|PROT_WRITE,
+            MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if(u->sqes == MAP_FAILED) {
+        u->sqes = 0;
+        goto fail;
+    }
+
+    u->sqHead = (void *) (u->sqMap + p.sq_off.head);
+    u->sqTail = (void *) (u->sqMap + p.sq_off.tail);
+    u->sqMask = (void *) (u->sqMap + p.sq_off.ring_mask);
+    u->cqHead = (void *) (u->cqMap + p.cq_off.head);
+    u->cqTail = (void *) (u->cqMap + p.cq_off.tail);
+    u->cqMask = (void *) (u->cqMap + p.cq_off.ring_mask);
+    u->cqes = (void *) (u->cqMap + p.cq_off.cqes);
+
+    // We never reorder the submission queue entries, so the array that
+    // indexes them is just 0, 1, 2, ...
+    unsigned *array = (void *) (u->sqMap + p.sq_off.array);
+    for(unsigned i = 0; i < p.sq_entries; ++i)
+        array[i] = i;
+
+    u->tail = *u->sqTail;
+
+    u->depth = depth;
+    u->slots = calloc(depth, sizeof(*u->slots));
+    ASSERT(u->slots, "calloc(%" PRIu32 ",%zu) failed",
+            depth, sizeof(*u->slots));
+
+    return false;
+
+fail:
+
+    UringDestroy(u);
+    return true;
+}
+
+
+// Returns a zeroed submission queue entry.  There is always one, since
+// we never have more than depth + 1 in flight.
+//
+static inline struct io_uring_sqe *UringGetSqe(struct Uring *u) {
+
+    DASSERT(u->tail - __atomic_load_n(u->sqHead, __ATOMIC_ACQUIRE) <
+            u->entries);
+
+    struct io_uring_sqe *sqe = u->sqes + (u->tail & *u->sqMask);
+    memset(sqe, 0, sizeof(*sqe));
+    ++u->tail;
+    ++u->toSubmit;
+    ++u->numInFlight;
+    return sqe;
+}
+
+
+// Tell the kernel about the entries from UringGetSqe(), and if wait is
+// set wait for at least one completion.  Returns true on error.
+//
+static inline bool UringEnter(struct Uring *u, bool wait) {
+
+    if(!u->toSubmit && !wait)
+        return false;
+
+    __atomic_store_n(u->sqTail, u->tail, __ATOMIC_RELEASE);
+
+    int ret;
+    do
+        ret = syscall(__NR_io_uring_enter, u->fd, u->toSubmit,
+                wait?1:0, wait?IORING_ENTER_GETEVENTS:0, 0, 0);
+    while(ret < 0 && errno == EINTR);
+
+    if(ret < 0) {
+        WARN("io_uring_enter(%d,%u,,) failed", u->fd, u->toSubmit);
+        return true;
+    }
+
+    DASSERT((unsigned) ret == u->toSubmit);
+    u->toSubmit = 0;
+    return false;
+}
+
+
+static inline void UringSubmitNop(struct Uring *u) {
+
+    struct io_uring_sqe *sqe = UringGetSqe(u);
+    sqe->opcode = IORING_OP_NOP;
+    sqe->user_data = URING_NOP;
+}
+
+
+// Queue a read or write of the part of the slot that is not done.  buf
+// is the stream buffer that goes with u->offset.
+//
+static inline void
+UringSubmitSlot(struct Uring *u, uint32_t i, uint8_t op, uint8_t *buf,
+        int fd) {
+
+    struct UringSlot *s = u->slots + i;
+    DASSERT(!s->inFlight);
+    DASSERT(s->done < s->len);
+
+    struct io_uring_sqe *sqe = UringGetSqe(u);
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->off = s->offset + s->done;
+    sqe->addr = (uintptr_t) (buf + (s->offset - u->offset) + s->done);
+    sqe->len = s->len - s->done;
+    sqe->user_data = i;
+    s->inFlight = true;
+}
+
+
+// Get the completions.  Returns the negative errno of the first read or
+// write that failed, 1 if a read or write returned 0 (end of file for a
+// read), else 0.
+//
+static inline int UringReap(struct Uring *u) {
+
+    int ret = 0;
+
+    unsigned head = *u->cqHead;
+    unsigned tail = __atomic_load_n(u->cqTail, __ATOMIC_ACQUIRE);
+
+    for(; head != tail; ++head) {
+
+        struct io_uring_cqe *cqe = u->cqes + (head & *u->cqMask);
+        DASSERT(u->numInFlight);
+        --u->numInFlight;
+
+        if(cqe->user_data == URING_NOP)
+            continue;
+
+        DASSERT(cqe->user_data < u->depth);
+        struct UringSlot *s = u->slots + cqe->user_data;
+        DASSERT(s->inFlight);
+        s->inFlight = false;
+
+        if(cqe->res < 0) {
+            if(!ret) ret = cqe->res;
+        } else if(cqe->res == 0) {
+            if(!ret) ret = 1;
+        } else
+            s->done += cqe->res;
+    }
+
+    __atomic_store_n(u->cqHead, head, __ATOMIC_RELEASE);
+
+    return ret;
+}
+
+
+// Wait for all the reads and writes in flight to finish, so that the
+// kernel is not using the stream buffer.
+//
+static inline void UringDrain(struct Uring *u) {
+
+    while(u->numInFlight) {
+        if(UringEnter(u, true))
+            break;
+        UringReap(u);
+    }
+}
+
+
+// Returns the number of bytes from u->offset that are done, and removes
+// the slots for them.  end is set if a slot returned end of file (0).
+//
+static inline size_t UringPopDone(struct Uring *u) {
+
+    size_t len = 0;
+
+    while(u->numSlots) {
+        struct UringSlot *s = u->slots + u->firstSlot;
+        if(s->inFlight || s->done < s->len)
+            break;
+        len += s->len;
+        u->firstSlot = (u->firstSlot + 1) % u->depth;
+        --u->numSlots;
+    }
+
+    u->offset += len;
+    DASSERT(u->queued >= len);
+    u->queued -= len;
+
+    return len;
+}
+
+
+// Add slots for the part of the stream buffer, buf with bufLen bytes,
+// that does not have slots yet, ioLen bytes per slot, and submit them and
+// any slots that came back short.
+//
+static inline void
+UringQueue(struct Uring *u, uint8_t op, int fd, uint8_t *buf,
+        size_t bufLen, size_t ioLen) {
+
+    // Slots that completed short get the rest submitted.
+    for(uint32_t n = 0; n < u->numSlots; ++n) {
+        uint32_t i = (u->firstSlot + n) % u->depth;
+        if(!u->slots[i].inFlight && u->slots[i].done < u->slots[i].len)
+            UringSubmitSlot(u, i, op, buf, fd);
+    }
+
+    while(u->numSlots < u->depth && u->queued < bufLen) {
+        uint32_t i = (u->firstSlot + u->numSlots) % u->depth;
+        struct UringSlot *s = u->slots + i;
+        s->offset = u->offset + u->queued;
+        s->len = bufLen - u->queued;
+        if(s->len > ioLen)
+            s->len = ioLen;
+        s->done = 0;
+        s->inFlight = false;
+        u->queued += s->len;
+        ++u->numSlots;
+        UringSubmitSlot(u, i, op, buf, fd);
+    }
+
+    if(!u->numInFlight)
+        // Nothing will complete, so we make something complete, so that
+        // the epoll thread queues this block again.
+        UringSubmitNop(u);
+}
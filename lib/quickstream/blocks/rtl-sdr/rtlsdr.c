@@ -295,6 +295,9 @@ ERROR("tuner=%d", tuner);
             (int (*)(const struct QsParameter *p, const void *value,
                 uint32_t readCount, uint32_t queueCount, void *userData))
                 Freq_setter);
+    // Setting old values to the hardware is a waste of time, so these
+    // setters only get the newest value.
+    qsSetterLatestOnly(freqSetter, true);
 
     freqGetter = qsCreateGetter(
             "freq", sizeof(c.freq), QsValueType_double,
@@ -307,6 +310,7 @@ ERROR("tuner=%d", tuner);
             (int (*)(const struct QsParameter *p, const void *value,
                 uint32_t readCount, uint32_t queueCount, void *userData))
                 Rate_setter);
+    qsSetterLatestOnly(rateSetter, true);
 
     rateGetter = qsCreateGetter(
             "rate", sizeof(c.rate), QsValueType_double,
@@ -319,6 +323,7 @@ ERROR("tuner=%d", tuner);
             (int (*)(const struct QsParameter *p, const void *value,
                 uint32_t readCount, uint32_t queueCount, void *userData))
                 Gain_setter);
+    qsSetterLatestOnly(gainSetter, true);
 
     gainGetter = qsCreateGetter(
             "gain", sizeof(c.gain), QsValueType_double,
@@ -331,6 +336,7 @@ ERROR("tuner=%d", tuner);
             (int (*)(const struct QsParameter *p, const void *value,
                 uint32_t readCount, uint32_t queueCount, void *userData))
                 AutoGain_setter);
+    qsSetterLatestOnly(autoGainSetter, true);
 
     autoGainGetter = qsCreateGetter(
             "autoGain", sizeof(c.autoGain), QsValueType_bool,
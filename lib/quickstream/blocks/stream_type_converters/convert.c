@@ -0,0 +1,653 @@
+// A stream type converter block that converts between integer samples
+// and float samples, with a scale and offset.
+//
+// Integer to float:
+//
+//    out = (in + Offset) * Scale
+//
+// and float to integer is the inverse of that, rounded to the nearest
+// integer (half away from zero) and saturated to the range of the integer
+// type, with NaN going to the lowest value:
+//
+//    out = saturate(round(in/Scale - Offset))
+//
+// So "Types u8 f32" with "Offset -127.5" and "Scale 0.0078431372549"
+// (1/127.5) does what the u8ToF32 block does, and "Types f32 u8" with
+// the same Offset and Scale undoes it.
+//
+// The complex types (cu8, cs8, cs16, cf32) are interleaved real and
+// imaginary parts, and get converted one part at a time just like the
+// real types.  The "Types" configuration declares the stream port types
+// with qsSetInputType() and qsSetOutputType(), so flow() only gets whole
+// samples, and qsGraph_connect() fails if we are connected to a block
+// port of a different type.
+//
+// The u8ToF32 block converts one byte per loop, and the converter blocks
+// are the first blocks after the high rate sources, so here we have a
+// converter loop (kernel) for each x86 vector instruction set, SSE2,
+// AVX2 and AVX-512, and a scalar one for the left over tail and for other
+// CPUs.  We pick the best kernel that the CPU we are running on has in
+// declare() using CPUID (via __builtin_cpu_supports()).  The "Kernel"
+// configuration can override that, so we can compare them.  See
+// tests/932_convertBench.
+//
+// One macro makes the vector kernels for all the vector widths, so the
+// float math is the same for all of them.
+//
+// All the state of a block is in its struct Convert userData, so this
+// block defines qsBlockIsReentrant and all the convert blocks in a
+// program share one loaded DSO.
+//
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+struct Convert;
+#define QS_USER_DATA_TYPE  struct Convert *
+#include "../../../../include/quickstream.h"
+#include "../../../debug.h"
+#include "../../../mprintf.h"
+
+#define STR(s)   XSTR(s)
+#define XSTR(s)  #s
+
+
+#define DEFAULT_INPUTMAX   2048
+
+
+#if defined(__x86_64__) || defined(__i386__)
+#  define HAVE_X86_KERNELS
+#  include <immintrin.h>
+#endif
+
+
+enum Isa {
+
+    SCALAR = 0,
+#ifdef HAVE_X86_KERNELS
+    SSE2,
+    AVX2,
+    AVX512,
+#endif
+    NUM_ISA
+};
+
+static const char * const isaNames[] = {
+    "scalar",
+#ifdef HAVE_X86_KERNELS
+    "sse2",
+    "avx2",
+    "avx512",
+#endif
+    0
+};
+
+
+// The integer types that we convert to and from float.
+enum Int {
+    U8 = 0,
+    S8,
+    S16,
+    NUM_INT
+};
+
+
+static const struct Type {
+
+    const char *name;
+    // Bytes in one real number, or part of a complex number.
+    size_t size;
+    // 2 for complex, else 1.
+    uint32_t numParts;
+    // Which integer type, or -1 for float.
+    int intType;
+    // The stream port type.
+    enum QsStreamType streamType;
+
+} types[] = {
+    { "u8",   1, 1, U8,  QsStreamType_u8 },
+    { "s8",   1, 1, S8,  QsStreamType_s8 },
+    { "s16",  2, 1, S16, QsStreamType_s16 },
+    { "f32",  4, 1, -1,  QsStreamType_f32 },
+    { "cu8",  1, 2, U8,  QsStreamType_cu8 },
+    { "cs8",  1, 2, S8,  QsStreamType_cs8 },
+    { "cs16", 2, 2, S16, QsStreamType_cs16 },
+    { "cf32", 4, 2, -1,  QsStreamType_cf32 },
+    { 0, 0, 0, 0, 0 }
+};
+
+
+const bool qsBlockIsReentrant = true;
+
+
+// The kernels convert n values with:
+//
+//   to float:    out = (in + add) * mul
+//   from float:  out = saturate(round((in - add) * mul))
+//
+typedef void (*Kernel_t)(const void *in, void *out, size_t n,
+        float add, float mul);
+
+
+struct Convert {
+
+    // Configuration that we use at the next start().
+    const struct Type *inType;
+    const struct Type *outType;
+    float scale, offset;
+    size_t maxRead;
+
+    // The best kernel the CPU can run, from declare(), and the one we
+    // asked for with the "Kernel" configuration.  -1 for auto.
+    enum Isa bestIsa;
+    int isaRequest;
+
+    // What flow() uses; set in start().
+    float add, mul;
+    Kernel_t kernel;
+};
+
+
+
+// Scalar kernels.  The vector kernels call these for the left over
+// values at the end, so they must do exactly the same float operations as
+// the vector kernels, so that the output does not depend on the kernel.
+// The clamping is done like the x86 max and min instructions, which give
+// the second operand if the first is NaN; so NaN goes to LO.  y gets
+// HALF, with the sign of y, added and the convert to int32_t truncates
+// toward zero, so we round half away from zero.  HALF is the float just
+// below 0.5; with 0.5 the add would round 0.49999997 up to 1.0.  x.5
+// still goes up, since x.5 + HALF rounds to x + 1 (ties to even).
+//
+#define HALF  (0x1.fffffep-2F)
+//
+#define SCALAR_KERNELS(NAME, T, LO, HI)\
+\
+static void NAME##ToF32_scalar(const void *in, void *out, size_t n,\
+        float add, float mul) {\
+    const T *i = in;\
+    float *o = out;\
+    for(const T *end = i + n; i < end; ++i, ++o)\
+        *o = (((float) *i) + add) * mul;\
+}\
+\
+static void F32To##NAME##_scalar(const void *in, void *out, size_t n,\
+        float add, float mul) {\
+    const float *i = in;\
+    T *o = out;\
+    for(const float *end = i + n; i < end; ++i, ++o) {\
+        float y = (*i - add) * mul;\
+        y = (y > (float) (LO))?y:(float) (LO);\
+        y = (y < (float) (HI))?y:(float) (HI);\
+        y += signbit(y)?-HALF:HALF;\
+        *o = (T) (int32_t) y;\
+    }\
+}
+
+
+SCALAR_KERNELS(U8,  uint8_t, 0,         UINT8_MAX)
+SCALAR_KERNELS(S8,  int8_t,  INT8_MIN,  INT8_MAX)
+SCALAR_KERNELS(S16, int16_t, INT16_MIN, INT16_MAX)
+
+
+
+#ifdef HAVE_X86_KERNELS
+
+// The vector kernels.  We compile each with a function target attribute,
+// so that this file builds without -mavx2 and the like, and the kernel
+// only runs if declare() found that the CPU has the instructions.
+//
+// The float math is written with the GCC vector extension operators on
+// the __m128, __m256, and __m512 types, and the rest with intrinsics.
+// GCC does not make good code from __builtin_convertvector() for
+// widening 8 and 16 bit integers to 32 bits, so we have a load (widen)
+// and store (narrow) function for each integer type and instruction set.
+// The stored values are already clamped to the range of the type, so the
+// saturation in the pack instructions does nothing.
+
+
+typedef int32_t Unaligned32 __attribute__((aligned(1), may_alias));
+
+
+#define ATTR_sse2    __attribute__((target("sse2")))
+#define ATTR_avx2    __attribute__((target("avx2")))
+#define ATTR_avx512  __attribute__((target("avx512f")))
+
+// So that they are inlined without -O too, like the intrinsics.
+#define ALWAYS_INLINE  __attribute__((always_inline))
+
+
+static inline ALWAYS_INLINE ATTR_sse2 __m128i LoadU8_sse2(const void *p) {
+    __m128i z = _mm_setzero_si128();
+    return _mm_unpacklo_epi16(_mm_unpacklo_epi8(
+            _mm_cvtsi32_si128(*(const Unaligned32 *) p), z), z);
+}
+static inline ALWAYS_INLINE ATTR_sse2 __m128i LoadS8_sse2(const void *p) {
+    __m128i x = _mm_cvtsi32_si128(*(const Unaligned32 *) p);
+    x = _mm_unpacklo_epi8(x, x);
+    // Now 4 copies of each byte in each 32 bits.
+    return _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 24);
+}
+static inline ALWAYS_INLINE ATTR_sse2 __m128i LoadS16_sse2(const void *p) {
+    __m128i x = _mm_loadl_epi64(p);
+    return _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+}
+static inline ALWAYS_INLINE ATTR_sse2 void StoreU8_sse2(void *p, __m128i x) {
+    x = _mm_packs_epi32(x, x);
+    *(Unaligned32 *) p = _mm_cvtsi128_si32(_mm_packus_epi16(x, x));
+}
+static inline ALWAYS_INLINE ATTR_sse2 void StoreS8_sse2(void *p, __m128i x) {
+    x = _mm_packs_epi32(x, x);
+    *(Unaligned32 *) p = _mm_cvtsi128_si32(_mm_packs_epi16(x, x));
+}
+static inline ALWAYS_INLINE ATTR_sse2 void StoreS16_sse2(void *p, __m128i x) {
+    _mm_storel_epi64(p, _mm_packs_epi32(x, x));
+}
+
+
+static inline ALWAYS_INLINE ATTR_avx2 __m256i LoadU8_avx2(const void *p) {
+    return _mm256_cvtepu8_epi32(_mm_loadl_epi64(p));
+}
+static inline ALWAYS_INLINE ATTR_avx2 __m256i LoadS8_avx2(const void *p) {
+    return _mm256_cvtepi8_epi32(_mm_loadl_epi64(p));
+}
+static inline ALWAYS_INLINE ATTR_avx2 __m256i LoadS16_avx2(const void *p) {
+    return _mm256_cvtepi16_epi32(_mm_loadu_si128(p));
+}
+// The 256 bit pack instructions work in two 128 bit halves, so we split
+// it first.
+static inline ALWAYS_INLINE ATTR_avx2 __m128i Pack_avx2(__m256i x) {
+    return _mm_packs_epi32(_mm256_castsi256_si128(x),
+            _mm256_extracti128_si256(x, 1));
+}
+static inline ALWAYS_INLINE ATTR_avx2 void StoreU8_avx2(void *p, __m256i x) {
+    __m128i y = Pack_avx2(x);
+    _mm_storel_epi64(p, _mm_packus_epi16(y, y));
+}
+static inline ALWAYS_INLINE ATTR_avx2 void StoreS8_avx2(void *p, __m256i x) {
+    __m128i y = Pack_avx2(x);
+    _mm_storel_epi64(p, _mm_packs_epi16(y, y));
+}
+static inline ALWAYS_INLINE ATTR_avx2 void StoreS16_avx2(void *p, __m256i x) {
+    _mm_storeu_si128(p, Pack_avx2(x));
+}
+
+
+static inline ALWAYS_INLINE ATTR_avx512 __m512i LoadU8_avx512(const void *p) {
+    return _mm512_cvtepu8_epi32(_mm_loadu_si128(p));
+}
+static inline ALWAYS_INLINE ATTR_avx512 __m512i LoadS8_avx512(const void *p) {
+    return _mm512_cvtepi8_epi32(_mm_loadu_si128(p));
+}
+static inline ALWAYS_INLINE ATTR_avx512 __m512i LoadS16_avx512(const void *p) {
+    return _mm512_cvtepi16_epi32(_mm256_loadu_si256(p));
+}
+static inline ALWAYS_INLINE ATTR_avx512 void StoreU8_avx512(void *p, __m512i x) {
+    _mm_storeu_si128(p, _mm512_cvtepi32_epi8(x));
+}
+static inline ALWAYS_INLINE ATTR_avx512 void StoreS8_avx512(void *p, __m512i x) {
+    _mm_storeu_si128(p, _mm512_cvtepi32_epi8(x));
+}
+static inline ALWAYS_INLINE ATTR_avx512 void StoreS16_avx512(void *p, __m512i x) {
+    _mm256_storeu_si256(p, _mm512_cvtepi32_epi16(x));
+}
+
+
+// Vector kernels that do N values per loop.  PRE is the intrinsic name
+// prefix, like _mm256, and VF and VI are the float and integer vector
+// types.  The stream buffers are aligned to the sample size but not the
+// vector size, so we use unaligned loads and stores.
+//
+#define VECTOR_KERNELS(NAME, T, LO, HI, ISA, N, PRE, VF, VI)\
+\
+static ATTR_##ISA \
+void NAME##ToF32_##ISA(const void *in, void *out, size_t n,\
+        float add, float mul) {\
+    const T *i = in;\
+    float *o = out;\
+    const VF a = PRE##_set1_ps(add);\
+    const VF m = PRE##_set1_ps(mul);\
+    for(const T *end = i + (n/N)*N; i < end; i += N, o += N)\
+        PRE##_storeu_ps(o, (PRE##_cvtepi32_ps(Load##NAME##_##ISA(i))\
+                + a) * m);\
+    NAME##ToF32_scalar(i, o, n%N, add, mul);\
+}\
+\
+static ATTR_##ISA \
+void F32To##NAME##_##ISA(const void *in, void *out, size_t n,\
+        float add, float mul) {\
+    const float *i = in;\
+    T *o = out;\
+    const VF a = PRE##_set1_ps(add);\
+    const VF m = PRE##_set1_ps(mul);\
+    const VF lo = PRE##_set1_ps(LO);\
+    const VF hi = PRE##_set1_ps(HI);\
+    const VI half = (VI) PRE##_set1_ps(HALF);\
+    const VI sign = (VI) PRE##_set1_ps(-0.0F);\
+    for(const float *end = i + (n/N)*N; i < end; i += N, o += N) {\
+        VF y = (PRE##_loadu_ps(i) - a) * m;\
+        y = PRE##_min_ps(PRE##_max_ps(y, lo), hi);\
+        y += (VF) ((((VI) y) & sign) | half);\
+        Store##NAME##_##ISA(o, PRE##_cvttps_epi32(y));\
+    }\
+    F32To##NAME##_scalar(i, o, n%N, add, mul);\
+}
+
+
+#define ISA_KERNELS(ISA, N, PRE, VF, VI)\
+    VECTOR_KERNELS(U8,  uint8_t, 0,         UINT8_MAX, ISA, N, PRE, VF, VI)\
+    VECTOR_KERNELS(S8,  int8_t,  INT8_MIN,  INT8_MAX,  ISA, N, PRE, VF, VI)\
+    VECTOR_KERNELS(S16, int16_t, INT16_MIN, INT16_MAX, ISA, N, PRE, VF, VI)
+
+
+ISA_KERNELS(sse2,    4, _mm,    __m128, __m128i)
+ISA_KERNELS(avx2,    8, _mm256, __m256, __m256i)
+ISA_KERNELS(avx512, 16, _mm512, __m512, __m512i)
+
+#endif // #ifdef HAVE_X86_KERNELS
+
+
+
+#define KERNELS(ISA)\
+    {\
+        { U8ToF32_##ISA,  F32ToU8_##ISA },\
+        { S8ToF32_##ISA,  F32ToS8_##ISA },\
+        { S16ToF32_##ISA, F32ToS16_##ISA }\
+    }
+
+// kernels[isa][intType][0 = to float, 1 = from float]
+//
+static const Kernel_t kernels[NUM_ISA][NUM_INT][2] = {
+    KERNELS(scalar),
+#ifdef HAVE_X86_KERNELS
+    KERNELS(sse2),
+    KERNELS(avx2),
+    KERNELS(avx512)
+#endif
+};
+
+
+
+static enum Isa GetBestIsa(void) {
+
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+
+    // __builtin_cpu_supports() checks that the OS saves the AVX
+    // registers too.
+    if(__builtin_cpu_supports("avx512f"))
+        return AVX512;
+    if(__builtin_cpu_supports("avx2"))
+        return AVX2;
+    if(__builtin_cpu_supports("sse2"))
+        return SSE2;
+#endif
+
+    return SCALAR;
+}
+
+
+static inline enum Isa GetIsa(const struct Convert *c) {
+
+    if(c->isaRequest < 0 || c->isaRequest > c->bestIsa)
+        return c->bestIsa;
+    return c->isaRequest;
+}
+
+
+static void SetMax(const struct Convert *c) {
+
+    // Set the stream read and write limits for the next stream start.  We
+    // make the read and write limits the same number of values, like in
+    // u8ToF32.c.
+    qsSetInputMax(0/*port*/, c->maxRead);
+    qsSetOutputMax(0/*port*/,
+            (c->maxRead/c->inType->size + 1)*c->outType->size);
+}
+
+
+static const struct Type *FindType(const char *name) {
+
+    for(const struct Type *t = types; t->name; ++t)
+        if(!strcmp(name, t->name))
+            return t;
+    return 0;
+}
+
+
+static
+char *Types_config(int argc, const char * const *argv,
+        struct Convert *c) {
+
+    if(argc < 3) {
+        ERROR("Need input and output types");
+        return QS_CONFIG_FAIL;
+    }
+
+    const struct Type *in = FindType(argv[1]);
+    const struct Type *out = FindType(argv[2]);
+
+    if(!in || !out) {
+        ERROR("Unknown type \"%s\"", in?argv[2]:argv[1]);
+        return QS_CONFIG_FAIL;
+    }
+    if((in->intType < 0) == (out->intType < 0) ||
+            in->numParts != out->numParts) {
+        ERROR("Cannot convert %s to %s", in->name, out->name);
+        return QS_CONFIG_FAIL;
+    }
+
+    c->inType = in;
+    c->outType = out;
+    SetMax(c);
+
+    // We do not declare the port types until the types are configured,
+    // so that blocks can be connected before they are configured.  The
+    // default, u8 to f32, is real, so untyped ports give whole samples.
+    // 0 for the element size is one sample of the type.
+    qsSetInputType(0/*port*/, in->streamType, 0);
+    qsSetOutputType(0/*port*/, out->streamType, 0);
+
+    return mprintf("Types %s %s", in->name, out->name);
+}
+
+
+static
+char *Scale_config(int argc, const char * const *argv,
+        struct Convert *c) {
+
+    double val = qsParseDouble(1.0);
+
+    if(val == 0.0) {
+        ERROR("Scale cannot be 0");
+        return QS_CONFIG_FAIL;
+    }
+
+    c->scale = val;
+
+    return mprintf("Scale %.17g", val);
+}
+
+
+static
+char *Offset_config(int argc, const char * const *argv,
+        struct Convert *c) {
+
+    double val = qsParseDouble(0.0);
+
+    c->offset = val;
+
+    return mprintf("Offset %.17g", val);
+}
+
+
+static
+char *Kernel_config(int argc, const char * const *argv,
+        struct Convert *c) {
+
+    if(argc < 2 || !strcmp(argv[1], "auto")) {
+        c->isaRequest = -1;
+        return mprintf("Kernel auto");
+    }
+
+    int isa = 0;
+    for(; isa < NUM_ISA; ++isa)
+        if(!strcmp(argv[1], isaNames[isa]))
+            break;
+
+    if(isa == NUM_ISA) {
+        // Like asking for "avx2" on a CPU that is not x86.
+        WARN("Kernel \"%s\" is not built, using kernel \"%s\"",
+                argv[1], isaNames[c->bestIsa]);
+        c->isaRequest = -1;
+        return mprintf("Kernel auto");
+    }
+
+    if(isa > c->bestIsa)
+        WARN("This CPU does not have %s, using kernel \"%s\"",
+                argv[1], isaNames[c->bestIsa]);
+
+    c->isaRequest = isa;
+
+    return mprintf("Kernel %s", isaNames[isa]);
+}
+
+
+static
+char *InputMax_config(int argc, const char * const *argv,
+        struct Convert *c) {
+
+    c->maxRead = qsParseSizet(DEFAULT_INPUTMAX);
+    if(c->maxRead < sizeof(float)*2)
+        // At least one sample of the largest type.
+        c->maxRead = sizeof(float)*2;
+
+    SetMax(c);
+
+    return mprintf("MaxRead %zu", c->maxRead);
+}
+
+
+int declare(void) {
+
+    qsSetNumInputs(1/*min*/, 1/*max*/);
+    qsSetNumOutputs(1/*min*/, 1/*max*/);
+
+    struct Convert *c = calloc(1, sizeof(*c));
+    ASSERT(c, "calloc(1,%zu) failed", sizeof(*c));
+    c->inType = types + 0; // u8
+    c->outType = types + 3; // f32
+    c->scale = 1.0F;
+    c->offset = 0.0F;
+    c->maxRead = DEFAULT_INPUTMAX;
+    c->bestIsa = GetBestIsa();
+    c->isaRequest = -1;
+    qsSetUserData(c);
+
+    DSPEW("Using \"%s\" converter kernels", isaNames[c->bestIsa]);
+
+    SetMax(c);
+
+    qsAddConfig((char *(*) (int, const char * const *,
+                void *)) Types_config, "Types",
+            "Set the input and output stream types.  Types are: "
+            "u8, s8, s16, f32, cu8, cs8, cs16, and cf32.  One of "
+            "them must be f32 or cf32, and the other an integer "
+            "type; both real or both complex",
+            "Types IN OUT",
+            "Types u8 f32");
+
+    qsAddConfig((char *(*) (int, const char * const *,
+                void *)) Scale_config, "Scale",
+            "Float value = (integer value + Offset) * Scale",
+            "Scale SCALE",
+            "Scale 1");
+
+    qsAddConfig((char *(*) (int, const char * const *,
+                void *)) Offset_config, "Offset",
+            "Float value = (integer value + Offset) * Scale",
+            "Offset OFFSET",
+            "Offset 0");
+
+    qsAddConfig((char *(*) (int, const char * const *,
+                void *)) Kernel_config, "Kernel",
+            "Set the converter kernel: auto, scalar, sse2, avx2, or "
+            "avx512.  auto is the best that the CPU can run",
+            "Kernel KERNEL",
+            "Kernel auto");
+
+    qsAddConfig((char *(*) (int, const char * const *,
+                void *)) InputMax_config, "MaxRead",
+            "The maximum bytes requested for each stream input read",
+            "MaxRead NUM_BYTES",
+            "MaxRead " STR(DEFAULT_INPUTMAX));
+
+    return 0;
+}
+
+
+int start(uint32_t numInputs, uint32_t numOutputs, struct Convert *c) {
+
+    enum Isa isa = GetIsa(c);
+    bool toFloat = (c->inType->intType >= 0);
+    const struct Type *intType = toFloat?c->inType:c->outType;
+
+    if(toFloat) {
+        c->add = c->offset;
+        c->mul = c->scale;
+    } else {
+        // From the inverse of (x + offset) * scale, without a multiply
+        // and add that the compiler may fuse in one kernel and not in
+        // another.
+        c->add = c->offset * c->scale;
+        c->mul = 1.0F/c->scale;
+    }
+
+    c->kernel = kernels[isa][intType->intType][toFloat?0:1];
+
+    DSPEW("Converting %s to %s with \"%s\" kernel",
+            c->inType->name, c->outType->name, isaNames[isa]);
+
+    return 0;
+}
+
+
+int flow(const void * const in[], const size_t inLens[],
+        uint32_t numIn,
+        void * const out[], const size_t outLens[], uint32_t numOut,
+        struct Convert *c) {
+
+    DASSERT(numIn == 1);
+    DASSERT(numOut == 1);
+
+    const struct Type *inType = c->inType;
+    const struct Type *outType = c->outType;
+
+    // n is the number of values (real or complex parts) we convert.
+    // The stream lengths are whole samples, so n is too.
+    size_t n = inLens[0]/inType->size;
+    if(n > outLens[0]/outType->size)
+        n = outLens[0]/outType->size;
+
+    if(!n)
+        return 0;
+
+    c->kernel(in[0], out[0], n, c->add, c->mul);
+
+    qsAdvanceInput(0, n*inType->size);
+    qsAdvanceOutput(0, n*outType->size);
+
+    return 0;
+}
+
+
+int undeclare(struct Convert *c) {
+
+    DASSERT(c);
+#ifdef DEBUG
+    memset(c, 0, sizeof(*c));
+#endif
+    free(c);
+
+    return 0;
+}
@@ -2,6 +2,11 @@
 #include "../../../../include/quickstream.h"
 #include "../../../debug.h"
 
+// This block has no state that changes, so all the blocks from this DSO
+// can share it.
+const bool qsBlockIsReentrant = true;
+
+
 #define STR(s)   XSTR(s)
 #define XSTR(s)  #s
 
@@ -0,0 +1,164 @@
+// A sink block that eats all its input and counts how many times flow()
+// is called.  At stop() it prints the number of flow() calls per MB (2^20
+// bytes) of input to stdout, so we can see the effect of an input
+// threshold set with qsSetInputThreshold().  See tests/924_coalesce.
+//
+// It can also be a slow lossy reader, set with qsSetInputLossy(), that
+// prints the number of bytes it dropped too, and the number of bytes that
+// it read and threw out since qsInputOverrun() said that they were
+// written over.  Those are not counted as read.  See tests/929_lossy.
+//
+#include <unistd.h>
+
+#include "../../../debug.h"
+#include "../../../../include/quickstream.h"
+
+
+static uint64_t flowCount;
+static uint64_t total;
+static uint64_t dropped;
+static uint64_t overrun;
+static size_t lossy;
+static useconds_t sleepUsec;
+
+
+static
+char *SetThreshold(int argc, const char * const *argv, void *userData) {
+
+    size_t threshold = 0;
+
+    qsParseSizetArray(threshold, &threshold, 1);
+
+    DSPEW("Input threshold %zu", threshold);
+
+    qsSetInputThreshold(0, threshold);
+
+    return 0;
+}
+
+
+static
+char *SetInputMax(int argc, const char * const *argv, void *userData) {
+
+    size_t len = QS_DEFAULT_MAXREAD;
+
+    qsParseSizetArray(len, &len, 1);
+
+    qsSetInputMax(0, len);
+
+    return 0;
+}
+
+
+static
+char *SetLossy(int argc, const char * const *argv, void *userData) {
+
+    lossy = 0;
+
+    qsParseSizetArray(lossy, &lossy, 1);
+
+    DSPEW("Input lossy skip size %zu", lossy);
+
+    qsSetInputLossy(0, lossy);
+
+    return 0;
+}
+
+
+static
+char *SetSleep(int argc, const char * const *argv, void *userData) {
+
+    size_t usec = 0;
+
+    qsParseSizetArray(usec, &usec, 1);
+
+    sleepUsec = usec;
+
+    return 0;
+}
+
+
+int declare(void) {
+
+    qsSetNumInputs(1, 1);
+    qsSetNumOutputs(0, 0);
+
+    qsAddConfig(SetThreshold, "InputThreshold",
+            "Wait for at least NUM bytes of input before calling flow()",
+            "InputThreshold NUM",
+            "InputThreshold 0");
+
+    const size_t Len = 70;
+    char text[Len];
+    snprintf(text, Len, "InputMax %zu", (size_t) QS_DEFAULT_MAXREAD);
+    qsAddConfig(SetInputMax, "InputMax",
+            "Set the maximum input read length",
+            "InputMax NUM",
+            text);
+
+    qsAddConfig(SetLossy, "Lossy",
+            "Make the input lossy, skipping in multiples of SKIP_SIZE "
+            "bytes when we lag too far; 0 for not lossy",
+            "Lossy SKIP_SIZE",
+            "Lossy 0");
+
+    qsAddConfig(SetSleep, "Sleep",
+            "Sleep USEC micro-seconds in each flow() call, to make a "
+            "slow reader",
+            "Sleep USEC",
+            "Sleep 0");
+
+    return 0; // success
+}
+
+
+int start(uint32_t numInputs, uint32_t numOutputs, void *userData) {
+
+    flowCount = 0;
+    total = 0;
+    dropped = 0;
+    overrun = 0;
+
+    return 0; // success
+}
+
+
+int flow(const void * const in[], const size_t inLens[], uint32_t numIn,
+        void * const out[], const size_t outLens[], uint32_t numOut,
+        void *userData) {
+
+    ++flowCount;
+
+    if(lossy)
+        dropped += qsInputDropped(0);
+
+    if(sleepUsec)
+        usleep(sleepUsec);
+
+    if(inLens[0]) {
+        if(lossy && qsInputOverrun(0))
+            overrun += inLens[0];
+        else
+            total += inLens[0];
+        qsAdvanceInput(0, inLens[0]);
+    }
+
+    return 0; // success
+}
+
+
+int stop(uint32_t numIn, uint32_t numOut, void *userData) {
+
+    double mb = ((double) total)/(1024.0 * 1024.0);
+
+    printf("%" PRIu64 " flow() calls for %" PRIu64
+            " bytes: %.1f calls per MB",
+            flowCount, total, mb > 0.0?((double) flowCount)/mb:0.0);
+    if(lossy)
+        printf(" %" PRIu64 " bytes dropped %" PRIu64 " overrun",
+                dropped, overrun);
+    printf("\n");
+    fflush(stdout);
+
+    return 0;
+}
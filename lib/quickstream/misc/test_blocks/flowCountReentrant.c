@@ -0,0 +1,80 @@
+// Like flowCount.c but it keeps its counts in the userData, and so it
+// defines qsBlockIsReentrant and all the flowCountReentrant blocks share
+// one loaded DSO.  See tests/934_dsoCopies.
+//
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "../../../debug.h"
+
+struct FlowCount {
+
+    uint64_t flowCount;
+    uint64_t total;
+};
+
+#define QS_USER_DATA_TYPE  struct FlowCount *
+#include "../../../../include/quickstream.h"
+
+
+const bool qsBlockIsReentrant = true;
+
+
+int declare(void) {
+
+    qsSetNumInputs(1, 1);
+    qsSetNumOutputs(0, 0);
+
+    struct FlowCount *fc = calloc(1, sizeof(*fc));
+    ASSERT(fc, "calloc(1,%zu) failed", sizeof(*fc));
+    qsSetUserData(fc);
+
+    return 0; // success
+}
+
+
+int start(uint32_t numInputs, uint32_t numOutputs, struct FlowCount *fc) {
+
+    fc->flowCount = 0;
+    fc->total = 0;
+
+    return 0; // success
+}
+
+
+int flow(const void * const in[], const size_t inLens[], uint32_t numIn,
+        void * const out[], const size_t outLens[], uint32_t numOut,
+        struct FlowCount *fc) {
+
+    ++fc->flowCount;
+
+    if(inLens[0]) {
+        fc->total += inLens[0];
+        qsAdvanceInput(0, inLens[0]);
+    }
+
+    return 0; // success
+}
+
+
+int stop(uint32_t numIn, uint32_t numOut, struct FlowCount *fc) {
+
+    printf("%" PRIu64 " flow() calls for %" PRIu64 " bytes\n",
+            fc->flowCount, fc->total);
+    fflush(stdout);
+
+    return 0;
+}
+
+
+int undeclare(struct FlowCount *fc) {
+
+    DASSERT(fc);
+#ifdef DEBUG
+    memset(fc, 0, sizeof(*fc));
+#endif
+    free(fc);
+
+    return 0;
+}
@@ -0,0 +1,133 @@
+// A copy block that, in a flow() call, calls qsBlockHaltAsync() to move
+// another block to another thread pool while the stream runs.  Configured
+// like:
+//
+//   --configure-mk MK bname HaltAt 10 out tp1 MK
+//
+// which, in the 10th flow() call, asks for a halt of this block and
+// block "out", and the callback moves block "out" to thread pool "tp1".
+// The callback prints to stderr like:
+//
+//   haltAsync h moved out to tp1
+//
+// or with "flow() running" if this block was not halted.  See
+// tests/942_blockHaltAsync.
+//
+#include <string.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#include "../../../debug.h"
+#include "../../../../include/quickstream.h"
+
+
+static uint64_t haltAt;
+static uint64_t flowCount;
+static char *name;
+static char *blockName;
+static char *threadPoolName;
+static atomic_bool inFlow = false;
+
+
+static void FreeNames(void) {
+
+    if(name) free(name);
+    if(blockName) free(blockName);
+    if(threadPoolName) free(threadPoolName);
+    name = 0;
+    blockName = 0;
+    threadPoolName = 0;
+}
+
+
+static
+char *SetHaltAt(int argc, const char * const *argv, void *userData) {
+
+    if(argc < 4)
+        return strdup("HaltAt needs 3 arguments");
+
+    FreeNames();
+
+    haltAt = strtoull(argv[1], 0, 10);
+    name = strdup(qsBlockGetName());
+    blockName = strdup(argv[2]);
+    threadPoolName = strdup(argv[3]);
+    ASSERT(name && blockName && threadPoolName, "strdup() failed");
+
+    return 0;
+}
+
+
+int declare(void) {
+
+    qsSetNumInputs(1, 1);
+    qsSetNumOutputs(1, 1);
+
+    qsAddConfig(SetHaltAt, "HaltAt",
+            "In the COUNT flow() call move block BLOCK to thread "
+            "pool THREAD_POOL; 0 to not",
+            "HaltAt COUNT BLOCK THREAD_POOL",
+            "HaltAt 0 none none");
+
+    return 0; // success
+}
+
+
+int start(uint32_t numInputs, uint32_t numOutputs, void *userData) {
+
+    flowCount = 0;
+
+    return 0; // success
+}
+
+
+// Called by the thread in qsGraph_wait().
+static
+void Callback(struct QsGraph *g, void *userData) {
+
+    bool running = atomic_load(&inFlow);
+
+    struct QsBlock *b = qsGraph_getBlock(g, blockName);
+    ASSERT(b, "Block \"%s\" was not found", blockName);
+    struct QsThreadPool *tp = qsGraph_getThreadPool(g, threadPoolName);
+    ASSERT(tp, "Thread pool \"%s\" was not found", threadPoolName);
+
+    qsBlock_setThreadPool(b, tp);
+
+    fprintf(stderr, "haltAsync %s moved %s to %s%s\n", name,
+            blockName, threadPoolName, running?" flow() running":"");
+}
+
+
+int flow(const void * const in[], const size_t inLens[], uint32_t numIn,
+        void * const out[], const size_t outLens[], uint32_t numOut,
+        void *userData) {
+
+    atomic_store(&inFlow, true);
+
+    if(haltAt && ++flowCount == haltAt) {
+        const char *names[] = { blockName };
+        qsBlockHaltAsync(Callback, 0, names, 1);
+    }
+
+    size_t len = inLens[0];
+    if(len > outLens[0])
+        len = outLens[0];
+    if(len) {
+        memcpy(out[0], in[0], len);
+        qsAdvanceInput(0, len);
+        qsAdvanceOutput(0, len);
+    }
+
+    atomic_store(&inFlow, false);
+
+    return 0; // success
+}
+
+
+int undeclare(void *userData) {
+
+    FreeNames();
+
+    return 0;
+}
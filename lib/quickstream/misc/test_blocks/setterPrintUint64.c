@@ -1,25 +1,116 @@
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "../../../../include/quickstream.h"
 #include "../../../debug.h"
 
 
+static struct QsParameter *setter;
+static useconds_t sleepUsec = 0;
+// If set, the block name that we print before the value, so that a test
+// can tell which setter printed it.  See tests/930_getterBroadcast.
+static char *name = 0;
+
+
 int callback(const struct QsParameter *p, const uint64_t *value,
             uint32_t readCount, uint32_t queueCount, void *userData) {
 
-    printf("%" PRIu64 "\n", *value);
+    if(name)
+        printf("%s %" PRIu64 "\n", name, *value);
+    else
+        printf("%" PRIu64 "\n", *value);
+
+    if(sleepUsec)
+        // Make a slow setter.  See tests/931_latestOnly.
+        usleep(sleepUsec);
+
+    return 0;
+}
+
+
+static
+char *SetLatestOnly(int argc, const char * const *argv, void *userData) {
+
+    bool latestOnly = false;
+
+    qsParseBoolArray(false, &latestOnly, 1);
+
+    qsSetterLatestOnly(setter, latestOnly);
+
+    return 0;
+}
+
+
+static
+char *SetPrintName(int argc, const char * const *argv, void *userData) {
+
+    bool printName = false;
+
+    qsParseBoolArray(false, &printName, 1);
+
+    if(name) {
+        free(name);
+        name = 0;
+    }
+    if(printName) {
+        name = strdup(qsBlockGetName());
+        ASSERT(name, "strdup() failed");
+    }
+
+    return 0;
+}
+
+
+static
+char *SetSleep(int argc, const char * const *argv, void *userData) {
+
+    size_t usec = 0;
+
+    qsParseSizetArray(usec, &usec, 1);
+
+    sleepUsec = usec;
 
     return 0;
 }
 
+
 int declare(void) {
 
     DSPEW();
 
-    qsCreateSetter("value", sizeof(uint64_t), QsValueType_uint64,
+    setter = qsCreateSetter("value", sizeof(uint64_t), QsValueType_uint64,
             0/*initValue*/,
             (int (*)(const struct QsParameter *p,
                      const void *value, uint32_t readCount,
                      uint32_t queueCount,
                      void *userData)) callback);
 
+    qsAddConfig(SetLatestOnly, "LatestOnly",
+            "Only get the newest value in the setter callback",
+            "LatestOnly BOOL",
+            "LatestOnly false");
+
+    qsAddConfig(SetPrintName, "PrintName",
+            "Print the block name before each value",
+            "PrintName BOOL",
+            "PrintName false");
+
+    qsAddConfig(SetSleep, "Sleep",
+            "Sleep USEC micro-seconds in each setter callback",
+            "Sleep USEC",
+            "Sleep 0");
+
+    return 0;
+}
+
+
+int undeclare(void *userData) {
+
+    if(name) {
+        free(name);
+        name = 0;
+    }
+
     return 0;
 }
@@ -0,0 +1,106 @@
+// A block that copies its input to its output, but it does not read the
+// last "Tail" bytes of input in flow().  Like a filter with a tail, it
+// needs flush() to be called at the end of the stream to write out all
+// of its input.  See tests/925_flush.
+//
+#include "../../../../include/quickstream.h"
+#include "../../../../lib/debug.h"
+
+
+static size_t tail = 300;
+
+// maxRead must be larger than the tail, or the stream will stall.
+static const size_t maxRead = 1024;
+static const size_t maxWrite = 1024;
+
+static uint64_t flushCount;
+
+
+static
+char *SetTail(int argc, const char * const *argv, void *userData) {
+
+    qsParseSizetArray(tail, &tail, 1);
+
+    if(tail >= maxRead)
+        tail = maxRead - 1;
+
+    DSPEW("Tail %zu", tail);
+
+    return 0;
+}
+
+
+int declare(void) {
+
+    qsSetNumInputs(1, 1);
+    qsSetNumOutputs(1, 1);
+
+    const size_t Len = 70;
+    char text[Len];
+    snprintf(text, Len, "Tail %zu", tail);
+    qsAddConfig(SetTail, "Tail",
+            "Number of input bytes not read in flow()",
+            "Tail NUM",
+            text);
+
+    return 0; // success
+}
+
+
+int start(uint32_t numInputs, uint32_t numOutputs, void *userData) {
+
+    qsSetInputMax(0, maxRead);
+    qsSetOutputMax(0, maxWrite);
+    flushCount = 0;
+
+    return 0; // success
+}
+
+
+static inline size_t Copy(const void * const in[], const size_t inLen,
+        void * const out[], const size_t outLens[]) {
+
+    size_t len = inLen;
+    if(len > outLens[0])
+        len = outLens[0];
+    if(len == 0)
+        return 0;
+
+    memcpy(out[0], in[0], len);
+    qsAdvanceInput(0, len);
+    qsAdvanceOutput(0, len);
+
+    return len;
+}
+
+
+int flow(const void * const in[], const size_t inLens[], uint32_t numIn,
+        void * const out[], const size_t outLens[], uint32_t numOut,
+        void * const userData) {
+
+    if(inLens[0] > tail)
+        Copy(in, inLens[0] - tail, out, outLens);
+
+    return 0;
+}
+
+
+int flush(const void * const in[], const size_t inLens[], uint32_t numIn,
+        void * const out[], const size_t outLens[], uint32_t numOut,
+        void * const userData) {
+
+    ++flushCount;
+
+    size_t len = Copy(in, inLens[0], out, outLens);
+
+    // We are done when we wrote all that is left.
+    return (len == inLens[0])?1:0;
+}
+
+
+int stop(uint32_t numInputs, uint32_t numOutputs, void *userData) {
+
+    DSPEW("flush() was called %" PRIu64 " times", flushCount);
+
+    return 0;
+}
@@ -0,0 +1,96 @@
+// A sink block that eats all its input, and in the first flow() call
+// gets the CPU affinity and scheduling policy of the worker thread that
+// calls it.  At stop() it prints them to stdout like:
+//
+//   threadInfo BLOCK_NAME cpus 0,2,3 policy rr priority 1
+//
+// so we can see that the thread pool settings from
+// qsThreadPool_setCpus() and qsThreadPool_setSchedPolicy() are applied
+// to the worker threads.  See tests/927_threadsAffinity.
+//
+#define _GNU_SOURCE
+#include <sched.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "../../../debug.h"
+#include "../../../../include/quickstream.h"
+
+
+static bool gotInfo;
+static char cpus[256];
+static int policy;
+static int priority;
+
+
+int declare(void) {
+
+    qsSetNumInputs(1, 1);
+    qsSetNumOutputs(0, 0);
+
+    return 0; // success
+}
+
+
+int start(uint32_t numInputs, uint32_t numOutputs, void *userData) {
+
+    gotInfo = false;
+
+    return 0; // success
+}
+
+
+static void GetInfo(void) {
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CHECK(sched_getaffinity(0, sizeof(set), &set));
+
+    size_t len = 0;
+    cpus[0] = '\0';
+    for(int i = 0; i < CPU_SETSIZE && len < sizeof(cpus) - 16; ++i)
+        if(CPU_ISSET(i, &set))
+            len += snprintf(cpus + len, sizeof(cpus) - len,
+                    len?",%d":"%d", i);
+
+    struct sched_param param;
+    CHECK(pthread_getschedparam(pthread_self(), &policy, &param));
+    priority = param.sched_priority;
+
+    gotInfo = true;
+}
+
+
+int flow(const void * const in[], const size_t inLens[], uint32_t numIn,
+        void * const out[], const size_t outLens[], uint32_t numOut,
+        void *userData) {
+
+    if(!gotInfo)
+        GetInfo();
+
+    if(inLens[0])
+        qsAdvanceInput(0, inLens[0]);
+
+    return 0; // success
+}
+
+
+int stop(uint32_t numIn, uint32_t numOut, void *userData) {
+
+    if(!gotInfo) {
+        ERROR("flow() was not called");
+        return -1;
+    }
+
+    const char *name = "other";
+    if(policy == SCHED_FIFO)
+        name = "fifo";
+    else if(policy == SCHED_RR)
+        name = "rr";
+
+    printf("threadInfo %s cpus %s policy %s priority %d\n",
+            qsBlockGetName(), cpus, name, priority);
+    fflush(stdout);
+
+    return 0;
+}
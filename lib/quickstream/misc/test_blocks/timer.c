@@ -0,0 +1,97 @@
+// A block with a timer job, from qsAddTimerJob(), and no streams.  At
+// undeclare() it prints the number of timer ticks, the number of timer
+// callback calls, and the nanoseconds from when the Period was last set
+// to when the timer was destroyed, to stdout.  With a callback that sleeps longer
+// than the timer period the ticks get coalesced, so there are fewer
+// calls than ticks.  See tests/941_timerJob.
+//
+#include <unistd.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "../../../debug.h"
+#include "../../../../include/quickstream.h"
+
+
+static struct QsTimerJob *timer;
+static uint64_t ticks;
+static uint64_t calls;
+static useconds_t sleepUsec;
+static struct timespec setTime;
+
+
+static inline uint64_t
+Nanoseconds(const struct timespec *t) {
+
+    return ((uint64_t) t->tv_sec) * 1000000000 + t->tv_nsec;
+}
+
+
+static void Callback(uint64_t n, void *userData) {
+
+    ticks += n;
+    ++calls;
+
+    if(sleepUsec)
+        usleep(sleepUsec);
+}
+
+
+static
+char *SetPeriod(int argc, const char * const *argv, void *userData) {
+
+    size_t ns = 0;
+
+    qsParseSizetArray(ns, &ns, 1);
+
+    qsTimerJobSetPeriod(timer, ns);
+    clock_gettime(CLOCK_MONOTONIC, &setTime);
+
+    return 0;
+}
+
+
+static
+char *SetSleep(int argc, const char * const *argv, void *userData) {
+
+    size_t usec = 0;
+
+    qsParseSizetArray(usec, &usec, 1);
+
+    sleepUsec = usec;
+
+    return 0;
+}
+
+
+int declare(void) {
+
+    // Not running until the Period is configured.
+    timer = qsAddTimerJob(0, Callback, 0);
+
+    qsAddConfig(SetPeriod, "Period",
+            "Timer period in nanoseconds.  0 stops the timer",
+            "Period NS", "Period 0");
+
+    qsAddConfig(SetSleep, "Sleep",
+            "Microseconds that the timer callback sleeps",
+            "Sleep USEC", "Sleep 0");
+
+    return 0;
+}
+
+
+int undeclare(void *userData) {
+
+    // The callback uses the counters, so we stop it before we print
+    // them.
+    qsTimerJobDestroy(timer);
+
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    printf("ticks=%" PRIu64 " calls=%" PRIu64 " elapsed=%" PRIu64 "\n",
+            ticks, calls, Nanoseconds(&t) - Nanoseconds(&setTime));
+
+    return 0;
+}
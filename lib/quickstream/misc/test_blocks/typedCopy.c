@@ -0,0 +1,167 @@
+// A test block that copies its' one typed input to its' one typed output,
+// and checks that the engine keeps the promises that it makes for typed
+// stream ports; see qsSetInputType().  flow() asserts that the input and
+// output lengths are multiples of the element sizes, and that the buffer
+// pointers are aligned to the element sizes (if they are a power of 2).
+//
+// For tests/936_streamTypes
+
+#include <string.h>
+
+#include "../../../../include/quickstream.h"
+#include "../../../../lib/debug.h"
+
+
+static const struct {
+    const char *name;
+    enum QsStreamType type;
+} types[] = {
+    { "bytes", QsStreamType_bytes },
+    { "u8",    QsStreamType_u8 },
+    { "s16",   QsStreamType_s16 },
+    { "f32",   QsStreamType_f32 },
+    { "cf32",  QsStreamType_cf32 },
+    { 0, 0 }
+};
+
+
+// The element sizes, and the least common multiple of them; which is the
+// size that we copy in multiples of.
+static size_t inSize = 1, outSize = 1, copySize = 1;
+
+static size_t maxRead = QS_DEFAULT_MAXREAD;
+
+
+// "InputType TYPE [ELEMENT_SIZE]" and "OutputType TYPE [ELEMENT_SIZE]"
+//
+// The ELEMENT_SIZE default of 0 is the size of the type.
+//
+static
+char *SetType(int argc, const char * const *argv, void *userData) {
+
+    if(argc < 2) {
+        ERROR("Need a type");
+        return QS_CONFIG_FAIL;
+    }
+
+    int i = 0;
+    for(; types[i].name; ++i)
+        if(!strcmp(argv[1], types[i].name))
+            break;
+
+    if(!types[i].name) {
+        ERROR("Unknown type \"%s\"", argv[1]);
+        return QS_CONFIG_FAIL;
+    }
+
+    size_t size = 0;
+    if(argc > 2)
+        size = strtoul(argv[2], 0, 10);
+
+    if(argv[0][0] == 'I')
+        qsSetInputType(0, types[i].type, size);
+    else
+        qsSetOutputType(0, types[i].type, size);
+
+    return 0;
+}
+
+
+static
+char *SetMaxRead(int argc, const char * const *argv, void *userData) {
+
+    maxRead = qsParseSizet(QS_DEFAULT_MAXREAD);
+    qsSetInputMax(0, maxRead);
+    qsSetOutputMax(0, maxRead);
+
+    return 0;
+}
+
+
+static
+char *SetSizes(int argc, const char * const *argv, void *userData) {
+
+    if(argc < 3) {
+        ERROR("Need two sizes");
+        return QS_CONFIG_FAIL;
+    }
+
+    inSize = strtoul(argv[1], 0, 10);
+    outSize = strtoul(argv[2], 0, 10);
+    ASSERT(inSize && outSize);
+
+    copySize = inSize;
+    while(copySize % outSize)
+        copySize += inSize;
+
+    return 0;
+}
+
+
+int declare(void) {
+
+    qsSetNumInputs(1, 1);
+    qsSetNumOutputs(1, 1);
+
+    qsAddConfig(SetType, "InputType",
+            "Set the input type and element size",
+            "InputType TYPE [ELEMENT_SIZE]",
+            "InputType bytes 0");
+
+    qsAddConfig(SetType, "OutputType",
+            "Set the output type and element size",
+            "OutputType TYPE [ELEMENT_SIZE]",
+            "OutputType bytes 0");
+
+    // We could get the element sizes from the types, but then this test
+    // would be using the same code that it's testing.
+    qsAddConfig(SetSizes, "CheckSizes",
+            "The input and output element sizes to check",
+            "CheckSizes IN_SIZE OUT_SIZE",
+            "CheckSizes 1 1");
+
+    qsAddConfig(SetMaxRead, "MaxRead",
+            "Set the input and output maximum lengths",
+            "MaxRead BYTES",
+            "MaxRead 1024");
+
+    return 0; // success
+}
+
+
+static inline void
+CheckAlignment(const void *ptr, size_t size) {
+
+    if(size & (size - 1) || size > 4096)
+        // Not a power of 2, or larger than a page.
+        return;
+
+    ASSERT(((uintptr_t) ptr) % size == 0,
+            "buffer %p not aligned to %zu", ptr, size);
+}
+
+
+int flow(const void * const in[], const size_t inLens[], uint32_t numIn,
+        void * const out[], const size_t outLens[], uint32_t numOut,
+        void * const userData) {
+
+    ASSERT(inLens[0] % inSize == 0, "input length %zu", inLens[0]);
+    ASSERT(outLens[0] % outSize == 0, "output length %zu", outLens[0]);
+    CheckAlignment(in[0], inSize);
+    CheckAlignment(out[0], outSize);
+
+    size_t len = inLens[0];
+    if(len > outLens[0])
+        len = outLens[0];
+    len -= len % copySize;
+
+    if(len == 0)
+        return 0;
+
+    memcpy(out[0], in[0], len);
+
+    qsAdvanceInput(0, len);
+    qsAdvanceOutput(0, len);
+
+    return 0;
+}
@@ -5,6 +5,8 @@
 #include <inttypes.h>
 #include <pthread.h>
 #include <stdatomic.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "../include/quickstream.h"
 
@@ -119,10 +121,6 @@ DisconnectInput(struct QsStreamJob *j,
         // Disconnect these two blocks; same as disconnect these two
         // stream jobs in the "job" API.
         qsJob_removePeer((void *) j, (void *) rj);
-        // Mutually, remove the mutexes from each others' jobs.  They will
-        // no longer queue each other, while they are not connected.
-        qsJob_removeMutex((void *) j, &rj->mutex);
-        qsJob_removeMutex((void *) rj, &j->mutex);
     }
 
     // Unmark the parent block that made the connection.
@@ -248,6 +246,8 @@ void DestroyStreamJob(struct QsSimpleBlock *b, struct QsStreamJob *sj) {
 
     CHECK(pthread_mutex_destroy(&sj->mutex));
 
+    FreeStreamArgs(sj);
+
 
     if(sj->inputs) {
         DASSERT(b->module.ports.inputs);
@@ -329,6 +329,9 @@ void qsSetNumInputs(uint32_t min, uint32_t max) {
         struct QsInput *input = sj->inputs + i;
         input->nextMaxRead = QS_DEFAULT_MAXREAD;
         input->maxRead = QS_DEFAULT_MAXREAD;
+        input->elementSize = 1;
+        input->nextElementSize = 1;
+        input->fileFd = -1;
         input->portNum = i;
         struct QsPort *port = &input->port;
         port->portType = QsPortType_input;
@@ -377,6 +380,9 @@ void qsSetNumOutputs(uint32_t min, uint32_t max) {
         struct QsOutput *output = sj->outputs + i;
         output->maxWrite     = QS_DEFAULT_MAXWRITE;
         output->nextMaxWrite = QS_DEFAULT_MAXWRITE;
+        output->elementSize     = 1;
+        output->nextElementSize = 1;
+        output->fileFd = -1;
         output->portNum = i;
         struct QsPort *port = &output->port;
         port->portType = QsPortType_output;
@@ -401,6 +407,10 @@ void qsAdvanceInput(uint32_t inputPortNum, size_t len) {
             "stream port cannot be advanced more"
             " than once per flow() call");
     ASSERT(len <= sj->inputLens[inputPortNum]);
+    ASSERT(len % sj->inputs[inputPortNum].elementSize == 0,
+            "stream input %" PRIu32 " advanced %zu bytes which is not"
+            " a multiple of the element size %zu", inputPortNum, len,
+            sj->inputs[inputPortNum].elementSize);
 
     sj->advanceInputs[inputPortNum] = len;
 }
@@ -416,11 +426,27 @@ void qsAdvanceOutput(uint32_t outputPortNum, size_t len) {
             "stream port cannot be advanced more"
             " than once per flow() call");
     ASSERT(len <= sj->outputLens[outputPortNum]);
+    ASSERT(len % sj->outputs[outputPortNum].elementSize == 0,
+            "stream output %" PRIu32 " advanced %zu bytes which is not"
+            " a multiple of the element size %zu", outputPortNum, len,
+            sj->outputs[outputPortNum].elementSize);
 
     sj->advanceOutputs[outputPortNum] = len;
 }
 
 
+void qsEpollAdvance(void) {
+
+    struct QsStreamJob *sj = GetStreamJob(CB_FLOW|CB_FLUSH, 0);
+
+    ASSERT(sj->epoll, "The block did not add an epoll file descriptor");
+
+    // Only this thread, that is calling flow() or flush(), uses this
+    // until the call returns.
+    sj->didIOAdvance = true;
+}
+
+
 void qsSetInputMax(uint32_t inputPortNum, size_t len) {
 
     NotWorkerThread();
@@ -442,6 +468,65 @@ void qsSetInputMax(uint32_t inputPortNum, size_t len) {
 }
 
 
+void qsSetInputThreshold(uint32_t inputPortNum, size_t len) {
+
+    NotWorkerThread();
+
+    struct QsStreamJob *sj = GetStreamJob(CB_ANY, 0);
+
+    // This must be.
+    ASSERT(inputPortNum < sj->maxInputs);
+
+    DASSERT(sj->inputs);
+    DASSERT(sj->maxInputs);
+
+    sj->inputs[inputPortNum].nextThreshold = len;
+}
+
+
+void qsSetInputLossy(uint32_t inputPortNum, size_t skipSize) {
+
+    NotWorkerThread();
+
+    struct QsStreamJob *sj = GetStreamJob(CB_ANY, 0);
+
+    // This must be.
+    ASSERT(inputPortNum < sj->maxInputs);
+
+    DASSERT(sj->inputs);
+    DASSERT(sj->maxInputs);
+
+    sj->inputs[inputPortNum].nextLossy = skipSize;
+}
+
+
+size_t qsInputDropped(uint32_t inputPortNum) {
+
+    struct QsStreamJob *sj = GetStreamJob(CB_FLOW|CB_FLUSH, 0);
+
+    ASSERT(inputPortNum < sj->numInputs);
+
+    struct QsInput *in = sj->inputs + inputPortNum;
+    size_t dropped = in->dropped;
+    in->dropped = 0;
+    return dropped;
+}
+
+
+bool qsInputOverrun(uint32_t inputPortNum) {
+
+    struct QsStreamJob *sj = GetStreamJob(CB_FLOW|CB_FLUSH, 0);
+
+    ASSERT(inputPortNum < sj->numInputs);
+
+    struct QsInput *in = sj->inputs + inputPortNum;
+    if(!in->lossy)
+        return false;
+
+    return LossyOverrun(in);
+}
+
+
 void qsSetOutputMax(uint32_t outputPortNum, size_t maxWriteLen) {
 
     NotWorkerThread();
@@ -463,6 +548,270 @@ void qsSetOutputMax(uint32_t outputPortNum, size_t maxWriteLen) {
 }
 
 
+// The names and sizes of the stream types, indexed by enum
+// QsStreamType.
+static const struct {
+    const char *name;
+    size_t size; // bytes
+} streamTypes[] = {
+    [QsStreamType_bytes] = { "bytes", 1 },
+    [QsStreamType_u8]    = { "u8",    1 },
+    [QsStreamType_s8]    = { "s8",    1 },
+    [QsStreamType_u16]   = { "u16",   2 },
+    [QsStreamType_s16]   = { "s16",   2 },
+    [QsStreamType_u32]   = { "u32",   4 },
+    [QsStreamType_s32]   = { "s32",   4 },
+    [QsStreamType_u64]   = { "u64",   8 },
+    [QsStreamType_s64]   = { "s64",   8 },
+    [QsStreamType_f32]   = { "f32",   4 },
+    [QsStreamType_f64]   = { "f64",   8 },
+    [QsStreamType_cu8]   = { "cu8",   2 },
+    [QsStreamType_cs8]   = { "cs8",   2 },
+    [QsStreamType_cs16]  = { "cs16",  4 },
+    [QsStreamType_cs32]  = { "cs32",  8 },
+    [QsStreamType_cf32]  = { "cf32",  8 },
+    [QsStreamType_cf64]  = { "cf64", 16 }
+};
+
+
+// Returns the element size to use for qsSetInputType() and
+// qsSetOutputType().
+//
+static inline size_t
+ElementSize(enum QsStreamType type, size_t elementSize) {
+
+    ASSERT(type >= 0 &&
+            type < sizeof(streamTypes)/sizeof(*streamTypes),
+            "Bad stream type %d", type);
+
+    size_t size = streamTypes[type].size;
+
+    if(!elementSize)
+        return size;
+
+    ASSERT(elementSize % size == 0,
+            "Stream element size %zu is not a multiple of the size"
+            " of type %s (%zu)", elementSize,
+            streamTypes[type].name, size);
+
+    return elementSize;
+}
+
+
+void qsSetInputType(uint32_t inputPortNum, enum QsStreamType type,
+        size_t elementSize) {
+
+    NotWorkerThread();
+
+    struct QsStreamJob *sj = GetStreamJob(CB_DECLARE|CB_CONFIG, 0);
+
+    // This must be.
+    ASSERT(inputPortNum < sj->maxInputs);
+
+    DASSERT(sj->inputs);
+    DASSERT(sj->maxInputs);
+
+    struct QsInput *in = sj->inputs + inputPortNum;
+    in->nextElementSize = ElementSize(type, elementSize);
+    in->type = type;
+}
+
+
+void qsSetOutputType(uint32_t outputPortNum, enum QsStreamType type,
+        size_t elementSize) {
+
+    NotWorkerThread();
+
+    struct QsStreamJob *sj = GetStreamJob(CB_DECLARE|CB_CONFIG, 0);
+
+    // This must be.
+    ASSERT(outputPortNum < sj->maxOutputs);
+
+    DASSERT(sj->outputs);
+    DASSERT(sj->maxOutputs);
+
+    struct QsOutput *out = sj->outputs + outputPortNum;
+    out->nextElementSize = ElementSize(type, elementSize);
+    out->type = type;
+}
+
+
+static inline size_t
+Alignment(size_t elementSize, size_t align) {
+
+    if(elementSize > align && !(elementSize & (elementSize - 1)) &&
+            elementSize <= (size_t) getpagesize())
+        return elementSize;
+    return align;
+}
+
+
+size_t OutputAlignment(const struct QsOutput *out, bool next) {
+
+    size_t align = Alignment(next?out->nextElementSize:out->elementSize, 1);
+
+    for(uint32_t i = 0; i < out->numInputs; ++i) {
+        const struct QsInput *in = out->inputs[i];
+        align = Alignment(next?in->nextElementSize:in->elementSize, align);
+    }
+
+    return align;
+}
+
+
+int qsMapOutputFile(uint32_t outputPortNum, int fd, off_t offset,
+        size_t length) {
+
+    NotWorkerThread();
+
+    struct QsSimpleBlock *b;
+    struct QsStreamJob *sj = GetStreamJob(CB_START, &b);
+
+    ASSERT(outputPortNum < sj->maxOutputs);
+    DASSERT(sj->outputs);
+
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+        ERROR("Block \"%s\" file descriptor %d is not a regular file",
+                b->jobsBlock.block.name, fd);
+        return -1;
+    }
+    if(offset < 0 || !length || offset > st.st_size ||
+            length > st.st_size - offset) {
+        ERROR("Block \"%s\" file offset %jd length %zu is not in the "
+                "%jd byte file", b->jobsBlock.block.name,
+                (intmax_t) offset, length, (intmax_t) st.st_size);
+        return -1;
+    }
+
+    struct QsOutput *out = sj->outputs + outputPortNum;
+
+    // The mapping keeps the file offset relative to the page size, so
+    // the offset must keep the element alignment of the buffer.
+    size_t align = OutputAlignment(out, true);
+    if(offset % align) {
+        ERROR("Block \"%s\" output %" PRIu32 " file offset %jd is not "
+                "a multiple of %zu, the element alignment of the output "
+                "and the inputs that read it", b->jobsBlock.block.name,
+                outputPortNum, (intmax_t) offset, align);
+        return -1;
+    }
+
+    out->fileFd = fd;
+    out->fileOffset = offset;
+    out->fileLength = length;
+
+    return 0;
+}
+
+
+// Returns true if fd, offset, and length are not good for a shared ring
+// buffer.
+//
+static inline bool
+BadSharedFile(struct QsSimpleBlock *b, int fd, off_t offset,
+        size_t length) {
+
+    size_t pageSize = getpagesize();
+    struct stat st;
+
+    if(fd < 0 || fstat(fd, &st)) {
+        ERROR("Block \"%s\" file descriptor %d is not a file",
+                b->jobsBlock.block.name, fd);
+        return true;
+    }
+    if(offset < 0 || offset % pageSize || !length || length % pageSize ||
+            offset > st.st_size || length > st.st_size - offset) {
+        ERROR("Block \"%s\" shared memory offset %jd length %zu is not "
+                "page aligned in the %jd byte file",
+                b->jobsBlock.block.name, (intmax_t) offset, length,
+                (intmax_t) st.st_size);
+        return true;
+    }
+
+    return false;
+}
+
+
+int qsMapOutputShared(uint32_t outputPortNum, int fd, off_t offset,
+        size_t length) {
+
+    NotWorkerThread();
+
+    struct QsSimpleBlock *b;
+    struct QsStreamJob *sj = GetStreamJob(CB_START, &b);
+
+    ASSERT(outputPortNum < sj->maxOutputs);
+    DASSERT(sj->outputs);
+
+    if(BadSharedFile(b, fd, offset, length))
+        return -1;
+
+    struct QsOutput *out = sj->outputs + outputPortNum;
+    out->fileFd = fd;
+    out->fileOffset = offset;
+    out->fileLength = length;
+    out->fileShared = true;
+
+    return 0;
+}
+
+
+int qsMapInputShared(uint32_t inputPortNum, int fd, off_t offset,
+        size_t length) {
+
+    NotWorkerThread();
+
+    struct QsSimpleBlock *b;
+    struct QsStreamJob *sj = GetStreamJob(CB_START, &b);
+
+    ASSERT(inputPortNum < sj->maxInputs);
+    DASSERT(sj->inputs);
+
+    if(BadSharedFile(b, fd, offset, length))
+        return -1;
+
+    // The output that feeds this input may be in a block that has not
+    // had its' start() called yet, so we keep it in the input until
+    // CheckSharedBuffers() in qsGraph_start.c.
+    struct QsInput *in = sj->inputs + inputPortNum;
+    in->fileFd = fd;
+    in->fileOffset = offset;
+    in->fileLength = length;
+
+    return 0;
+}
+
+
+size_t qsOutputUnread(uint32_t outputPortNum) {
+
+    struct QsStreamJob *sj = GetStreamJob(CB_FLOW|CB_FLUSH, 0);
+
+    ASSERT(outputPortNum < sj->numOutputs);
+
+    return MaxReadLength(sj->outputs + outputPortNum);
+}
+
+
+bool CheckStreamTypes(const struct QsInput *in,
+        const struct QsOutput *out) {
+
+    if(in->type == QsStreamType_bytes ||
+            out->type == QsStreamType_bytes ||
+            in->type == out->type)
+        return false;
+
+    ERROR("Block \"%s\" output %s of type %s cannot connect to"
+            " block \"%s\" input %s of type %s",
+            out->port.block->name, out->port.name,
+            streamTypes[out->type].name,
+            in->port.block->name, in->port.name,
+            streamTypes[in->type].name);
+
+    return true;
+}
+
+
 // The parameters to this function are a little redundant, but that's
 // okay: this is not a public API interface and we need to get these
 // variables anyway; to make sure things are consistent.
@@ -521,6 +870,11 @@ int qsBlock_connectStreams(struct QsSimpleBlock *inb, uint32_t inPort,
         goto finish;
     }
 
+    if(CheckStreamTypes(in, out)) {
+        ret = -1;
+        goto finish;
+    }
+
     // This thread pool job abstraction takes care of some things
     // magically.  We cannot make stream connections while the stream is
     // running, but it's not because of the thread pool job abstraction.
@@ -565,18 +919,19 @@ int qsBlock_connectStreams(struct QsSimpleBlock *inb, uint32_t inPort,
 
     if(inb != outb) {
         DASSERT(inb->streamJob != outb->streamJob);
-        // Now deal with connecting the stream jobs and their mutexes.
-        // The jobs API does not keep reference counts and lets you
-        // request to add peers and mutexes more than once, while really
-        // adding them just once.  NOTE: that makes disconnecting stream
-        // connections more complicated; but maybe not too complicated.
-        // There's always give and take; pros and cons.  We choose to keep
-        // the jobs API simpler at the expense of making the streams code
-        // just a little more complex and slower in the disconnecting,
-        // transit, case.
+        // Now deal with connecting the stream jobs.  The jobs API does
+        // not keep reference counts and lets you request to add peers
+        // more than once, while really adding them just once.  NOTE: that
+        // makes disconnecting stream connections more complicated; but
+        // maybe not too complicated.  There's always give and take; pros
+        // and cons.  We choose to keep the jobs API simpler at the
+        // expense of making the streams code just a little more complex
+        // and slower in the disconnecting, transit, case.
+        //
+        // We do not add each others mutexes to the stream jobs.  The
+        // read and write counts are atomic, and a stream job gets the
+        // lock of one peer at a time to queue it.  See QueueWorkCalls().
         qsJob_addPeer((void *) inb->streamJob, (void *) outb->streamJob);
-        qsJob_addMutex((void *) inb->streamJob, &outb->streamJob->mutex);
-        qsJob_addMutex((void *) outb->streamJob, &inb->streamJob->mutex);
     }
 #ifdef DEBUG
     else
@@ -747,13 +1102,12 @@ void qsOutputDone(uint32_t outputPortNum) {
 
     ASSERT(outputPortNum < sj->numOutputs);
 
-    qsJob_lock((void *) sj);
-
-    ASSERT(!sj->outputs[outputPortNum].isFlushing);
-
-    sj->outputs[outputPortNum].isFlushing = true;
-    // Mark the stream IO as changed.
-    sj->didIOAdvance = true;
+    ASSERT(!sj->outputs[outputPortNum].isDone);
 
-    qsJob_unlock((void *) sj);
+    // Only this thread, the thread calling flow() or flush(), accesses
+    // isDone while the stream is running.  The output gets marked as
+    // flushing, so the reading blocks see it, after this flow() or
+    // flush() returns and we add to the output's write count; so they
+    // do not drain before they can see all the data that was written.
+    sj->outputs[outputPortNum].isDone = true;
 }
@@ -30,6 +30,23 @@ struct QsBuffer {
     // these get rounded to the nearest page size.
     //
     size_t mapLength, overhangLength; // in bytes.
+
+    // The NUMA node the memory is bound to, or -1, and the enum
+    // QsRingBufferMode that the memory was made with.
+    int numaNode;
+    int ringBufferMode;
+
+    // If fileMap is not 0 the memory is a private mapping of a file from
+    // qsMapOutputFile() that starts fileMap, and fileMapLength bytes are
+    // mapped; it's not a ring buffer that wraps, and it does not go in
+    // QsGraph::bufferPool.  Or it's a shared mapping from
+    // makeSharedBuffer(), that is a ring buffer, and it does not go in
+    // the pool either.
+    void *fileMap;
+    size_t fileMapLength;
+
+    // For the list of unused buffers in QsGraph::bufferPool.
+    struct QsBuffer *next;
 };
 
 
@@ -75,36 +92,95 @@ struct QsInput {
     // This will be the value of maxRead for the next qsGraph_start().
     size_t nextMaxRead;
 
+    // The least amount of input data we like to have before calling
+    // flow(), so that we do not call flow() for every little bit of data
+    // that the writing block writes.  0 for no threshold.  We only wait
+    // for the threshold while the writing block is still calling flow()
+    // (see QsStreamJob::flowing), so the stream will not get stuck with
+    // less than the threshold.  It's never more than maxRead when it's
+    // used.
+    //
+    // Set with qsSetInputThreshold() at stream start, like maxRead.
+    //
+    size_t threshold;
+    //
+    // This will be the value of threshold for the next qsGraph_start().
+    size_t nextThreshold;
+
+    // If not 0 this input is lossy and this is the size, in bytes, that
+    // we skip in multiples of, when the reader lags so far that the
+    // writer would write over the data it has not read.  Lossy inputs do
+    // not hold back the writer; see MaxReadLength() and SkipLossyInputs()
+    // in streamWork.c.  Set with qsSetInputLossy() at stream start.
+    //
+    size_t lossy;
+    //
+    // This will be the value of lossy for the next qsGraph_start().
+    size_t nextLossy;
+    //
+    // The number of bytes skipped since the block last called
+    // qsInputDropped().  Only the stream job that owns this input
+    // accesses it.
+    size_t dropped;
+
+    // The type of the elements that this input reads and their size in
+    // bytes, from qsSetInputType().  The default is QsStreamType_bytes
+    // with an element size of 1.  The input lengths that we pass to
+    // flow() and flush() are always a multiple of elementSize.  type is
+    // checked against the type of the output in qsGraph_connect() and
+    // qsGraph_start(); see CheckStreamTypes().
+    //
+    enum QsStreamType type;
+    size_t elementSize;
+    //
+    // This will be the value of elementSize for the next qsGraph_start().
+    size_t nextElementSize;
+
 
     // NOTE: If the output that feeds this input is Flushing (isFlushing
     // is set), then the blocks flow() or flush() function can't expect
     // to be able to read maxRead on it's input port.
 
-
-    // readLength is the number of bytes to the write pointer from the
-    // read pointer at this pass-through level, on the ring buffer; it's
-    // the amount that can be read and may exceed the maximum that we let
-    // the block read.
-    //
-    // Accessing readLength requires mutex locks of all simple blocks
-    // involved ...
+    // Set with qsMapInputShared() in the block's start(), for this
+    // qsGraph_start() to make the ring buffer of the output that feeds
+    // this input from shared memory, if fileFd is not -1.  It's moved to
+    // the output, in CheckSharedBuffers() in qsGraph_start.c, and set
+    // back to -1 before the block's start() is called and at
+    // qsGraph_stop().
+    int fileFd;
+    off_t fileOffset;
+    size_t fileLength;
+
+
+    // readCount is the total number of bytes read from this input since
+    // the stream started.  The read length, the number of bytes to the
+    // write pointer from the read pointer at this pass-through level, on
+    // the ring buffer, is the output's writeCount minus this readCount;
+    // it's the amount that can be read and may exceed the maximum that
+    // we let the block read.  See ReadLength() in streamWork.c.
+    //
+    // Only the stream job that owns this input adds to readCount, with
+    // release memory order, after the block is done reading the data.
+    // The stream job that writes to this input reads it with acquire
+    // memory order, so it does not need the reading stream job's mutex
+    // lock.  The counts wrap around, but the difference between them is
+    // still correct with unsigned arithmetic.
     //
     // read and write pointers are in the stream job: inputBuffers[] and
     // outputBuffers[].  This input is in the stream job too.
     //
-    // readLength can get larger while flow() is being called.
+    // The read length can get larger while flow() is being called.
     //
-    // readLength may seem superfluous.  We could have just as well
-    // calculated the difference between the write pointer and the read
-    // pointer to get it's value, but it made coding easier; because we
-    // needed to store buffer lengths at a time when we cannot move the
-    // pointers while the flow() callback is being called.  readLength is
-    // a variable that is shared between blocks and threads; where as the
-    // read and write pointers are not.  The read and write pointers are
-    // moved by the stream job (and block) that own them, and they are not
-    // shared between blocks.
+    // The read and write counts may seem superfluous.  We could have just
+    // as well calculated the difference between the write pointer and the
+    // read pointer, but it made coding easier; because we needed to store
+    // buffer lengths at a time when we cannot move the pointers while the
+    // flow() callback is being called.  The counts are shared between
+    // blocks and threads; where as the read and write pointers are not.
+    // The read and write pointers are moved by the stream job (and block)
+    // that own them, and they are not shared between blocks.
     //
-    size_t readLength;
+    atomic_size_t readCount;
 };
 
 
@@ -153,6 +229,38 @@ struct QsOutput {
     // The maximum of all input maxRead for inputs that this output feeds.
     size_t maxMaxRead;
 
+    // Like in QsInput, the type of the elements that this output writes
+    // and their size in bytes, from qsSetOutputType().  The output
+    // lengths that we pass to flow() and flush() are always a multiple
+    // of elementSize.
+    //
+    enum QsStreamType type;
+    size_t elementSize;
+    //
+    // This will be the value of elementSize for the next qsGraph_start().
+    size_t nextElementSize;
+
+    // Set with qsMapOutputFile() in the block's start(), for this
+    // qsGraph_start() to make the output buffer from a file, if fileFd is
+    // not -1.  It's set back to -1 when the buffer is made, before the
+    // block's start() is called, and at qsGraph_stop(); so a file
+    // descriptor from a start that failed is never used.
+    //
+    // If fileShared is set the file is from qsMapOutputShared() or
+    // qsMapInputShared(), and the buffer is a shared mapping of it that
+    // wraps around like the other ring buffers; so another process that
+    // maps the file sees what is written to this output.
+    int fileFd;
+    off_t fileOffset;
+    size_t fileLength;
+    bool fileShared;
+
+    // The total number of bytes written to this output since the stream
+    // started.  Only the stream job that owns this output adds to it,
+    // with release memory order, after the block wrote the data.  All the
+    // inputs that this output feeds share it.  See QsInput::readCount.
+    atomic_size_t writeCount;
+
     // The "pass through" buffers are a doubly linked list with the
     // "owner" buffer is the first one in the list.
     //
@@ -200,7 +308,37 @@ struct QsOutput {
     // finished running the stream. ??
     //
     // See qsOutputDone().
-    bool isFlushing;
+    //
+    // This is atomic since the stream jobs that read this output check
+    // it without this stream job's mutex lock.
+    atomic_bool isFlushing;
+    //
+    // Set by qsOutputDone() in the block's flow() or flush() and then
+    // isFlushing is set after the flow() or flush() call returns, in
+    // AdvanceRingBufferpointers().
+    bool isDone;
+
+    // Statistics for qsGraph_getStats().  Changed by the stream job that
+    // owns this output with its lock, and reset at qsGraph_start().
+    //
+    // highWater is the most bytes that were written and not read yet, by
+    // the slowest reader, just after this output was written to.  If
+    // it's near the buffer mapLength the readers are not keeping up.  So
+    // that we do not look at all the readers at every write, it's the
+    // fill from FixFlowArgs(), which we keep in fill, plus what flow()
+    // wrote; the readers may have read some of that since.
+    //
+    // clogs is the number of times the stream job stopped calling
+    // flow() with less than maxWrite room to write to this output; that
+    // is the writing block waited on the reading blocks.
+    //
+    // bufferLength is the ring buffer mapLength, which we keep after the
+    // buffer is put back in the buffer pool at qsGraph_stop().
+    //
+    size_t highWater;
+    size_t fill;
+    uint64_t clogs;
+    size_t bufferLength;
 };
 
 
@@ -266,24 +404,33 @@ struct QsStreamJob {
     //
     // inputBuffers[] is an array of ring buffer read pointers.
     //
-    void **inputBuffers; // allocated after start and freed after stop
+    // These arrays are kept after stop, so that we do not need to
+    // allocate them again at the next start, unless there are more ports
+    // connected than before.  They are freed when the stream job is
+    // destroyed.
+    //
+    void **inputBuffers; // allocated at start if needed
     // inputLens[] values cannot exceed input maxRead
-    size_t *inputLens;   // allocated after start and freed after stop
+    size_t *inputLens;   // allocated at start if needed
     //
     // advanceInputs is the length in bytes that the filter block advanced
     // the input buffers, indexed by input port number.
-    size_t *advanceInputs; // allocated after start and freed after stop
+    size_t *advanceInputs; // allocated at start if needed
     //
     // outputBuffers[] is an array of ring buffer write pointers.
     //
-    void **outputBuffers; // allocated after start and freed after stop
+    void **outputBuffers; // allocated at start if needed
     // outputLens[] cannot exceed output maxWrite.
-    size_t *outputLens; // allocated after start and freed after stop
+    size_t *outputLens; // allocated at start if needed
     //
     // advanceOutputs[i] is the amount output was advanced in flow() or
     // flush() call, for output channel i.  This cannot be larger than
     // the output maxWrite for that output port.
     size_t *advanceOutputs;
+    //
+    // The number of elements allocated in the input and output flow()
+    // argument arrays above.
+    uint32_t argsNumInputs, argsNumOutputs;
 
     // Since flow() is required, we can use it as a flag to show that the
     // first flow start sequence has been called; so that we can tell if
@@ -295,7 +442,7 @@ struct QsStreamJob {
     // flush() is optional.  If present it is called when the stream is
     // ending and the stream is not obeying the flow() callback
     // requirements, like having enough input data that the block would
-    // have liked.  If not present flow() is called in place of flow().
+    // have liked.  If not present flow() is called in place of flush().
     int (*flush)(const void * const in[], const size_t inLens[],
             uint32_t numIn, void * const out[], const size_t outLens[],
             uint32_t numOut, void *userData);
@@ -333,6 +480,24 @@ struct QsStreamJob {
     //
     bool busy;
 
+    // Set while a worker thread keeps calling flow() or flush() in
+    // StreamWork(); that is StreamWork() has not returned false yet.
+    // Blocks that read from this block check this to see if they should
+    // wait for more input, if they have an input threshold.  See
+    // QsInput::threshold.  This is atomic since the reading stream jobs
+    // do not have this stream job's mutex lock.
+    //
+    atomic_bool flowing;
+
+    // Set when all the outputs that feed this stream job's inputs are
+    // flushing, so there will be no more input for this stream run.
+    // Then we call flush() (if there is one) in place of flow() when all
+    // inputs have less than maxRead left, and we finish the stream job
+    // when there is nothing left to do.  See InputsFlushed() and
+    // DoneDraining() in streamWork.c.
+    //
+    bool draining;
+
 
     // If input or output advances for this stream job in the last flow()
     // or flush() call or a output port was flushed via qsOutputDone().
@@ -344,12 +509,55 @@ struct QsStreamJob {
     //
     size_t lastAvailableCount;
 
+    // Statistics for qsGraph_getStats().  Changed by the worker thread
+    // running this stream job with the stream job lock, and reset at
+    // qsGraph_start().  The bytes read and written are not here; they
+    // are the input readCount and output writeCount.
+    //
+    // calls is the number of flow() and flush() calls.  busyNs is the
+    // nanoseconds spent in them.  stalls is the number of those calls
+    // that did not read or write anything.  waitNs is the nanoseconds
+    // that the stream job was queued, waiting for a worker thread, after
+    // a peer queued it in QueueWorkCalls().  queuedAt is the time it was
+    // queued, or 0 if we are not timing a wait.
+    //
+    uint64_t calls, busyNs, stalls, waitNs, queuedAt;
+
+    // Set if the block called qsAddEpollReadJob() or
+    // qsAddEpollWriteJob() in start(), and the file descriptor can be
+    // polled; then we only call flow() or flush() when the epoll thread
+    // says the file descriptor is ready.  Unset at stream stop.  See
+    // epoll.h.
+    struct EpollClient *epoll;
+
+    // Set in qsGraph_start() if a ring buffer that this stream job reads
+    // or writes is in shared memory; see qsMapOutputShared() and
+    // qsMapInputShared().  Then the peers reading or writing the buffer
+    // is I/O for the block too, since it tells the other process, so a
+    // peer that advanced sets peerAdvanced, and we call flow() even if
+    // the epoll file descriptor is not ready.  See QueueWorkCalls() in
+    // streamWork.c.
+    bool sharedBuffer;
+    bool peerAdvanced;
+
+    // If this stream job's thread pool has QsThreadPool::fuseChains set,
+    // this is the stream job of the block that reads our one output, if
+    // that is the only input that reads it, that block has just that
+    // one input, and it is in the same thread pool; else 0.  Set in
+    // qsGraph_start().  The worker thread that runs this stream job runs
+    // fuseNext too, without queuing it, when it can.  See
+    // QueueWorkCalls() in streamWork.c.
+    struct QsStreamJob *fuseNext;
+
 
     // Used for the qsJob_lock() and qsJob_unlock(), and the accessing of
     // this structure.
     //
-    // We use qsJob_addMutex() when we make stream I/O connections to
-    // other blocks.
+    // This is the only mutex in the stream job's mutex list.  We do not
+    // add the mutexes of the stream jobs that we connect to, since the
+    // read and write counts that we share with them are atomic.  A stream
+    // job gets the lock of one peer stream job at a time to queue it.
+    // See QueueWorkCalls() in streamWork.c.
     pthread_mutex_t mutex;
 };
 
@@ -371,6 +579,32 @@ extern
 uint32_t HaltStreamBlocks(struct QsBlock *b);
 
 
+// In qsGraph_stop.c.  Frees the flow() argument arrays in the stream
+// job.
+extern
+void FreeStreamArgs(struct QsStreamJob *j);
+
+// In qsGraph_stop.c.  Frees the ring buffers in QsGraph::bufferPool.
+extern
+void FreeBufferPool(struct QsGraph *g);
+
+
+// Returns true and spews an error if the stream types of the input and
+// the output that feeds it do not match.  See qsSetInputType().
+extern
+bool CheckStreamTypes(const struct QsInput *in, const struct QsOutput *out);
+
+
+// Returns the alignment in bytes that the buffer pointers of the output
+// must have for the output and the inputs that read it: the largest of
+// their element sizes that are a power of two and no larger than the
+// page size, or 1.  See qsSetInputType().  If next is set the next
+// element sizes are used, like before qsGraph_start() sets the element
+// sizes.
+extern
+size_t OutputAlignment(const struct QsOutput *out, bool next);
+
+
 // Return false if we can run the streams part of the graph.
 //
 // NOTE: The user must also check the return value of numInputs, and if it
@@ -380,6 +614,66 @@ extern
 bool CheckStreamConnections(struct QsGraph *g, uint32_t *numInputs);
 
 
+// Returns the time in nanoseconds from a fixed point in the past, for
+// the stream statistics.  It's not the time of day.
+//
+static inline uint64_t
+GetNanoseconds(void) {
+
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return ((uint64_t) t.tv_sec) * 1000000000 + t.tv_nsec;
+}
+
+
+// For lossy inputs; returns true if the writer may have written over
+// the data at the read pointer of this input.  The writer may be
+// writing up to maxWrite past its' write count.
+//
+static inline bool
+LossyOverrun(const struct QsInput *in) {
+
+    return atomic_load_explicit(&in->output->writeCount,
+                memory_order_acquire) -
+        atomic_load_explicit(&in->readCount, memory_order_relaxed) +
+        in->output->maxWrite > in->output->buffer->mapLength;
+}
+
+
+// Returns the largest read length from all the inputs that this output,
+// out, feeds.  Only the stream job that owns the output calls this; in
+// streamWork.c and qsOutputUnread().
+//
+// The reading stream jobs publish their read counts with release memory
+// order after they read the data, so we can write over it.
+//
+// Lossy inputs (see qsSetInputLossy()) do not count, so they do not hold
+// back the writer.  They skip ahead in SkipLossyInputs() when they lag
+// too far.
+//
+static inline size_t
+MaxReadLength(const struct QsOutput *out) {
+
+    DASSERT(out->numInputs);
+
+    size_t writeCount = atomic_load_explicit(&out->writeCount,
+            memory_order_relaxed);
+    size_t maxReadLength = 0;
+
+    for(uint32_t k = out->numInputs - 1; k != -1; --k) {
+        if(out->inputs[k]->lossy)
+            continue;
+        size_t len = writeCount -
+            atomic_load_explicit(&out->inputs[k]->readCount,
+                    memory_order_acquire);
+        if(maxReadLength < len)
+            maxReadLength = len;
+    }
+
+    return maxReadLength;
+}
+
+
 static inline
 struct QsStreamJob *
 GetStreamJob(uint32_t inCallbacks, struct QsSimpleBlock **b_out) {
@@ -19,9 +19,111 @@
 #include "job.h"
 #include "port.h"
 #include "stream.h"
+#include "epoll.h"
+#include "workDeque.h"
 
 
 
+// The number of bytes that can be read from this input; that is the
+// distance from this input's read pointer to the write pointer of the
+// output that feeds it, in the ring buffer.
+//
+// The writing stream job publishes its write count with release memory
+// order after it writes the data, so the data is there for us to read.
+//
+static inline size_t
+ReadLength(const struct QsInput *in) {
+
+    return atomic_load_explicit(&in->output->writeCount,
+                memory_order_acquire) -
+        atomic_load_explicit(&in->readCount, memory_order_relaxed);
+}
+
+
+// Returns len rounded down to a multiple of the stream element size, so
+// that blocks only see whole elements.  See qsSetInputType().
+//
+static inline size_t
+WholeElements(size_t len, size_t elementSize) {
+
+    if(elementSize == 1)
+        return len;
+
+    return len - len % elementSize;
+}
+
+
+// For lossy inputs; move the read pointer up to the newest data if the
+// reader lags so far behind that the writer could be writing over the
+// data at the read pointer while flow() reads it.  The skipped bytes are
+// added to the inputs' dropped count.  Called by the stream job that
+// owns the inputs, before FixFlowArgs().
+//
+// After the skip there is at most maxRead left to read, so the writer
+// has at least the extra ring buffer room that was added for lossy
+// inputs in CreateOutputRingBuffer() to write in, while flow() reads.
+//
+static inline void
+SkipLossyInputs(struct QsStreamJob *j) {
+
+    for(uint32_t i = j->numInputs - 1; i != -1; --i) {
+
+        struct QsInput *in = j->inputs + i;
+
+        if(!in->lossy)
+            continue;
+
+        size_t mapLength = in->output->buffer->mapLength;
+        size_t lag = ReadLength(in);
+
+        if(lag + in->output->maxWrite + in->maxRead <= mapLength)
+            // The writer cannot catch up to the read pointer while we
+            // read.
+            continue;
+
+        // Skip all but the last maxRead bytes, rounded up to a multiple
+        // of the skip size.
+        size_t skip = lag - in->maxRead;
+        skip += (in->lossy - skip % in->lossy) % in->lossy;
+        if(skip > lag)
+            skip -= in->lossy;
+        if(!skip)
+            continue;
+
+        // The skip can be more than one time around the ring buffer.
+        j->inputBuffers[i] += skip % mapLength;
+        if(j->inputBuffers[i] >= in->output->buffer->end)
+            j->inputBuffers[i] -= mapLength;
+
+        atomic_fetch_add_explicit(&in->readCount, skip,
+                memory_order_release);
+        in->dropped += skip;
+    }
+}
+
+
+// For lossy inputs, just after flow() or flush() and before
+// AdvanceRingBufferpointers(); count the input that was just read as
+// dropped if the writer may have written over it while it was being
+// read.  The block can see that in flow() with qsInputOverrun(), after
+// it reads the data; we can't tell it after it returns.
+//
+static inline void
+CheckLossyOverruns(struct QsStreamJob *j) {
+
+    for(uint32_t i = j->numInputs - 1; i != -1; --i) {
+
+        struct QsInput *in = j->inputs + i;
+
+        if(!in->lossy || !j->advanceInputs[i])
+            continue;
+
+        if(LossyOverrun(in))
+            in->dropped += j->advanceInputs[i];
+    }
+}
+
+
 // Like FixFlowArgs() but does not set inputLens[] and outputLens[];
 // it just tallies them.
 //
@@ -40,17 +142,12 @@ GetAvailableCount(const struct QsStreamJob *j) {
         // thread is the one calling FixFlowArgs(); so we cannot call:
         // DASSERT(j->advanceInputs[i] == 0);
 
-        size_t len;
-
-        if(j->inputs[i].readLength > j->inputs[i].maxRead)
-            len = j->inputs[i].maxRead;
-        else
-            len = j->inputs[i].readLength;
+        size_t len = ReadLength(j->inputs + i);
 
         if(len > j->inputs[i].maxRead)
             len = j->inputs[i].maxRead;
 
-        availableCount += len;
+        availableCount += WholeElements(len, j->inputs[i].elementSize);
     }
 
 
@@ -64,18 +161,8 @@ GetAvailableCount(const struct QsStreamJob *j) {
         if(j->outputs[i].isFlushing)
             continue;
 
-        size_t maxReadLength = 0;
-
         struct QsOutput *out = j->outputs + i;
-        DASSERT(out->numInputs);
-
-        // Find the largest readLength from all the inputs that this
-        // output, out, feeds.
-        for(uint32_t k = out->numInputs - 1; k != -1; --k) {
-            struct QsInput *in = out->inputs[k];
-            if(maxReadLength < in->readLength)
-                maxReadLength = in->readLength;
-        }
+        size_t maxReadLength = MaxReadLength(out);
 
         size_t len = 0;
 
@@ -85,7 +172,7 @@ GetAvailableCount(const struct QsStreamJob *j) {
                 len = out->maxWrite;
         }
 
-        availableCount += len;
+        availableCount += WholeElements(len, out->elementSize);
     }
 
     return availableCount;
@@ -101,13 +188,14 @@ FixFlowArgs(struct QsStreamJob *j) {
     for(uint32_t i = j->numInputs - 1; i != -1; --i) {
         DASSERT(j->advanceInputs[i] == 0);
 
-        if(j->inputs[i].readLength > j->inputs[i].maxRead)
-            j->inputLens[i] = j->inputs[i].maxRead;
-        else
-            j->inputLens[i] = j->inputs[i].readLength;
+        j->inputLens[i] = ReadLength(j->inputs + i);
 
         if(j->inputLens[i] > j->inputs[i].maxRead)
             j->inputLens[i] = j->inputs[i].maxRead;
+        else
+            // maxRead is a multiple of the element size already.
+            j->inputLens[i] = WholeElements(j->inputLens[i],
+                    j->inputs[i].elementSize);
 
 //ERROR("j->inputLens[%" PRIu32 "] = %zu", i, j->inputLens[i]);
     }
@@ -121,24 +209,21 @@ FixFlowArgs(struct QsStreamJob *j) {
             continue;
         }
 
-        size_t maxReadLength = 0;
-
         struct QsOutput *out = j->outputs + i;
-        DASSERT(out->numInputs);
-
-        // Find the largest readLength from all the inputs that this
-        // output, out, feeds.
-        for(uint32_t k = out->numInputs - 1; k != -1; --k) {
-            struct QsInput *in = out->inputs[k];
-            if(maxReadLength < in->readLength)
-                maxReadLength = in->readLength;
-        }
+        size_t maxReadLength = MaxReadLength(out);
+
+        // For the stats; we have the fill here already, so we do not get
+        // it again at every write count add.
+        out->fill = maxReadLength;
 
         if(out->maxWrite + out->maxMaxRead > maxReadLength) {
             j->outputLens[i] =
                 out->maxWrite + out->maxMaxRead - maxReadLength;
             if(j->outputLens[i] > out->maxWrite)
                 j->outputLens[i] = out->maxWrite;
+            else
+                j->outputLens[i] = WholeElements(j->outputLens[i],
+                        out->elementSize);
         } else
             j->outputLens[i] = 0;
 
@@ -151,9 +236,10 @@ static inline void
 AdvanceRingBufferpointers(struct QsStreamJob *j) {
 
     // Here we advance read and write pointers due to this stream job
-    // reading and writing.  We also calculate the distance between
-    // the write and read pointers (readLength).  Read more comments
-    // for a more detailed understanding.
+    // reading and writing.  We also add to the read and write counts that
+    // we use to get the distance between the write and read pointers
+    // (see ReadLength()).  Read more comments for a more detailed
+    // understanding.
     //
 
     // Count the total bytes advanced in the last flow() (or flush())
@@ -180,14 +266,17 @@ AdvanceRingBufferpointers(struct QsStreamJob *j) {
             if(j->inputBuffers[i] >= in->output->buffer->end)
                 j->inputBuffers[i] -= in->output->buffer->mapLength;
             //
-            // Decrease the input readLength for this input.
+            // Add to the read count for this input.
             //
-            // readLength is the distance between the write pointer and
-            // this input's (j->inputs[i]) read pointer, on the ring
-            // buffer.  Here we tally the decrease in it due to the
-            // advancement of the read pointer.
+            // The read length is the distance between the write pointer
+            // and this input's (j->inputs[i]) read pointer, on the ring
+            // buffer.  Here we decrease it due to the advancement of the
+            // read pointer.  The release memory order makes it so the
+            // writer will not write over the memory before we are done
+            // reading it.
             //
-            in->readLength -= j->advanceInputs[i];
+            atomic_fetch_add_explicit(&in->readCount,
+                    j->advanceInputs[i], memory_order_release);
             j->advanceInputs[i] = 0;
             if(!j->didIOAdvance)
                 j->didIOAdvance = true;
@@ -212,33 +301,163 @@ AdvanceRingBufferpointers(struct QsStreamJob *j) {
             if(j->outputBuffers[i] >= out->buffer->end)
                 j->outputBuffers[i] -= out->buffer->mapLength;
             //
-            // Increase the input read lengths that this output feeds.
+            // Increase the read lengths of all the inputs that this
+            // output feeds, by adding to the one write count that they
+            // all share.
             //
-            // Note: we change input readLength since we cannot change
+            // Note: we change the write count since we cannot change
             // inputBuffers[] (read pointers) while there may be a
             // different block worker thread using that in a flow() or
-            // flush() call without a mutex lock.  In this way readLength
-            // is the magic sauce.
+            // flush() call without a mutex lock.  In this way the read
+            // and write counts are the magic sauce.
             //
             // That's how we can release mutex locks while we call the
-            // flow() and flush() block callback functions.
+            // flow() and flush() block callback functions; and since
+            // they are atomic, the reading and writing stream jobs do
+            // not need to have each others mutex locks to use them.
+            //
+            // The release memory order makes it so the readers see the
+            // data that we wrote.
             //
-            for(uint32_t k = out->numInputs - 1; k != -1; --k) {
-                //
-                // readLength is the distance between this input pointer
-                // (in) and the write (output) pointer, in the ring
-                // buffer.  Here we tally the increases in it due to the
-                // advancement of the write pointer.
-                //
-                struct QsInput *in = out->inputs[k];
-                in->readLength += j->advanceOutputs[i];
-            }
+            atomic_fetch_add_explicit(&out->writeCount,
+                    j->advanceOutputs[i], memory_order_release);
+
+            // The readers may have read some since FixFlowArgs(), so this
+            // is the most it can be.
+            size_t fill = out->fill + j->advanceOutputs[i];
+            if(out->highWater < fill)
+                out->highWater = fill;
 
             j->advanceOutputs[i] = 0;
             if(!j->didIOAdvance)
                 j->didIOAdvance = true;
         }
+
+        if(out->isDone && !out->isFlushing) {
+            // The block called qsOutputDone() in the last flow() or
+            // flush() call.  We set this after adding to the write count
+            // so that the reading blocks see all the data that was
+            // written when they see that this output is flushing.
+            out->isFlushing = true;
+            // Mark the stream IO as changed.
+            j->didIOAdvance = true;
+        }
+    }
+}
+
+
+// Return true if all the outputs that feed this stream job's inputs are
+// flushing; that is there will be no more input written to this stream
+// job in this stream run.  Blocks that declared that they are sources
+// (isSource) can write output without input, so they never drain.
+//
+static inline bool
+InputsFlushed(const struct QsStreamJob *j) {
+
+    if(!j->numInputs || j->isSource)
+        return false;
+
+    for(uint32_t i = j->numInputs - 1; i != -1; --i) {
+        DASSERT(j->inputs[i].output);
+        if(!j->inputs[i].output->isFlushing)
+            return false;
+    }
+
+    return true;
+}
+
+
+// For a draining stream job, after FixFlowArgs(); returns true if we call
+// flush() in place of flow().  We keep calling flow() until all inputs
+// have less than maxRead to read, so that flush() gets the exact
+// remaining input lengths.
+//
+static inline bool
+UseFlush(const struct QsStreamJob *j) {
+
+    if(!j->draining || !j->flush)
+        return false;
+
+    for(uint32_t i = j->numInputs - 1; i != -1; --i)
+        if(j->inputLens[i] >= j->inputs[i].maxRead)
+            return false;
+
+    return true;
+}
+
+
+// For a draining stream job, just after a flow() or flush() call that
+// returned 0; returns true if the stream job is done.  It's done if there
+// is no input left to read and it did not write any output when there
+// was room to write output.  If we did not have that rule, blocks
+// without a flush() and blocks with a flush() that never returns
+// non-zero would never finish, and so the blocks that they feed would
+// not drain.
+//
+static inline bool
+DoneDraining(const struct QsStreamJob *j, bool wrote) {
+
+    DASSERT(j->draining);
+
+    if(wrote)
+        return false;
+
+    // If the writer left part of an element the block will never see it,
+    // so that does not count.
+    for(uint32_t i = j->numInputs - 1; i != -1; --i)
+        if(ReadLength(j->inputs + i) >= j->inputs[i].elementSize)
+            return false;
+
+    for(uint32_t i = j->numOutputs - 1; i != -1; --i)
+        if(!j->outputs[i].isFlushing && !j->outputLens[i])
+            // It had no room to write.  It will get called again when
+            // there is room.
+            return false;
+
+    return true;
+}
+
+
+// Return true if the block should wait for more input before we call
+// flow(), because an input with a threshold set by qsSetInputThreshold()
+// has less than that threshold to read, and the block that writes to it
+// is still calling flow() and so will likely write more soon.
+//
+// When the writing block stops calling flow() it queues its peers again
+// and this will not hold them, so we do not get stuck with input that is
+// less than the threshold, like at the end of the stream.
+//
+static inline bool
+HoldForThreshold(const struct QsStreamJob *j) {
+
+    for(uint32_t i = j->numInputs - 1; i != -1; --i) {
+
+        const struct QsInput *in = j->inputs + i;
+
+        if(!in->threshold)
+            continue;
+
+        // We cannot hold for more than the block will read; the writer
+        // may not be able to write more than that until we read.
+        size_t threshold = in->threshold;
+        if(threshold > in->maxRead)
+            threshold = in->maxRead;
+
+        if(ReadLength(in) >= threshold)
+            continue;
+
+        DASSERT(in->output);
+        struct QsSimpleBlock *wb = (void *) in->output->port.block;
+        DASSERT(wb);
+        DASSERT(wb->streamJob);
+
+        // We do not have the writers mutex.  If this is stale the writer
+        // will queue us again when it stops flowing.
+        if(wb->streamJob->flowing)
+            return true;
     }
+
+    return false;
 }
 
 
@@ -255,8 +474,29 @@ CheckStreamJob(const struct QsStreamJob *j) {
         // not.
         return false;
 
+    if(HoldForThreshold(j))
+        // The writer will queue this again.
+        return false;
+
+    if(!j->draining && InputsFlushed(j) &&
+            !(j->epoll && !j->epoll->ready && !j->peerAdvanced))
+        // All the blocks that write to this block just finished.  That
+        // is new, so we call flow() or flush() even if there is no more
+        // input, so the block can drain.
+        return true;
+
     size_t availableCount = GetAvailableCount(j);
 
+    if(j->epoll) {
+        // The file descriptor being ready is new information, so we do
+        // not care about the last available count.
+        if(!j->epoll->ready)
+            // The epoll thread will queue this when it's ready, or a
+            // peer that advanced a shared memory ring buffer may.
+            return j->peerAdvanced;
+        return availableCount;
+    }
+
     if(j->didIOAdvance)
         // If nothing is available then we do not want to call flow() or
         // flush(), but otherwise yes.
@@ -283,6 +523,35 @@ CheckStreamJob(const struct QsStreamJob *j) {
 }
 
 
+// Count the outputs that do not have room for the block to write
+// maxWrite; for when the stream job stops running.  See QsOutput::clogs.
+//
+static inline void
+CountClogs(struct QsStreamJob *j) {
+
+    for(uint32_t i = j->numOutputs - 1; i != -1; --i) {
+        struct QsOutput *out = j->outputs + i;
+        if(!out->isFlushing && MaxReadLength(out) > out->maxMaxRead)
+            ++out->clogs;
+    }
+}
+
+
+// Queue a stream job and note the time, so we can see how long it waits
+// for a worker thread.  We need the stream job lock.
+//
+static inline void
+QueueStreamJob(struct QsStreamJob *j) {
+
+    if(!j->queuedAt && !j->busy)
+        // If it's busy (in flow()) the worker running it will keep
+        // running it, so there is no wait.
+        j->queuedAt = GetNanoseconds();
+
+    qsJob_queueJob((void *) j);
+}
+
+
 static inline struct QsSimpleBlock *
 GetSimpleBlock(struct QsStreamJob *j) {
 
@@ -300,11 +569,68 @@ GetStreamJobPP(struct QsStreamJob *j) {
 }
 
 
+// For thread pools with QsThreadPool::fuseChains set.
+//
+// We have the lock of stream job j, which is the QsStreamJob::fuseNext of
+// the stream job that this worker thread is running, and CheckStreamJob()
+// says that it can run.  If no other worker thread has the block of j,
+// we run j now in this worker thread, like a worker thread that popped
+// it from the queue would, but without queuing it.  The data that the
+// last flow() call wrote is then likely still in the CPU cache when j
+// reads it.  j gets its input and output lengths from FixFlowArgs() like
+// always, so the block's maxRead and maxWrite still hold.
+//
+// Returns false if we did not run it, so the caller can queue it.  We
+// return with the j lock, like we got it.
+//
+// If j has a fuseNext, the QueueWorkCalls() in this StreamWork() call
+// runs it too; so a chain is run link by link by one worker thread.
+//
+static inline bool
+RunFusedStreamJob(struct QsStreamJob *j) {
+
+    struct QsJobsBlock *b = ((struct QsJob *) j)->jobsBlock;
+    struct QsThreadPool *tp = b->threadPool;
+    struct QsWhichJob *wj = pthread_getspecific(threadPoolKey);
+
+    if(!wj || wj->threadPool != tp)
+        return false;
+
+    if(WorkerShouldYield(tp) ||
+            (wj->deque && WorkDequeLength(wj->deque)))
+        // There are other blocks waiting for a worker thread, so we do
+        // not keep this worker thread running this chain; otherwise a
+        // source at the start of a chain could keep it forever.
+        // Queuing j lets the other blocks have their turn, and with work
+        // stealing it gets another worker thread to come steal.
+        return false;
+
+    if(!GrabBlockJob(tp, b, (void *) j))
+        return false;
+
+    // The block API finds the job from the worker thread specific data.
+    struct QsJob *job = wj->job;
+    wj->job = (void *) j;
+
+    while(StreamWork(j));
+
+    wj->job = job;
+
+    ReleaseBlockJob(tp, b, (void *) j);
+
+    return true;
+}
+
+
 // Queues work for all neighboring blocks (stream neighbors) that can work
 // the stream.
 //
-// Returns true to have this block, b, continue calling flow() or flush()
-// in StreamWork().
+// We must not have the stream job, sj, lock when calling this.  We get
+// the lock of one peer stream job at a time.  Stream jobs do not share
+// mutexes, so that a stream job with many peers (like a source feeding
+// many blocks) does not lock all of them for every flow() call.  The
+// read and write counts are atomic, so we do not need the lock of the
+// other stream job to use them.
 //
 static inline void
 QueueWorkCalls(struct QsStreamJob *sj) {
@@ -321,11 +647,19 @@ QueueWorkCalls(struct QsStreamJob *sj) {
     // For all peer jobs which are stream jobs:
     for(struct QsStreamJob **j = GetStreamJobPP(sj); *j; ++j) {
         DASSERT((*j) != sj);
-        if(CheckStreamJob((void *)(*j)))
+        qsJob_lock((void *) (*j));
+        if((*j)->sharedBuffer && sj->didIOAdvance)
+            // The block may need to tell the other process.
+            (*j)->peerAdvanced = true;
+        if(CheckStreamJob((void *)(*j)) &&
+                (*j != sj->fuseNext || !RunFusedStreamJob(*j)))
             // If the stream job is running already this does the right
             // thing.  qsJob_queueJob() will not queue it if the stream
-            // job, (*j), is running, and that's what we want.
-            qsJob_queueJob((void *) (*j));
+            // job, (*j), is running, and that's what we want.  The
+            // worker thread running it checks it again, with its lock,
+            // before it stops running it; see StreamWork().
+            QueueStreamJob(*j);
+        qsJob_unlock((void *) (*j));
     }
 }
 
@@ -364,10 +698,39 @@ bool StreamWork(struct QsStreamJob *j) {
     DASSERT(!j->isFinished,
             "block \"%s\"", b->jobsBlock.block.name);
 
+    if(j->epoll && !j->epoll->ready && !j->peerAdvanced)
+        // It got queued, like in qsGraph_start(), before the file
+        // descriptor was ready.  The epoll thread will queue it again.
+        return false;
+
+    j->peerAdvanced = false;
+
 //ERROR("                    block \"%s\"", b->jobsBlock.block.name);
 
+    // We must check this before FixFlowArgs(), so that when we are
+    // draining the input lengths include all that the finished writers
+    // wrote; they add to their write counts before they set isFlushing.
+    if(!j->draining && InputsFlushed(j))
+        j->draining = true;
+
+    SkipLossyInputs(j);
+
     FixFlowArgs(j);
 
+    int (*callback)(const void * const in[], const size_t inLens[],
+            uint32_t numIn, void * const out[], const size_t outLens[],
+            uint32_t numOut, void *userData) = j->flow;
+    uint32_t callbackType = CB_FLOW;
+
+    if(UseFlush(j)) {
+        callback = j->flush;
+        callbackType = CB_FLUSH;
+    }
+
+    // Peers that read from this block may hold off calling their flow()
+    // until we stop looping in here.  See HoldForThreshold().
+    j->flowing = true;
+
 
     // Reinitialize the didIOAdvance flag.  It will be set if there was
     // any flow action (flow in or out) by this stream job in the next
@@ -376,42 +739,126 @@ bool StreamWork(struct QsStreamJob *j) {
     DASSERT(!j->busy);
     j->busy = true;
 
+    uint64_t t = GetNanoseconds();
+    if(j->queuedAt) {
+        j->waitNs += t - j->queuedAt;
+        j->queuedAt = 0;
+    }
+
     //////////////////////////////////////////
     qsJob_unlock((void *) j);
 
     struct QsWhichBlock stackSave;
-    SetBlockCallback((void *) b, CB_FLOW, &stackSave);
+    SetBlockCallback((void *) b, callbackType, &stackSave);
 
-    // TODO: Call flow() or flush().
-    //
-    int workRet = j->flow((const void * const *) j->inputBuffers,
+    int workRet = callback((const void * const *) j->inputBuffers,
             j->inputLens, j->numInputs,
             j->outputBuffers, j->outputLens, j->numOutputs,
             b->jobsBlock.block.userData);
 
     RestoreBlockCallback(&stackSave);
 
+    t = GetNanoseconds() - t;
+
     qsJob_lock((void *) j);
     //////////////////////////////////////////
 
     DASSERT(j->busy);
     j->busy = false;
 
+    ++j->calls;
+    j->busyNs += t;
+
+    bool wrote = false;
+    for(uint32_t i = j->numOutputs - 1; i != -1; --i)
+        if(j->advanceOutputs[i]) {
+            wrote = true;
+            break;
+        }
+
+    CheckLossyOverruns(j);
+
     AdvanceRingBufferpointers(j);
 
-    QueueWorkCalls(j);
+    if(!j->didIOAdvance)
+        ++j->stalls;
+
+    if(!workRet && j->draining && DoneDraining(j, wrote))
+        workRet = 1;
+
+    bool ret = false; // false == stop calling for now.
 
     if(workRet) {
         DASSERT(!j->isFinished);
-        INFO("Flushing source block \"%s\" (%" PRIu32 ") outputs",
+        INFO("Flushing block \"%s\" (%" PRIu32 ") outputs",
                 b->jobsBlock.block.name, j->numOutputs);
+        // No more data will be written to the outputs, so the blocks
+        // that read them can drain.  They get queued in QueueWorkCalls()
+        // below.
+        for(uint32_t i = j->numOutputs - 1; i != -1; --i)
+            j->outputs[i].isFlushing = true;
         j->isFinished = true;
         CheckSignalFinish(b->jobsBlock.block.graph);
         DASSERT(!j->job.inQueue);
-        return false;
+    } else {
+        if(j->epoll && !j->didIOAdvance && !j->epoll->waiting)
+            // The block did not get anything from the file descriptor,
+            // like when a read(2) returns EAGAIN, so we wait for it to be
+            // ready again before the next flow() or flush() call.
+            //
+            // If the block did read or write, the file descriptor may
+            // have more for it, like a fast pipe or file; so we keep it
+            // "ready" and call flow() again, like reading an edge
+            // triggered file descriptor until EAGAIN.  That saves an
+            // epoll_ctl(2) and a trip through the epoll thread for each
+            // flow() call.
+            //
+            // It's waiting already if a peer got it called; see
+            // QsStreamJob::peerAdvanced.
+            RearmEpollClient(j);
+        ret = CheckStreamJob(j);
+    }
+
+    if(!ret)
+        // We must unset this before we queue the peers, so that the
+        // peers that where held by their input thresholds get queued.
+        j->flowing = false;
+
+    // We cannot have our lock while getting the peers locks, or we could
+    // deadlock with a peer that is doing the same thing.
+    qsJob_unlock((void *) j);
+    //////////////////////////////////////////
+
+    QueueWorkCalls(j);
+
+    //////////////////////////////////////////
+    qsJob_lock((void *) j);
+
+    if(!ret && !j->isFinished && CheckStreamJob(j)) {
+        // A peer changed the stream while we did not have our lock.  It
+        // could not queue this stream job since we are still running it,
+        // so we keep running it.
+        j->flowing = true;
+        ret = true;
     }
 
-    return CheckStreamJob(j); // false == stop calling for now.
+    if(!ret) {
+        // A peer may have tried to queue this while we did not have our
+        // lock, but it could not since we are running it; so it's not
+        // waiting in the queue.
+        j->queuedAt = 0;
+        if(!j->isFinished)
+            CountClogs(j);
+    }
+
+    return ret;
+}
+
+
+void QueueEpollStreamJob(struct QsStreamJob *j) {
+
+    if(CheckStreamJob(j))
+        QueueStreamJob(j);
 }
 
 
@@ -1,6 +1,10 @@
+#define _GNU_SOURCE
 #include <inttypes.h>
 #include <string.h>
+#include <stddef.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <sched.h>
 #include <pthread.h>
 #include <stdatomic.h>
 
@@ -17,9 +21,54 @@
 #include "port.h"
 #include "job.h"
 #include "stream.h"
+#include "workDeque.h"
+#include "mmapRingBuffer.h"
 
 
 
+// We must have a thread pool mutex lock before calling this.  This
+// returns while holding the thread pool mutex lock.
+//
+// The worker thread has no work, so it waits (sleeps) until it is
+// signaled.  Returns false if the worker thread needs to exit.
+//
+static inline
+bool WorkerWait(struct QsThreadPool *tp) {
+
+    --tp->numWorkingThreads;
+
+    if(tp->haltCond && tp->numWorkingThreads == 0)
+        // Last worker to sleep (wait) signal this before we sleep (wait).
+        CHECK(pthread_cond_signal(tp->haltCond));
+
+    do
+        // It will return some time after we signal it, but we don't know
+        // when.  The signalOne flag lets us know that we are waiting for
+        // a thread to return from this pthread_cond_wait() because it was
+        // signaled, without having to have the signaler wait for a reply.
+        //
+        // We only let them out one at a time.  If they are too slow to
+        // trigger (return from pthread_cond_wait()) then the signal may
+        // not let a worker thread out of this do while loop.  Like if we
+        // signal it, than some time later we "close the gate" by setting
+        // tp->signalingOne to false in another part of the code.
+        //
+        CHECK(pthread_cond_wait(&tp->cond, &tp->mutex));
+    while(!tp->signalingOne);
+
+    tp->signalingOne = false;
+
+    ++tp->numWorkingThreads;
+
+    if(tp->numThreads > tp->maxThreadsRun)
+        // This worker is being terminated, after it waited.
+        return false;
+
+
+    return true; // keep looping
+}
+
+
 // We must have a thread pool mutex lock before calling this.  This
 // returns while holding the thread pool mutex lock.
 //
@@ -95,38 +144,377 @@ bool WorkerLoop(struct QsThreadPool *tp, struct QsWhichJob *wj) {
         // This worker is being terminated, before it would have waited.
         return false;
 
+    return WorkerWait(tp);
+}
 
-    --tp->numWorkingThreads;
 
-    if(tp->haltCond && tp->numWorkingThreads == 0)
-        // Last worker to sleep (wait) signal this before we sleep (wait).
-        CHECK(pthread_cond_signal(tp->haltCond));
+////////////////////////////////////////////////////////////////////////
+//                      Work Stealing
+////////////////////////////////////////////////////////////////////////
+//
+// The code below is just for thread pools with tp->workStealing set.
+// See QsThreadPool::workStealing in threadPool.h and workDeque.h.
 
-    do
-        // It will return some time after we signal it, but we don't know
-        // when.  The signalOne flag lets us know that we are waiting for
-        // a thread to return from this pthread_cond_wait() because it was
-        // signaled, without having to have the signaler wait for a reply.
-        //
-        // We only let them out one at a time.  If they are too slow to
-        // trigger (return from pthread_cond_wait()) then the signal may
-        // not let a worker thread out of this do while loop.  Like if we
-        // signal it, than some time later we "close the gate" by setting
-        // tp->signalingOne to false in another part of the code.
-        //
-        CHECK(pthread_cond_wait(&tp->cond, &tp->mutex));
-    while(!tp->signalingOne);
 
-    tp->signalingOne = false;
+// Put the block, b, at the end of the thread pool block queue.
+//
+// We need a thread pool mutex lock to call this.  The b->inQueue flag is
+// already set.
+//
+static inline
+void AppendBlock(struct QsThreadPool *tp, struct QsJobsBlock *b) {
 
-    ++tp->numWorkingThreads;
+    DASSERT(b->inQueue);
+    DASSERT(!b->next);
+    DASSERT(!b->prev);
+
+    if(tp->last) {
+        DASSERT(tp->first);
+        DASSERT(!tp->last->next);
+        tp->last->next = b;
+    } else {
+        DASSERT(!tp->first);
+        tp->first = b;
+    }
+    b->prev = tp->last;
+    tp->last = b;
+}
+
+
+// Move all the blocks in the worker's deque to the thread pool block
+// queue, keeping the order that they where pushed in.
+//
+// We need a thread pool mutex lock to call this, and the owner of the
+// deque must not be using it.
+//
+static inline
+void DrainWorkDeque(struct QsThreadPool *tp, struct QsWhichJob *wj) {
+
+    DASSERT(wj->deque);
+
+    struct QsJobsBlock *b;
+    while((b = StealWorkDeque(wj->deque)))
+        AppendBlock(tp, b);
+}
+
+
+void DrainWorkDeques(struct QsThreadPool *tp) {
+
+    DASSERT(tp);
+    DASSERT(tp->workStealing);
+    DASSERT(!tp->numWorkingThreads);
+
+    for(struct QsWhichJob *wj = tp->workers; wj; wj = wj->next)
+        DrainWorkDeque(tp, wj);
+}
+
+
+// Queue the block, b, that has b->inQueue set, but is not in a queue yet.
+//
+// If the calling thread is a worker in this thread pool we push the block
+// on the worker's own deque without getting the thread pool mutex lock.
+// Otherwise the block goes in the thread pool block queue the old way.
+//
+// If haveTPL is set the caller has the thread pool mutex lock.
+//
+static inline
+void PushBlock(struct QsThreadPool *tp, struct QsJobsBlock *b,
+        bool haveTPL) {
+
+    if(!haveTPL) {
+        struct QsWhichJob *wj = pthread_getspecific(threadPoolKey);
+        if(wj && wj->threadPool == tp && PushWorkDeque(wj->deque, b)) {
+            // This worker will get to it, but if it has more than it can
+            // do now, we get another worker thread to come steal.
+            if(WorkDequeLength(wj->deque) > 1 &&
+                    __atomic_load_n(&tp->numWorkingThreads,
+                        __ATOMIC_RELAXED) <
+                    __atomic_load_n(&tp->maxThreadsRun, __ATOMIC_RELAXED)) {
+                CHECK(pthread_mutex_lock(&tp->mutex));
+                WakeOrLaunchWorker(tp);
+                CHECK(pthread_mutex_unlock(&tp->mutex));
+            }
+            return;
+        }
+        CHECK(pthread_mutex_lock(&tp->mutex));
+    }
+
+    AppendBlock(tp, b);
+    CheckLaunchWorkers(tp);
+
+    if(!haveTPL)
+        CHECK(pthread_mutex_unlock(&tp->mutex));
+}
+
+
+// We must have the job lock before calling this.
+//
+// This is _qsJob_queueJob() for thread pools with tp->workStealing set.
+// The block's job queue is protected by the block's queueLock spin lock
+// and not the thread pool mutex.
+//
+void WorkStealingQueueJob(struct QsJob *j, bool getTPL) {
+
+    struct QsJobsBlock *b = j->jobsBlock;
+    struct QsThreadPool *tp = b->threadPool;
+    DASSERT(tp->workStealing);
+
+    CHECK(pthread_spin_lock(&b->queueLock));
+
+    if(j->busy || j->inQueue) {
+        // No need to queue the job, it's working on it now or
+        // it's already queued.
+        CHECK(pthread_spin_unlock(&b->queueLock));
+        return;
+    }
+
+    ReallyQueueJob(b, j);
+
+    if(j->work == (void *) StreamWork)
+        ++tp->graph->streamJobCount;
+
+    if(b->busy || b->inQueue) {
+        // The block is in a queue or is being acted on now.
+        CHECK(pthread_spin_unlock(&b->queueLock));
+        return;
+    }
+
+    // We own the queuing of this block now.
+    b->inQueue = true;
+
+    CHECK(pthread_spin_unlock(&b->queueLock));
+
+    PushBlock(tp, b, !getTPL);
+}
+
+
+// For thread pools with tp->fuseChains set.  See RunFusedStreamJob() in
+// streamWork.c.
+//
+// We must have the job, j, lock.  Get the block, b, and its job, j, for a
+// worker thread to run j without queuing it; like a worker thread that
+// popped the block and job from the queues.  Returns false if another
+// worker thread has the block, or the block or job is queued, or the
+// thread pool is halting; then the caller can queue the job the regular
+// way.
+//
+bool GrabBlockJob(struct QsThreadPool *tp, struct QsJobsBlock *b,
+        struct QsJob *j) {
+
+    DASSERT(tp->fuseChains);
+    DASSERT(b->threadPool == tp);
+    DASSERT(j->jobsBlock == b);
+
+    if(tp->workStealing)
+        CHECK(pthread_spin_lock(&b->queueLock));
+    else
+        CHECK(pthread_mutex_lock(&tp->mutex));
+
+    bool got = (!tp->halt && !b->busy && !b->inQueue &&
+            !j->busy && !j->inQueue);
+
+    if(got) {
+        b->busy = true;
+        j->busy = true;
+    }
+
+    if(tp->workStealing)
+        CHECK(pthread_spin_unlock(&b->queueLock));
+    else
+        CHECK(pthread_mutex_unlock(&tp->mutex));
+
+    return got;
+}
+
+
+// Undo GrabBlockJob() after running the job.  We must have the job, j,
+// lock.  Jobs that got queued in the block while we had it did not get
+// the block queued, so we queue it now.
+//
+void ReleaseBlockJob(struct QsThreadPool *tp, struct QsJobsBlock *b,
+        struct QsJob *j) {
+
+    if(tp->workStealing) {
+
+        CHECK(pthread_spin_lock(&b->queueLock));
+        DASSERT(b->busy);
+        DASSERT(j->busy);
+        DASSERT(!j->inQueue);
+        DASSERT(!b->inQueue);
+        j->busy = false;
+        b->busy = false;
+        bool queue = (b->first)?true:false;
+        if(queue)
+            // We own the queuing of this block now.
+            b->inQueue = true;
+        CHECK(pthread_spin_unlock(&b->queueLock));
+
+        if(queue)
+            PushBlock(tp, b, false);
+        return;
+    }
+
+    CHECK(pthread_mutex_lock(&tp->mutex));
+    DASSERT(b->busy);
+    DASSERT(j->busy);
+    DASSERT(!j->inQueue);
+    DASSERT(!b->inQueue);
+    j->busy = false;
+    b->busy = false;
+    if(b->first) {
+        QueueBlock(tp, b);
+        CheckLaunchWorkers(tp);
+    }
+    CHECK(pthread_mutex_unlock(&tp->mutex));
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Run the jobs in block, b, without the thread pool mutex lock.
+//
+// Returns false if the worker needs to go back and get the thread pool
+// mutex lock, in which case the block was pushed back in a queue if it
+// had jobs left in it.
+//
+static inline
+bool RunBlock(struct QsThreadPool *tp, struct QsJobsBlock *b,
+        struct QsWhichJob *wj) {
+
+    DASSERT(b->threadPool == tp);
+
+    CHECK(pthread_spin_lock(&b->queueLock));
+
+    DASSERT(b->inQueue);
+    DASSERT(!b->busy);
+    b->inQueue = false;
+    b->busy = true;
+
+    struct QsJob *j;
+
+    while((j = b->first)) {
+
+        ReallyDequeueJob(b, j);
+        DASSERT(j->jobsBlock == b);
+        DASSERT(!j->busy);
+        j->busy = true;
+
+        CHECK(pthread_spin_unlock(&b->queueLock));
+
+        // Process job/event.
+        qsJob_work(j, wj);
+
+        CHECK(pthread_spin_lock(&b->queueLock));
+        DASSERT(!j->inQueue);
+        DASSERT(j->busy);
+        j->busy = false;
+        CHECK(pthread_spin_unlock(&b->queueLock));
+
+        if(j->work == (void *) StreamWork &&
+                --tp->graph->streamJobCount == 0)
+            CheckStreamFinished(tp->graph);
+
+        qsJob_unlock(j);
+
+        CHECK(pthread_spin_lock(&b->queueLock));
+
+        if(b->first && WorkerShouldYield(tp)) {
+            // Put the block back in a queue so that it's jobs may be run
+            // after whatever is going on.
+            b->busy = false;
+            b->inQueue = true;
+            CHECK(pthread_spin_unlock(&b->queueLock));
+            PushBlock(tp, b, false);
+            return false;
+        }
+    }
+
+    DASSERT(b->busy);
+    b->busy = false;
+
+    CHECK(pthread_spin_unlock(&b->queueLock));
+
+    return true;
+}
+
+
+// We must have the thread pool mutex lock before calling this.
+//
+// Get a block from the thread pool block queue, or from this worker's
+// deque, or steal one from another worker's deque; in that order.  The
+// thread pool block queue goes first so that blocks queued by
+// non-worker threads do not starve.
+//
+static inline
+struct QsJobsBlock *GetWorkBlock(struct QsThreadPool *tp,
+        struct QsWhichJob *wj) {
+
+    if(tp->halt || tp->numThreads > tp->maxThreadsRun)
+        return 0;
+
+    struct QsJobsBlock *b = tp->first;
+
+    if(b) {
+        DASSERT(b->inQueue);
+        DASSERT(!b->prev);
+        tp->first = b->next;
+        if(b->next) {
+            b->next->prev = 0;
+            b->next = 0;
+        } else {
+            DASSERT(tp->last == b);
+            tp->last = 0;
+        }
+        return b;
+    }
+
+    if((b = PopWorkDeque(wj->deque)))
+        return b;
+
+    // Steal.  Start with the next worker so we do not all go after the
+    // same one.
+    struct QsWhichJob *w = wj->next?wj->next:tp->workers;
+    for(; w != wj; w = w->next?w->next:tp->workers)
+        if((b = StealWorkDeque(w->deque)))
+            return b;
+
+    return 0;
+}
+
+
+// We must have a thread pool mutex lock before calling this.  This
+// returns while holding the thread pool mutex lock.
+//
+// The WorkerLoop() for thread pools with tp->workStealing set.
+//
+static inline
+bool WorkStealingWorkerLoop(struct QsThreadPool *tp,
+        struct QsWhichJob *wj) {
+
+    DASSERT(tp->numWorkingThreads <= tp->numThreads);
+
+    struct QsJobsBlock *b;
+
+    while((b = GetWorkBlock(tp, wj))) {
+
+        if(tp->first || WorkDequeLength(wj->deque))
+            // There is more work for another worker thread.
+            WakeOrLaunchWorker(tp);
+
+        CHECK(pthread_mutex_unlock(&tp->mutex));
+
+        // Run blocks from our own deque for as long as we can without
+        // the thread pool mutex lock.
+        while(RunBlock(tp, b, wj) && !WorkerShouldYield(tp) &&
+                (b = PopWorkDeque(wj->deque)));
+
+        CHECK(pthread_mutex_lock(&tp->mutex));
+    }
 
     if(tp->numThreads > tp->maxThreadsRun)
-        // This worker is being terminated, after it waited.
+        // This worker is being terminated, before it would have waited.
         return false;
 
-
-    return true; // keep looping
+    return WorkerWait(tp);
 }
 
 
@@ -138,6 +526,11 @@ static void *RunThread(struct QsThreadPool *tp) {
     ASSERT(wj, "calloc(1,%zu) failed", sizeof(*wj));
     wj->threadPool = tp;
 
+    if(tp->workStealing) {
+        wj->deque = calloc(1, sizeof(*wj->deque));
+        ASSERT(wj->deque, "calloc(1,%zu) failed", sizeof(*wj->deque));
+    }
+
     CHECK(pthread_setspecific(threadPoolKey, wj));
 
     // This worker thread is already counted by tp->numThreads and
@@ -157,7 +550,26 @@ static void *RunThread(struct QsThreadPool *tp) {
 
     DASSERT(tp->numWorkingThreads <= tp->numThreads);
 
-    while(WorkerLoop(tp, wj));
+    if(tp->workStealing) {
+        // Add this worker to the list of workers that can be stolen from.
+        wj->next = tp->workers;
+        if(tp->workers)
+            tp->workers->prev = wj;
+        tp->workers = wj;
+
+        while(WorkStealingWorkerLoop(tp, wj));
+
+        // Give what's left in our deque to the other workers, and remove
+        // this worker from the list.
+        DrainWorkDeque(tp, wj);
+        if(wj->next)
+            wj->next->prev = wj->prev;
+        if(wj->prev)
+            wj->prev->next = wj->next;
+        else
+            tp->workers = wj->next;
+    } else
+        while(WorkerLoop(tp, wj));
 
     // We make it so that only one thread pool worker thread exits at a
     // time, via the thread pool mutex lock and the maxThreadsRun and
@@ -180,6 +592,10 @@ static void *RunThread(struct QsThreadPool *tp) {
 
 #ifdef DEBUG
     CHECK(pthread_setspecific(threadPoolKey, 0));
+#endif
+    if(wj->deque)
+        free(wj->deque);
+#ifdef DEBUG
     memset(wj, 0, sizeof(*wj));
 #endif
     free(wj);
@@ -193,6 +609,163 @@ static void *RunThread(struct QsThreadPool *tp) {
 }
 
 
+static const struct {
+    const char *name;
+    int policy;
+} schedPolicies[] = {
+    { "other", SCHED_OTHER },
+    { "fifo", SCHED_FIFO },
+    { "rr", SCHED_RR },
+    { 0, 0 }
+};
+
+
+const char *SchedPolicyName(int policy) {
+
+    for(int i = 0; schedPolicies[i].name; ++i)
+        if(schedPolicies[i].policy == policy)
+            return schedPolicies[i].name;
+    return 0;
+}
+
+
+// Parse a CPU list string like "0-3,6,8-9" into set.  Returns 0 on
+// success, or -1 if the string is not a CPU list.
+//
+static int ParseCpus(const char *cpus, cpu_set_t *set) {
+
+    CPU_ZERO(set);
+
+    const char *s = cpus;
+
+    while(*s) {
+        char *end;
+        long first = strtol(s, &end, 10);
+        if(end == s || first < 0 || first >= CPU_SETSIZE)
+            return -1;
+        long last = first;
+        s = end;
+        if(*s == '-') {
+            ++s;
+            last = strtol(s, &end, 10);
+            if(end == s || last < first || last >= CPU_SETSIZE)
+                return -1;
+            s = end;
+        }
+        for(long i = first; i <= last; ++i)
+            CPU_SET(i, set);
+        if(*s == ',')
+            ++s;
+        else if(*s)
+            return -1;
+    }
+
+    return CPU_COUNT(set)?0:-1;
+}
+
+
+// Returns a malloc() allocated CPU list string, in the shortest form,
+// from the CPU set.
+//
+static char *PrintCpus(const cpu_set_t *set) {
+
+    char *str = 0;
+    size_t size = 0;
+    FILE *f = open_memstream(&str, &size);
+    ASSERT(f, "open_memstream() failed");
+
+    const char *sep = "";
+
+    for(int i = 0; i < CPU_SETSIZE; ++i) {
+        if(!CPU_ISSET(i, set)) continue;
+        int last = i;
+        while(last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set))
+            ++last;
+        if(last == i)
+            fprintf(f, "%s%d", sep, i);
+        else
+            fprintf(f, "%s%d-%d", sep, i, last);
+        sep = ",";
+        i = last;
+    }
+
+    fclose(f);
+    ASSERT(str);
+    return str;
+}
+
+
+// Returns the NUMA node that all the CPUs in set are on, or -1 if they
+// are on more than one node, or if there is just one node, or if we
+// can't tell.  The NUMA node CPU lists in /sys have the same format as
+// the CPU lists that we parse.
+//
+static int NumaNodeOfCpus(const cpu_set_t *set) {
+
+    char line[4096];
+    cpu_set_t nodes, nodeCpus, both;
+
+    FILE *f = fopen("/sys/devices/system/node/online", "r");
+    if(!f) return -1;
+    bool gotLine = fgets(line, sizeof(line), f);
+    fclose(f);
+    if(!gotLine) return -1;
+    line[strcspn(line, "\n")] = '\0';
+    if(ParseCpus(line, &nodes) || CPU_COUNT(&nodes) < 2)
+        return -1;
+
+    for(int n = 0; n < CPU_SETSIZE; ++n) {
+        if(!CPU_ISSET(n, &nodes)) continue;
+        char path[64];
+        snprintf(path, sizeof(path),
+                "/sys/devices/system/node/node%d/cpulist", n);
+        f = fopen(path, "r");
+        if(!f) continue;
+        gotLine = fgets(line, sizeof(line), f);
+        fclose(f);
+        if(!gotLine) continue;
+        line[strcspn(line, "\n")] = '\0';
+        if(ParseCpus(line, &nodeCpus))
+            // A node with memory and no CPUs.
+            continue;
+        CPU_AND(&both, set, &nodeCpus);
+        if(!CPU_COUNT(&both)) continue;
+        if(!CPU_EQUAL(&both, set))
+            // The CPUs are on more than one node.
+            return -1;
+        return n;
+    }
+
+    return -1;
+}
+
+
+// Setup the pthread attributes for making a worker thread with the
+// thread pool CPU affinity, and if withSched is set, with the thread pool
+// scheduling policy.
+//
+static inline void GetWorkerAttr(struct QsThreadPool *tp,
+        pthread_attr_t *attr, bool withSched) {
+
+    CHECK(pthread_attr_init(attr));
+
+    if(tp->cpus) {
+        cpu_set_t set;
+        // It was checked in qsThreadPool_setAffinity().
+        ASSERT(ParseCpus(tp->cpus, &set) == 0);
+        CHECK(pthread_attr_setaffinity_np(attr, sizeof(set), &set));
+    }
+
+    if(!withSched || (!tp->schedPolicy && !tp->schedPriority))
+        return;
+
+    struct sched_param param = { .sched_priority = tp->schedPriority };
+    CHECK(pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED));
+    CHECK(pthread_attr_setschedpolicy(attr, tp->schedPolicy));
+    CHECK(pthread_attr_setschedparam(attr, &param));
+}
+
+
 // We need a thread pool mutex lock to call this:
 //
 void _LaunchWorker(struct QsThreadPool *tp) {
@@ -211,8 +784,31 @@ void _LaunchWorker(struct QsThreadPool *tp) {
     DASSERT(tp->numThreads < tp->maxThreads);
 
     pthread_t p;
+    pthread_attr_t attr;
 
-    CHECK(pthread_create(&p, 0, (void *(*) (void *)) RunThread, tp));
+    if(!tp->cpus && !tp->schedPolicy && !tp->schedPriority)
+        CHECK(pthread_create(&p, 0, (void *(*) (void *)) RunThread, tp));
+    else {
+        // We first try with the scheduling policy and the CPU affinity,
+        // then with just the CPU affinity, because the scheduling policy
+        // is the one that needs privileges, like for SCHED_FIFO.
+        GetWorkerAttr(tp, &attr, true);
+        int err = pthread_create(&p, &attr,
+                (void *(*) (void *)) RunThread, tp);
+        CHECK(pthread_attr_destroy(&attr));
+        if(err) {
+            if(!tp->schedFailed)
+                WARN("Thread pool \"%s\" failed to create worker thread "
+                        "with scheduling policy %s priority %d: %s",
+                        tp->name, SchedPolicyName(tp->schedPolicy),
+                        tp->schedPriority, strerror(err));
+            tp->schedFailed = true;
+            GetWorkerAttr(tp, &attr, false);
+            CHECK(pthread_create(&p, &attr,
+                    (void *(*) (void *)) RunThread, tp));
+            CHECK(pthread_attr_destroy(&attr));
+        }
+    }
 
     // Count this new worker thread NOW.  We want these numbers to reflect
     // that there is another worker thread now, so that we do not make
@@ -499,6 +1095,224 @@ void qsThreadPool_setMaxThreads(struct QsThreadPool *tp,
 }
 
 
+// Replace all the worker threads in the thread pool, so that the new
+// CPU affinity and scheduling policy apply to all of them.  We could have
+// the worker threads change their own settings, but then every worker
+// loop would need to check for it.  Changing these settings is rare, so
+// we do it the slow simple way: halt the thread pool, join all the
+// workers, and launch one new worker.  More workers get launched as they
+// are needed, with the new settings.
+//
+// We need the graph mutex lock to call this.  The changes to the thread
+// pool are done in the Set() callback with the thread pool mutex lock.
+//
+static void
+ResetWorkers(struct QsThreadPool *tp,
+        void (*Set)(struct QsThreadPool *tp, void *arg), void *arg) {
+
+    struct QsGraph *g = tp->graph;
+    DASSERT(g);
+
+    qsGraph_threadPoolHaltLock(g, tp);
+
+    CHECK(pthread_mutex_lock(&tp->mutex));
+
+    Set(tp, arg);
+    tp->schedFailed = false;
+
+    uint32_t numThreads = tp->numThreads;
+    JoinThreads(tp, 0);
+    tp->maxThreadsRun = Get_maxThreadsRun(tp);
+
+    CHECK(pthread_mutex_unlock(&tp->mutex));
+
+    qsGraph_threadPoolHaltUnlock(g);
+
+    CHECK(pthread_mutex_lock(&tp->mutex));
+    // A worker could have been launched when the thread pool was unhalted
+    // and a job was queued.
+    if(numThreads && !tp->numThreads)
+        _LaunchWorker(tp);
+    CHECK(pthread_mutex_unlock(&tp->mutex));
+}
+
+
+struct SetCpusArg {
+
+    char *cpus;
+    int numaNode;
+};
+
+
+static void SetCpus(struct QsThreadPool *tp, struct SetCpusArg *arg) {
+
+    if(tp->cpus) {
+        DZMEM(tp->cpus, strlen(tp->cpus));
+        free(tp->cpus);
+    }
+    tp->cpus = arg->cpus;
+    tp->cpusNumaNode = arg->numaNode;
+}
+
+
+int qsThreadPool_setAffinity(struct QsThreadPool *tp, const char *cpus) {
+
+    NotWorkerThread();
+    DASSERT(tp);
+    struct QsGraph *g = tp->graph;
+    DASSERT(g);
+
+    char *str = 0;
+    int numaNode = -1;
+
+    if(cpus && cpus[0]) {
+        cpu_set_t set, allowed;
+        if(ParseCpus(cpus, &set)) {
+            ERROR("Bad CPU list \"%s\"", cpus);
+            return -1;
+        }
+        // The worker threads can only run on CPUs that this process may
+        // run on.
+        CHECK(sched_getaffinity(0, sizeof(allowed), &allowed));
+        CPU_AND(&allowed, &allowed, &set);
+        if(!CPU_COUNT(&allowed)) {
+            ERROR("This process may not run on any CPU in \"%s\"", cpus);
+            return -1;
+        }
+        str = PrintCpus(&set);
+        numaNode = NumaNodeOfCpus(&set);
+    }
+
+    CHECK(pthread_mutex_lock(&g->mutex));
+
+    if((!str && !tp->cpus) ||
+            (str && tp->cpus && strcmp(str, tp->cpus) == 0)) {
+        // No change.
+        CHECK(pthread_mutex_unlock(&g->mutex));
+        free(str);
+        return 0;
+    }
+
+    DSPEW("Thread pool \"%s\" CPU affinity set to \"%s\" on NUMA "
+            "node %d", tp->name, str?str:"any", numaNode);
+
+    struct SetCpusArg arg = { .cpus = str, .numaNode = numaNode };
+    ResetWorkers(tp, (void (*)(struct QsThreadPool *, void *)) SetCpus,
+            &arg);
+
+    CHECK(pthread_mutex_unlock(&g->mutex));
+
+    return 0;
+}
+
+
+static void SetSched(struct QsThreadPool *tp, const int *sched) {
+
+    tp->schedPolicy = sched[0];
+    tp->schedPriority = sched[1];
+}
+
+
+int qsThreadPool_setSchedPolicy(struct QsThreadPool *tp,
+        int policy, int priority) {
+
+    NotWorkerThread();
+    DASSERT(tp);
+    struct QsGraph *g = tp->graph;
+    DASSERT(g);
+
+    if(!SchedPolicyName(policy)) {
+        ERROR("Unknown scheduling policy %d", policy);
+        return -1;
+    }
+    if(priority < sched_get_priority_min(policy) ||
+            priority > sched_get_priority_max(policy)) {
+        ERROR("Scheduling policy \"%s\" priority %d is not in "
+                "the range [%d,%d]", SchedPolicyName(policy), priority,
+                sched_get_priority_min(policy),
+                sched_get_priority_max(policy));
+        return -1;
+    }
+
+    CHECK(pthread_mutex_lock(&g->mutex));
+
+    if(policy != tp->schedPolicy || priority != tp->schedPriority) {
+
+        DSPEW("Thread pool \"%s\" scheduling policy set to %s "
+                "priority %d", tp->name, SchedPolicyName(policy),
+                priority);
+
+        int sched[2] = { policy, priority };
+        ResetWorkers(tp, (void (*)(struct QsThreadPool *, void *))
+                SetSched, sched);
+    }
+
+    CHECK(pthread_mutex_unlock(&g->mutex));
+
+    return 0;
+}
+
+
+// The NUMA node and ring buffer mode are used when the stream ring
+// buffers are made at stream start, so we do not need to replace the
+// worker threads; we just need the locks.
+//
+int qsThreadPool_setNumaNode(struct QsThreadPool *tp, int numaNode) {
+
+    NotWorkerThread();
+    DASSERT(tp);
+    struct QsGraph *g = tp->graph;
+    DASSERT(g);
+
+    if(numaNode < -1 || numaNode >= CPU_SETSIZE) {
+        ERROR("Bad NUMA node %d", numaNode);
+        return -1;
+    }
+
+    CHECK(pthread_mutex_lock(&g->mutex));
+    CHECK(pthread_mutex_lock(&tp->mutex));
+    tp->numaNode = numaNode;
+    CHECK(pthread_mutex_unlock(&tp->mutex));
+    CHECK(pthread_mutex_unlock(&g->mutex));
+
+    DSPEW("Thread pool \"%s\" ring buffers on NUMA node %d",
+            tp->name, GetNumaNode(tp));
+
+    return 0;
+}
+
+
+int qsThreadPool_setRingBuffer(struct QsThreadPool *tp,
+        const char *mode) {
+
+    NotWorkerThread();
+    DASSERT(tp);
+    struct QsGraph *g = tp->graph;
+    DASSERT(g);
+
+    int m = -1;
+
+    if(mode && mode[0]) {
+        m = RingBufferMode(mode);
+        if(m < 0) {
+            ERROR("Bad ring buffer mode \"%s\"", mode);
+            return -1;
+        }
+    }
+
+    CHECK(pthread_mutex_lock(&g->mutex));
+    CHECK(pthread_mutex_lock(&tp->mutex));
+    tp->ringBufferMode = m;
+    CHECK(pthread_mutex_unlock(&tp->mutex));
+    CHECK(pthread_mutex_unlock(&g->mutex));
+
+    DSPEW("Thread pool \"%s\" ring buffer mode \"%s\"", tp->name,
+            RingBufferModeName((m > -1)?m:ringBufferMode));
+
+    return 0;
+}
+
+
 // The All the graph's thread pools must be halted when this is called.
 //
 // This function is recursive.  It accesses all blocks in the graph.
@@ -668,6 +1482,11 @@ void _qsThreadPool_destroy(struct QsThreadPool *tp) {
     DZMEM(tp->name, strlen(tp->name));
     free(tp->name);
 
+    if(tp->cpus) {
+        DZMEM(tp->cpus, strlen(tp->cpus));
+        free(tp->cpus);
+    }
+
     DZMEM(tp, sizeof(*tp));
     free(tp);
 
@@ -696,7 +1515,7 @@ void qsThreadPool_destroy(struct QsThreadPool *tp) {
 
 
 struct QsThreadPool *_qsGraph_createThreadPool(struct QsGraph *g,
-        uint32_t maxThreads, const char *name) {
+        uint32_t maxThreads, const char *name, uint32_t flags) {
 
     DASSERT(g);
     ASSERT(maxThreads > 0);
@@ -728,6 +1547,20 @@ struct QsThreadPool *_qsGraph_createThreadPool(struct QsGraph *g,
     // if we have no blocks assigned yet we have a minimum of 1
     tp->maxThreadsRun = 1;
 
+    tp->workStealing = (flags & QS_THREADPOOL_WORK_STEALING) ||
+        workStealingDefault;
+    if(tp->workStealing)
+        DSPEW("Thread pool \"%s\" has work stealing", name);
+
+    tp->fuseChains = (flags & QS_THREADPOOL_FUSE_CHAINS) ||
+        fuseChainsDefault;
+    if(tp->fuseChains)
+        DSPEW("Thread pool \"%s\" fuses linear stream chains", name);
+
+    tp->numaNode = -1;
+    tp->cpusNumaNode = -1;
+    tp->ringBufferMode = -1;
+
     // Add this thread pool, tp, to the graphs lists.
     ASSERT(qsDictionaryInsert(g->threadPools, name, tp, 0) == 0);
 
@@ -751,7 +1584,7 @@ finish:
 
 
 struct QsThreadPool *qsGraph_createThreadPool(struct QsGraph *g,
-        uint32_t maxThreads, const char *name) {
+        uint32_t maxThreads, const char *name, uint32_t flags) {
 
     NotWorkerThread();
     DASSERT(g);
@@ -760,7 +1593,7 @@ struct QsThreadPool *qsGraph_createThreadPool(struct QsGraph *g,
     CHECK(pthread_mutex_lock(&g->mutex));
 
     struct QsThreadPool *tp = _qsGraph_createThreadPool(g,
-            maxThreads, name);
+            maxThreads, name, flags);
 
     if(g->isHalted) {
         // There is a graph wide thread pool halt in effect; so we add an
@@ -130,6 +130,86 @@ struct QsThreadPool {
     // one worker thread wake from the pthread_cond_wait() on the thread
     // pool condition variable: QsThreadPool::cond.
     bool signalingOne;
+
+
+    // Set if this thread pool was created with the
+    // QS_THREADPOOL_WORK_STEALING flag.  Fixed at create and never
+    // changes.
+    //
+    // With work stealing each worker thread has a deque of job blocks,
+    // QsWhichJob::deque.  Jobs queued by a worker thread in this thread
+    // pool, for blocks in this thread pool, get their block pushed onto
+    // the worker's deque without getting the thread pool mutex, and the
+    // worker runs the blocks from its' deque without getting the thread
+    // pool mutex.  Worker threads that run out of work get the thread
+    // pool mutex and take blocks from the thread pool block queue (first
+    // and last above) or steal them from the other worker's deques.
+    //
+    // The job queues in the blocks are then protected by
+    // QsJobsBlock::queueLock and not by the thread pool mutex.
+    //
+    // When the thread pool is halted all the worker deques are emptied
+    // into the thread pool block queue, so that code that edits the
+    // queues with a thread pool halt lock does not need to know about
+    // work stealing.
+    //
+    bool workStealing;
+
+    // Set if this thread pool was created with the
+    // QS_THREADPOOL_FUSE_CHAINS flag.  Fixed at create and never
+    // changes.
+    //
+    // With fuseChains, in a linear chain of stream blocks in this thread
+    // pool (one output feeding one input of a block with one input), the
+    // worker thread that runs a block's flow() runs the next block's
+    // flow() right after it, in the same worker thread, without queuing
+    // it; so the data that was just written is still in the CPU cache
+    // when it's read, and we skip the block and job queues.  See
+    // QsStreamJob::fuseNext and QueueWorkCalls() in streamWork.c.
+    //
+    bool fuseChains;
+
+    // The list of worker threads, so that worker threads can find deques
+    // to steal from.  Uses QsWhichJob::next and QsWhichJob::prev.
+    //
+    // Protected by the thread pool mutex.
+    struct QsWhichJob *workers;
+
+    // The NUMA node from qsThreadPool_setNumaNode(), or -1 if it was
+    // not set.  cpusNumaNode is the NUMA node that all the CPUs in
+    // "cpus" (below) are on, or -1 if they are not all on one node.  The
+    // stream ring buffers that are written by blocks in this thread pool
+    // get their memory from the node that GetNumaNode() returns.
+    //
+    // ringBufferMode is the enum QsRingBufferMode (see mmapRingBuffer.h)
+    // from qsThreadPool_setRingBuffer(), or -1 to use the env
+    // QS_RING_BUFFER mode.
+    //
+    int numaNode, cpusNumaNode;
+    int ringBufferMode;
+
+    // The CPUs that the worker threads may run on, as a CPU list string
+    // like "0-3,6" from qsThreadPool_setAffinity(), or 0 to let them run
+    // on any CPU the process may run on.  We keep the string and not a
+    // cpu_set_t, so that this header does not need _GNU_SOURCE, and so
+    // that qsGraph_save() can write it out.  _LaunchWorker() parses it
+    // each time it makes a worker thread.
+    //
+    // The scheduling policy, like SCHED_FIFO, and priority that the
+    // worker threads get from qsThreadPool_setSchedPolicy().  With
+    // schedPolicy == SCHED_OTHER (0) and schedPriority == 0 the workers
+    // inherit the scheduling of the thread that creates them.
+    //
+    // These are changed with the graph mutex and the thread pool mutex
+    // locked, so reading them with either lock is fine.
+    //
+    char *cpus;
+    int schedPolicy, schedPriority;
+
+    // So we do not spew every time we fail to make a worker thread with
+    // the scheduling policy above; like when we do not have the
+    // privileges to use SCHED_FIFO.
+    bool schedFailed;
 };
 
 
@@ -148,7 +228,7 @@ uint32_t Get_maxThreadsRun(struct QsThreadPool *tp) {
 
 extern
 struct QsThreadPool *_qsGraph_createThreadPool(struct QsGraph *g,
-        uint32_t maxThreads, const char *name);
+        uint32_t maxThreads, const char *name, uint32_t flags);
 
 
 extern
@@ -156,13 +236,93 @@ void LaunchWorker(struct QsThreadPool *tp);
 extern
 void _LaunchWorker(struct QsThreadPool *tp);
 
+// Returns the name of a worker thread scheduling policy, like "fifo" for
+// SCHED_FIFO, or 0 if it's not one we know.
+extern
+const char *SchedPolicyName(int policy);
+
+
+// Set from env QS_WORK_STEALING.  If set all thread pools are created
+// with work stealing, like with the QS_THREADPOOL_WORK_STEALING flag.
+extern
+bool workStealingDefault;
+
+// Set from env QS_FUSE_CHAINS.  If set all thread pools are created
+// fusing linear stream chains, like with the QS_THREADPOOL_FUSE_CHAINS
+// flag.
+extern
+bool fuseChainsDefault;
+
+// Set from env QS_NUMA_NODE.  The NUMA node for thread pools that do not
+// have one from qsThreadPool_setNumaNode() or from their CPU affinity.
+// -1 if not set.
+extern
+int numaNodeDefault;
+
+// Returns the NUMA node that the stream ring buffers that are written by
+// blocks in this thread pool get their memory from, or -1 for no NUMA
+// node.  The node set with qsThreadPool_setNumaNode() wins over the node
+// of the thread pool's CPU affinity, which wins over env QS_NUMA_NODE.
+//
+static inline
+int GetNumaNode(const struct QsThreadPool *tp) {
+
+    if(tp->numaNode > -1)
+        return tp->numaNode;
+    if(tp->cpusNumaNode > -1)
+        return tp->cpusNumaNode;
+    return numaNodeDefault;
+}
+
+
+// For thread pools with tp->workStealing set.
+//
+// Empties all the worker deques into the thread pool block queue.  We
+// must have the thread pool mutex lock and the worker threads must not be
+// working; like after a thread pool halt.
+extern
+void DrainWorkDeques(struct QsThreadPool *tp);
+
+
+// Worker threads in a work stealing thread pool run blocks from their
+// deque without the thread pool mutex lock.  They peek at these thread
+// pool variables to see if they need to come back and get the thread pool
+// mutex lock.  It's just a hint; the worker will check again with the
+// mutex lock.  We come back if the thread pool is halting, if a worker
+// thread needs to exit, or if a non-worker thread queued a block in the
+// thread pool block queue, so that it does not starve while the deque
+// keeps refilling.
+//
+static inline
+bool WorkerShouldYield(struct QsThreadPool *tp) {
+
+    return __atomic_load_n(&tp->halt, __ATOMIC_RELAXED) ||
+            __atomic_load_n(&tp->first, __ATOMIC_RELAXED) ||
+            __atomic_load_n(&tp->numThreads, __ATOMIC_RELAXED) >
+            __atomic_load_n(&tp->maxThreadsRun, __ATOMIC_RELAXED);
+}
+
 
 
 struct QsJob;
 
 // Thread pool halt functions.
+//
+// qsJob_threadPoolHaltLockAsync() is called from a job's work() (a
+// thread pool worker thread), which cannot wait for a thread pool halt.
+// It queues a graph command, so that the thread that calls
+// qsGraph_wait() halts just the thread pools that the job's block and
+// the numBlocks blocks[] use, calls callback(j) when they have no working
+// threads, and then unhalts them.  The other thread pools in the graph
+// keep running, so the callback may only edit the job's block and the
+// blocks[] that are passed in; a block in another thread pool, even a
+// block connected to the job's block, may be running.  blocks may be 0
+// if numBlocks is 0.  qsBlockHaltAsync() in include/block.h is the
+// version of this that block code calls.  In graphCommand.c.
+extern
 void qsJob_threadPoolHaltLockAsync(struct QsJob *j,
-        void (*callback)(struct QsJob *j));
+        void (*callback)(struct QsJob *j),
+        struct QsJobsBlock * const *blocks, uint32_t numBlocks);
 extern
 void qsJob_threadPoolHaltLock(struct QsJob *j);
 extern
@@ -175,6 +335,16 @@ extern
 void qsGraph_threadPoolHaltUnlock(struct QsGraph *g);
 
 
+// For thread pools with QsThreadPool::fuseChains set; in threadPool.c.
+// A worker thread uses these to run a job in a block without queuing it.
+extern
+bool GrabBlockJob(struct QsThreadPool *tp, struct QsJobsBlock *b,
+        struct QsJob *j);
+extern
+void ReleaseBlockJob(struct QsThreadPool *tp, struct QsJobsBlock *b,
+        struct QsJob *j);
+
+
 extern
 void _qsThreadPool_destroy(struct QsThreadPool *tp);
 
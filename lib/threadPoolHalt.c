@@ -19,13 +19,8 @@
 
 
 
-// Called from job->work().  Since we cannot call
-// qsGraph_threadPoolHaltLock() from in a work() call, we make this
-// asynchronous.  The 
-//
-void qsJob_threadPoolHaltLockAsync(struct QsJob *j,
-        void (*callback)(struct QsJob *j)) {
-}
+// qsJob_threadPoolHaltLockAsync() is in graphCommand.c, because it uses
+// the graph command queue.
 
 
 
@@ -81,6 +76,12 @@ void WaitHalt(struct QsThreadPool *tp,
         tp->haltCond = 0;
     } // else it's halted already.
 
+    if(tp->workStealing)
+        // Now that no worker is working we can put all the blocks that
+        // are in the worker deques back in the thread pool block queue,
+        // so that code with a halt lock only needs to look there.
+        DrainWorkDeques(tp);
+
     CHECK(pthread_mutex_unlock(&tp->mutex));
 }
 
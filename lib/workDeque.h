@@ -0,0 +1,151 @@
+// A fixed size Chase-Lev work stealing deque of job blocks.
+//
+// Used by thread pools that are created with the
+// QS_THREADPOOL_WORK_STEALING flag.  Each worker thread in such a thread
+// pool owns one of these deques.  The owner worker thread pushes and pops
+// job blocks at the "bottom" end without any locks, and other worker
+// threads, that have run out of work, steal from the "top" end.
+//
+// In quickstream the stealing worker threads also hold the thread pool
+// mutex when they steal, so there is at most one stealer at a time per
+// thread pool; but the owner does not hold the mutex, so the owner and the
+// one stealer may race for the last job block in the deque.  That race is
+// settled by the compare and swap on "top".
+//
+// References:
+//
+//   D. Chase and Y. Lev, "Dynamic Circular Work-Stealing Deque", SPAA 2005
+//
+//   N. M. Le, A. Pop, A. Cohen, and F. Zappa Nardelli, "Correct and
+//   Efficient Work-Stealing for Weak Memory Models", PPoPP 2013
+//
+// We do not grow the array.  If the deque is full the job block is queued
+// in the thread pool block queue (QsThreadPool::first and last) the same
+// way it would be without work stealing.  Not growing the array keeps us
+// from having to figure out when we can free an old array that a stealer
+// may be reading.
+
+
+// This must be a power of 2.
+#define QS_WORK_DEQUE_LENGTH  ((size_t) 256)
+
+
+struct QsWorkDeque {
+
+    // "top" and "bottom" only increase, except that PopWorkDeque() may
+    // decrease "bottom" by one, and then increase it back.  They are used
+    // modulo QS_WORK_DEQUE_LENGTH to index blocks[].
+    //
+    atomic_size_t top, bottom;
+
+    struct QsJobsBlock *_Atomic blocks[QS_WORK_DEQUE_LENGTH];
+};
+
+
+// Only the owner worker thread may call this.
+//
+// Returns false if the deque is full.
+//
+static inline
+bool PushWorkDeque(struct QsWorkDeque *d, struct QsJobsBlock *b) {
+
+    DASSERT(d);
+    DASSERT(b);
+
+    size_t bottom = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    size_t top = atomic_load_explicit(&d->top, memory_order_acquire);
+
+    if(bottom - top >= QS_WORK_DEQUE_LENGTH)
+        // It's full.
+        return false;
+
+    atomic_store_explicit(d->blocks + (bottom & (QS_WORK_DEQUE_LENGTH-1)),
+            b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, bottom + 1, memory_order_relaxed);
+
+    return true;
+}
+
+
+// Only the owner worker thread may call this, or a thread that knows that
+// the owner is not accessing it.
+//
+// Returns the last pushed job block, or 0 if the deque is empty.
+//
+static inline
+struct QsJobsBlock *PopWorkDeque(struct QsWorkDeque *d) {
+
+    DASSERT(d);
+
+    size_t bottom = atomic_load_explicit(&d->bottom,
+            memory_order_relaxed) - 1;
+    atomic_store_explicit(&d->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    size_t top = atomic_load_explicit(&d->top, memory_order_relaxed);
+
+    if((ptrdiff_t) (bottom - top) < 0) {
+        // It's empty.
+        atomic_store_explicit(&d->bottom, bottom + 1,
+                memory_order_relaxed);
+        return 0;
+    }
+
+    struct QsJobsBlock *b = atomic_load_explicit(d->blocks +
+            (bottom & (QS_WORK_DEQUE_LENGTH-1)), memory_order_relaxed);
+
+    if(top == bottom) {
+        // This is the last one, so we race a stealer for it.
+        if(!atomic_compare_exchange_strong_explicit(&d->top, &top,
+                    top + 1, memory_order_seq_cst, memory_order_relaxed))
+            // The stealer got it.
+            b = 0;
+        atomic_store_explicit(&d->bottom, bottom + 1,
+                memory_order_relaxed);
+    }
+
+    return b;
+}
+
+
+// Any thread may call this.  In quickstream the caller holds the thread
+// pool mutex.
+//
+// Returns the first pushed job block, or 0 if the deque is empty or the
+// owner popped it first.
+//
+static inline
+struct QsJobsBlock *StealWorkDeque(struct QsWorkDeque *d) {
+
+    DASSERT(d);
+
+    size_t top = atomic_load_explicit(&d->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    size_t bottom = atomic_load_explicit(&d->bottom,
+            memory_order_acquire);
+
+    if((ptrdiff_t) (bottom - top) <= 0)
+        // It's empty.
+        return 0;
+
+    struct QsJobsBlock *b = atomic_load_explicit(d->blocks +
+            (top & (QS_WORK_DEQUE_LENGTH-1)), memory_order_relaxed);
+
+    if(!atomic_compare_exchange_strong_explicit(&d->top, &top, top + 1,
+                memory_order_seq_cst, memory_order_relaxed))
+        // The owner popped it.
+        return 0;
+
+    return b;
+}
+
+
+// This is a hint.  It's exact only if the owner is not using it.
+//
+static inline
+size_t WorkDequeLength(struct QsWorkDeque *d) {
+
+    size_t bottom = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    size_t top = atomic_load_explicit(&d->top, memory_order_relaxed);
+    return ((ptrdiff_t) (bottom - top) > 0)?(bottom - top):0;
+}
@@ -135,7 +135,7 @@ int main(void) {
     
     for(uint32_t i = 0; i < NumBlocks;) {
 
-        tps[numTps] = qsGraph_createThreadPool(g, 4, 0/*name*/);
+        tps[numTps] = qsGraph_createThreadPool(g, 4, 0/*name*/, 0);
 
         Block_init(g, blocks + (i++), tps[numTps]);
         ++numTps;
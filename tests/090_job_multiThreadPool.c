@@ -18,6 +18,8 @@
 #include "../lib/graph.h"
 #include "../lib/job.h"
 
+#include "workStealing.h"
+
 
 // We use this single mutex for all jobs.
 pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -123,7 +125,7 @@ int main(void) {
     signal(SIGSEGV, Catcher);
     signal(SIGABRT, Catcher);
 
-    struct QsGraph *g = qsGraph_create(0, 6, 0, 0, 0);
+    struct QsGraph *g = qsGraph_create(0, 6, 0, 0, GRAPH_FLAGS);
 
     struct Block blocks[NumBlocks];
     memset(blocks, 0, NumBlocks*sizeof(struct Block));
@@ -144,7 +146,7 @@ int main(void) {
     for(uint32_t i = 0; i < NumBlocks;) {
 
         if(threadPoolIndex < NumThreadPools) {
-            tps[threadPoolIndex] = qsGraph_createThreadPool(g, 4, 0/*name*/);
+            tps[threadPoolIndex] = qsGraph_createThreadPool(g, 4, 0/*name*/, TP_FLAGS);
             ++numThreadPools;
         }
 
@@ -158,7 +160,7 @@ int main(void) {
 
     // Make the rest of the thread pools, if any.
     for(;numThreadPools < NumThreadPools; ++numThreadPools)
-        tps[numThreadPools] = qsGraph_createThreadPool(g, 4, 0/*name*/);
+        tps[numThreadPools] = qsGraph_createThreadPool(g, 4, 0/*name*/, TP_FLAGS);
 
     qsGraph_threadPoolHaltLock(g, 0);
 
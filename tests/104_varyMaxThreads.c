@@ -18,6 +18,8 @@
 #include "../lib/graph.h"
 #include "../lib/job.h"
 
+#include "workStealing.h"
+
 
 // We use this single mutex for all jobs.
 pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -122,8 +124,8 @@ int main(void) {
     signal(SIGSEGV, Catcher);
     signal(SIGABRT, Catcher);
 
-    struct QsGraph *g = qsGraph_create(0, 6, 0, 0, 0);
-    struct QsThreadPool *tp = qsGraph_createThreadPool(g, 4, 0/*name*/);
+    struct QsGraph *g = qsGraph_create(0, 6, 0, 0, GRAPH_FLAGS);
+    struct QsThreadPool *tp = qsGraph_createThreadPool(g, 4, 0/*name*/, TP_FLAGS);
 
     struct Block blocks[NumBlocks];
     memset(blocks, 0, NumBlocks*sizeof(struct Block));
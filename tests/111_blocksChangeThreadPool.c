@@ -18,6 +18,8 @@
 #include "../lib/graph.h"
 #include "../lib/job.h"
 
+#include "workStealing.h"
+
 
 // We use this single mutex for all jobs.
 pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -155,7 +157,7 @@ int main(void) {
     signal(SIGSEGV, Catcher);
     signal(SIGABRT, Catcher);
 
-    struct QsGraph *g = qsGraph_create(0, 6, 0, 0, 0);
+    struct QsGraph *g = qsGraph_create(0, 6, 0, 0, GRAPH_FLAGS);
 
      memset(blocks, 0, NumBlocks*sizeof(struct Block));
 
@@ -165,7 +167,7 @@ int main(void) {
 
 
     for(uint32_t i = 0; i < NumThreadPools; ++i)
-        tps[i] = qsGraph_createThreadPool(g, 1+(i%12), 0/*name*/);
+        tps[i] = qsGraph_createThreadPool(g, 1+(i%12), 0/*name*/, TP_FLAGS);
 
     qsGraph_threadPoolHaltLock(g, 0);
 
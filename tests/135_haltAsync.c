@@ -0,0 +1,214 @@
+// Test qsJob_threadPoolHaltLockAsync().  Block A in thread pool tp0 and
+// block B in thread pool tp1 keep their jobs queuing each other.  A job
+// in block A asks for an asynchronous halt; the callback gets called in
+// the qsGraph_wait() thread with tp0 halted, while block B keeps working
+// in tp1.  Block A works again after the callback.  Then block A asks
+// for another halt that also passes block B, and the callback gets called
+// with both tp0 and tp1 halted.
+
+#include <inttypes.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "../include/quickstream.h"
+
+#include "../lib/debug.h"
+#include "../lib/Dictionary.h"
+
+#include "../lib/c-rbtree.h"
+#include "../lib/name.h"
+#include "../lib/threadPool.h"
+#include "../lib/block.h"
+#include "../lib/graph.h"
+#include "../lib/job.h"
+
+#include "workStealing.h"
+
+
+#define NumJobsPerBlock  2
+
+// Block A asks for the halt at this work count, and for the halt with
+// block B at two times it.
+#define HaltAt  100
+
+
+struct Block {
+    struct QsJobsBlock jobsBlock;
+
+    struct QsJob jobs[NumJobsPerBlock];
+
+    pthread_mutex_t mutex;
+
+    atomic_uint wcount;
+};
+
+
+static struct Block blockA, blockB;
+static struct QsThreadPool *tp0, *tp1;
+
+static atomic_bool callbackDone = false, callback2Done = false;
+static bool callbackOkay = false, callback2Okay = false;
+
+
+static inline
+bool Halted(struct QsThreadPool *tp) {
+
+    CHECK(pthread_mutex_lock(&tp->mutex));
+    bool halted = tp->halt && !tp->numWorkingThreads;
+    CHECK(pthread_mutex_unlock(&tp->mutex));
+    return halted;
+}
+
+
+static
+void Callback(struct QsJob *j) {
+
+    NotWorkerThread();
+    ASSERT(j->jobsBlock == &blockA.jobsBlock);
+
+    bool halted = Halted(tp0);
+
+    uint32_t a = blockA.wcount;
+    uint32_t b = blockB.wcount;
+
+    // Give block B time to work.
+    usleep(20000);
+
+    fprintf(stderr, "\n  Callback: tp0 halted=%d  block A work %"
+            PRIu32 " -> %u  block B work %" PRIu32 " -> %u\n\n",
+            halted, a, blockA.wcount, b, blockB.wcount);
+
+    callbackOkay = halted && a == blockA.wcount && b < blockB.wcount;
+    callbackDone = true;
+}
+
+
+static
+void Callback2(struct QsJob *j) {
+
+    NotWorkerThread();
+    ASSERT(j->jobsBlock == &blockA.jobsBlock);
+
+    bool halted = Halted(tp0) && Halted(tp1);
+
+    uint32_t a = blockA.wcount;
+    uint32_t b = blockB.wcount;
+
+    usleep(20000);
+
+    fprintf(stderr, "\n  Callback2: tp0 and tp1 halted=%d  block A work %"
+            PRIu32 " -> %u  block B work %" PRIu32 " -> %u\n\n",
+            halted, a, blockA.wcount, b, blockB.wcount);
+
+    callback2Okay = halted && a == blockA.wcount && b == blockB.wcount;
+    callback2Done = true;
+}
+
+
+static
+bool Work(struct QsJob *j) {
+
+    struct Block *b = (void *) j->jobsBlock;
+
+    uint32_t wcount = ++b->wcount;
+
+    if(b == &blockA && wcount == HaltAt)
+        qsJob_threadPoolHaltLockAsync(j, Callback, 0, 0);
+    else if(b == &blockA && wcount == 2*HaltAt) {
+        struct QsJobsBlock *blocks[] = { &blockB.jobsBlock };
+        qsJob_threadPoolHaltLockAsync(j, Callback2, blocks, 1);
+    }
+
+    // Keep the other job in this block going, and so on.
+    for(struct QsJob **job = j->peers; *job; ++job)
+        qsJob_queueJob(*job);
+
+    return false; // Until next time we are queued.
+}
+
+
+static
+void Block_init(struct QsGraph *g, struct Block *b,
+        struct QsThreadPool *tp) {
+
+    qsBlock_init(g, &b->jobsBlock.block,
+            0/*parentBlock*/, tp,
+            QsBlockType_jobs, 0, 0);
+
+    CHECK(pthread_mutex_init(&b->mutex, 0));
+
+    for(uint32_t i=0; i<NumJobsPerBlock; ++i) {
+        struct QsJob *j = b->jobs + i;
+        qsJob_init(j, &b->jobsBlock, Work, 0, 0);
+        qsJob_addMutex(j, &b->mutex);
+    }
+}
+
+
+static
+void Catcher(int sig) {
+    ERROR("Caught signal %d", sig);
+    ASSERT(0);
+}
+
+
+int main(void) {
+
+    if(getenv("VaLGRIND_RuN"))
+        // The jobs spin; this is too slow with valgrind.
+        return 123;
+
+    signal(SIGSEGV, Catcher);
+    signal(SIGABRT, Catcher);
+
+    struct QsGraph *g = qsGraph_create(0, 1, 0, 0, GRAPH_FLAGS);
+
+    tp0 = qsGraph_createThreadPool(g, 1, 0/*name*/, TP_FLAGS);
+    tp1 = qsGraph_createThreadPool(g, 1, 0/*name*/, TP_FLAGS);
+
+    Block_init(g, &blockA, tp0);
+    Block_init(g, &blockB, tp1);
+
+    qsGraph_threadPoolHaltLock(g, 0);
+
+    // The jobs only queue the other job in the same block, so each block
+    // only uses its' own thread pool.
+    for(uint32_t k = 0; k < NumJobsPerBlock; ++k) {
+        qsJob_addPeer(&blockA.jobs[k],
+                &blockA.jobs[(k + 1) % NumJobsPerBlock]);
+        qsJob_addPeer(&blockB.jobs[k],
+                &blockB.jobs[(k + 1) % NumJobsPerBlock]);
+    }
+    qsJob_queueJob(&blockA.jobs[0]);
+    qsJob_queueJob(&blockB.jobs[0]);
+
+    qsGraph_threadPoolHaltUnlock(g);
+
+    // This thread runs the graph commands, like the asynchronous halt.
+    for(uint32_t i = 0; !callbackDone && i < 1000; ++i)
+        qsGraph_wait(g, 0.01);
+
+    ASSERT(callbackDone, "The halt callback was not called");
+
+    for(uint32_t i = 0; !callback2Done && i < 1000; ++i)
+        qsGraph_wait(g, 0.01);
+
+    ASSERT(callback2Done, "The second halt callback was not called");
+
+    // Both blocks keep working after the halt.
+    uint32_t a = blockA.wcount;
+    uint32_t b = blockB.wcount;
+    while(blockA.wcount < a + HaltAt || blockB.wcount < b + HaltAt)
+        ASSERT(usleep(100) == 0);
+
+    qsGraph_destroy(g);
+
+    CHECK(pthread_mutex_destroy(&blockA.mutex));
+    CHECK(pthread_mutex_destroy(&blockB.mutex));
+
+    return (callbackOkay && callback2Okay)?0:1;
+}
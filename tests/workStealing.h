@@ -0,0 +1,11 @@
+// The tests that tests/Makefile builds a second time with -DWORK_STEALING
+// pass these flags to qsGraph_create() and qsGraph_createThreadPool(), so
+// that the second build runs the test with work stealing thread pools.
+
+#ifdef WORK_STEALING
+#  define GRAPH_FLAGS  QS_GRAPH_WORK_STEALING
+#  define TP_FLAGS     QS_THREADPOOL_WORK_STEALING
+#else
+#  define GRAPH_FLAGS  0
+#  define TP_FLAGS     0
+#endif